@@ -1,5 +1,12 @@
 #!/bin/bash
 
+# Usage:
+#   compare_servers.sh                           Run both servers for interactive use
+#   compare_servers.sh --ab <journal> [speed]    Replay a journal against both servers
+#
+# The journal is one recorded with "bin/mazewar -J <journal>"; speed is
+# passed to bin/mazewar_replay -x (default: max).
+
 # Ports
 DEMO_PORT=3333
 YOUR_PORT=4444
@@ -8,6 +15,50 @@ YOUR_PORT=4444
 fuser -k ${DEMO_PORT}/tcp > /dev/null 2>&1
 fuser -k ${YOUR_PORT}/tcp > /dev/null 2>&1
 
+if [ "$1" = "--ab" ]; then
+    JOURNAL=$2
+    SPEED=${3:-max}
+    if [ ! -f "$JOURNAL" ]; then
+        echo "Usage: $0 --ab <journal> [speed]" >&2
+        exit 1
+    fi
+
+    # Each server gets a fresh start, so that neither sees the other's replay
+    for side in demo your; do
+        if [ $side = demo ]; then
+            util/mazewar -p $DEMO_PORT > /dev/null 2>&1 &
+            PORT=$DEMO_PORT
+        else
+            bin/mazewar -p $YOUR_PORT > /dev/null 2>&1 &
+            PORT=$YOUR_PORT
+        fi
+        PID=$!
+        sleep 1
+
+        echo ">>> Replaying $JOURNAL against the $side server (port $PORT, speed $SPEED)..."
+        bin/mazewar_replay -p $PORT -x $SPEED "$JOURNAL" | tee /tmp/replay_$side.$$
+        echo
+
+        kill -HUP $PID
+        wait $PID
+    done
+
+    echo ">>> Summary (demo vs. your server):"
+    for key in replay_s divergence_pct; do
+        printf "   %-16s %12s %12s\n" $key \
+            "$(awk -v k=$key '$1 == k { print $2 }' /tmp/replay_demo.$$)" \
+            "$(awk -v k=$key '$1 == k { print $2 }' /tmp/replay_your.$$)"
+    done
+    for key in p50_us p99_us; do
+        col=$([ $key = p50_us ] && echo 4 || echo 5)
+        printf "   %-16s %12s %12s\n" $key \
+            "$(awk -v c=$col '$1 == "ALL" { print $c }' /tmp/replay_demo.$$)" \
+            "$(awk -v c=$col '$1 == "ALL" { print $c }' /tmp/replay_your.$$)"
+    done
+    rm -f /tmp/replay_demo.$$ /tmp/replay_your.$$
+    exit 0
+fi
+
 echo ">>> Starting Demo Server on port ${DEMO_PORT}..."
 util/mazewar -p $DEMO_PORT &
 DEMO_PID=$!
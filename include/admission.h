@@ -0,0 +1,57 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+/*
+ * Admission control for incoming connections.
+ *
+ * The accept loops ask admission_admit() about each connection they accept.
+ * A connection is turned away if the server already has the maximum number
+ * of concurrent sessions, or if connections are arriving faster than the
+ * configured accept rate (a token bucket with a one-second burst).  Turned
+ * away connections get an unsolicited INUSE packet with param1 set to
+ * MZW_INUSE_BUSY and are closed, without a service thread ever being
+ * created for them, so a connection storm costs the players already in
+ * the game no more than an accept() and a short write per connection.
+ */
+
+/*
+ * Configure admission control.
+ *
+ * @param max_sessions  Maximum number of concurrent sessions; zero for no
+ * limit other than the client registry's.
+ * @param accept_rate  Maximum sustained number of connections admitted per
+ * second; zero for no limit.
+ *
+ * This is intended to be called once at startup, before any connections
+ * are accepted.
+ */
+void admission_init(int max_sessions, int accept_rate);
+
+/*
+ * Decide whether to admit a newly accepted connection.
+ *
+ * @param fd  The connection.
+ * @return zero if the connection is admitted, in which case a session slot
+ * has been reserved and must later be returned with admission_release().
+ * Otherwise the connection has been sent a busy reply and closed, and
+ * nonzero is returned.
+ *
+ * This may be called concurrently from several accept threads.
+ */
+int admission_admit(int fd);
+
+/*
+ * Return the session slot of an admitted connection, once its service
+ * thread has finished with it.
+ */
+void admission_release(void);
+
+/*
+ * Get admission statistics.
+ *
+ * @param activep  Receives the number of admitted sessions still active.
+ * @param rejectedp  Receives the total number of connections turned away.
+ */
+void admission_stats(int *activep, unsigned long *rejectedp);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef CLIENT_REGISTRY_EXT_H
+#define CLIENT_REGISTRY_EXT_H
+
+#include "client_registry.h"
+
+/*
+ * Extensions to the client registry that are not part of client_registry.h.
+ *
+ * The registry is indexed by file descriptor, so registering, unregistering
+ * and looking up a client take constant time regardless of how many clients
+ * are connected.  It grows on demand up to CREG_MAX_CLIENTS clients.
+ */
+
+/* Maximum number of clients that can be registered at once. */
+#define CREG_MAX_CLIENTS 65536
+
+/*
+ * Register a client file descriptor, reporting whether that was possible.
+ * creg_register() is equivalent, but has no way of reporting failure.
+ *
+ * @param cr  The client registry.
+ * @param fd  The file descriptor to be registered.
+ * @return zero if the descriptor is now registered (including if it already
+ * was), nonzero if the registry is full, fd is invalid, memory could not
+ * be allocated, or creg_shutdown_all() has been called.  In that case the
+ * registry is unchanged, and the descriptor must not be passed to
+ * creg_unregister().
+ */
+int creg_try_register(CLIENT_REGISTRY *cr, int fd);
+
+/*
+ * Get the number of currently registered clients.
+ *
+ * @param cr  The client registry.
+ * @return the number of registered file descriptors.
+ */
+int creg_count(CLIENT_REGISTRY *cr);
+
+/*
+ * Call a function for each registered file descriptor.
+ *
+ * @param cr  The client registry.
+ * @param func  The function, which receives each descriptor and arg.
+ * @param arg  Passed through to func.
+ *
+ * The registry is locked for the duration of the iteration, so func must
+ * not call back into the registry and should not block.
+ */
+void creg_foreach(CLIENT_REGISTRY *cr, void (*func)(int fd, void *arg), void *arg);
+
+#endif
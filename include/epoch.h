@@ -0,0 +1,75 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <stddef.h>
+
+/*
+ * Epoch-based reclamation of shared objects read without locks.
+ *
+ * Readers bracket their accesses with epoch_enter() and epoch_exit().  A
+ * writer that unlinks an object, so that no new reader can reach it, hands
+ * it to epoch_retire() instead of freeing it.  The object is freed once
+ * every reader that was inside a critical section when it was unlinked has
+ * left it: a global epoch counter advances only when every thread inside a
+ * critical section has observed its current value, so an object retired
+ * in epoch e is unreachable once the counter reaches e + 2.
+ *
+ * Each thread keeps the objects it retires in a list of its own and frees
+ * them itself as the epoch advances, so retiring takes no lock.  When a
+ * thread exits, what it has not yet freed is passed to whichever thread
+ * next scans for objects to free.
+ */
+
+/*
+ * Link by which an object waits to be freed.  Embed it in the object; its
+ * fields are private to the epoch module.
+ */
+typedef struct epoch_entry {
+    struct epoch_entry *next;
+    void (*free_fn)(struct epoch_entry *entry);
+    unsigned long epoch;           // Global epoch when the object was retired
+} EPOCH_ENTRY;
+
+/*
+ * Type of a function that frees a retired object, given its entry.
+ */
+typedef void EPOCH_FREE_FN(EPOCH_ENTRY *entry);
+
+/*
+ * Enter a read-side critical section on the calling thread.
+ *
+ * Objects reachable from shared pointers loaded after this stay valid
+ * until the matching epoch_exit().  Critical sections nest, and should be
+ * short: while one is open, no object retired by any thread is freed.
+ */
+void epoch_enter(void);
+
+/*
+ * Leave a read-side critical section entered by epoch_enter().
+ */
+void epoch_exit(void);
+
+/*
+ * Free an object once no reader can still be using it.
+ *
+ * @param entry  The object's entry.  The object must already be
+ * unreachable from the shared pointers readers load.
+ * @param free_fn  Function that frees the object.
+ *
+ * This may be called inside or outside a critical section; it never
+ * blocks, and may free objects retired earlier by the calling thread.
+ */
+void epoch_retire(EPOCH_ENTRY *entry, EPOCH_FREE_FN *free_fn);
+
+/*
+ * Format a report of reclamation: the global epoch, objects retired and
+ * freed so far, and threads that have taken part.
+ *
+ * @param buf  Buffer to receive the report (may be NULL if len is zero).
+ * @param len  Size of the buffer.
+ * @return the number of characters that the full report needs, as for
+ * snprintf().
+ */
+int epoch_report(char *buf, size_t len);
+
+#endif
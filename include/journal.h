@@ -0,0 +1,120 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "protocol.h"
+
+/*
+ * Inbound packet journal.
+ *
+ * When enabled, the server appends every packet it receives, with the
+ * time it was received, the connection it arrived on and its payload, to a
+ * binary journal file.  The opening and closing of each connection are
+ * recorded too; the close record carries the number of packets of each
+ * type that the server sent on the connection.  The mazewar_replay tool
+ * feeds a journal back to a server, reproducing the original connections
+ * and their timing, and compares the outbound traffic it receives with
+ * the recorded counts.
+ *
+ * File format (host byte order):
+ *
+ *   JOURNAL_HEADER
+ *   then any number of records, in time order, each:
+ *     JOURNAL_RECORD
+ *     record.size bytes of payload
+ *
+ * The payload of a JOURNAL_PACKET record is the packet's payload; that of
+ * a JOURNAL_CLOSE record is an array of JOURNAL_OUT_TYPES uint32_t counts
+ * of outbound packets, indexed by packet type.
+ */
+
+#define JOURNAL_MAGIC "MZWJRNL"
+#define JOURNAL_VERSION 1
+
+/* Outbound packet types counted per connection. */
+#define JOURNAL_OUT_TYPES 16
+
+typedef struct journal_header {
+    char magic[8];           // JOURNAL_MAGIC
+    uint32_t version;        // JOURNAL_VERSION
+    uint32_t record_size;    // sizeof(JOURNAL_RECORD)
+} JOURNAL_HEADER;
+
+/*
+ * Kinds of journal record.
+ */
+typedef enum {
+    JOURNAL_OPEN = 1,        // Connection accepted
+    JOURNAL_PACKET,          // Packet received on the connection
+    JOURNAL_CLOSE            // Connection closed
+} JOURNAL_KIND;
+
+typedef struct journal_record {
+    uint64_t ts;             // Nanoseconds since the journal was started
+    uint32_t conn;           // Connection ID, unique within the journal
+    uint16_t size;           // Bytes of payload that follow
+    uint8_t kind;            // JOURNAL_KIND
+    uint8_t type;            // Packet fields (JOURNAL_PACKET only)
+    int8_t param1;
+    int8_t param2;
+    int8_t param3;
+    uint8_t reserved[5];
+} JOURNAL_RECORD;
+
+/* Nonzero while the journal is being written. */
+extern atomic_int journal_enabled;
+
+/*
+ * Start journaling to a file.
+ *
+ * @param path  Path of the journal, which is created or truncated.
+ * @return zero on success, nonzero if the file could not be created.
+ */
+int journal_init(const char *path);
+
+/*
+ * Stop journaling, flushing and closing the journal.  Connections still
+ * open are left without a close record.
+ */
+void journal_fini(void);
+
+/*
+ * Record that a connection was accepted.
+ *
+ * @param fd  The connection's file descriptor.
+ * @return the connection's ID, for the other journal functions, or zero
+ * if journaling is disabled.
+ */
+uint32_t journal_open(int fd);
+
+/*
+ * Record a packet received on a connection.
+ *
+ * @param conn  The connection's ID, as returned by journal_open().
+ * @param pkt  The packet, with fields in host byte order.
+ * @param data  Its payload, or NULL.
+ */
+void journal_packet(uint32_t conn, MZW_PACKET *pkt, void *data);
+
+/*
+ * Record that a connection was closed, with its outbound packet counts.
+ *
+ * @param conn  The connection's ID, as returned by journal_open().
+ * @param fd  The connection's file descriptor, not yet closed.
+ */
+void journal_close(uint32_t conn, int fd);
+
+/* Slow path of JOURNAL_COUNT_OUT(). */
+void journal_count_out(int fd, int type);
+
+/*
+ * Count a packet sent (or attempted) on a connection, if journaling is enabled.
+ */
+#define JOURNAL_COUNT_OUT(fd, type) do { \
+        if (__builtin_expect(atomic_load_explicit(&journal_enabled, memory_order_relaxed), 0)) \
+            journal_count_out((fd), (type)); \
+    } while (0)
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef LOCKPROF_H
+#define LOCKPROF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "stats.h"
+
+/*
+ * Lock contention profiling.
+ *
+ * The server's mutexes are grouped into named lock classes (all maze
+ * region locks, all player locks, ...).  When profiling is enabled, every
+ * acquisition through prof_lock() is counted against its class, and the
+ * time spent waiting for the lock and the time it was then held are
+ * recorded in the class's histograms.  When profiling is disabled,
+ * prof_lock() and prof_unlock() cost one extra predictable branch over
+ * plain pthread_mutex_lock() and pthread_mutex_unlock().
+ *
+ * Profiling can be switched on and off at any time; a lock acquired while
+ * profiling was off is simply not counted.  A report is included in the
+ * stats port output (see stats.h), and written on stderr whenever the
+ * server receives SIGUSR2.
+ */
+
+/*
+ * IDs of the lock classes, as recorded in TRACE_LOCK_ACQUIRED events.
+ */
+typedef enum {
+    LOCK_ID_MAZE, LOCK_ID_TABLE, LOCK_ID_SCOREBOARD, LOCK_ID_REGISTRY,
+    LOCK_NCLASSES
+} LOCK_CLASS_ID;
+
+/*
+ * A lock class.  Defined statically by the module that owns the locks.
+ */
+typedef struct lock_class {
+    const char *name;             // Name shown in reports
+    LOCK_CLASS_ID id;             // ID shown in traces
+    atomic_ulong acquisitions;    // Number of profiled acquisitions
+    atomic_ulong contended;       // Acquisitions that had to wait
+    HISTOGRAM *wait;              // Time spent waiting to acquire
+    HISTOGRAM *hold;              // Time from acquisition to release
+    struct lock_class *next;      // Next registered class
+} LOCK_CLASS;
+
+/* Initializer for a lock class with the given ID and name. */
+#define LOCK_CLASS_INIT(i, n) { .name = (n), .id = (i) }
+
+/* The lock classes profiled by the server. */
+extern LOCK_CLASS lock_maze;        // Maze region locks
+extern LOCK_CLASS lock_table;       // Player table (map) locks
+extern LOCK_CLASS lock_scoreboard;  // Scoreboard locks
+extern LOCK_CLASS lock_registry;    // Client registry lock
+
+/* Bits of lockprof_mode. */
+#define LOCKPROF_PROFILE 0x1        // Profiling is enabled
+#define LOCKPROF_TRACE   0x2        // Acquisitions are traced (see trace.h)
+
+/* Nonzero while profiling or lock tracing is enabled.  Read by prof_lock(). */
+extern atomic_int lockprof_mode;
+
+/* Number of profiled locks held by the calling thread. */
+extern __thread int lockprof_depth;
+
+/*
+ * Initialize the profiler, creating the histograms of the server's lock
+ * classes, and start the thread that dumps a report on SIGUSR2.  SIGUSR2
+ * must already be blocked in every thread (i.e. blocked in the main thread
+ * before any other thread is created).
+ *
+ * @param enable  Nonzero to enable profiling straight away.
+ * @return zero on success, nonzero on failure.
+ */
+int lockprof_init(int enable);
+
+/*
+ * Stop the thread started by lockprof_init() and wait for it to exit.
+ * Has no effect before lockprof_init().
+ *
+ * This is intended to be called once, at termination.
+ */
+void lockprof_fini(void);
+
+/*
+ * Enable or disable profiling.  Has no effect before lockprof_init().
+ */
+void lockprof_enable(int enable);
+
+/*
+ * Enable or disable recording a TRACE_LOCK_ACQUIRED event, with the time
+ * spent waiting, for each acquisition.  Used by the trace module.
+ */
+void lockprof_trace(int enable);
+
+/*
+ * Get the name of a lock class from its ID.
+ *
+ * @return the name, or NULL if the ID is not valid.
+ */
+const char *lockprof_class_name(int id);
+
+/*
+ * Format a report of every lock class: acquisitions, contended
+ * acquisitions, and p50/p99/p999/max of wait and hold times.
+ *
+ * @param buf  Buffer to receive the report (may be NULL if len is zero).
+ * @param len  Size of the buffer.
+ * @return the number of characters that the full report needs, as for
+ * snprintf().  Only a status line is written if profiling has never been
+ * enabled, and nothing at all before lockprof_init().
+ */
+int lockprof_report(char *buf, size_t len);
+
+/* Slow paths of prof_lock() and prof_unlock(). */
+void lockprof_lock(pthread_mutex_t *mutex, LOCK_CLASS *cls);
+void lockprof_unlock(pthread_mutex_t *mutex);
+
+/*
+ * Lock a mutex, profiling (or tracing) the acquisition against a lock class.
+ */
+static inline void prof_lock(pthread_mutex_t *mutex, LOCK_CLASS *cls) {
+    if (__builtin_expect(atomic_load_explicit(&lockprof_mode, memory_order_relaxed), 0))
+        lockprof_lock(mutex, cls);
+    else
+        pthread_mutex_lock(mutex);
+}
+
+/*
+ * Unlock a mutex locked with prof_lock().
+ */
+static inline void prof_unlock(pthread_mutex_t *mutex) {
+    if (__builtin_expect(lockprof_depth > 0, 0))
+        lockprof_unlock(mutex);
+    else
+        pthread_mutex_unlock(mutex);
+}
+
+#endif
@@ -0,0 +1,224 @@
+#ifndef MAZE_EXT_H
+#define MAZE_EXT_H
+
+#include <stdint.h>
+
+#include "maze.h"
+
+/*
+ * Extensions to the maze module that are not part of maze.h.
+ *
+ * Internally each maze cell is a 16-bit value.  Values below
+ * MAZE_OCCUPANT_BASE are template characters (EMPTY or a wall), exactly
+ * as they appear in the maze template.  Values at or above it denote a
+ * player, identified by a 16-bit occupant ID rather than by its avatar
+ * character.  Each occupant ID is associated with a display glyph, which
+ * is what is reported in views, so several players may share a glyph.
+ *
+ * Several independent mazes may exist at once (one per game room), each
+ * with its own locks.  Within a maze, cells are grouped into square lock
+ * regions (see maze_set_region_size()), so that players in distant parts
+ * of a large maze do not contend with one another when they change it.
+ * Reading views and tracing laser rays takes no locks: readers see a
+ * snapshot of the maze, to which each change is published as a whole
+ * once it is complete.  The functions in maze.h operate on the default maze,
+ * which is the one set up by maze_init(); the functions below take the
+ * maze to operate on explicitly.  The avatar-based functions in maze.h use
+ * the avatar character itself as the occupant ID and as the glyph.
+ */
+
+/*
+ * Type of a maze object.
+ */
+typedef struct maze MAZE;
+
+/*
+ * Type used for occupant IDs.
+ */
+typedef uint16_t OCCUPANT;
+
+/* First cell value used for occupants; cell value = MAZE_OCCUPANT_BASE + ID. */
+#define MAZE_OCCUPANT_BASE 0x100
+
+/* Number of distinct occupant IDs that can be stored in a cell. */
+#define MAZE_MAX_OCCUPANTS (0x10000 - MAZE_OCCUPANT_BASE)
+
+/* Returned by maze_find_occupant() when no occupant is found. */
+#define NO_OCCUPANT ((OCCUPANT)0xFFFF)
+
+/*
+ * Set the side length, in cells, of the lock regions of mazes built from
+ * now on (by maze_init() or maze_create()).
+ *
+ * @param size  Region side; zero (the default) makes each maze a single
+ * region protected by one lock.
+ *
+ * This is intended to be called once at startup, before maze_init().
+ */
+void maze_set_region_size(int size);
+
+/*
+ * Seed the generators used to place occupants at random in mazes built
+ * from now on.
+ *
+ * @param seed  The seed.  Each maze has its own generator, seeded from
+ * this seed and the number of mazes built since it was set, so a run that
+ * builds its mazes and places its occupants in the same order always makes
+ * the same placements.
+ *
+ * If this is not called, maze_init() seeds the generators from the time of
+ * day.  It is intended to be called once at startup, before maze_init().
+ */
+void maze_set_seed(unsigned long seed);
+
+/*
+ * Initialize the default maze from a template file, as maze_init() does
+ * from an in-memory template.
+ *
+ * @param path  Path of the template file.  Each line is one row of the
+ * maze; all rows must have the same length and consist only of EMPTY and
+ * wall characters.  Lines may end in "\n" or "\r\n", the final newline
+ * is optional and trailing blank lines are ignored.
+ * @return zero on success, nonzero if the file could not be read or is not
+ * a valid template, in which case a diagnostic has been printed on stderr.
+ *
+ * The file is read in a single pass directly into the maze grid, so
+ * arbitrarily long rows and very large templates are supported.  The file
+ * may instead be a maze image written by maze_save_image(), which is
+ * recognized by its header and loaded without parsing.
+ */
+int maze_init_file(const char *path);
+
+/*
+ * Save a maze as a maze image, which maze_init_file() loads in place of a
+ * text template.
+ *
+ * @param maze  The maze to save.  Occupants are not saved.
+ * @param path  Path of the image file to create.
+ * @return zero on success, nonzero on error, in which case a diagnostic
+ * has been printed on stderr.
+ *
+ * An image holds the maze grid bit-packed, at one bit per cell for a maze
+ * with a single kind of wall and at most eight, together with an index of
+ * the cells where players may be placed.  Loading one maps the file and
+ * unpacks the grid in one pass, without parsing, and uses the index in
+ * place.  Images use the byte order of the host that wrote them and are
+ * rejected by hosts of the other order.
+ */
+int maze_save_image(MAZE *maze, const char *path);
+
+/*
+ * Create a maze that is independent of the default maze.
+ *
+ * @param template  The template for the maze, in the format accepted
+ * by maze_init().
+ * @return the new maze, or NULL if it could not be created.
+ */
+MAZE *maze_create(char **template);
+
+/*
+ * Create a maze that is independent of any other, with the same template
+ * as an existing maze.
+ *
+ * @param src  The maze whose template is copied.  Its occupants are not
+ * copied: the new maze is empty.
+ * @return the new maze, or NULL if it could not be created.
+ */
+MAZE *maze_clone(MAZE *src);
+
+/*
+ * Destroy a maze created by maze_create() or maze_clone().
+ *
+ * @param maze  The maze, which must not be referenced again.
+ */
+void maze_destroy(MAZE *maze);
+
+/*
+ * Get the default maze.
+ *
+ * @return the maze that the functions in maze.h operate on.
+ */
+MAZE *maze_default(void);
+
+/*
+ * Place an occupant at a specified row/column location.
+ *
+ * @param maze  The maze.
+ * @param id  The occupant ID.
+ * @param glyph  The character used to display the occupant in views.
+ * @param row  The row in which the occupant is to be placed.
+ * @param col  The column in which the occupant is to be placed.
+ * @return zero if the placement was successful, nonzero otherwise.
+ */
+int maze_set_occupant(MAZE *maze, OCCUPANT id, OBJECT glyph, int row, int col);
+
+/*
+ * Place an occupant at a random unoccupied location.
+ *
+ * @param maze  The maze.
+ * @param id  The occupant ID.
+ * @param glyph  The character used to display the occupant in views.
+ * @param rowp  Receives the row at which the occupant was placed.
+ * @param colp  Receives the column at which the occupant was placed.
+ * @return zero if the placement was successful, nonzero otherwise.
+ */
+int maze_set_occupant_random(MAZE *maze, OCCUPANT id, OBJECT glyph, int *rowp, int *colp);
+
+/*
+ * Remove an occupant from a specified location.  Nothing happens unless
+ * the location currently holds that occupant.
+ *
+ * @param maze  The maze.
+ * @param id  The occupant ID.
+ * @param row  The row from which the occupant is to be removed.
+ * @param col  The column from which the occupant is to be removed.
+ */
+void maze_remove_occupant(MAZE *maze, OCCUPANT id, int row, int col);
+
+/*
+ * Search from a specified location in a specified direction and return
+ * the ID of the first occupant found, if any.
+ *
+ * @param maze  The maze.
+ * @param row  The starting row for the search.
+ * @param col  The starting column for the search.
+ * @param dir  The direction for the search.
+ * @return the occupant ID found, or NO_OCCUPANT if the search stopped at
+ * a wall or at the maze boundary.
+ */
+OCCUPANT maze_find_occupant(MAZE *maze, int row, int col, DIRECTION dir);
+
+/*
+ * As maze_move(), but in the specified maze.
+ */
+int maze_move_in(MAZE *maze, int row, int col, int dir);
+
+/*
+ * As maze_get_view(), but in the specified maze.
+ */
+int maze_get_view_in(MAZE *maze, VIEW *view, int row, int col, DIRECTION gaze, int depth);
+
+/*
+ * A view requested from maze_get_views_in(): where it is seen from, and
+ * what is seen.
+ */
+typedef struct maze_view {
+    int row, col;                 // Location of the viewer
+    DIRECTION gaze;               // Direction of gaze
+    int depth;                    // Set to the depth of the view
+    char view[VIEW_DEPTH][VIEW_WIDTH];  // Set to the view, as by maze_get_view()
+} MAZE_VIEW;
+
+/*
+ * Compute several views of full depth (VIEW_DEPTH) at once, all from the
+ * same state of the maze.
+ *
+ * @param maze  The maze.
+ * @param views  The views; the location and gaze of each must be set.
+ * @param count  Number of views.
+ *
+ * All the views are read from one snapshot of the maze, without locks.
+ */
+void maze_get_views_in(MAZE *maze, MAZE_VIEW *views, int count);
+
+#endif
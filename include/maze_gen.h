@@ -0,0 +1,64 @@
+#ifndef MAZE_GEN_H
+#define MAZE_GEN_H
+
+/*
+ * Procedural maze generation.
+ *
+ * The generator produces maze templates, in the format accepted by
+ * maze_init(), for benchmarking the server on mazes of arbitrary size.
+ * Generation is driven by a private PRNG seeded by the caller, so the same
+ * kind, size, density and seed always produce the same maze, on any host.
+ */
+
+/*
+ * Kinds of generated maze.
+ *
+ *   MAZE_GEN_PERFECT:  A perfect maze (exactly one path between any two
+ *                      open cells) of one-cell corridors, carved by a
+ *                      randomized depth-first search.  The wall density
+ *                      is fixed by the structure and the density argument
+ *                      is ignored.
+ *   MAZE_GEN_CAVERN:   Organic caves: the interior is filled with walls
+ *                      at the given density and smoothed by a few rounds
+ *                      of a cellular automaton.
+ *   MAZE_GEN_ARENA:    An open floor with isolated pillars scattered at
+ *                      the given density.
+ *
+ * Every kind is enclosed by a border of walls.
+ */
+typedef enum {
+    MAZE_GEN_PERFECT, MAZE_GEN_CAVERN, MAZE_GEN_ARENA
+} MAZE_GEN_KIND;
+
+/*
+ * Look up a maze kind by name ("perfect", "cavern" or "arena").
+ *
+ * @param name  The name.
+ * @param kindp  Receives the kind.
+ * @return zero if the name was recognized, nonzero otherwise.
+ */
+int maze_gen_parse_kind(const char *name, MAZE_GEN_KIND *kindp);
+
+/*
+ * Generate a maze template.
+ *
+ * @param kind  The kind of maze.
+ * @param rows  The number of rows, at least 3.
+ * @param cols  The number of columns, at least 3.
+ * @param density  Percentage (0-100) of interior cells that are walls,
+ * where applicable.
+ * @param seed  Seed for the generator.
+ * @return a NULL-terminated array of rows, to be released with
+ * maze_gen_free(), or NULL if the arguments are invalid or memory could
+ * not be allocated.
+ */
+char **maze_generate(MAZE_GEN_KIND kind, int rows, int cols, int density, unsigned long seed);
+
+/*
+ * Release a template returned by maze_generate().
+ *
+ * @param template  The template (may be NULL).
+ */
+void maze_gen_free(char **template);
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef PLAYER_EXT_H
+#define PLAYER_EXT_H
+
+#include "player.h"
+#include "maze_ext.h"
+#include "task_sched.h"
+
+/*
+ * Extensions to the player module that are not part of player.h.
+ *
+ * Players are identified by a 16-bit ID (the occupant ID under which they
+ * are stored in the maze), and separately carry the avatar character used
+ * to display them.  Players logged in with player_login() use their avatar
+ * as their ID, so avatars remain unique among them; players logged in with
+ * MZW_CAP_EXTENDED_ID are assigned a free ID and may share an avatar.
+ *
+ * The players of one game room are kept in a PLAYER_TABLE, which also
+ * holds the room's scoreboard and refers to the maze the room plays in.
+ * Players in different tables never see or affect each other.  The
+ * functions in player.h use the default table, which plays in the default
+ * maze; a player, once logged in, always operates within its own table.
+ */
+
+/*
+ * Type of a player table.
+ */
+typedef struct player_table PLAYER_TABLE;
+
+/*
+ * Create a player table for an additional game room.
+ *
+ * @param maze  The maze in which the table's players play.
+ * @return the new table, or NULL if it could not be created.
+ */
+PLAYER_TABLE *player_table_create(MAZE *maze);
+
+/*
+ * Destroy a table created by player_table_create().  Any players still
+ * registered in the table are released as by player_fini().
+ *
+ * @param table  The table, which must not be referenced again.
+ */
+void player_table_destroy(PLAYER_TABLE *table);
+
+/*
+ * Get the default table.
+ *
+ * @return the table used by the functions in player.h.
+ */
+PLAYER_TABLE *player_default_table(void);
+
+/*
+ * Attempt to log in a player to a table, taking the client's capabilities
+ * into account.
+ *
+ * @param table  The table (game room) to log in to.
+ * @param clientfd  The file descriptor of the connection to the client.
+ * @param avatar  The avatar desired for the player.
+ * @param name  The player's name, which is copied before being saved.
+ * @param caps  Bitwise OR of MZW_CAP_* flags (see protocol_ext.h), as
+ * received in the param2 field of the client's LOGIN packet.
+ * @return A pointer to a PLAYER object, in case of success, otherwise NULL.
+ *
+ * Without MZW_CAP_EXTENDED_ID this behaves exactly like player_login(),
+ * and fails if the avatar is already in use.  With it, the login only
+ * fails if there are no free player IDs.
+ */
+PLAYER *player_login_ext(PLAYER_TABLE *table, int clientfd, OBJECT avatar, char *name, int caps);
+
+/*
+ * Get the ID of a player.
+ *
+ * @param player  The player.
+ * @return the player's ID.
+ */
+OCCUPANT player_get_id(PLAYER *player);
+
+/*
+ * Get the state object for the player with a specified ID.
+ *
+ * @param table  The table to look in.
+ * @param id  The ID of the player whose state is to be retrieved.
+ * @return the PLAYER object, with its reference count incremented, or NULL
+ * if no player currently has that ID.  As with player_get(), the caller
+ * must release the reference with player_unref().
+ */
+PLAYER *player_get_by_id(PLAYER_TABLE *table, OCCUPANT id);
+
+/* Time a player hit by a laser spends out of the maze, in seconds. */
+#define PLAYER_PURGATORY_SECONDS 3
+
+/*
+ * Function called by player_fire_laser() to tell a player that it has been
+ * hit.  The hit has already been recorded on the player when it is called.
+ *
+ * @param victim  The player that was hit.
+ */
+typedef void PLAYER_HIT_NOTIFIER(PLAYER *victim);
+
+/*
+ * Replace the way players are told of laser hits.
+ *
+ * @param notify  The notifier, or NULL for the default, which sends
+ * SIGUSR1 to the thread that logged the victim in, so that its blocking
+ * receive is interrupted and player_check_for_laser_hit() is called.
+ *
+ * This is intended for driving the game without service threads (for
+ * example in a simulation), and should be called once at startup.
+ */
+void player_set_hit_notifier(PLAYER_HIT_NOTIFIER *notify);
+
+/*
+ * Take a laser hit recorded on a player, if there is one: remove the
+ * player from the maze, update the views of the players who could see it
+ * and send it an ALERT.  This is the first half of
+ * player_check_for_laser_hit(), which then waits out the purgatory and
+ * respawns the player.
+ *
+ * @param player  The player.
+ * @return nonzero if a hit was taken, in which case the player must be
+ * respawned with player_reset() after PLAYER_PURGATORY_SECONDS; zero if
+ * the player had not been hit.
+ */
+int player_take_hit(PLAYER *player);
+
+/*
+ * Get the strand that serializes the work done for a player.
+ *
+ * @param player  The player.
+ * @return the strand.  The player's state is changed only by tasks of this
+ * strand: the functions in player.h run their work in it (at once, on the
+ * calling thread, if it is idle), and other players post messages to it
+ * when the player's view may be stale, the scores have changed or a packet
+ * is to be sent to its client.  Views made stale by other players are
+ * computed in batches, one per table at a time, from a single consistent
+ * state of the maze, and posted to the players' strands to be sent.  When the task scheduler is running, the
+ * player's commands are posted to it by its service thread.
+ * player_logout() and player_take_hit() run after the tasks already posted.
+ */
+STRAND *player_strand(PLAYER *player);
+
+/*
+ * Format a report of view batches: batches run, views they computed, views
+ * dropped because the player had read a newer one itself by the time the
+ * batch's arrived, views left for the player to read because a message
+ * could not be allocated, and the most views computed by one batch.
+ *
+ * @param buf  Buffer to receive the report (may be NULL if len is zero).
+ * @param len  Size of the buffer.
+ * @return the number of characters that the full report needs, as for
+ * snprintf().
+ */
+int player_view_report(char *buf, size_t len);
+
+#endif
@@ -0,0 +1,160 @@
+#ifndef PROTOCOL_EXT_H
+#define PROTOCOL_EXT_H
+
+#include <stdint.h>
+
+#include "protocol.h"
+#include "slab.h"
+
+/*
+ * Server-side extensions to the packet layer that are not part of the
+ * base protocol definition in protocol.h.
+ */
+
+/*
+ * Client capability bits, sent by a client in the param2 field of its LOGIN
+ * packet.  Clients that predate these extensions send zero and get the base
+ * protocol.
+ *
+ *   MZW_CAP_SCORE_BATCH:  The client understands batched SCORE packets.
+ *   MZW_CAP_EXTENDED_ID:  The client wants an extended-ID login.  The
+ *                         avatar in param1 is then only a display glyph:
+ *                         it need not be unique, and the server assigns
+ *                         the player a 16-bit ID, returned as the payload
+ *                         of the READY packet (uint16_t, network order).
+ *                         Since param1 cannot hold such an ID, all SCORE
+ *                         updates to this client use the batched form.
+ */
+#define MZW_CAP_SCORE_BATCH 0x01
+#define MZW_CAP_EXTENDED_ID 0x02
+
+/*
+ * Busy reply.
+ *
+ * When the server is overloaded it may turn a connection away as soon as it
+ * is accepted, by sending an unsolicited INUSE packet whose param1 is
+ * MZW_INUSE_BUSY and closing the connection.  (An INUSE reply to a LOGIN
+ * has param1 zero.)  The client should try again later.
+ */
+#define MZW_INUSE_BUSY 1
+
+/*
+ * Batched SCORE packet.
+ *
+ * A SCORE packet whose param1 is MZW_SCORE_BATCH (which is never a valid
+ * avatar) carries several scoreboard entries in its payload instead of a
+ * single entry in param1/param2.  The payload is an array of the following
+ * records, with multi-byte fields in network byte order.  A score of -1
+ * removes the entry from the scoreboard, as for an ordinary SCORE packet.
+ * For players logged in without MZW_CAP_EXTENDED_ID, id is the avatar.
+ */
+#define MZW_SCORE_BATCH 0
+
+typedef struct mzw_score_record {
+    uint16_t id;                   // Player ID
+    int16_t score;                 // Player's score, or -1 to remove
+    uint8_t glyph;                 // Avatar character displayed for the player
+    uint8_t reserved;              // Zero
+} MZW_SCORE_RECORD;
+
+/*
+ * Clock sources used to stamp outgoing packets.
+ *
+ *   MZW_CLOCK_PRECISE:  CLOCK_MONOTONIC (the default).
+ *   MZW_CLOCK_COARSE:   CLOCK_MONOTONIC_COARSE, which is served from the
+ *                       vDSO without reading the hardware counter, at the
+ *                       cost of tick (typically 1-4ms) resolution.
+ *   MZW_CLOCK_VIRTUAL:  A virtual clock, which only moves when set with
+ *                       proto_set_virtual_time(), for simulations.
+ */
+typedef enum {
+    MZW_CLOCK_PRECISE, MZW_CLOCK_COARSE, MZW_CLOCK_VIRTUAL
+} MZW_CLOCK_MODE;
+
+/*
+ * Select the clock source used for packet timestamps.
+ *
+ * @param mode  The clock source to use from now on.
+ * @return zero if the mode was accepted, nonzero if the clock is not
+ * supported on this system (in which case the previous mode is kept).
+ *
+ * This is intended to be called once at startup, before any client
+ * threads have been created.
+ */
+int proto_set_clock_mode(MZW_CLOCK_MODE mode);
+
+/*
+ * Set the time of the virtual clock used by MZW_CLOCK_VIRTUAL.
+ *
+ * @param nanos  The virtual time, in nanoseconds.
+ *
+ * The virtual clock is global, so it is only meaningful when packets are
+ * sent from a single thread.
+ */
+void proto_set_virtual_time(uint64_t nanos);
+
+/*
+ * Function to which outgoing packets can be diverted.
+ *
+ * @param fd  The descriptor the packet was addressed to.
+ * @param pkt  The packet, stamped, with fields in host byte order.
+ * @param data  Its payload, or NULL.
+ * @return zero if the packet was accepted, nonzero to report a send error.
+ */
+typedef int MZW_PACKET_SINK(int fd, MZW_PACKET *pkt, void *data);
+
+/*
+ * Divert outgoing packets to a sink instead of writing them to their
+ * descriptors, so that the game can be driven without sockets (for
+ * example by a simulation, where the descriptors are fake).
+ *
+ * @param sink  The sink, or NULL to write packets to their descriptors.
+ *
+ * This is intended to be called once at startup.
+ */
+void proto_set_sink(MZW_PACKET_SINK *sink);
+
+/*
+ * Receive a packet, as proto_recv_packet() does, but allocate its payload
+ * from an arena instead of with malloc().
+ *
+ * @param fd  The file descriptor from which the packet is to be received.
+ * @param pkt  Receives the packet header, with fields in host byte order.
+ * @param arena  The arena; the payload stays valid until it is reset.
+ * @param datap  Receives the payload, or NULL if there is none.
+ * @return zero on success, nonzero on error or end of file.  The payload
+ * must not be freed.
+ */
+int proto_recv_packet_arena(int fd, MZW_PACKET *pkt, ARENA *arena, void **datap);
+
+/*
+ * Send several packets without payloads, as proto_send_packet() would send
+ * each of them, but with as few writes as possible.
+ *
+ * @param fd  The file descriptor on which the packets are to be sent.
+ * @param pkts  The packets, with fields in host byte order.  Their size
+ * fields are set to zero and their timestamps are filled in.
+ * @param count  Number of packets.
+ * @return zero on success, nonzero on error.  After an error, some of the
+ * packets may have been sent.
+ */
+int proto_send_packets(int fd, MZW_PACKET *pkts, int count);
+
+/*
+ * Begin a send batch on the calling thread.
+ *
+ * @return zero on success, nonzero if the clock could not be read.
+ *
+ * The clock is read once when the outermost batch begins, and every packet
+ * sent by this thread until the matching proto_batch_end() carries that
+ * same timestamp.  Batches nest; only the outermost begin/end pair has any
+ * effect.  Packets sent outside of any batch are each stamped individually.
+ */
+int proto_batch_begin(void);
+
+/*
+ * End a send batch on the calling thread.
+ */
+void proto_batch_end(void);
+
+#endif
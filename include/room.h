@@ -0,0 +1,70 @@
+#ifndef ROOM_H
+#define ROOM_H
+
+#include "maze_ext.h"
+#include "player_ext.h"
+
+/*
+ * A game room is an independent match: it has its own maze, its own
+ * player table (and therefore scoreboard) and its own locks, so that
+ * players in different rooms never contend with each other.  Room 0 is
+ * the default room, made up of the default maze and player table.
+ * A client selects a room with the param3 field of its LOGIN packet.
+ *
+ * Optionally, each room can be associated with a CPU: the threads serving
+ * a room's players are then pinned to that CPU, so that a room's state
+ * stays in one core's caches instead of bouncing between cores.
+ */
+typedef struct room ROOM;
+
+/* Maximum number of rooms (LOGIN param3 is a signed 8-bit field). */
+#define MAX_ROOMS 128
+
+/*
+ * Set up the game rooms.
+ *
+ * @param count  The number of rooms, between 1 and MAX_ROOMS.
+ * @param pin  Nonzero if the threads serving each room should be pinned
+ * to a CPU, with rooms assigned to the online CPUs round-robin.
+ * @return zero on success, nonzero otherwise.
+ *
+ * maze_init() and player_init() must have been called first, since room 0
+ * uses the default maze and player table, and the mazes of the other rooms
+ * are copies of the default maze's template.
+ */
+int room_init(int count, int pin);
+
+/*
+ * Tear down the rooms created by room_init(), logging out any players in
+ * rooms other than room 0.  The default maze and player table are left
+ * for maze_fini() and player_fini().
+ */
+void room_fini(void);
+
+/*
+ * Get the number of rooms.
+ */
+int room_count(void);
+
+/*
+ * Get a room by index.
+ *
+ * @param index  The room index, as sent in LOGIN param3.
+ * @return the room, or NULL if there is no room with that index.
+ */
+ROOM *room_get(int index);
+
+/*
+ * Get the player table of a room.
+ */
+PLAYER_TABLE *room_players(ROOM *room);
+
+/*
+ * Called by a thread that is about to serve a player in a room.  If CPU
+ * pinning is enabled, the calling thread is pinned to the room's CPU.
+ *
+ * @param room  The room.
+ */
+void room_enter(ROOM *room);
+
+#endif
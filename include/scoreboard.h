@@ -0,0 +1,80 @@
+#ifndef SCOREBOARD_H
+#define SCOREBOARD_H
+
+#include "maze_ext.h"
+
+/*
+ * A scoreboard is a versioned table of player scores.  Every change to an
+ * entry (new score, or removal of the player) stamps that entry with the
+ * next value of a global version counter.  A client that has been sent the
+ * board up to version V can then be brought up to date by sending only the
+ * entries whose version is greater than V, instead of the whole board.
+ */
+typedef struct scoreboard SCOREBOARD;
+
+/* Number of slots in a scoreboard; occupant IDs must be below this. */
+#define SCOREBOARD_SIZE 256
+
+/*
+ * One entry of a scoreboard delta.  A score of -1 means that the player
+ * has left and the entry should be removed from the client's scoreboard.
+ */
+typedef struct score_entry {
+    OCCUPANT id;
+    OBJECT glyph;
+    int score;
+} SCORE_ENTRY;
+
+/*
+ * Create an empty scoreboard.
+ *
+ * @return the new scoreboard, or NULL if memory could not be allocated.
+ */
+SCOREBOARD *scoreboard_create(void);
+
+/*
+ * Destroy a scoreboard.
+ *
+ * @param sb  The scoreboard, which must not be referenced again.
+ */
+void scoreboard_destroy(SCOREBOARD *sb);
+
+/*
+ * Set the score of a player, adding the player to the board if needed.
+ *
+ * @param sb  The scoreboard.
+ * @param id  The player's occupant ID.
+ * @param glyph  The player's display glyph.
+ * @param score  The new score.
+ */
+void scoreboard_set(SCOREBOARD *sb, OCCUPANT id, OBJECT glyph, int score);
+
+/*
+ * Remove a player from the board.  Clients that have seen the player will
+ * receive a score of -1 for it in their next delta.
+ *
+ * @param sb  The scoreboard.
+ * @param id  The player's occupant ID.
+ */
+void scoreboard_remove(SCOREBOARD *sb, OCCUPANT id);
+
+/*
+ * Collect the entries that have changed since a given version.
+ *
+ * @param sb  The scoreboard.
+ * @param since  The last version already known to the client (0 for none).
+ * @param out  Array to receive the changed entries.
+ * @param max  Capacity of the out array.
+ * @param versionp  Receives the version the client is at once the
+ * returned entries have been delivered.
+ * @return the number of entries stored in out.
+ *
+ * When since is 0 the client has never seen the board, so removed players
+ * are skipped instead of being reported with a score of -1.  An out array
+ * of SCOREBOARD_SIZE entries is always large enough; if a smaller one fills
+ * up, *versionp is left at since so the rest is sent by the next delta.
+ */
+int scoreboard_delta(SCOREBOARD *sb, unsigned long since, SCORE_ENTRY *out, int max,
+                     unsigned long *versionp);
+
+#endif
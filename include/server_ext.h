@@ -0,0 +1,48 @@
+#ifndef SERVER_EXT_H
+#define SERVER_EXT_H
+
+#include "protocol.h"
+#include "player.h"
+
+/*
+ * Extensions to the client service that are not part of server.h.
+ *
+ * The handling of each packet received from a client is separated from
+ * the service loop that receives it, so that the same game logic can be
+ * driven without a socket or a thread per client (for example by a
+ * simulation that feeds packets from an event loop).
+ */
+
+/*
+ * State of one client session, as kept by its service loop.
+ */
+typedef struct mzw_session {
+    int fd;                  // Descriptor replies are sent to
+    PLAYER *player;          // The logged-in player, or NULL before login
+} MZW_SESSION;
+
+/*
+ * Carry out one packet received from a client.
+ *
+ * @param session  The client's session.  A successful LOGIN sets its player.
+ * @param pkt  The packet, with fields in host byte order.
+ * @param data  Its payload, or NULL.
+ *
+ * Until the session has logged in, only LOGIN packets are honored; after
+ * that, LOGIN packets are ignored.  Laser hits on the session's player are
+ * not handled here (see player_check_for_laser_hit()).
+ */
+void mzw_handle_packet(MZW_SESSION *session, MZW_PACKET *pkt, void *data);
+
+/*
+ * Serve a client connection until it is closed, as mzw_client_service()
+ * does, but on the calling thread.
+ *
+ * @param fd  The connection, which has been admitted (see admission.h).
+ * It is closed, and its admission released, before this returns.
+ *
+ * The calling thread may go on to serve other connections afterwards.
+ */
+void mzw_serve_connection(int fd);
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+/*
+ * Object allocators that keep connection churn off the global heap.
+ *
+ * A SLAB hands out fixed-size objects of one kind (such as PLAYER).  Freed
+ * objects go on the slab's free list and are reused by later allocations;
+ * when the list is empty, the slab grows by one chunk of several objects,
+ * obtained from malloc() in a single call.  Chunks are never returned to
+ * the heap, so after warm-up a login/logout cycle does no malloc() at all.
+ *
+ * An ARENA is a bump allocator for short-lived data, such as the payloads
+ * of the packets received on one connection.  It owns one block, taken
+ * from a shared slab of blocks; allocations are carved from the block and
+ * all released at once by arena_reset().  Allocations that do not fit in
+ * what is left of the block fall back to malloc() and are freed on reset.
+ *
+ * Every slab that has been used appears in slab_report(), which the stats
+ * report includes.
+ */
+
+/*
+ * A slab of objects of one size.  Define each slab statically with
+ * SLAB_INIT(); its fields are private to the slab module.
+ */
+typedef struct slab {
+    const char *name;              // Name in reports
+    size_t size;                   // Object size requested
+    size_t per_chunk;              // Objects per chunk
+    pthread_mutex_t mutex;         // Protects the fields below
+    void *free_list;               // Free objects, linked through their first word
+    unsigned long chunks;          // Chunks obtained from malloc()
+    unsigned long in_use, peak;    // Objects allocated now, and at most
+    unsigned long allocs, frees;   // Calls to slab_alloc() and slab_free()
+    int registered;                // Listed for reports
+    struct slab *next;             // Next slab in the report list
+} SLAB;
+
+#define SLAB_INIT(name, size, per_chunk) \
+    { (name), (size), (per_chunk), PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, 0, 0, 0, 0, NULL }
+
+/*
+ * Allocate an object from a slab.
+ *
+ * @param slab  The slab.
+ * @return a zero-filled object, or NULL if memory is exhausted.
+ */
+void *slab_alloc(SLAB *slab);
+
+/*
+ * Return an object to the slab it was allocated from.
+ *
+ * @param slab  The slab.
+ * @param obj  The object (may be NULL).
+ */
+void slab_free(SLAB *slab, void *obj);
+
+/* Size of an arena's block, and so of the allocations it serves without malloc(). */
+#define ARENA_BLOCK_SIZE 4096
+
+/*
+ * A bump allocator for data that is freed all at once.
+ */
+typedef struct arena {
+    char *block;                   // Block of ARENA_BLOCK_SIZE bytes, or NULL
+    size_t used;                   // Bytes of the block handed out
+    struct arena_spill *spill;     // Allocations that did not fit, freed on reset
+} ARENA;
+
+/*
+ * Initialize an arena, taking its block from the shared slab of blocks.
+ *
+ * @param arena  The arena.
+ */
+void arena_init(ARENA *arena);
+
+/*
+ * Allocate from an arena.
+ *
+ * @param arena  The arena.
+ * @param size  Number of bytes.
+ * @return memory aligned for any type, valid until the next arena_reset()
+ * or arena_fini(), or NULL if memory is exhausted.
+ */
+void *arena_alloc(ARENA *arena, size_t size);
+
+/*
+ * Release everything allocated from an arena, keeping its block.
+ *
+ * @param arena  The arena.
+ */
+void arena_reset(ARENA *arena);
+
+/*
+ * Release everything allocated from an arena, and its block.
+ *
+ * @param arena  The arena, which must be initialized again before reuse.
+ */
+void arena_fini(ARENA *arena);
+
+/*
+ * Format a report of every slab used so far: object size, chunks, objects
+ * in use (now and at peak) and allocation counts, followed by the number
+ * of arena allocations that did not fit in their arena's block.
+ *
+ * @param buf  Buffer to receive the report (may be NULL if len is zero).
+ * @param len  Size of the buffer.
+ * @return the number of characters that the full report needs, as for
+ * snprintf().
+ */
+int slab_report(char *buf, size_t len);
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Server statistics.
+ *
+ * For each client-to-server packet type, the service loop records how long
+ * the server took to handle the packet, from the moment it was decoded to
+ * the moment the last packet sent in response was written.  Latencies are
+ * kept in lock-free log-linear histograms (in the style of HdrHistogram:
+ * 32 linear sub-buckets per power of two, so every recorded value is
+ * accurate to within about 3%).  The packet layer also counts packets and
+ * bytes in each direction.
+ *
+ * A report can be fetched over a plain-text TCP port on the loopback
+ * interface (see stats_serve()); each connection receives one report, e.g.
+ *
+ *     nc 127.0.0.1 <port>
+ */
+
+/*
+ * Latency histogram, usable on its own (e.g. by the lock profiler).
+ * Recording is lock-free and may be done concurrently from any thread.
+ */
+typedef struct histogram HISTOGRAM;
+
+/*
+ * Create an empty histogram.
+ *
+ * @return the histogram, or NULL if memory could not be allocated.
+ */
+HISTOGRAM *histogram_create(void);
+
+/*
+ * Record one value, in nanoseconds.
+ */
+void histogram_record(HISTOGRAM *h, uint64_t nanos);
+
+/*
+ * Summarize a histogram.
+ *
+ * @param h  The histogram.
+ * @param p50p, p99p, p999p, maxp  Receive the 50th, 99th and 99.9th
+ * percentiles and the maximum, in nanoseconds.
+ * @return the number of values recorded.
+ */
+unsigned long histogram_summary(HISTOGRAM *h, uint64_t *p50p, uint64_t *p99p,
+                                uint64_t *p999p, uint64_t *maxp);
+
+/* Packet types below this value have a latency histogram. */
+#define STATS_MAX_TYPES 16
+
+/*
+ * Initialize the statistics and start the uptime clock.
+ */
+void stats_init(void);
+
+/*
+ * Get the current time, for measuring latencies.
+ *
+ * @return monotonic time in nanoseconds.
+ */
+uint64_t stats_now(void);
+
+/*
+ * Record the time taken to handle one packet.
+ *
+ * @param type  The packet type.
+ * @param nanos  The latency in nanoseconds.
+ */
+void stats_record(int type, uint64_t nanos);
+
+/*
+ * Count a packet received, or sent.
+ *
+ * @param bytes  Size of the packet, including its header.
+ */
+void stats_count_in(size_t bytes);
+void stats_count_out(size_t bytes);
+
+/*
+ * Type of a function that formats a section of the report, with the same
+ * arguments and result as stats_report().
+ */
+typedef int STATS_REPORT_FN(char *buf, size_t len);
+
+/* Most sections that can be added to the report with stats_add_report(). */
+#define STATS_MAX_REPORTS 16
+
+/*
+ * Add a section to the report, e.g. the counters of another module.
+ *
+ * @param fn  Function that formats the section; it may be called from the
+ * thread serving the stats port at any time afterwards.
+ * @return zero on success, nonzero if STATS_MAX_REPORTS have been added.
+ *
+ * This is intended to be called at startup, before stats_serve().  The
+ * statistics module itself depends on no other module, so the modules a
+ * program links are only those it uses.
+ */
+int stats_add_report(STATS_REPORT_FN *fn);
+
+/*
+ * Format a report: uptime, packet and byte totals and rates, and for each
+ * packet type seen, the count and the p50/p99/p999/max latency.  Rates are
+ * computed over the interval since the previous report (or since startup).
+ * If lock profiling is enabled, the lock profile (see lockprof.h) follows,
+ * and then the sections added with stats_add_report(), in order.
+ *
+ * @param buf  Buffer to receive the report.
+ * @param len  Size of the buffer.
+ * @return the length of the report, which is truncated if it does not fit.
+ */
+int stats_report(char *buf, size_t len);
+
+/*
+ * Start a thread that serves reports on a TCP port on 127.0.0.1.  Each
+ * connection receives one report and is then closed.
+ *
+ * @param port  The port to listen on.
+ * @return zero on success, nonzero if the port could not be opened.
+ */
+int stats_serve(int port);
+
+/*
+ * Stop serving reports: close the port opened by stats_serve(), if any,
+ * and wait for its thread to exit.
+ *
+ * This is intended to be called at termination, before the modules whose
+ * sections were added with stats_add_report() are finalized.
+ */
+void stats_fini(void);
+
+#endif
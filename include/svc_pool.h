@@ -0,0 +1,80 @@
+#ifndef SVC_POOL_H
+#define SVC_POOL_H
+
+#include <stddef.h>
+
+/*
+ * A pool of pre-spawned client service threads.
+ *
+ * Instead of creating a thread for each accepted connection, the accept
+ * threads hand connections to the pool through a bounded lock-free queue,
+ * and idle workers take them from it.  A worker serves one connection at a
+ * time, from its arrival to its disconnection (see mzw_serve_connection()),
+ * and then waits for the next, so in a reconnect storm most connections
+ * find a worker already waiting and pay no thread creation at all.
+ *
+ * The pool starts with a minimum number of workers.  When a connection
+ * arrives and no worker is idle, one more is created, up to the maximum;
+ * beyond it, connections wait in the queue until a worker finishes its
+ * session.  Workers above the minimum that stay idle for
+ * SVC_POOL_IDLE_SECONDS exit.  Workers are created with svc_thread_create(),
+ * so they have the configured stack size.
+ */
+
+/* Default minimum number of workers. */
+#define SVC_POOL_MIN_DEFAULT 16
+
+/* Capacity of the queue of connections waiting for a worker. */
+#define SVC_POOL_QUEUE_SIZE 4096
+
+/* Time an idle worker above the minimum waits before exiting, in seconds. */
+#define SVC_POOL_IDLE_SECONDS 10
+
+/*
+ * Start the pool.
+ *
+ * @param min_workers  Workers created now and kept even when idle.
+ * @param max_workers  Most workers that may exist at once; zero for no limit.
+ * @return zero on success, nonzero if a worker could not be created.
+ *
+ * This is intended to be called once at startup, after svc_thread_init()
+ * and before any connections are accepted.
+ */
+int svc_pool_init(int min_workers, int max_workers);
+
+/*
+ * Hand an accepted connection to the pool.
+ *
+ * @param fd  The connection, which has been admitted.
+ * @return zero if the connection has been queued for a worker, nonzero if
+ * the queue is full, in which case the caller still owns the connection.
+ *
+ * This may be called concurrently from several accept threads.
+ */
+int svc_pool_submit(int fd);
+
+/*
+ * Shut the pool down.
+ *
+ * Connections still waiting in the queue are closed and their admission
+ * slots released, idle workers exit, and busy workers exit as soon as
+ * their sessions end.  This returns once every worker has exited.
+ *
+ * This is intended to be called once, at termination, after the last
+ * svc_pool_submit() and after creg_shutdown_all(), which ends the sessions
+ * being served.
+ */
+void svc_pool_shutdown(void);
+
+/*
+ * Format a report of the pool: workers now, idle and busy, and created and
+ * exited so far, and connections waiting and most ever waiting.
+ *
+ * @param buf  Buffer to receive the report (may be NULL if len is zero).
+ * @param len  Size of the buffer.
+ * @return the number of characters that the full report needs, as for
+ * snprintf().
+ */
+int svc_pool_report(char *buf, size_t len);
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef SVC_THREAD_H
+#define SVC_THREAD_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+/*
+ * Creation of client service threads, and their memory budget.
+ *
+ * Threads created with default attributes reserve the process's default
+ * stack size (usually 8 MiB), so a few thousand connections exhaust the
+ * address space or the kernel's limit on memory mappings long before they
+ * exhaust memory.  Service threads need far less: nothing on their call
+ * paths keeps more than a few KiB on the stack.  They are therefore created
+ * detached, with a stack size and guard size configured at startup.
+ */
+
+/* Default stack size of service threads, in bytes. */
+#define SVC_THREAD_STACK_DEFAULT (256 * 1024)
+
+/*
+ * Smallest stack size accepted, in bytes.  Debug builds, which log on every
+ * action and in the SIGUSR1 handler, have overflowed 24 KiB under load.
+ */
+#define SVC_THREAD_STACK_MIN (32 * 1024)
+
+/*
+ * Configure the attributes of service threads created from now on.
+ *
+ * @param stack_size  Stack size in bytes; zero for SVC_THREAD_STACK_DEFAULT.
+ * It is rounded up to a whole number of pages.
+ * @param guard_size  Size in bytes of the inaccessible guard area below the
+ * stack, rounded up to a whole number of pages; zero for one page.
+ * @return zero on success, nonzero if the stack size is below
+ * SVC_THREAD_STACK_MIN or the system's minimum, in which case a diagnostic
+ * has been printed on stderr.
+ *
+ * This is intended to be called once at startup, before any service
+ * threads are created.
+ */
+int svc_thread_init(size_t stack_size, size_t guard_size);
+
+/*
+ * Create a detached service thread.
+ *
+ * @param fn  Thread function.
+ * @param arg  Argument passed to fn.
+ * @return zero on success, or an error number as for pthread_create().
+ */
+int svc_thread_create(void *(*fn)(void *), void *arg);
+
+/*
+ * Per-connection memory budget.
+ */
+typedef struct svc_thread_budget {
+    size_t stack_size;       // Stack reserved per service thread
+    size_t guard_size;       // Guard area below each stack
+    size_t resident;         // Resident memory per idle thread, as measured
+    size_t heap;             // Heap reserved per session (payload arena)
+    long max_by_maps;        // Connections the mapping limit allows, or -1 if unknown
+    long max_by_as;          // Connections the address space limit allows, or -1 if unlimited
+} SVC_THREAD_BUDGET;
+
+/*
+ * Measure the memory each connection costs with the current attributes.
+ *
+ * @param budget  Receives the budget.
+ * @param probes  Number of idle threads to create for the measurement.
+ * @return zero on success, nonzero if the measurement failed.
+ *
+ * The resident cost is measured by creating idle threads with the service
+ * thread attributes and comparing the process's resident set size before
+ * and after, so it includes the thread's stack pages touched so far, its
+ * thread control block and its thread-local storage.
+ */
+int svc_thread_budget(SVC_THREAD_BUDGET *budget, int probes);
+
+#endif
@@ -0,0 +1,182 @@
+#ifndef TASK_SCHED_H
+#define TASK_SCHED_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+/*
+ * A work-stealing task scheduler, and strands that serialize tasks.
+ *
+ * The scheduler runs tasks on a fixed set of worker threads.  Each worker
+ * has its own deque: tasks spawned by a task go on the bottom of its
+ * worker's deque and are taken back from the bottom (most recent first),
+ * while idle workers steal from the top of other workers' deques, so
+ * workers contend only when one runs out of work.  Tasks spawned from
+ * other threads are dropped into a per-worker inbox, one worker after
+ * another.
+ *
+ * A STRAND is a sequence of tasks that must run one at a time, in the
+ * order they were posted, such as the commands of one player.  Tasks of
+ * different strands run in parallel.  A strand with tasks to run is itself
+ * a task on the scheduler, so it costs nothing while it is empty.
+ *
+ * Until task_sched_init() has started the scheduler, spawning a task runs
+ * it at once on the calling thread, and a strand is run by whichever thread
+ * posts to it while it is idle: that thread runs the task at once, and then
+ * any tasks other threads post meanwhile, until the strand is empty.  Either
+ * way, a strand's tasks never run at the same time as one another, so data
+ * touched only by the tasks of one strand needs no lock.
+ */
+
+/*
+ * Type of a task function.
+ */
+typedef void TASK_FN(void *arg);
+
+/*
+ * A unit of work.  Its fields are private to the scheduler.
+ */
+typedef struct task {
+    TASK_FN *fn;
+    void *arg;
+    _Atomic(struct task *) next;   // Next task in a strand or inbox
+    int pooled;                    // Allocated by the scheduler, freed after running
+} TASK;
+
+/*
+ * A sequence of tasks run one at a time.  Its fields are private to the
+ * scheduler; initialize it with strand_init().
+ */
+typedef struct strand {
+    _Atomic(TASK *) head;          // Most recently posted task
+    TASK *tail;                    // Next task to run (consumer side)
+    TASK stub;                     // Placeholder that keeps the queue non-empty
+    atomic_int pending;            // Tasks posted and not yet finished
+    TASK run;                      // The task that runs this strand
+    TASK_FN *hold, *release;       // Called with owner as the strand starts and stops
+    void *owner;
+} STRAND;
+
+/*
+ * Start the scheduler.
+ *
+ * @param workers  Number of worker threads; zero leaves the scheduler
+ * stopped, so that tasks run on the threads that spawn them.
+ * @return zero on success, nonzero if the workers could not be started.
+ *
+ * This is intended to be called once at startup.
+ */
+int task_sched_init(int workers);
+
+/*
+ * Shut the scheduler down.
+ *
+ * Tasks already spawned or posted are run; the workers then exit, and
+ * this returns once they have.  Afterward, tasks run on the threads that
+ * spawn them, as before task_sched_init().
+ *
+ * This is intended to be called once, at termination, when no thread
+ * other than the workers is still spawning or posting tasks.
+ */
+void task_sched_shutdown(void);
+
+/*
+ * Determine whether the scheduler has been started.
+ *
+ * @return nonzero if tasks are run by the scheduler's workers.
+ */
+int task_sched_running(void);
+
+/*
+ * Run a task on the scheduler.
+ *
+ * @param fn  Task function.
+ * @param arg  Argument passed to fn.
+ *
+ * If the scheduler is not running, fn is called before this returns.
+ */
+void task_spawn(TASK_FN *fn, void *arg);
+
+/*
+ * Initialize a strand.
+ *
+ * @param strand  The strand, which must not move while it has tasks.
+ */
+void strand_init(STRAND *strand);
+
+/*
+ * Initialize a strand embedded in an object whose lifetime is managed by
+ * reference counting.
+ *
+ * @param strand  The strand.
+ * @param hold  Function that takes a reference to owner.
+ * @param release  Function that releases a reference to owner.
+ * @param owner  The object containing the strand.
+ *
+ * A reference is held while the strand has tasks to run, and released
+ * once it has stopped touching the strand, so that a task may drop the
+ * last reference held elsewhere without freeing the strand under its
+ * runner.
+ */
+void strand_init_owned(STRAND *strand, TASK_FN *hold, TASK_FN *release, void *owner);
+
+/*
+ * Get the strand whose task the calling thread is running.
+ *
+ * @return the strand, or NULL if the calling thread is not running a task
+ * of a strand.
+ */
+STRAND *strand_current(void);
+
+/*
+ * Post a task to a strand.
+ *
+ * @param strand  The strand.
+ * @param fn  Task function.
+ * @param arg  Argument passed to fn.
+ *
+ * The task runs after every task posted to the strand before it has
+ * finished, and before any posted after it starts.  This may be called from
+ * any thread, including from a task of the same strand, and does not wait
+ * for the task unless memory for it cannot be allocated.
+ */
+void strand_post(STRAND *strand, TASK_FN *fn, void *arg);
+
+/*
+ * Run a function as a task of a strand, and wait for it to finish.
+ *
+ * @param strand  The strand.
+ * @param fn  Task function.
+ * @param arg  Argument passed to fn.
+ *
+ * If the strand is idle, fn is run at once on the calling thread; if it is
+ * busy, fn is queued behind the tasks already posted.  Called from a task
+ * of the same strand, fn is simply called.  This must not be called from a
+ * task of another strand, which could wait for a strand that is waiting
+ * for it.
+ */
+void strand_call(STRAND *strand, TASK_FN *fn, void *arg);
+
+/*
+ * Wait until every task posted to a strand so far has finished.
+ *
+ * @param strand  The strand.
+ *
+ * This is strand_call() with a function that does nothing, and is subject
+ * to the same restriction.
+ */
+void strand_drain(STRAND *strand);
+
+/*
+ * Format a report of the scheduler: tasks run, tasks stolen from another
+ * worker's deque, tasks that found the deque full and ran inline, and
+ * times workers went to sleep.
+ *
+ * @param buf  Buffer to receive the report (may be NULL if len is zero).
+ * @param len  Size of the buffer.
+ * @return the number of characters that the full report needs, as for
+ * snprintf().
+ */
+int task_sched_report(char *buf, size_t len);
+
+#endif
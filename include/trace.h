@@ -0,0 +1,106 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+ * Binary event tracing.
+ *
+ * Unlike the debug() macros, which format text to stderr synchronously,
+ * tracing records hot-path events as fixed-size binary records: an event
+ * ID, a timestamp and two small arguments.  Each thread appends to its own
+ * ring buffer without locking; a background thread drains the rings to the
+ * trace file every few milliseconds.  If a ring fills up before it is
+ * drained, new events are dropped (and counted) rather than blocking the
+ * thread that records them.
+ *
+ * Trace files are converted to Chrome trace JSON, for viewing in
+ * chrome://tracing or Perfetto, by the trace2json tool.
+ *
+ * File format (host byte order):
+ *
+ *   TRACE_HEADER
+ *   then any number of chunks, each:
+ *     TRACE_CHUNK
+ *     chunk.count TRACE_RECORDs, all recorded by thread chunk.tid
+ *
+ * Records within a chunk are in time order; chunks of different threads
+ * are interleaved in the order they were drained.
+ */
+
+/*
+ * Traced events, and the meaning of their arguments.
+ */
+typedef enum {
+    TRACE_PACKET_RECV = 1,  // Packet received: arg0 = type, arg1 = payload size
+    TRACE_PACKET_DONE,      // Packet handled: arg0 = type
+    TRACE_VIEW_SENT,        // View sent: arg0 = player ID, arg1 = cells sent (bit 31: full redraw)
+    TRACE_LOCK_ACQUIRED,    // Lock acquired: arg0 = lock class (see lockprof.h), arg1 = wait in ns
+    TRACE_LASER_HIT,        // Laser hit: arg0 = victim ID, arg1 = shooter ID
+    TRACE_NEVENTS
+} TRACE_EVENT;
+
+/* Flag in the arg1 of TRACE_VIEW_SENT for a full redraw. */
+#define TRACE_VIEW_FULL 0x80000000u
+
+#define TRACE_MAGIC "MZWTRACE"
+#define TRACE_VERSION 2        // Lock class IDs renumbered when players lost their lock
+
+typedef struct trace_header {
+    char magic[8];           // TRACE_MAGIC
+    uint32_t version;        // TRACE_VERSION
+    uint32_t record_size;    // sizeof(TRACE_RECORD)
+} TRACE_HEADER;
+
+typedef struct trace_chunk {
+    uint32_t tid;            // Kernel thread ID of the recording thread
+    uint32_t count;          // Number of records that follow
+    uint32_t dropped;        // Records lost by this thread since its previous chunk
+    uint32_t reserved;
+} TRACE_CHUNK;
+
+typedef struct trace_record {
+    uint64_t ts;             // CLOCK_MONOTONIC time in ns (see stats_now())
+    uint16_t event;          // TRACE_EVENT
+    uint16_t arg0;
+    uint32_t arg1;
+} TRACE_RECORD;
+
+/* Nonzero while tracing is enabled.  Read by TRACE(). */
+extern atomic_int trace_enabled;
+
+/*
+ * Start tracing to a file, and the thread that writes it.
+ *
+ * @param path  Path of the trace file, which is created or truncated.
+ * @return zero on success, nonzero if the file could not be created or
+ * the thread could not be started.
+ */
+int trace_init(const char *path);
+
+/*
+ * Stop tracing, write out all recorded events and close the trace file.
+ * Has no effect if tracing was not started.
+ */
+void trace_fini(void);
+
+/*
+ * Get the name of an event, as shown by trace viewers.
+ *
+ * @return the name, or NULL if the event ID is not valid.
+ */
+const char *trace_event_name(int event);
+
+/* Slow path of TRACE(). */
+void trace_emit(TRACE_EVENT event, uint16_t arg0, uint32_t arg1);
+
+/*
+ * Record an event in the calling thread's ring, if tracing is enabled.
+ */
+#define TRACE(event, arg0, arg1) do { \
+        if (__builtin_expect(atomic_load_explicit(&trace_enabled, memory_order_relaxed), 0)) \
+            trace_emit((event), (arg0), (arg1)); \
+    } while (0)
+
+#endif
@@ -0,0 +1,126 @@
+/**
+ * @file admission.c
+ * @brief Admission control for incoming connections.
+ *
+ * The session count is shared between the accept threads, which reserve
+ * slots, and service threads, which release them, so it is kept in an
+ * atomic and reserved with compare-and-swap, which keeps concurrent accept
+ * threads from overshooting the limit.  The accept-rate token bucket is
+ * shared by the accept threads under a mutex; it is touched once per
+ * accepted connection, so the lock is not contended in practice.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "admission.h"
+#include "protocol_ext.h"
+#include "debug.h"
+
+static int max_sessions = 0;           // 0 = unlimited
+static int accept_rate = 0;            // Admissions per second; 0 = unlimited
+static atomic_int active_sessions = 0;
+static atomic_ulong rejected = 0;
+
+// Token bucket: tokens accrue at accept_rate per second
+static pthread_mutex_t bucket_mutex = PTHREAD_MUTEX_INITIALIZER;
+static double tokens;
+static struct timespec last_refill;
+
+/**
+ * @brief Configure the session limit and accept rate.
+ * @param sessions Maximum concurrent sessions (0 = unlimited).
+ * @param rate     Maximum admissions per second (0 = unlimited).
+ */
+void admission_init(int sessions, int rate) {
+    max_sessions = (sessions > 0) ? sessions : 0;
+    accept_rate = (rate > 0) ? rate : 0;
+    tokens = accept_rate;
+    clock_gettime(CLOCK_MONOTONIC, &last_refill);
+    debug("admission_init: max_sessions=%d accept_rate=%d/s", max_sessions, accept_rate);
+}
+
+/**
+ * @brief Take one token from the accept-rate bucket, if one is available.
+ * @return 1 if a token was taken, 0 if the rate limit is exceeded.
+ */
+static int take_token(void) {
+    if (accept_rate == 0) return 1;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    pthread_mutex_lock(&bucket_mutex);
+    double elapsed = (now.tv_sec - last_refill.tv_sec) + (now.tv_nsec - last_refill.tv_nsec) / 1e9;
+    last_refill = now;
+
+    // The bucket holds at most one second's worth of admissions
+    tokens += elapsed * accept_rate;
+    if (tokens > accept_rate) tokens = accept_rate;
+
+    int ok = (tokens >= 1.0);
+    if (ok) tokens -= 1.0;
+    pthread_mutex_unlock(&bucket_mutex);
+    return ok;
+}
+
+/**
+ * @brief Send a busy reply to a connection and close it.
+ *
+ * The reply is a single packet written without blocking; if the client's
+ * socket buffer cannot take it (or the client is already gone), the
+ * connection is simply closed.
+ */
+static void reject(int fd) {
+    // Sent directly, as proto_send_packet() could block the accept thread.
+    // All multi-byte fields are zero, so no byte order conversion is needed.
+    MZW_PACKET busy = { .type = MZW_INUSE_PKT, .param1 = MZW_INUSE_BUSY };
+    (void)!send(fd, &busy, sizeof(busy), MSG_DONTWAIT | MSG_NOSIGNAL);
+    shutdown(fd, SHUT_WR);
+    close(fd);
+    atomic_fetch_add(&rejected, 1);
+}
+
+/**
+ * @brief Admit or turn away a newly accepted connection.
+ * @param fd The accepted connection.
+ * @return 0 if admitted (a session slot is reserved), -1 if rejected and closed.
+ */
+int admission_admit(int fd) {
+    // Reserve a session slot, unless all are taken
+    int active = atomic_load(&active_sessions);
+    do {
+        if (max_sessions > 0 && active >= max_sessions) {
+            debug("admission_admit: Rejecting fd=%d, %d sessions active", fd, max_sessions);
+            reject(fd);
+            return -1;
+        }
+    } while (!atomic_compare_exchange_weak(&active_sessions, &active, active + 1));
+
+    if (!take_token()) {
+        debug("admission_admit: Rejecting fd=%d, accept rate %d/s exceeded", fd, accept_rate);
+        atomic_fetch_sub(&active_sessions, 1);
+        reject(fd);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Release the session slot of a finished connection.
+ */
+void admission_release(void) {
+    atomic_fetch_sub(&active_sessions, 1);
+}
+
+/**
+ * @brief Report the number of active sessions and of rejected connections.
+ */
+void admission_stats(int *activep, unsigned long *rejectedp) {
+    if (activep) *activep = atomic_load(&active_sessions);
+    if (rejectedp) *rejectedp = atomic_load(&rejected);
+}
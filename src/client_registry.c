@@ -12,32 +12,44 @@
  * - Allows the main thread to wait until all clients have disconnected.
  * - Can shut down all client connections (e.g., during server termination).
  *
+ * How it is stored:
+ * - A dense array holds the registered fds, so iterating costs one step per client.
+ * - A second array, indexed by fd, holds each fd's position in the dense array
+ *   (or -1), so register and unregister never search.  Unregistering moves the
+ *   last fd into the hole, keeping the dense array packed.
+ * - Both arrays grow by doubling as needed, up to CREG_MAX_CLIENTS clients.
+ *
  * Why this is needed:
  * - The server handles multiple clients at the same time using threads.
  * - Threads must not interfere with each other (race conditions).
- * - We use a mutex (lock) and semaphore to make this system safe and predictable.
+ * - We use a mutex (lock) and condition variable to make this system safe and predictable.
  */
 
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <pthread.h>
-#include <semaphore.h>
 #include <sys/socket.h>
 #include "client_registry.h"
+#include "client_registry_ext.h"
+#include "lockprof.h"
 #include "debug.h"  // Enables debug logging
 
-#define MAX_CLIENTS 128  // Maximum number of clients the server can track at once
+#define INITIAL_CAPACITY 128  // Initial size of the fd and slot arrays
 
 /**
  * Internal structure to track all active clients.
  * This is shared across threads, so it uses synchronization tools.
  */
 struct client_registry {
-    int client_fds[MAX_CLIENTS];   // Array that stores each client's socket fd (or -1 if unused)
+    int *fds;                      // Dense array of registered fds; the first `count` are valid
+    int fds_cap;                   // Allocated length of fds
+    int *slot_of;                  // slot_of[fd] = index of fd in fds, or -1 if unregistered
+    int slot_cap;                  // Allocated length of slot_of (one past the largest indexable fd)
     int count;                     // Total number of currently connected clients
-    pthread_mutex_t mutex;        // Lock to protect shared access to the array and count
-    sem_t empty;                  // Used to notify when all clients have disconnected
+    int closed;                    // Set by creg_shutdown_all(); no more clients are taken
+    pthread_mutex_t mutex;         // Lock to protect shared access to the arrays and count
+    pthread_cond_t empty;          // Signaled when all clients have disconnected
 };
 
 // Global pointer to the main client registry instance (set in main.c)
@@ -45,7 +57,7 @@ CLIENT_REGISTRY *client_registry = NULL;
 
 /**
  * Create and initialize a new client registry.
- * Sets all client slots to "empty" (-1) and prepares the locking mechanisms.
+ * Allocates the initial slot arrays and prepares the locking mechanisms.
  *
  * @return Pointer to a new CLIENT_REGISTRY, or NULL if memory allocation fails.
  */
@@ -56,13 +68,26 @@ CLIENT_REGISTRY *creg_init() {
         return NULL;
     }
 
+    cr->fds = malloc(INITIAL_CAPACITY * sizeof(int));
+    cr->slot_of = malloc(INITIAL_CAPACITY * sizeof(int));
+    if (cr->fds == NULL || cr->slot_of == NULL) {
+        debug("creg_init: Failed to allocate memory for client slots.");
+        free(cr->fds);
+        free(cr->slot_of);
+        free(cr);
+        return NULL;
+    }
+    cr->fds_cap = INITIAL_CAPACITY;
+    cr->slot_cap = INITIAL_CAPACITY;
+
     // Mark all fd slots as unused (-1 means "no client here")
-    memset(cr->client_fds, -1, sizeof(cr->client_fds));
+    memset(cr->slot_of, -1, INITIAL_CAPACITY * sizeof(int));
     cr->count = 0;
+    cr->closed = 0;
 
     // Initialize lock and signal
     pthread_mutex_init(&cr->mutex, NULL);
-    sem_init(&cr->empty, 0, 0);
+    pthread_cond_init(&cr->empty, NULL);
 
     debug("creg_init: Client registry initialized.");
     return cr;
@@ -78,61 +103,145 @@ void creg_fini(CLIENT_REGISTRY *cr) {
     if (cr == NULL) return;
 
     pthread_mutex_destroy(&cr->mutex);
-    sem_destroy(&cr->empty);
+    pthread_cond_destroy(&cr->empty);
+    free(cr->fds);
+    free(cr->slot_of);
     free(cr);
 
     debug("creg_fini: Client registry finalized and memory freed.");
 }
 
 /**
- * Register a new client.
+ * Grow an int array by doubling until it has at least `need` entries.
+ * New entries are set to `fill` if fill_new is nonzero.
+ *
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+static int grow(int **arrayp, int *capp, int need, int fill_new) {
+    if (need <= *capp) return 0;
+
+    int cap = *capp;
+    while (cap < need) cap *= 2;
+
+    int *array = realloc(*arrayp, cap * sizeof(int));
+    if (array == NULL) return -1;
+    if (fill_new) memset(array + *capp, -1, (cap - *capp) * sizeof(int));
+
+    *arrayp = array;
+    *capp = cap;
+    return 0;
+}
+
+/**
+ * Register a new client, reporting failure.
  * Adds the client's file descriptor to the registry and increments the client count.
  * Safe to call from multiple threads at once.
  *
  * @param cr Pointer to the client registry.
  * @param fd The file descriptor for the new client.
+ * @return 0 if registered, -1 if the registry is full, out of memory, or
+ * shut down.
  */
-void creg_register(CLIENT_REGISTRY *cr, int fd) {
-    pthread_mutex_lock(&cr->mutex);
+int creg_try_register(CLIENT_REGISTRY *cr, int fd) {
+    if (fd < 0) return -1;
 
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (cr->client_fds[i] == -1) {
-            cr->client_fds[i] = fd;
-            cr->count++;
-            debug("creg_register: Registered fd=%d (count=%d)", fd, cr->count);
-            break;
-        }
+    prof_lock(&cr->mutex, &lock_registry);
+
+    if (fd < cr->slot_cap && cr->slot_of[fd] != -1) {
+        // Already registered; nothing to do
+        prof_unlock(&cr->mutex);
+        return 0;
     }
 
-    pthread_mutex_unlock(&cr->mutex);
+    if (cr->closed || cr->count >= CREG_MAX_CLIENTS ||
+        grow(&cr->slot_of, &cr->slot_cap, fd + 1, 1) != 0 ||
+        grow(&cr->fds, &cr->fds_cap, cr->count + 1, 0) != 0) {
+        debug("creg_try_register: Cannot register fd=%d (count=%d)", fd, cr->count);
+        prof_unlock(&cr->mutex);
+        return -1;
+    }
+
+    cr->slot_of[fd] = cr->count;
+    cr->fds[cr->count++] = fd;
+    debug("creg_try_register: Registered fd=%d (count=%d)", fd, cr->count);
+
+    prof_unlock(&cr->mutex);
+    return 0;
+}
+
+/**
+ * Register a new client.
+ * As creg_try_register(), for callers that cannot handle failure.
+ *
+ * @param cr Pointer to the client registry.
+ * @param fd The file descriptor for the new client.
+ */
+void creg_register(CLIENT_REGISTRY *cr, int fd) {
+    if (creg_try_register(cr, fd) != 0) {
+        error("creg_register: Failed to register fd=%d", fd);
+    }
 }
 
 /**
  * Unregister a client.
  * Removes the client's file descriptor and decrements the client count.
  * If no clients are left, signals the main thread that the registry is now empty.
+ * Unregistering a file descriptor that is not registered has no effect.
  *
  * @param cr Pointer to the client registry.
  * @param fd The file descriptor of the client to remove.
  */
 void creg_unregister(CLIENT_REGISTRY *cr, int fd) {
-    pthread_mutex_lock(&cr->mutex);
+    prof_lock(&cr->mutex, &lock_registry);
 
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (cr->client_fds[i] == fd) {
-            cr->client_fds[i] = -1;
-            cr->count--;
-            debug("creg_unregister: Unregistered fd=%d (count=%d)", fd, cr->count);
-            break;
-        }
+    if (fd < 0 || fd >= cr->slot_cap || cr->slot_of[fd] == -1) {
+        debug("creg_unregister: fd=%d is not registered", fd);
+        prof_unlock(&cr->mutex);
+        return;
     }
 
+    // Move the last registered fd into the vacated slot
+    int slot = cr->slot_of[fd];
+    int last = cr->fds[--cr->count];
+    cr->fds[slot] = last;
+    cr->slot_of[last] = slot;
+    cr->slot_of[fd] = -1;
+    debug("creg_unregister: Unregistered fd=%d (count=%d)", fd, cr->count);
+
     if (cr->count == 0) {
         debug("creg_unregister: No more clients connected, signaling empty.");
-        sem_post(&cr->empty);
+        pthread_cond_broadcast(&cr->empty);
     }
 
-    pthread_mutex_unlock(&cr->mutex);
+    prof_unlock(&cr->mutex);
+}
+
+/**
+ * Get the number of registered clients.
+ *
+ * @param cr Pointer to the client registry.
+ * @return The current client count.
+ */
+int creg_count(CLIENT_REGISTRY *cr) {
+    prof_lock(&cr->mutex, &lock_registry);
+    int count = cr->count;
+    prof_unlock(&cr->mutex);
+    return count;
+}
+
+/**
+ * Call a function for every registered client, with the registry locked.
+ *
+ * @param cr   Pointer to the client registry.
+ * @param func Function called with each fd and arg.
+ * @param arg  Passed through to func.
+ */
+void creg_foreach(CLIENT_REGISTRY *cr, void (*func)(int fd, void *arg), void *arg) {
+    prof_lock(&cr->mutex, &lock_registry);
+    for (int i = 0; i < cr->count; i++) {
+        func(cr->fds[i], arg);
+    }
+    prof_unlock(&cr->mutex);
 }
 
 /**
@@ -143,35 +252,41 @@ void creg_unregister(CLIENT_REGISTRY *cr, int fd) {
  */
 void creg_wait_for_empty(CLIENT_REGISTRY *cr) {
     pthread_mutex_lock(&cr->mutex);
-    int empty = (cr->count == 0);
-    pthread_mutex_unlock(&cr->mutex);
-
-    if (!empty) {
+    if (cr->count > 0) {
         debug("creg_wait_for_empty: Waiting for all clients to disconnect...");
-        sem_wait(&cr->empty);  // Will block until creg_unregister posts to the semaphore
+        while (cr->count > 0) {
+            pthread_cond_wait(&cr->empty, &cr->mutex);  // Woken by creg_unregister
+        }
         debug("creg_wait_for_empty: All clients have disconnected.");
     } else {
         debug("creg_wait_for_empty: No clients connected, skipping wait.");
     }
+    pthread_mutex_unlock(&cr->mutex);
+}
+
+/**
+ * Shut down the read side of one client connection (creg_foreach callback).
+ */
+static void shutdown_client(int fd, void *arg __attribute__((unused))) {
+    debug("creg_shutdown_all: Shutting down fd=%d", fd);
+    shutdown(fd, SHUT_RD);  // Disable read-side of the connection
 }
 
 /**
  * Gracefully shut down all active clients.
  * This will "cut off" incoming communication from every client socket.
  * Each client thread will detect the shutdown and begin exiting.
+ * The registry is closed at the same time, so a client that had not yet
+ * registered is turned away instead of being left running.
  *
  * @param cr Pointer to the client registry.
  */
 void creg_shutdown_all(CLIENT_REGISTRY *cr) {
-    pthread_mutex_lock(&cr->mutex);
-
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (cr->client_fds[i] != -1) {
-            debug("creg_shutdown_all: Shutting down fd=%d", cr->client_fds[i]);
-            shutdown(cr->client_fds[i], SHUT_RD);  // Disable read-side of the connection
-        }
+    prof_lock(&cr->mutex, &lock_registry);
+    cr->closed = 1;
+    for (int i = 0; i < cr->count; i++) {
+        shutdown_client(cr->fds[i], NULL);
     }
-
-    pthread_mutex_unlock(&cr->mutex);
+    prof_unlock(&cr->mutex);
     debug("creg_shutdown_all: All client fds shut down.");
 }
@@ -0,0 +1,233 @@
+/**
+ * @file epoch.c
+ * @brief Epoch-based reclamation.
+ *
+ * Every thread that reads or retires gets a record, found through a
+ * thread-local pointer, holding its state and its list of retired objects.
+ * The state is the epoch the thread observed when it last entered a
+ * critical section, shifted left by one, with the low bit set while it is
+ * inside.  Records are never freed: the record of a thread that exits is
+ * marked unused and taken over by the next new thread, so the list of
+ * records that an advance scans grows only to the most threads that have
+ * existed at once.
+ *
+ * Every EPOCH_SCAN_INTERVAL retires, a thread tries to advance the epoch
+ * and frees what it retired at least two epochs ago.  A thread for which
+ * no record can be allocated still works: while it reads, the epoch is
+ * held back, and what it retires goes straight to the list of orphans.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "epoch.h"
+#include "debug.h"
+
+/// Retires between attempts to advance the epoch and free objects.
+#define EPOCH_SCAN_INTERVAL 32
+
+/**
+ * @struct epoch_record
+ * @brief Reclamation state of one thread.
+ */
+typedef struct epoch_record {
+    atomic_ulong state;              /**< (observed epoch << 1) | inside a critical section. */
+    int nest;                        /**< Depth of nested critical sections. */
+    EPOCH_ENTRY *head, *tail;        /**< Retired objects, oldest first. */
+    unsigned retires;                /**< Retires since the last scan. */
+    atomic_int in_use;               /**< Owned by a live thread. */
+    struct epoch_record *next;       /**< Next record; the list only grows. */
+} EPOCH_RECORD;
+
+static atomic_ulong global_epoch = 1;
+static _Atomic(EPOCH_RECORD *) records = NULL;
+static atomic_int unregistered_readers = 0;   // Critical sections of threads without a record
+static atomic_ulong retired = 0, freed = 0;
+static atomic_int nrecords = 0;
+
+// Objects left by threads that exited or had no record
+static pthread_mutex_t orphan_mutex = PTHREAD_MUTEX_INITIALIZER;
+static _Atomic(EPOCH_ENTRY *) orphans = NULL;   // Changed only under orphan_mutex
+
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t record_key;
+static __thread EPOCH_RECORD *self = NULL;
+static __thread int unregistered_nest = 0;
+
+/**
+ * @brief Move a list of retired objects to the orphans.
+ */
+static void epoch_orphan(EPOCH_ENTRY *head, EPOCH_ENTRY *tail) {
+    if (!head) return;
+    pthread_mutex_lock(&orphan_mutex);
+    tail->next = atomic_load_explicit(&orphans, memory_order_relaxed);
+    atomic_store_explicit(&orphans, head, memory_order_relaxed);
+    pthread_mutex_unlock(&orphan_mutex);
+}
+
+/**
+ * @brief Give up the record of an exiting thread.
+ * @param arg The record.
+ */
+static void epoch_thread_exit(void *arg) {
+    EPOCH_RECORD *r = arg;
+    atomic_store(&r->state, 0);
+    r->nest = 0;
+    epoch_orphan(r->head, r->tail);
+    r->head = r->tail = NULL;
+    r->retires = 0;
+    atomic_store_explicit(&r->in_use, 0, memory_order_release);
+}
+
+/**
+ * @brief Create the key whose destructor gives up a thread's record.
+ */
+static void epoch_make_key(void) {
+    pthread_key_create(&record_key, epoch_thread_exit);
+}
+
+/**
+ * @brief Get the calling thread's record, taking over an unused one or
+ * allocating one on first use.
+ * @return The record, or NULL if memory is exhausted.
+ */
+static EPOCH_RECORD *epoch_self(void) {
+    if (self) return self;
+    pthread_once(&key_once, epoch_make_key);
+
+    EPOCH_RECORD *r;
+    for (r = atomic_load(&records); r; r = r->next) {
+        int unused = 0;
+        if (atomic_compare_exchange_strong(&r->in_use, &unused, 1)) break;
+    }
+    if (!r) {
+        if (!(r = calloc(1, sizeof(EPOCH_RECORD)))) {
+            error("epoch_self: Memory allocation failed");
+            return NULL;
+        }
+        atomic_init(&r->in_use, 1);
+        r->next = atomic_load(&records);
+        while (!atomic_compare_exchange_weak(&records, &r->next, r))
+            ;
+        atomic_fetch_add(&nrecords, 1);
+    }
+    pthread_setspecific(record_key, r);
+    return self = r;
+}
+
+void epoch_enter(void) {
+    EPOCH_RECORD *r = epoch_self();
+    if (!r) {
+        if (unregistered_nest++ == 0) atomic_fetch_add(&unregistered_readers, 1);
+        return;
+    }
+    if (r->nest++ > 0) return;
+    // Loads of shared pointers after this store cannot be reordered before
+    // it, so an advance either sees this thread inside or the thread sees
+    // the objects' replacements
+    atomic_store(&r->state, atomic_load(&global_epoch) << 1 | 1);
+}
+
+void epoch_exit(void) {
+    EPOCH_RECORD *r = self;
+    if (!r) {
+        if (--unregistered_nest == 0) atomic_fetch_sub(&unregistered_readers, 1);
+        return;
+    }
+    if (--r->nest > 0) return;
+    atomic_store_explicit(&r->state, atomic_load_explicit(&r->state, memory_order_relaxed) & ~1UL,
+                          memory_order_release);
+}
+
+/**
+ * @brief Advance the global epoch if every thread inside a critical
+ * section has observed it.
+ * @return The global epoch.
+ */
+static unsigned long epoch_try_advance(void) {
+    unsigned long e = atomic_load(&global_epoch);
+    if (atomic_load(&unregistered_readers) > 0) return e;
+    for (EPOCH_RECORD *r = atomic_load(&records); r; r = r->next) {
+        unsigned long s = atomic_load(&r->state);
+        if ((s & 1) && (s >> 1) != e) return e;
+    }
+    if (atomic_compare_exchange_strong(&global_epoch, &e, e + 1)) e++;
+    return e;
+}
+
+/**
+ * @brief Free the objects of a list that were retired at least two epochs
+ * before the given one.
+ * @param listp The list, which is updated.
+ * @param epoch Current global epoch.
+ */
+static void epoch_free_list(EPOCH_ENTRY **listp, unsigned long epoch) {
+    unsigned long n = 0;
+    while (*listp) {
+        EPOCH_ENTRY *e = *listp;
+        if (e->epoch + 2 > epoch) {
+            listp = &e->next;
+            continue;
+        }
+        *listp = e->next;
+        e->free_fn(e);
+        n++;
+    }
+    if (n) atomic_fetch_add_explicit(&freed, n, memory_order_relaxed);
+}
+
+/**
+ * @brief Try to advance the epoch, and free what has become unreachable:
+ * the calling thread's objects and, if no other thread is at it, orphans.
+ */
+static void epoch_scan(EPOCH_RECORD *r) {
+    unsigned long epoch = epoch_try_advance();
+
+    // The list is in retire order, so stop at the first object still in use
+    unsigned long n = 0;
+    while (r->head && r->head->epoch + 2 <= epoch) {
+        EPOCH_ENTRY *e = r->head;
+        r->head = e->next;
+        e->free_fn(e);
+        n++;
+    }
+    if (!r->head) r->tail = NULL;
+    if (n) atomic_fetch_add_explicit(&freed, n, memory_order_relaxed);
+
+    // A peek without the lock, so that scans usually skip it
+    if (atomic_load_explicit(&orphans, memory_order_relaxed) && pthread_mutex_trylock(&orphan_mutex) == 0) {
+        EPOCH_ENTRY *list = atomic_load_explicit(&orphans, memory_order_relaxed);
+        epoch_free_list(&list, epoch);
+        atomic_store_explicit(&orphans, list, memory_order_relaxed);
+        pthread_mutex_unlock(&orphan_mutex);
+    }
+}
+
+void epoch_retire(EPOCH_ENTRY *entry, EPOCH_FREE_FN *free_fn) {
+    entry->free_fn = free_fn;
+    entry->next = NULL;
+    entry->epoch = atomic_load(&global_epoch);
+    atomic_fetch_add_explicit(&retired, 1, memory_order_relaxed);
+
+    EPOCH_RECORD *r = epoch_self();
+    if (!r) {
+        epoch_orphan(entry, entry);
+        return;
+    }
+    if (r->tail) r->tail->next = entry;
+    else r->head = entry;
+    r->tail = entry;
+
+    if (++r->retires >= EPOCH_SCAN_INTERVAL) {
+        r->retires = 0;
+        epoch_scan(r);
+    }
+}
+
+int epoch_report(char *buf, size_t len) {
+    unsigned long r = atomic_load(&retired), f = atomic_load(&freed);
+    return snprintf(buf, len, "epoch %lu retired %lu freed %lu pending %lu threads %d\n",
+                    atomic_load(&global_epoch), r, f, r > f ? r - f : 0, atomic_load(&nrecords));
+}
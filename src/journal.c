@@ -0,0 +1,118 @@
+/**
+ * @file journal.c
+ * @brief Inbound packet journal.
+ *
+ * Records are appended through a stdio stream with a large buffer, under a
+ * mutex, so that records of different connections are never interleaved
+ * and the file stays in time order.  Outbound packets are counted per file
+ * descriptor in a table allocated when the journal is started; a
+ * connection's counts are cleared when it is opened and written out in its
+ * close record.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "journal.h"
+#include "client_registry_ext.h"
+#include "stats.h"
+#include "debug.h"
+
+/// Size of the journal's stdio buffer.
+#define JOURNAL_BUFFER (1 << 20)
+
+/// File descriptors below this have outbound counters.
+#define JOURNAL_MAX_FDS (CREG_MAX_CLIENTS + 256)
+
+atomic_int journal_enabled = 0;
+
+static FILE *journal_file = NULL;
+static pthread_mutex_t journal_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t journal_start;
+static atomic_uint next_conn = 1;
+static atomic_uint (*out_counts)[JOURNAL_OUT_TYPES];  // Indexed by fd, then type
+
+/**
+ * @brief Append a record and its payload to the journal.
+ */
+static void journal_append(JOURNAL_RECORD *rec, const void *data) {
+    pthread_mutex_lock(&journal_mutex);
+    if (journal_file) {
+        rec->ts = stats_now() - journal_start;
+        fwrite(rec, sizeof(*rec), 1, journal_file);
+        if (rec->size) fwrite(data, rec->size, 1, journal_file);
+    }
+    pthread_mutex_unlock(&journal_mutex);
+}
+
+int journal_init(const char *path) {
+    out_counts = calloc(JOURNAL_MAX_FDS, sizeof(*out_counts));
+    journal_file = fopen(path, "wb");
+    if (!out_counts || !journal_file) {
+        error("journal_init: Cannot create journal %s", path);
+        if (journal_file) fclose(journal_file);
+        journal_file = NULL;
+        free(out_counts);
+        return -1;
+    }
+    setvbuf(journal_file, NULL, _IOFBF, JOURNAL_BUFFER);
+
+    JOURNAL_HEADER header = { .version = JOURNAL_VERSION, .record_size = sizeof(JOURNAL_RECORD) };
+    memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+    fwrite(&header, sizeof(header), 1, journal_file);
+
+    journal_start = stats_now();
+    atomic_store(&journal_enabled, 1);
+    debug("journal_init: Journaling to %s", path);
+    return 0;
+}
+
+void journal_fini(void) {
+    if (!atomic_exchange(&journal_enabled, 0)) return;
+
+    pthread_mutex_lock(&journal_mutex);
+    fclose(journal_file);
+    journal_file = NULL;
+    pthread_mutex_unlock(&journal_mutex);
+    debug("journal_fini: Journal closed");
+}
+
+uint32_t journal_open(int fd) {
+    if (!atomic_load_explicit(&journal_enabled, memory_order_relaxed)) return 0;
+
+    if (fd >= 0 && fd < JOURNAL_MAX_FDS)
+        for (int t = 0; t < JOURNAL_OUT_TYPES; t++) atomic_store(&out_counts[fd][t], 0);
+
+    JOURNAL_RECORD rec = { .conn = atomic_fetch_add(&next_conn, 1), .kind = JOURNAL_OPEN };
+    journal_append(&rec, NULL);
+    return rec.conn;
+}
+
+void journal_packet(uint32_t conn, MZW_PACKET *pkt, void *data) {
+    if (!conn || !atomic_load_explicit(&journal_enabled, memory_order_relaxed)) return;
+
+    JOURNAL_RECORD rec = {
+        .conn = conn, .kind = JOURNAL_PACKET, .type = pkt->type,
+        .param1 = pkt->param1, .param2 = pkt->param2, .param3 = pkt->param3,
+        .size = data ? pkt->size : 0
+    };
+    journal_append(&rec, data);
+}
+
+void journal_close(uint32_t conn, int fd) {
+    if (!conn || !atomic_load_explicit(&journal_enabled, memory_order_relaxed)) return;
+
+    uint32_t counts[JOURNAL_OUT_TYPES] = { 0 };
+    if (fd >= 0 && fd < JOURNAL_MAX_FDS)
+        for (int t = 0; t < JOURNAL_OUT_TYPES; t++) counts[t] = atomic_load(&out_counts[fd][t]);
+
+    JOURNAL_RECORD rec = { .conn = conn, .kind = JOURNAL_CLOSE, .size = sizeof(counts) };
+    journal_append(&rec, counts);
+}
+
+void journal_count_out(int fd, int type) {
+    if (fd >= 0 && fd < JOURNAL_MAX_FDS && type >= 0 && type < JOURNAL_OUT_TYPES)
+        atomic_fetch_add_explicit(&out_counts[fd][type], 1, memory_order_relaxed);
+}
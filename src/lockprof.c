@@ -0,0 +1,206 @@
+/**
+ * @file lockprof.c
+ * @brief Lock contention profiler.
+ *
+ * Each thread keeps a small stack of the profiled locks it holds, with the
+ * time each was acquired, so that the hold time can be recorded on release.
+ * Recursive mutexes simply appear on the stack once per acquisition.
+ * Releases normally match the top of the stack, but the stack is searched
+ * from the top down so that out-of-order releases are handled too.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "lockprof.h"
+#include "trace.h"
+#include "debug.h"
+
+/// Maximum number of profiled locks a thread can hold at once.
+#define MAX_HELD 64
+
+LOCK_CLASS lock_maze = LOCK_CLASS_INIT(LOCK_ID_MAZE, "maze_region");
+LOCK_CLASS lock_table = LOCK_CLASS_INIT(LOCK_ID_TABLE, "player_table");
+LOCK_CLASS lock_scoreboard = LOCK_CLASS_INIT(LOCK_ID_SCOREBOARD, "scoreboard");
+LOCK_CLASS lock_registry = LOCK_CLASS_INIT(LOCK_ID_REGISTRY, "client_registry");
+
+/// All lock classes, indexed by ID.
+static LOCK_CLASS *const all_classes[LOCK_NCLASSES] = {
+    [LOCK_ID_MAZE] = &lock_maze,
+    [LOCK_ID_TABLE] = &lock_table,
+    [LOCK_ID_SCOREBOARD] = &lock_scoreboard,
+    [LOCK_ID_REGISTRY] = &lock_registry
+};
+
+atomic_int lockprof_mode = 0;
+__thread int lockprof_depth = 0;
+
+static LOCK_CLASS *classes = NULL;  // Registered classes (linked through next)
+static int initialized = 0;
+static int ever_enabled = 0;        // Whether there is anything to report
+static pthread_t dump_tid;
+static atomic_int dump_stop = 0;    // Set by lockprof_fini()
+
+/**
+ * @struct held_lock
+ * @brief A profiled lock held by the current thread.
+ */
+typedef struct held_lock {
+    pthread_mutex_t *mutex;
+    LOCK_CLASS *cls;
+    uint64_t acquired;
+} HELD_LOCK;
+
+static __thread HELD_LOCK held[MAX_HELD];
+
+/**
+ * @brief Create the histograms of a lock class and add it to the report.
+ */
+static int register_class(LOCK_CLASS *cls) {
+    cls->wait = histogram_create();
+    cls->hold = histogram_create();
+    if (!cls->wait || !cls->hold) return -1;
+    cls->next = classes;
+    classes = cls;
+    return 0;
+}
+
+/**
+ * @brief Dump a report on stderr each time SIGUSR2 is received, until
+ * lockprof_fini() sends the signal to stop it.
+ */
+static void *dump_thread(void *arg __attribute__((unused))) {
+    sigset_t usr2;
+    sigemptyset(&usr2);
+    sigaddset(&usr2, SIGUSR2);
+
+    char report[4096];
+    while (1) {
+        int sig;
+        if (sigwait(&usr2, &sig) != 0) continue;
+        if (atomic_load(&dump_stop)) break;
+        lockprof_report(report, sizeof(report));
+        fputs(report, stderr);
+    }
+    return NULL;
+}
+
+int lockprof_init(int enable) {
+    for (int i = LOCK_NCLASSES - 1; i >= 0; i--) {
+        if (register_class(all_classes[i]) != 0) {
+            error("lockprof_init: Failed to create histograms for %s", all_classes[i]->name);
+            return -1;
+        }
+    }
+
+    if (pthread_create(&dump_tid, NULL, dump_thread, NULL) != 0) {
+        error("lockprof_init: Failed to start dump thread");
+        return -1;
+    }
+
+    initialized = 1;
+    lockprof_enable(enable);
+    return 0;
+}
+
+void lockprof_fini(void) {
+    if (!initialized) return;
+    atomic_store(&dump_stop, 1);
+    pthread_kill(dump_tid, SIGUSR2);
+    pthread_join(dump_tid, NULL);
+    initialized = 0;
+}
+
+void lockprof_enable(int enable) {
+    if (!initialized) return;
+    if (enable) {
+        ever_enabled = 1;
+        atomic_fetch_or(&lockprof_mode, LOCKPROF_PROFILE);
+    } else {
+        atomic_fetch_and(&lockprof_mode, ~LOCKPROF_PROFILE);
+    }
+    debug("lockprof_enable: Lock profiling %s", enable ? "enabled" : "disabled");
+}
+
+void lockprof_trace(int enable) {
+    if (enable)
+        atomic_fetch_or(&lockprof_mode, LOCKPROF_TRACE);
+    else
+        atomic_fetch_and(&lockprof_mode, ~LOCKPROF_TRACE);
+}
+
+const char *lockprof_class_name(int id) {
+    return (id >= 0 && id < LOCK_NCLASSES) ? all_classes[id]->name : NULL;
+}
+
+void lockprof_lock(pthread_mutex_t *mutex, LOCK_CLASS *cls) {
+    int mode = atomic_load_explicit(&lockprof_mode, memory_order_relaxed);
+    uint64_t acquired, waited = 0;
+    if (pthread_mutex_trylock(mutex) == 0) {
+        acquired = stats_now();
+    } else {
+        uint64_t start = stats_now();
+        pthread_mutex_lock(mutex);
+        acquired = stats_now();
+        waited = acquired - start;
+        if (mode & LOCKPROF_PROFILE)
+            atomic_fetch_add_explicit(&cls->contended, 1, memory_order_relaxed);
+    }
+
+    if (mode & LOCKPROF_TRACE)
+        trace_emit(TRACE_LOCK_ACQUIRED, cls->id, waited > UINT32_MAX ? UINT32_MAX : (uint32_t)waited);
+    if (!(mode & LOCKPROF_PROFILE)) return;
+
+    histogram_record(cls->wait, waited);
+    atomic_fetch_add_explicit(&cls->acquisitions, 1, memory_order_relaxed);
+
+    if (lockprof_depth < MAX_HELD) {
+        held[lockprof_depth].mutex = mutex;
+        held[lockprof_depth].cls = cls;
+        held[lockprof_depth].acquired = acquired;
+        lockprof_depth++;
+    }
+}
+
+void lockprof_unlock(pthread_mutex_t *mutex) {
+    for (int i = lockprof_depth - 1; i >= 0; i--) {
+        if (held[i].mutex == mutex) {
+            histogram_record(held[i].cls->hold, stats_now() - held[i].acquired);
+            held[i] = held[--lockprof_depth];
+            break;
+        }
+    }
+    pthread_mutex_unlock(mutex);
+}
+
+int lockprof_report(char *buf, size_t len) {
+    size_t n = 0;
+#define EMIT(...) do { \
+        int w = snprintf(n < len ? buf + n : NULL, n < len ? len - n : 0, __VA_ARGS__); \
+        if (w > 0) n += w; \
+    } while (0)
+
+    if (!initialized) {
+        if (len > 0) buf[0] = '\0';
+        return 0;
+    }
+
+    EMIT("lock_profiling %s\n", (atomic_load(&lockprof_mode) & LOCKPROF_PROFILE) ? "on" : "off");
+    if (!ever_enabled) return (int)n;
+    EMIT("%-16s %10s %10s %12s %12s %12s %12s %12s %12s %12s %12s\n", "lock", "acquired", "contended",
+         "wait_p50_us", "wait_p99_us", "wait_p999_us", "wait_max_us",
+         "hold_p50_us", "hold_p99_us", "hold_p999_us", "hold_max_us");
+    for (LOCK_CLASS *cls = classes; cls; cls = cls->next) {
+        uint64_t w50, w99, w999, wmax, h50, h99, h999, hmax;
+        histogram_summary(cls->wait, &w50, &w99, &w999, &wmax);
+        histogram_summary(cls->hold, &h50, &h99, &h999, &hmax);
+        EMIT("%-16s %10lu %10lu %12.1f %12.1f %12.1f %12.1f %12.1f %12.1f %12.1f %12.1f\n", cls->name,
+             atomic_load(&cls->acquisitions), atomic_load(&cls->contended),
+             w50 / 1e3, w99 / 1e3, w999 / 1e3, wmax / 1e3,
+             h50 / 1e3, h99 / 1e3, h999 / 1e3, hmax / 1e3);
+    }
+#undef EMIT
+    return (int)n;
+}
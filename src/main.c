@@ -9,30 +9,58 @@
  * Responsibilities:
  * - Parse command-line arguments.
  * - Load maze template from file or use default.
- * - Initialize modules: client registry, maze, player.
- * - Create TCP socket and accept incoming clients.
- * - Spawn a thread per client using mzw_client_service().
+ * - Initialize modules: client registry, maze, player, rooms.
+ * - Create the listening socket(s) and accept incoming clients, with one
+ *   accept thread per listener.
+ * - Hand each client to a pool of service threads with bounded stacks,
+ *   and report what each connection costs in memory.
  * - Handle SIGHUP to shut down cleanly.
  */
 
+#define _GNU_SOURCE  // accept4
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
 #include <signal.h>
 #include <pthread.h>
+#include <time.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/resource.h>
 #include <arpa/inet.h>
 
 #include "client_registry.h"
+#include "client_registry_ext.h"
 #include "maze.h"
+#include "maze_ext.h"
+#include "maze_gen.h"
 #include "player.h"
+#include "protocol_ext.h"
+#include "room.h"
+#include "admission.h"
+#include "stats.h"
+#include "lockprof.h"
+#include "trace.h"
+#include "journal.h"
+#include "svc_thread.h"
+#include "svc_pool.h"
+#include "task_sched.h"
+#include "slab.h"
+#include "epoch.h"
+#include "player_ext.h"
 #include "debug.h"
 #include "server.h"
 
 static void terminate(int status);
 static void handle_sighup(int sig);
+static int open_listener(int port, int backlog, int reuseport);
+static void *accept_loop(void *arg);
+
+/// Maximum number of listening sockets (-L).
+#define MAX_LISTENERS 64
 
 extern CLIENT_REGISTRY *client_registry;
 
@@ -48,14 +76,34 @@ static char *default_maze[] = {
     NULL
 };
 
-static int listenfd;  // Listening socket for the server
+static int listenfds[MAX_LISTENERS];  // Listening sockets for the server
+static int num_listeners = 0;
+static pthread_t accept_tids[MAX_LISTENERS];  // Accept thread of each listener
+static int num_accept_threads = 0;
 
 int main(int argc, char *argv[]) {
     int opt, port = -1;
     char *template_file = NULL;
+    MZW_CLOCK_MODE clock_mode = MZW_CLOCK_PRECISE;
+    int num_rooms = 1, pin_rooms = 0, region_size = 0;
+    char *gen_spec = NULL;
+    unsigned long gen_seed = 1, place_seed = 0;
+    int place_seeded = 0;
+    int max_sessions = 0, accept_rate = 0, backlog = SOMAXCONN, listeners = 1;
+    int stats_port = 0, lock_profiling = 0;
+    char *trace_file = NULL, *journal_file = NULL;
+    size_t stack_kb = 0, guard_kb = 0;
+    int pool_min = SVC_POOL_MIN_DEFAULT, pool_max = 0;
+    int sched_workers = 0;
 
-    // Parse command-line arguments: -p <port> [-t <template_file>]
-    while ((opt = getopt(argc, argv, "p:t:")) != -1) {
+    // Parse command-line arguments:
+    //   -p <port> [-t <template_file> | -g <kind>:<rows>x<cols>[:<density>] [-S <seed>]]
+    //   [-c precise|coarse] [-n <rooms>] [-a] [-R <region_size>]
+    //   [-M <max_sessions>] [-A <accepts_per_sec>] [-B <backlog>] [-L <listeners>]
+    //   [-s <stats_port>] [-P] [-T <trace_file>] [-J <journal_file>] [-r <placement_seed>]
+    //   [-k <stack_kb>[:<guard_kb>]] [-w <min_workers>[:<max_workers>]]
+    //   [-E <sched_workers>]
+    while ((opt = getopt(argc, argv, "p:t:g:S:c:n:aR:M:A:B:L:s:PT:J:r:k:w:E:")) != -1) {
         switch (opt) {
             case 'p':
                 port = atoi(optarg);
@@ -63,8 +111,129 @@ int main(int argc, char *argv[]) {
             case 't':
                 template_file = optarg;
                 break;
+            case 'g':
+                gen_spec = optarg;
+                break;
+            case 'S':
+                gen_seed = strtoul(optarg, NULL, 0);
+                break;
+            case 'c':
+                if (strcmp(optarg, "precise") == 0) {
+                    clock_mode = MZW_CLOCK_PRECISE;
+                } else if (strcmp(optarg, "coarse") == 0) {
+                    clock_mode = MZW_CLOCK_COARSE;
+                } else {
+                    fprintf(stderr, "Error: Unknown clock '%s' (expected precise or coarse)\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'n':
+                num_rooms = atoi(optarg);
+                if (num_rooms < 1 || num_rooms > MAX_ROOMS) {
+                    fprintf(stderr, "Error: Number of rooms must be between 1 and %d\n", MAX_ROOMS);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'a':
+                pin_rooms = 1;
+                break;
+            case 'R':
+                region_size = atoi(optarg);
+                if (region_size < 0) {
+                    fprintf(stderr, "Error: Region size must be non-negative\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'M':
+                max_sessions = atoi(optarg);
+                if (max_sessions < 0 || max_sessions > CREG_MAX_CLIENTS) {
+                    fprintf(stderr, "Error: Maximum sessions must be between 0 and %d\n",
+                            CREG_MAX_CLIENTS);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'A':
+                accept_rate = atoi(optarg);
+                if (accept_rate < 0) {
+                    fprintf(stderr, "Error: Accept rate must be non-negative\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'B':
+                backlog = atoi(optarg);
+                if (backlog < 1) {
+                    fprintf(stderr, "Error: Listen backlog must be positive\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'L':
+                listeners = atoi(optarg);
+                if (listeners < 1 || listeners > MAX_LISTENERS) {
+                    fprintf(stderr, "Error: Number of listeners must be between 1 and %d\n",
+                            MAX_LISTENERS);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 's':
+                stats_port = atoi(optarg);
+                if (stats_port <= 0) {
+                    fprintf(stderr, "Error: Invalid stats port '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'P':
+                lock_profiling = 1;
+                break;
+            case 'T':
+                trace_file = optarg;
+                break;
+            case 'J':
+                journal_file = optarg;
+                break;
+            case 'r':
+                place_seed = strtoul(optarg, NULL, 0);
+                place_seeded = 1;
+                break;
+            case 'k': {
+                char *end;
+                stack_kb = strtoul(optarg, &end, 10);
+                if (*end == ':') guard_kb = strtoul(end + 1, &end, 10);
+                if (*end != '\0' || stack_kb == 0) {
+                    fprintf(stderr, "Error: Invalid thread stack spec '%s' "
+                            "(expected <stack_kb>[:<guard_kb>])\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            }
+            case 'w': {
+                char *end;
+                pool_min = strtol(optarg, &end, 10);
+                pool_max = 0;
+                if (*end == ':') pool_max = strtol(end + 1, &end, 10);
+                if (*end != '\0' || pool_min < 0 || pool_max < 0 ||
+                    (pool_max > 0 && pool_max < pool_min)) {
+                    fprintf(stderr, "Error: Invalid worker spec '%s' "
+                            "(expected <min_workers>[:<max_workers>], min <= max)\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            }
+            case 'E':
+                sched_workers = atoi(optarg);
+                if (sched_workers < 0) {
+                    fprintf(stderr, "Error: Number of scheduler workers must be non-negative\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
             default:
-                fprintf(stderr, "Usage: %s -p <port> [-t <template_file>]\n", argv[0]);
+                fprintf(stderr, "Usage: %s -p <port> [-t <template_file> | "
+                        "-g <kind>:<rows>x<cols>[:<density>] [-S <seed>]] [-c precise|coarse] "
+                        "[-n <rooms>] [-a] [-R <region_size>] "
+                        "[-M <max_sessions>] [-A <accepts_per_sec>] [-B <backlog>] "
+                        "[-L <listeners>] [-s <stats_port>] [-P] [-T <trace_file>] "
+                        "[-J <journal_file>] [-r <placement_seed>] "
+                        "[-k <stack_kb>[:<guard_kb>]] [-w <min_workers>[:<max_workers>]] "
+                        "[-E <sched_workers>]\n", argv[0]);
                 exit(EXIT_FAILURE);
         }
     }
@@ -74,6 +243,24 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
+    if (template_file && gen_spec) {
+        fprintf(stderr, "Error: -t and -g cannot be used together\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (proto_set_clock_mode(clock_mode) != 0) {
+        fprintf(stderr, "Error: Requested packet clock is not supported on this system\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // SIGUSR2 requests a lock profile dump; it is accepted only by the
+    // profiler's own thread, so it must be blocked before any other thread
+    // exists, and all threads inherit the mask.
+    sigset_t usr2;
+    sigemptyset(&usr2);
+    sigaddset(&usr2, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &usr2, NULL);
+
     // Install SIGHUP handler to trigger graceful shutdown
     struct sigaction sa;
     sa.sa_handler = handle_sighup;
@@ -81,50 +268,175 @@ int main(int argc, char *argv[]) {
     sa.sa_flags = 0;
     sigaction(SIGHUP, &sa, NULL);
 
+    // A client that disconnects mid-write must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    // Allow as many open connections as the client registry can track
+    struct rlimit nofile;
+    if (getrlimit(RLIMIT_NOFILE, &nofile) == 0 && nofile.rlim_cur < nofile.rlim_max) {
+        rlim_t want = CREG_MAX_CLIENTS + 256;  // Headroom for listeners, templates, logs
+        nofile.rlim_cur = (nofile.rlim_max == RLIM_INFINITY || nofile.rlim_max > want)
+                          ? want : nofile.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &nofile);
+    }
+
     // Initialize global modules
     client_registry = creg_init();
+    admission_init(max_sessions, accept_rate);
+    stats_init();
+    // Allocators, service workers and view batches, after the packet stats
+    stats_add_report(slab_report);
+    stats_add_report(epoch_report);
+    stats_add_report(svc_pool_report);
+    stats_add_report(task_sched_report);
+    stats_add_report(player_view_report);
+    maze_set_region_size(region_size);
+    if (place_seeded) maze_set_seed(place_seed);
 
     if (template_file) {
-        FILE *fp = fopen(template_file, "r");
-        if (!fp) {
-            perror("Error opening maze template");
+        struct timespec start, stop;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (maze_init_file(template_file) != 0) {
+            fprintf(stderr, "Error: Failed to load maze template %s\n", template_file);
             exit(EXIT_FAILURE);
         }
-
-        char **lines = calloc(64, sizeof(char *));
-        size_t cap = 64, len = 0;
-        char buffer[256];
-
-        while (fgets(buffer, sizeof(buffer), fp)) {
-            buffer[strcspn(buffer, "\n")] = '\0';  // Strip newline
-            lines[len++] = strdup(buffer);
-            if (len >= cap) {
-                cap *= 2;
-                lines = realloc(lines, cap * sizeof(char *));
-            }
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        double ms = (stop.tv_sec - start.tv_sec) * 1e3 + (stop.tv_nsec - start.tv_nsec) / 1e6;
+        fprintf(stderr, "Loaded maze template %s (%d x %d) in %.3f ms\n",
+                template_file, maze_get_rows(), maze_get_cols(), ms);
+    } else if (gen_spec) {
+        // -g <kind>:<rows>x<cols>[:<density>], density defaulting per kind
+        char kind_name[16];
+        int rows, cols, density = -1;
+        MAZE_GEN_KIND kind;
+        if (sscanf(gen_spec, "%15[a-z]:%dx%d:%d", kind_name, &rows, &cols, &density) < 3 ||
+            maze_gen_parse_kind(kind_name, &kind) != 0) {
+            fprintf(stderr, "Error: Invalid maze spec '%s' "
+                    "(expected perfect|cavern|arena:<rows>x<cols>[:<density>])\n", gen_spec);
+            exit(EXIT_FAILURE);
         }
-        lines[len] = NULL;
-        fclose(fp);
+        if (density < 0) density = (kind == MAZE_GEN_CAVERN) ? 45 : (kind == MAZE_GEN_ARENA) ? 10 : 0;
 
+        struct timespec start, stop;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        char **lines = maze_generate(kind, rows, cols, density, gen_seed);
+        if (!lines) {
+            fprintf(stderr, "Error: Failed to generate %s maze of %d x %d (density %d)\n",
+                    kind_name, rows, cols, density);
+            exit(EXIT_FAILURE);
+        }
         maze_init(lines);
-        for (size_t i = 0; i < len; i++) free(lines[i]);
-        free(lines);
+        maze_gen_free(lines);
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        double ms = (stop.tv_sec - start.tv_sec) * 1e3 + (stop.tv_nsec - start.tv_nsec) / 1e6;
+        fprintf(stderr, "Generated %s maze (%d x %d, density %d, seed %lu) in %.3f ms\n",
+                kind_name, rows, cols, density, gen_seed, ms);
     } else {
         maze_init(default_maze);
     }
 
     player_init();
+    if (room_init(num_rooms, pin_rooms) != 0) {
+        fprintf(stderr, "Error: Failed to create %d game rooms\n", num_rooms);
+        exit(EXIT_FAILURE);
+    }
+
+    // Size the service threads' stacks and report what a connection costs
+    if (svc_thread_init(stack_kb * 1024, guard_kb * 1024) != 0)
+        exit(EXIT_FAILURE);
+    SVC_THREAD_BUDGET budget;
+    if (svc_thread_budget(&budget, 16) == 0) {
+        fprintf(stderr, "Per-connection memory: %zu KiB stack + %zu KiB guard reserved, "
+                "%.1f KiB resident when idle, %zu KiB payload arena\n",
+                budget.stack_size / 1024, budget.guard_size / 1024,
+                budget.resident / 1024.0, budget.heap / 1024);
+        if (budget.max_by_maps > 0)
+            fprintf(stderr, "Connection limit from memory mappings: %ld\n", budget.max_by_maps);
+        if (budget.max_by_as > 0)
+            fprintf(stderr, "Connection limit from address space: %ld\n", budget.max_by_as);
+    }
+
     debug_show_maze = 1;  // Enable maze display after each action (DEBUG mode)
 
-    // Create listening socket
-    listenfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (listenfd < 0) {
-        perror("socket");
+    // Create the listening sockets.  With more than one, each is bound to
+    // the same port with SO_REUSEPORT and the kernel spreads incoming
+    // connections across them.
+    for (int i = 0; i < listeners; i++) {
+        listenfds[i] = open_listener(port, backlog, listeners > 1);
+        if (listenfds[i] < 0) exit(EXIT_FAILURE);
+        num_listeners++;
+    }
+
+    // Run one accept thread per listener, the service and scheduler workers,
+    // and the profiling, tracing and stats threads.  They (and the workers created
+    // later by the accept threads) block SIGHUP, so that it is always handled here, by a thread
+    // that is not itself waited for during termination.
+    sigset_t hup, saved;
+    sigemptyset(&hup);
+    sigaddset(&hup, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &hup, &saved);
+    if (lockprof_init(lock_profiling) != 0) {
+        fprintf(stderr, "Error: Failed to initialize lock profiling\n");
+        exit(EXIT_FAILURE);
+    }
+    if (trace_file && trace_init(trace_file) != 0) {
+        fprintf(stderr, "Error: Failed to start tracing to %s\n", trace_file);
+        exit(EXIT_FAILURE);
+    }
+    if (journal_file && journal_init(journal_file) != 0) {
+        fprintf(stderr, "Error: Failed to start journaling to %s\n", journal_file);
+        exit(EXIT_FAILURE);
+    }
+    if (task_sched_init(sched_workers) != 0) {
+        fprintf(stderr, "Error: Failed to start %d scheduler workers\n", sched_workers);
+        exit(EXIT_FAILURE);
+    }
+    if (svc_pool_init(pool_min, pool_max) != 0) {
+        fprintf(stderr, "Error: Failed to start %d service workers\n", pool_min);
+        exit(EXIT_FAILURE);
+    }
+    if (stats_port > 0 && stats_serve(stats_port) != 0) {
+        fprintf(stderr, "Error: Failed to open stats port %d\n", stats_port);
         exit(EXIT_FAILURE);
     }
+    for (int i = 0; i < num_listeners; i++) {
+        if (pthread_create(&accept_tids[i], NULL, accept_loop, &listenfds[i]) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+        num_accept_threads++;
+    }
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+    while (1) {
+        pause();  // Wait for SIGHUP
+    }
+
+    // Should never reach here
+    terminate(EXIT_SUCCESS);
+}
+
+/**
+ * @brief Create a listening socket bound to the given port on all interfaces.
+ * @param port      Port number.
+ * @param backlog   Listen backlog.
+ * @param reuseport Nonzero to set SO_REUSEPORT, so that several sockets can share the port.
+ * @return The socket, or -1 on error (after printing a message).
+ */
+static int open_listener(int port, int backlog, int reuseport) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
 
     int optval = 1;
-    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+    if (reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) < 0) {
+        perror("setsockopt(SO_REUSEPORT)");
+        close(fd);
+        return -1;
+    }
 
     struct sockaddr_in addr = {
         .sin_family = AF_INET,
@@ -132,41 +444,70 @@ int main(int argc, char *argv[]) {
         .sin_addr.s_addr = INADDR_ANY
     };
 
-    if (bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
         perror("bind");
-        exit(EXIT_FAILURE);
+        close(fd);
+        return -1;
     }
 
-    if (listen(listenfd, 32) < 0) {
+    if (listen(fd, backlog) < 0) {
         perror("listen");
-        exit(EXIT_FAILURE);
+        close(fd);
+        return -1;
     }
+    return fd;
+}
 
-    // Accept client connections and spawn handler threads
-    while (1) {
-        int *clientfd = malloc(sizeof(int));
-        if (!clientfd) continue;
+/// Pause after running out of descriptors or memory: initial and longest, in ms.
+#define ACCEPT_BACKOFF_MIN_MS 10
+#define ACCEPT_BACKOFF_MAX_MS 1000
+
+/**
+ * @brief Accept client connections on one listener and hand them to service workers.
+ *
+ * Returns when the listener is shut down by terminate().  When the process
+ * runs out of descriptors or memory, the pending connection stays in the
+ * backlog, so accepting again at once would fail again at once; instead
+ * the thread pauses, for twice as long each time in a row.
+ *
+ * @param arg Pointer to the listening socket.
+ * @return NULL.
+ */
+static void *accept_loop(void *arg) {
+    int listenfd = *(int *)arg;
+    int backoff_ms = 0;
 
-        *clientfd = accept(listenfd, NULL, NULL);
-        if (*clientfd < 0) {
-            free(clientfd);
-            continue;
+    while (1) {
+        // Accepted sockets stay blocking: service threads use blocking reads
+        int clientfd = accept4(listenfd, NULL, NULL, SOCK_CLOEXEC);
+        if (clientfd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED || errno == EPROTO) continue;
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                backoff_ms = backoff_ms ? backoff_ms * 2 : ACCEPT_BACKOFF_MIN_MS;
+                if (backoff_ms > ACCEPT_BACKOFF_MAX_MS) backoff_ms = ACCEPT_BACKOFF_MAX_MS;
+                error("accept_loop: %s; pausing %d ms", strerror(errno), backoff_ms);
+                struct timespec pause = { backoff_ms / 1000, backoff_ms % 1000 * 1000000L };
+                nanosleep(&pause, NULL);
+                continue;
+            }
+            // EINVAL once terminate() has shut the listener down
+            debug("accept_loop: Listener fd=%d closed (%s)", listenfd, strerror(errno));
+            return NULL;
         }
+        backoff_ms = 0;
 
-        debug("Accepted client fd=%d", *clientfd);
+        debug("Accepted client fd=%d on listener fd=%d", clientfd, listenfd);
 
-        pthread_t tid;
-        if (pthread_create(&tid, NULL, mzw_client_service, clientfd) != 0) {
-            perror("pthread_create");
-            close(*clientfd);
-            free(clientfd);
-            continue;
+        // Turn the connection away early if the server is at capacity
+        if (admission_admit(clientfd) != 0) continue;
+
+        // Hand the connection to an idle service worker
+        if (svc_pool_submit(clientfd) != 0) {
+            close(clientfd);
+            admission_release();
         }
-        pthread_detach(tid);  // Reap thread automatically on exit
     }
-
-    // Should never reach here
-    terminate(EXIT_SUCCESS);
+    return NULL;
 }
 
 /**
@@ -184,16 +525,27 @@ static void handle_sighup(int sig) {
  * @param status The exit code to terminate the program with.
  */
 static void terminate(int status) {
-    if (listenfd > 0) close(listenfd);
+    // Closing a listener does not wake a thread blocked accepting on it;
+    // shutting it down does, and no connection is accepted afterwards
+    for (int i = 0; i < num_listeners; i++) shutdown(listenfds[i], SHUT_RDWR);
+    for (int i = 0; i < num_accept_threads; i++) pthread_join(accept_tids[i], NULL);
+    for (int i = 0; i < num_listeners; i++) close(listenfds[i]);
 
     creg_shutdown_all(client_registry);
     debug("Waiting for service threads to terminate...");
+    svc_pool_shutdown();
     creg_wait_for_empty(client_registry);
     debug("All service threads terminated.");
 
+    stats_fini();
     creg_fini(client_registry);
+    room_fini();
     player_fini();
+    task_sched_shutdown();
     maze_fini();
+    trace_fini();
+    journal_fini();
+    lockprof_fini();
 
     debug("MazeWar server terminating");
     exit(status);
@@ -1,262 +1,1301 @@
 /**
  * @file maze.c
  * @brief Thread-safe maze module for MazeWar server.
+ *
+ * Each MAZE is stored as one contiguous row-major array of 16-bit cells
+ * (see maze_ext.h): template characters below MAZE_OCCUPANT_BASE and
+ * occupant IDs above it.  Views report the display glyph of an occupant,
+ * looked up in a per-maze table indexed by occupant ID.
+ *
+ * The grid itself holds only the template and never changes once built.
+ * Occupants live in copy-on-write snapshots: a snapshot is a two-level
+ * table of TILE_SIZE x TILE_SIZE tiles, in which a tile or a row of tiles
+ * that no occupant has ever entered is NULL and reads through to the
+ * template.  A change copies the root, the rows of tiles and the tiles it
+ * touches, updates the copies and publishes the new root with a single
+ * compare-and-swap, so readers (views and laser rays) see every change,
+ * including the two halves of a move, all at once or not at all.  They
+ * take no locks: they load the root inside an epoch critical section, and
+ * the parts that a change replaces are freed by epoch-based reclamation
+ * once no reader can hold them (see epoch.h).
+ *
+ * Writers still lock the cells they check and change.  Every MAZE has its
+ * own locks, so separate mazes (e.g. separate game rooms) never contend.
+ * Within a maze, the grid is partitioned into square regions of a
+ * configurable size, each protected by its own mutex, so that changes in
+ * distant parts of a large world do not serialize; they meet only at the
+ * compare-and-swap of the root, which a change that loses retries on top
+ * of the winner's.  An operation that touches several regions locks them
+ * in ascending region index order, which keeps multi-region locking
+ * deadlock-free.  With the default region size of 0, the whole maze is
+ * one region (a single lock).
+ *
+ * The functions declared in maze.h operate on the default maze, which is
+ * the one set up by maze_init().
  */
 
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <ctype.h>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "maze.h"
+#include "maze_ext.h"
+#include "lockprof.h"
+#include "epoch.h"
 #include "debug.h"
 
-static char **maze = NULL;
-static int maze_rows = 0;
-static int maze_cols = 0;
-static pthread_mutex_t maze_mutex;
+/// Cell value stored for an occupant, and the inverse.
+#define OCCUPANT_CELL(id) ((uint16_t)(MAZE_OCCUPANT_BASE + (id)))
+#define CELL_IS_OCCUPANT(c) ((c) >= MAZE_OCCUPANT_BASE)
+#define CELL_OCCUPANT(c) ((OCCUPANT)((c) - MAZE_OCCUPANT_BASE))
+
+/// Access the template cell at (row, col) of a maze's contiguous grid.
+#define CELL(m, r, c) ((m)->cells[(size_t)(r) * (m)->cols + (c)])
+
+/// True if (r, c) lies inside maze m.
+#define IN_BOUNDS(m, r, c) ((r) >= 0 && (r) < (m)->rows && (c) >= 0 && (c) < (m)->cols)
+
+/// Region row/column containing maze row/column x.
+#define REGION_OF(m, x) ((x) / (m)->region_size)
+
+/// Side of a tile of a snapshot, in cells.
+#define TILE_SHIFT 4
+#define TILE_SIZE (1 << TILE_SHIFT)
+#define TILE_MASK (TILE_SIZE - 1)
+
+/**
+ * @struct maze_tile
+ * @brief TILE_SIZE x TILE_SIZE cells of a snapshot, row-major.
+ */
+typedef struct maze_tile {
+    EPOCH_ENTRY retire;                       /**< Must be first (see maze_free_node()). */
+    uint16_t cells[TILE_SIZE * TILE_SIZE];
+} MAZE_TILE;
+
+/**
+ * @struct maze_tile_row
+ * @brief One row of tiles of a snapshot; NULL tiles are the template's.
+ */
+typedef struct maze_tile_row {
+    EPOCH_ENTRY retire;                       /**< Must be first. */
+    MAZE_TILE *tiles[];                       /**< tile_cols tiles. */
+} MAZE_TILE_ROW;
 
 /**
- * @brief Initialize the maze from a template.
+ * @struct maze_snapshot
+ * @brief Root of a snapshot; NULL rows are the template's.  Immutable once published.
+ */
+typedef struct maze_snapshot {
+    EPOCH_ENTRY retire;                       /**< Must be first. */
+    MAZE_TILE_ROW *rows[];                    /**< tile_rows rows. */
+} MAZE_SNAPSHOT;
+
+/// Most cells changed at once (by a move).
+#define MAX_CELL_UPDATES 2
+
+/**
+ * @struct cell_update
+ * @brief A change to one cell, published by maze_publish().
+ */
+typedef struct cell_update {
+    int row, col;
+    uint16_t value;
+} CELL_UPDATE;
+
+/**
+ * @struct maze
+ * @brief State of one maze.
+ */
+struct maze {
+    uint16_t *cells;                          /**< rows * cols template cells, row-major; never changed. */
+    int rows, cols;                           /**< Dimensions. */
+    int region_size;                          /**< Side of a square lock region, in cells. */
+    int region_rows, region_cols;             /**< Number of regions down and across. */
+    pthread_mutex_t *regions;                 /**< One mutex per region, row-major. */
+    const uint32_t *spawns;                   /**< Indexes of spawnable cells, or NULL. */
+    size_t nspawns;                           /**< Number of entries in spawns. */
+    _Atomic uint64_t rng;                     /**< Placement generator state (splitmix64). */
+    void *image;                              /**< Mapping of a maze image (for its spawns), or NULL. */
+    size_t image_len;                         /**< Length of the image mapping. */
+    _Atomic(MAZE_SNAPSHOT *) snapshot;        /**< Current cells, template plus occupants. */
+    int tile_rows, tile_cols;                 /**< Number of snapshot tiles down and across. */
+    _Atomic(OBJECT) glyphs[MAZE_MAX_OCCUPANTS]; /**< Display glyph of each occupant ID. */
+};
+
+/// First bytes of a maze image file.
+#define MAZE_IMAGE_MAGIC "MZWMAZE\0"
+
+/// Version of the maze image format written by maze_save_image().
+#define MAZE_IMAGE_VERSION 2
+
+/// Most distinct template characters an image can hold (there are 33).
+#define MAZE_IMAGE_PALETTE 64
+
+/// Written as-is into images, to detect byte order mismatches.
+#define MAZE_IMAGE_BYTE_ORDER 0x01020304u
+
+/**
+ * @struct maze_image_header
+ * @brief Header at the start of a maze image file.
  *
- * This function initializes the global maze grid based on a NULL-terminated
- * array of strings (each row). It allocates internal memory, determines dimensions,
- * and sets up the maze mutex for thread-safe operations. It also seeds the
- * random number generator for future randomized placement (e.g., respawning).
+ * All fields, and the sections they describe, are in the byte order of the
+ * host that wrote the image.  Sections start at 8-byte aligned offsets:
+ *   - cells:  rows * cols cells, row-major, bit-packed at cell_bits bits
+ *             per cell, lowest bits of each byte first.  A cell holds the
+ *             index in the palette of its template character, so a maze
+ *             with one kind of wall takes one bit per cell;
+ *   - spawns: nspawns uint32_t indexes of the EMPTY cells, in row-major
+ *             order, from which random placements are drawn.
+ */
+struct maze_image_header {
+    char magic[8];           /**< MAZE_IMAGE_MAGIC. */
+    uint32_t version;        /**< MAZE_IMAGE_VERSION. */
+    uint32_t byte_order;     /**< MAZE_IMAGE_BYTE_ORDER. */
+    uint32_t rows, cols;     /**< Dimensions. */
+    uint32_t cell_bits;      /**< Bits per packed cell: 1, 2, 4 or 8. */
+    uint32_t npalette;       /**< Number of palette entries in use. */
+    uint8_t palette[MAZE_IMAGE_PALETTE]; /**< Template character of each cell value. */
+    uint64_t nspawns;        /**< Number of spawn indexes. */
+    uint64_t cells_offset;   /**< File offset of the cells section. */
+    uint64_t spawns_offset;  /**< File offset of the spawns section. */
+    uint64_t file_size;      /**< Total size of the image. */
+};
+
+/// The maze operated on by the functions in maze.h.
+static MAZE default_maze;
+
+/// Region size used for mazes built from now on; 0 = one region per maze.
+static int region_size_setting = 0;
+
+/// Seed of the placement generators, and whether it was chosen by the caller.
+static uint64_t placement_seed;
+static int placement_seeded = 0;
+
+/// Number of mazes built since the seed was set.
+static unsigned long mazes_built = 0;
+
+/// Increment of the splitmix64 generator.
+#define GOLDEN_GAMMA 0x9E3779B97F4A7C15ULL
+
+/**
+ * @brief Set the side length of lock regions for mazes created afterwards.
+ * @param size Region side in cells; 0 (or negative) makes each maze one region.
+ */
+void maze_set_region_size(int size) {
+    region_size_setting = (size > 0) ? size : 0;
+}
+
+/**
+ * @brief Set the seed of the placement generators of mazes built afterwards.
+ * @param seed Seed; the nth maze built from now on is seeded from it and n.
+ */
+void maze_set_seed(unsigned long seed) {
+    placement_seed = seed;
+    placement_seeded = 1;
+    mazes_built = 0;
+}
+
+/**
+ * @brief Draw the next value from a maze's placement generator.
  *
- * @param template A NULL-terminated array of strings representing the maze template.
+ * The state is advanced with a single atomic add, so concurrent placements
+ * never see the same value, and a single-threaded run is reproducible.
  */
-void maze_init(char **template) {
-    if (!template || !template[0]) {
-        error("maze_init: invalid or empty template");
-        return;
+static uint64_t maze_random(MAZE *maze) {
+    uint64_t z = atomic_fetch_add_explicit(&maze->rng, GOLDEN_GAMMA, memory_order_relaxed) + GOLDEN_GAMMA;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/**
+ * @brief Lock every region overlapping the rectangle [r0..r1] x [c0..c1].
+ *
+ * Regions are locked in ascending row-major index order.  Coordinates are
+ * clamped to the maze, so callers may pass a rectangle that sticks out.
+ */
+static void maze_lock_span(MAZE *maze, int r0, int c0, int r1, int c1) {
+    if (r0 < 0) r0 = 0;
+    if (c0 < 0) c0 = 0;
+    if (r1 >= maze->rows) r1 = maze->rows - 1;
+    if (c1 >= maze->cols) c1 = maze->cols - 1;
+    if (r0 > r1 || c0 > c1) return;
+
+    for (int rr = REGION_OF(maze, r0); rr <= REGION_OF(maze, r1); rr++)
+        for (int rc = REGION_OF(maze, c0); rc <= REGION_OF(maze, c1); rc++)
+            prof_lock(&maze->regions[rr * maze->region_cols + rc], &lock_maze);
+}
+
+/**
+ * @brief Unlock the regions locked by a matching maze_lock_span() call.
+ */
+static void maze_unlock_span(MAZE *maze, int r0, int c0, int r1, int c1) {
+    if (r0 < 0) r0 = 0;
+    if (c0 < 0) c0 = 0;
+    if (r1 >= maze->rows) r1 = maze->rows - 1;
+    if (c1 >= maze->cols) c1 = maze->cols - 1;
+    if (r0 > r1 || c0 > c1) return;
+
+    for (int rr = REGION_OF(maze, r1); rr >= REGION_OF(maze, r0); rr--)
+        for (int rc = REGION_OF(maze, c1); rc >= REGION_OF(maze, c0); rc--)
+            prof_unlock(&maze->regions[rr * maze->region_cols + rc]);
+}
+
+/// Lock / unlock the region containing a single in-bounds cell.
+#define maze_lock_cell(m, r, c) maze_lock_span((m), (r), (c), (r), (c))
+#define maze_unlock_cell(m, r, c) maze_unlock_span((m), (r), (c), (r), (c))
+
+/**
+ * @brief Character shown for a cell: the template character or the occupant's glyph.
+ */
+static inline OBJECT cell_glyph(MAZE *maze, uint16_t c) {
+    return CELL_IS_OCCUPANT(c) ? atomic_load_explicit(&maze->glyphs[CELL_OCCUPANT(c)], memory_order_relaxed)
+                               : (OBJECT)c;
+}
+
+/**
+ * @brief Read the cell at (r, c), which must be in bounds, from a snapshot.
+ */
+static inline uint16_t snapshot_cell(MAZE *maze, MAZE_SNAPSHOT *snap, int r, int c) {
+    MAZE_TILE_ROW *row = snap->rows[r >> TILE_SHIFT];
+    MAZE_TILE *tile = row ? row->tiles[c >> TILE_SHIFT] : NULL;
+    return tile ? tile->cells[(r & TILE_MASK) << TILE_SHIFT | (c & TILE_MASK)] : CELL(maze, r, c);
+}
+
+/**
+ * @struct snapshot_reader
+ * @brief Reads cells of a snapshot, remembering where the tile of the last
+ * cell read is, since nearby cells are usually in the same tile.
+ */
+typedef struct snapshot_reader {
+    MAZE *maze;
+    MAZE_SNAPSHOT *snap;
+    int tr, tc;                               /**< Tile of the last cell read, or -1. */
+    const uint16_t *base;                     /**< Its first cell, in the tile or the template. */
+    size_t stride;                            /**< Distance between its rows of cells. */
+} SNAPSHOT_READER;
+
+/**
+ * @brief Point a reader at the tile holding (r, c).
+ */
+static void reader_seek(SNAPSHOT_READER *rd, int r, int c) {
+    rd->tr = r >> TILE_SHIFT;
+    rd->tc = c >> TILE_SHIFT;
+    MAZE_TILE_ROW *row = rd->snap->rows[rd->tr];
+    MAZE_TILE *tile = row ? row->tiles[rd->tc] : NULL;
+    if (tile) {
+        rd->base = tile->cells;
+        rd->stride = TILE_SIZE;
+    } else {
+        rd->base = &CELL(rd->maze, rd->tr << TILE_SHIFT, rd->tc << TILE_SHIFT);
+        rd->stride = rd->maze->cols;
+    }
+}
+
+/// Read the in-bounds cell at (r, c) through a SNAPSHOT_READER.
+#define READER_CELL(rd, r, c) \
+    ((((r) >> TILE_SHIFT) != (rd)->tr || ((c) >> TILE_SHIFT) != (rd)->tc ? reader_seek((rd), (r), (c)) : (void)0), \
+     (rd)->base[(size_t)((r) & TILE_MASK) * (rd)->stride + ((c) & TILE_MASK)])
+
+/**
+ * @brief Get the current snapshot of a maze (inside an epoch critical section).
+ */
+static inline MAZE_SNAPSHOT *maze_snapshot(MAZE *maze) {
+    return atomic_load(&maze->snapshot);
+}
+
+/**
+ * @brief Free a tile, row of tiles or root retired from a snapshot.
+ */
+static void maze_free_node(EPOCH_ENTRY *entry) {
+    free(entry);
+}
+
+/**
+ * @brief Copy a tile to be changed, or make one from the template if the
+ * snapshot has none yet.
+ * @return The copy, or NULL on allocation failure.
+ */
+static MAZE_TILE *tile_copy(MAZE *maze, MAZE_TILE *old, int tr, int tc) {
+    MAZE_TILE *tile = malloc(sizeof(MAZE_TILE));
+    if (!tile) return NULL;
+    if (old) {
+        memcpy(tile->cells, old->cells, sizeof(tile->cells));
+        return tile;
+    }
+    for (int i = 0; i < TILE_SIZE; i++) {
+        for (int j = 0; j < TILE_SIZE; j++) {
+            int r = (tr << TILE_SHIFT) + i, c = (tc << TILE_SHIFT) + j;
+            tile->cells[i << TILE_SHIFT | j] = IN_BOUNDS(maze, r, c) ? CELL(maze, r, c) : EMPTY;
+        }
+    }
+    return tile;
+}
+
+/**
+ * @brief Copy a row of tiles to be changed, or make an empty one.
+ * @return The copy, or NULL on allocation failure.
+ */
+static MAZE_TILE_ROW *tile_row_copy(MAZE *maze, MAZE_TILE_ROW *old) {
+    size_t size = sizeof(MAZE_TILE_ROW) + maze->tile_cols * sizeof(MAZE_TILE *);
+    MAZE_TILE_ROW *row = old ? malloc(size) : calloc(1, size);
+    if (row && old) memcpy(row->tiles, old->tiles, maze->tile_cols * sizeof(MAZE_TILE *));
+    return row;
+}
+
+/**
+ * @brief Copy a snapshot's root, or make an empty one if there is none.
+ * @return The copy, or NULL on allocation failure.
+ */
+static MAZE_SNAPSHOT *snapshot_copy(MAZE *maze, MAZE_SNAPSHOT *old) {
+    size_t size = sizeof(MAZE_SNAPSHOT) + maze->tile_rows * sizeof(MAZE_TILE_ROW *);
+    MAZE_SNAPSHOT *snap = old ? malloc(size) : calloc(1, size);
+    if (snap && old) memcpy(snap->rows, old->rows, maze->tile_rows * sizeof(MAZE_TILE_ROW *));
+    return snap;
+}
+
+/**
+ * @brief Publish a new snapshot with some cells changed.
+ *
+ * The root, and the rows of tiles and tiles holding the changed cells, are
+ * copied from the current snapshot and updated, and the copy replaces the
+ * current snapshot if no other change has replaced it meanwhile; otherwise
+ * the copy is discarded and made again from the newer snapshot.  The parts
+ * replaced are retired.  Must be called inside an epoch critical section,
+ * with the regions of the changed cells locked.
+ *
+ * @param maze    The maze.
+ * @param updates Changes, to in-bounds cells.
+ * @param n       Number of changes, at most MAX_CELL_UPDATES.
+ * @return 0 on success, -1 on allocation failure (nothing is changed).
+ */
+static int maze_publish(MAZE *maze, const CELL_UPDATE *updates, int n) {
+    MAZE_SNAPSHOT *old = maze_snapshot(maze);
+    while (1) {
+        MAZE_TILE_ROW *old_rows[MAX_CELL_UPDATES], *new_rows[MAX_CELL_UPDATES];
+        MAZE_TILE *old_tiles[MAX_CELL_UPDATES], *new_tiles[MAX_CELL_UPDATES];
+        int nrows = 0, ntiles = 0;
+        MAZE_SNAPSHOT *snap = snapshot_copy(maze, old);
+        int ok = (snap != NULL);
+
+        for (int i = 0; ok && i < n; i++) {
+            int tr = updates[i].row >> TILE_SHIFT, tc = updates[i].col >> TILE_SHIFT;
+            MAZE_TILE_ROW *old_row = old->rows[tr], *row = snap->rows[tr];
+            if (row == old_row) {
+                // Not yet copied for an earlier change
+                if (!(row = tile_row_copy(maze, old_row))) {
+                    ok = 0;
+                    break;
+                }
+                snap->rows[tr] = row;
+                old_rows[nrows] = old_row;
+                new_rows[nrows++] = row;
+            }
+            MAZE_TILE *old_tile = old_row ? old_row->tiles[tc] : NULL, *tile = row->tiles[tc];
+            if (tile == old_tile) {
+                if (!(tile = tile_copy(maze, old_tile, tr, tc))) {
+                    ok = 0;
+                    break;
+                }
+                row->tiles[tc] = tile;
+                old_tiles[ntiles] = old_tile;
+                new_tiles[ntiles++] = tile;
+            }
+            tile->cells[(updates[i].row & TILE_MASK) << TILE_SHIFT | (updates[i].col & TILE_MASK)] =
+                updates[i].value;
+        }
+
+        if (ok && atomic_compare_exchange_strong(&maze->snapshot, &old, snap)) {
+            epoch_retire(&old->retire, maze_free_node);
+            for (int i = 0; i < nrows; i++)
+                if (old_rows[i]) epoch_retire(&old_rows[i]->retire, maze_free_node);
+            for (int i = 0; i < ntiles; i++)
+                if (old_tiles[i]) epoch_retire(&old_tiles[i]->retire, maze_free_node);
+            return 0;
+        }
+
+        // Never published, so nobody else can have seen it
+        for (int i = 0; i < ntiles; i++) free(new_tiles[i]);
+        for (int i = 0; i < nrows; i++) free(new_rows[i]);
+        free(snap);
+        if (!ok) {
+            error("maze_publish: Memory allocation failed");
+            return -1;
+        }
+    }
+}
+
+/**
+ * @brief Free a maze's current snapshot, which no thread may be reading.
+ */
+static void snapshot_free(MAZE *maze) {
+    MAZE_SNAPSHOT *snap = atomic_exchange(&maze->snapshot, NULL);
+    if (!snap) return;
+    for (int tr = 0; tr < maze->tile_rows; tr++) {
+        MAZE_TILE_ROW *row = snap->rows[tr];
+        if (!row) continue;
+        for (int tc = 0; tc < maze->tile_cols; tc++)
+            free(row->tiles[tc]);
+        free(row);
+    }
+    free(snap);
+}
+
+/**
+ * @brief Partition a maze whose grid has been filled in into lock regions.
+ *
+ * @param maze Maze with cells, rows and cols set.
+ * @return 0 on success, -1 on allocation failure (the grid is then freed).
+ */
+static int maze_setup_regions(MAZE *maze) {
+    // Region size 0 means a single region
+    int longest = (maze->rows > maze->cols) ? maze->rows : maze->cols;
+    maze->region_size = (region_size_setting > 0 && region_size_setting < longest)
+                        ? region_size_setting : (longest > 0 ? longest : 1);
+    maze->region_rows = (maze->rows + maze->region_size - 1) / maze->region_size;
+    maze->region_cols = (maze->cols + maze->region_size - 1) / maze->region_size;
+    if (maze->region_rows < 1) maze->region_rows = 1;
+    if (maze->region_cols < 1) maze->region_cols = 1;
+
+    int nregions = maze->region_rows * maze->region_cols;
+    maze->regions = malloc(nregions * sizeof(pthread_mutex_t));
+    if (!maze->regions) {
+        error("maze_build: memory allocation failed for %d lock regions", nregions);
+        free(maze->cells);
+        maze->cells = NULL;
+        maze->rows = maze->cols = 0;
+        return -1;
+    }
+    for (int i = 0; i < nregions; i++) {
+        pthread_mutex_init(&maze->regions[i], NULL);
+    }
+
+    // The first snapshot is all template
+    maze->tile_rows = (maze->rows + TILE_MASK) >> TILE_SHIFT;
+    maze->tile_cols = (maze->cols + TILE_MASK) >> TILE_SHIFT;
+    MAZE_SNAPSHOT *snap = snapshot_copy(maze, NULL);
+    if (!snap) {
+        error("maze_build: memory allocation failed for the snapshot of a %d x %d maze",
+              maze->rows, maze->cols);
+        for (int i = 0; i < nregions; i++)
+            pthread_mutex_destroy(&maze->regions[i]);
+        free(maze->regions);
+        maze->regions = NULL;
+        free(maze->cells);
+        maze->cells = NULL;
+        maze->rows = maze->cols = 0;
+        return -1;
     }
+    atomic_store(&maze->snapshot, snap);
+
+    // Give each maze its own placement sequence
+    atomic_init(&maze->rng, placement_seed + mazes_built++ * 0xD1B54A32D192ED03ULL);
 
-    // Initialize maze mutex for thread safety
-    pthread_mutex_init(&maze_mutex, NULL);
+    debug("maze_setup_regions: Maze %p is %d rows × %d cols, %d regions of %d",
+          maze, maze->rows, maze->cols, nregions, maze->region_size);
+    return 0;
+}
 
-    // Seed random number generator for randomized respawns
-    srand(time(NULL));
+/**
+ * @brief Fill in a MAZE from a template.
+ *
+ * Determines the dimensions, allocates the grid and widens the template
+ * characters into it, then creates the region locks.  Rows shorter than
+ * the first are padded with EMPTY.
+ *
+ * @param maze     Maze to fill in.
+ * @param template NULL-terminated array of row strings.
+ * @return 0 on success, -1 on an empty template or allocation failure.
+ */
+static int maze_build(MAZE *maze, char **template) {
+    if (!template || !template[0]) {
+        error("maze_build: invalid or empty template");
+        return -1;
+    }
 
     // Determine maze dimensions
-    maze_rows = 0;
-    maze_cols = strlen(template[0]);  // Assume all rows same length
-    while (template[maze_rows] != NULL) {
-        maze_rows++;
+    maze->rows = 0;
+    maze->cols = strlen(template[0]);  // Assume all rows same length
+    while (template[maze->rows] != NULL) {
+        maze->rows++;
     }
 
-    // Allocate and copy maze content
-    maze = calloc(maze_rows, sizeof(char *));
-    if (!maze) {
-        error("maze_init: memory allocation failed for maze rows");
-        return;
+    // Allocate one contiguous grid and widen the template characters into it
+    maze->cells = malloc((size_t)maze->rows * maze->cols * sizeof(uint16_t));
+    if (!maze->cells) {
+        error("maze_build: memory allocation failed for %d x %d maze", maze->rows, maze->cols);
+        maze->rows = maze->cols = 0;
+        return -1;
+    }
+
+    for (int i = 0; i < maze->rows; i++) {
+        const unsigned char *row = (const unsigned char *)template[i];
+        int len = strlen(template[i]);
+        for (int j = 0; j < maze->cols; j++) {
+            // Rows shorter than the first are padded with empty space
+            CELL(maze, i, j) = (j < len) ? row[j] : EMPTY;
+        }
+    }
+
+    return maze_setup_regions(maze);
+}
+
+/**
+ * @brief Number of bytes taken by ncells cells packed at bits bits each.
+ */
+static uint64_t image_cells_size(uint64_t ncells, unsigned bits) {
+    unsigned per_byte = 8 / bits;
+    return ncells / per_byte + (ncells % per_byte != 0);
+}
+
+/**
+ * @brief Fill in a MAZE by mapping a maze image written by maze_save_image().
+ *
+ * The image is mapped read-only.  The packed grid is unpacked into the maze
+ * grid in one pass, a byte at a time through a table of the cells each byte
+ * value stands for; every cell is checked against the palette on the way,
+ * so a corrupt image is rejected.  The spawn index is used in place, and
+ * its pages are only read in as placements touch them.  Occupants never
+ * touch the grid; they live in the snapshot.
+ *
+ * @param maze Maze to fill in.
+ * @param path Path of the image (for diagnostics).
+ * @param fd   Open descriptor of the image.
+ * @param size Size of the image file.
+ * @return 0 on success, -1 if the image is invalid or cannot be loaded.
+ */
+static int maze_build_image(MAZE *maze, const char *path, int fd, size_t size) {
+    struct maze_image_header hdr;
+    if (size < sizeof(hdr) || pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+        fprintf(stderr, "Error: %s: truncated maze image\n", path);
+        return -1;
+    }
+    if (hdr.version != MAZE_IMAGE_VERSION || hdr.byte_order != MAZE_IMAGE_BYTE_ORDER) {
+        fprintf(stderr, "Error: %s: unsupported maze image (version %u, byte order 0x%08x)\n",
+                path, hdr.version, hdr.byte_order);
+        return -1;
+    }
+
+    int palette_ok = hdr.npalette > 0 && hdr.npalette <= MAZE_IMAGE_PALETTE;
+    for (uint32_t i = 0; palette_ok && i < hdr.npalette; i++)
+        palette_ok = IS_EMPTY(hdr.palette[i]) || IS_WALL(hdr.palette[i]);
+    int bits_ok = hdr.cell_bits == 1 || hdr.cell_bits == 2 || hdr.cell_bits == 4 || hdr.cell_bits == 8;
+    uint64_t ncells = (uint64_t)hdr.rows * hdr.cols;
+    if (!palette_ok || !bits_ok ||
+        hdr.rows == 0 || hdr.cols == 0 || hdr.rows > INT32_MAX || hdr.cols > INT32_MAX ||
+        ncells > SIZE_MAX / sizeof(uint16_t) ||
+        hdr.file_size != size || hdr.cells_offset % 8 || hdr.spawns_offset % 8 ||
+        hdr.cells_offset < sizeof(hdr) || hdr.cells_offset > size ||
+        image_cells_size(ncells, hdr.cell_bits) > size - hdr.cells_offset ||
+        hdr.spawns_offset > size ||
+        hdr.nspawns > (size - hdr.spawns_offset) / sizeof(uint32_t)) {
+        fprintf(stderr, "Error: %s: corrupt maze image header\n", path);
+        return -1;
+    }
+
+    maze->cells = malloc(ncells * sizeof(uint16_t));
+    if (!maze->cells) {
+        fprintf(stderr, "Error: %s: cannot allocate %u x %u maze\n", path, hdr.rows, hdr.cols);
+        return -1;
+    }
+    void *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) {
+        perror(path);
+        free(maze->cells);
+        maze->cells = NULL;
+        return -1;
+    }
+    madvise(base, size, MADV_SEQUENTIAL);
+
+    // The cells each byte value unpacks to, and whether they all index the
+    // palette
+    unsigned bits = hdr.cell_bits, per_byte = 8 / bits, mask = (1u << bits) - 1;
+    uint16_t table[256][8];
+    uint8_t valid[256];
+    for (unsigned v = 0; v < 256; v++) {
+        valid[v] = 1;
+        for (unsigned k = 0; k < per_byte; k++) {
+            unsigned index = (v >> (k * bits)) & mask;
+            valid[v] &= index < hdr.npalette;
+            table[v][k] = index < hdr.npalette ? hdr.palette[index] : EMPTY;
+        }
+    }
+
+    const uint8_t *packed = (const uint8_t *)base + hdr.cells_offset;
+    size_t full = ncells / per_byte, rest = ncells % per_byte;
+    uint16_t *dst = maze->cells;
+    int ok = 1;
+    for (size_t i = 0; i < full; i++, dst += per_byte) {
+        memcpy(dst, table[packed[i]], per_byte * sizeof(uint16_t));
+        ok &= valid[packed[i]];
+    }
+    for (unsigned k = 0; k < rest; k++) {
+        ok &= ((packed[full] >> (k * bits)) & mask) < hdr.npalette;
+        dst[k] = table[packed[full]][k];
+    }
+    if (!ok) {
+        fprintf(stderr, "Error: %s: corrupt maze image cells\n", path);
+        munmap(base, size);
+        free(maze->cells);
+        maze->cells = NULL;
+        return -1;
+    }
+
+    maze->image = base;
+    maze->image_len = size;
+    maze->rows = hdr.rows;
+    maze->cols = hdr.cols;
+    maze->spawns = (const uint32_t *)((char *)base + hdr.spawns_offset);
+    maze->nspawns = hdr.nspawns;
+
+    if (maze_setup_regions(maze) != 0) {
+        munmap(base, size);
+        free(maze->cells);
+        maze->image = NULL;
+        maze->cells = NULL;
+        maze->spawns = NULL;
+        maze->nspawns = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Fill in a MAZE from a template file, in a single pass over the file.
+ *
+ * The file is mapped into memory and scanned line by line; each line is
+ * validated and widened straight into the grid, with no per-line buffers.
+ * The grid is sized up front for the largest number of rows the file could
+ * hold (every line but the last takes at least cols + 1 bytes) and trimmed
+ * once the real row count is known.  Lines may end in "\n" or "\r\n", the
+ * final newline is optional, and blank lines at the end are ignored.
+ *
+ * Diagnostics for malformed templates are printed on stderr, with the line
+ * and column at fault.
+ *
+ * @param maze Maze to fill in.
+ * @param path Path of the template file.
+ * @return 0 on success, -1 if the file could not be read or is invalid.
+ */
+static int maze_build_file(MAZE *maze, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    size_t size = st.st_size;
+    if (size == 0) {
+        fprintf(stderr, "Error: %s: empty maze template\n", path);
+        close(fd);
+        return -1;
     }
 
-    for (int i = 0; i < maze_rows; i++) {
-        maze[i] = strdup(template[i]);
-        if (!maze[i]) {
-            error("maze_init: memory allocation failed for row %d", i);
-            // Not freeing earlier rows for simplicity here; can add cleanup if desired
-            return;
+    // Maze images are recognized by their magic number
+    char magic[sizeof(MAZE_IMAGE_MAGIC) - 1];
+    if (size >= sizeof(magic) && pread(fd, magic, sizeof(magic), 0) == sizeof(magic) &&
+        memcmp(magic, MAZE_IMAGE_MAGIC, sizeof(magic)) == 0) {
+        int rc = maze_build_image(maze, path, fd, size);
+        close(fd);
+        return rc;
+    }
+
+    const char *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        perror(path);
+        return -1;
+    }
+    madvise((void *)base, size, MADV_SEQUENTIAL);
+
+    const char *p = base, *end = base + size;
+    size_t cols = 0, rows = 0, max_rows = 0;
+    int rc = -1;
+
+    while (p < end) {
+        const char *nl = memchr(p, '\n', end - p);
+        const char *eol = nl ? nl : end;
+        size_t len = eol - p;
+        if (len > 0 && p[len - 1] == '\r') len--;
+
+        if (len == 0) {
+            // A blank line is only acceptable as trailing padding
+            const char *q = eol;
+            while (q < end && (*q == '\n' || *q == '\r')) q++;
+            if (q == end && rows > 0) break;
+            fprintf(stderr, "Error: %s:%zu: blank line in maze template\n", path, rows + 1);
+            goto out;
+        }
+
+        if (rows == 0) {
+            // The first line fixes the width, which bounds the number of rows
+            cols = len;
+            if (cols > INT32_MAX || size / (cols + 1) + 1 > INT32_MAX) {
+                fprintf(stderr, "Error: %s: maze template is too large\n", path);
+                goto out;
+            }
+            max_rows = size / (cols + 1) + 1;
+            maze->cells = malloc(max_rows * cols * sizeof(uint16_t));
+            if (!maze->cells) {
+                fprintf(stderr, "Error: %s: cannot allocate %zu x %zu maze\n", path, max_rows, cols);
+                goto out;
+            }
+        } else if (len != cols) {
+            fprintf(stderr, "Error: %s:%zu: row has %zu columns, expected %zu\n",
+                    path, rows + 1, len, cols);
+            goto out;
+        }
+
+        uint16_t *dst = maze->cells + rows * cols;
+        for (size_t j = 0; j < len; j++) {
+            unsigned char ch = p[j];
+            if (!IS_EMPTY(ch) && !IS_WALL(ch)) {
+                fprintf(stderr, "Error: %s:%zu:%zu: invalid maze character 0x%02x\n",
+                        path, rows + 1, j + 1, ch);
+                goto out;
+            }
+            dst[j] = ch;
         }
+        rows++;
+        p = nl ? nl + 1 : end;
+    }
+
+    if (rows < max_rows) {
+        uint16_t *cells = realloc(maze->cells, rows * cols * sizeof(uint16_t));
+        if (cells) maze->cells = cells;
+    }
+    maze->rows = rows;
+    maze->cols = cols;
+    rc = 0;
+
+out:
+    munmap((void *)base, size);
+    if (rc != 0) {
+        free(maze->cells);
+        maze->cells = NULL;
+        maze->rows = maze->cols = 0;
+        return -1;
+    }
+    return maze_setup_regions(maze);
+}
+
+/**
+ * @brief Fill in a MAZE as a fresh copy of another maze's template.
+ *
+ * Occupants of the source maze are not copied; their cells become EMPTY.
+ * The copy shares the source's spawn index, if any, so the source must not
+ * be destroyed before the copy.
+ *
+ * @param maze Maze to fill in.
+ * @param src  Maze to copy.
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int maze_build_copy(MAZE *maze, MAZE *src) {
+    size_t ncells = (size_t)src->rows * src->cols;
+    maze->cells = malloc(ncells * sizeof(uint16_t));
+    if (!maze->cells) {
+        error("maze_build_copy: memory allocation failed for %d x %d maze", src->rows, src->cols);
+        return -1;
     }
+    maze->rows = src->rows;
+    maze->cols = src->cols;
 
-    debug("maze_init: Maze initialized (%d rows × %d cols)", maze_rows, maze_cols);
+    // The template grid holds no occupants and never changes
+    memcpy(maze->cells, src->cells, ncells * sizeof(uint16_t));
+
+    // The spawn index is read-only, and src outlives its copies
+    maze->spawns = src->spawns;
+    maze->nspawns = src->nspawns;
+
+    return maze_setup_regions(maze);
 }
 
+/**
+ * @brief Release the grid, snapshot and region locks of a MAZE.
+ */
+static void maze_teardown(MAZE *maze) {
+    snapshot_free(maze);
+    for (int i = 0; maze->regions && i < maze->region_rows * maze->region_cols; i++) {
+        pthread_mutex_destroy(&maze->regions[i]);
+    }
+    free(maze->regions);
+    free(maze->cells);
+    if (maze->image) munmap(maze->image, maze->image_len);
+    maze->regions = NULL;
+    maze->cells = NULL;
+    maze->spawns = NULL;
+    maze->nspawns = 0;
+    maze->image = NULL;
+    maze->rows = maze->cols = 0;
+    maze->tile_rows = maze->tile_cols = 0;
+}
+
+/**
+ * @brief Initialize the default maze from a template.
+ *
+ * This function initializes the default maze grid based on a NULL-terminated
+ * array of strings (each row). It allocates internal memory, determines dimensions,
+ * and sets up the region mutexes for thread-safe operations. Unless
+ * maze_set_seed() was called, it also seeds the generators used for
+ * randomized placement (e.g., respawning) from the time of day.
+ *
+ * @param template A NULL-terminated array of strings representing the maze template.
+ */
+void maze_init(char **template) {
+    // Seed the placement generators for randomized respawns
+    if (!placement_seeded) maze_set_seed(time(NULL));
+
+    maze_build(&default_maze, template);
+}
 
 /**
- * Free maze memory and destroy mutex.
+ * @brief Initialize the default maze from a template file.
+ *
+ * As maze_init(), but the template is read straight from a file; see
+ * maze_build_file() for the accepted format.
+ *
+ * @param path Path of the template file.
+ * @return 0 on success, -1 if the file could not be loaded.
+ */
+int maze_init_file(const char *path) {
+    // Seed the placement generators for randomized respawns
+    if (!placement_seeded) maze_set_seed(time(NULL));
+
+    return maze_build_file(&default_maze, path);
+}
+
+/**
+ * Free maze memory and destroy mutexes.
  */
 void maze_fini() {
-    pthread_mutex_lock(&maze_mutex);
-    for (int i = 0; i < maze_rows; i++) {
-        free(maze[i]);
+    maze_teardown(&default_maze);
+}
+
+/**
+ * @brief Create an additional maze, independent of the default one.
+ * @param template NULL-terminated array of row strings.
+ * @return New maze, or NULL on failure.
+ */
+MAZE *maze_create(char **template) {
+    MAZE *maze = calloc(1, sizeof(MAZE));
+    if (!maze) {
+        error("maze_create: Memory allocation failed");
+        return NULL;
+    }
+    if (maze_build(maze, template) != 0) {
+        free(maze);
+        return NULL;
+    }
+    return maze;
+}
+
+/**
+ * @brief Create an additional maze with the same template as an existing one.
+ * @param src Maze to copy; its occupants are not copied.
+ * @return New maze, or NULL on failure.
+ */
+MAZE *maze_clone(MAZE *src) {
+    MAZE *maze = calloc(1, sizeof(MAZE));
+    if (!maze) {
+        error("maze_clone: Memory allocation failed");
+        return NULL;
+    }
+    if (maze_build_copy(maze, src) != 0) {
+        free(maze);
+        return NULL;
+    }
+    return maze;
+}
+
+/**
+ * @brief Write a maze out as a maze image.
+ *
+ * The image holds the template grid (occupants are not part of it), packed
+ * at the fewest bits per cell that index a palette of its characters, and
+ * the index of spawnable (EMPTY) cells.
+ *
+ * @param maze Maze to save.
+ * @param path Path of the image file to create.
+ * @return 0 on success, -1 on error (with a diagnostic on stderr).
+ */
+int maze_save_image(MAZE *maze, const char *path) {
+    size_t ncells = (size_t)maze->rows * maze->cols;
+    if (ncells == 0 || ncells > UINT32_MAX) {
+        fprintf(stderr, "Error: %s: maze of %d x %d cannot be saved as an image\n",
+                path, maze->rows, maze->cols);
+        return -1;
+    }
+
+    struct maze_image_header hdr = {
+        .magic = MAZE_IMAGE_MAGIC,
+        .version = MAZE_IMAGE_VERSION,
+        .byte_order = MAZE_IMAGE_BYTE_ORDER,
+        .rows = maze->rows,
+        .cols = maze->cols,
+        .cells_offset = sizeof(hdr),
+    };
+
+    // The template grid holds no occupants and never changes
+    const uint16_t *cells = maze->cells;
+    uint8_t index[256];
+    memset(index, 0xff, sizeof(index));
+    size_t nspawns = 0;
+    for (size_t i = 0; i < ncells; i++) {
+        uint16_t c = cells[i];
+        if (c >= 256 || (!IS_EMPTY(c) && !IS_WALL(c))) {
+            fprintf(stderr, "Error: %s: maze has invalid character 0x%02x\n", path, c);
+            return -1;
+        }
+        if (index[c] == 0xff) {
+            index[c] = hdr.npalette;
+            hdr.palette[hdr.npalette++] = c;
+        }
+        if (IS_EMPTY(c)) nspawns++;
+    }
+    hdr.cell_bits = 1;
+    while ((1u << hdr.cell_bits) < hdr.npalette) hdr.cell_bits *= 2;
+
+    size_t packed_len = image_cells_size(ncells, hdr.cell_bits);
+    uint8_t *packed = calloc(packed_len, 1);
+    uint32_t *spawns = malloc((nspawns ? nspawns : 1) * sizeof(uint32_t));
+    if (!packed || !spawns) {
+        fprintf(stderr, "Error: %s: out of memory\n", path);
+        free(packed);
+        free(spawns);
+        return -1;
+    }
+    unsigned per_byte = 8 / hdr.cell_bits;
+    nspawns = 0;
+    for (size_t i = 0; i < ncells; i++) {
+        packed[i / per_byte] |= index[cells[i]] << (i % per_byte * hdr.cell_bits);
+        if (IS_EMPTY(cells[i])) spawns[nspawns++] = i;
+    }
+
+    hdr.nspawns = nspawns;
+    hdr.spawns_offset = (hdr.cells_offset + packed_len + 7) & ~(uint64_t)7;
+    hdr.file_size = hdr.spawns_offset + nspawns * sizeof(uint32_t);
+
+    int rc = -1;
+    FILE *fp = fopen(path, "wb");
+    if (fp) {
+        static const char pad[8];
+        size_t padlen = hdr.spawns_offset - (hdr.cells_offset + packed_len);
+        if (fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+            fwrite(packed, 1, packed_len, fp) == packed_len &&
+            fwrite(pad, 1, padlen, fp) == padlen &&
+            fwrite(spawns, sizeof(uint32_t), nspawns, fp) == nspawns) {
+            rc = 0;
+        }
+        if (fclose(fp) != 0) rc = -1;
     }
+    if (rc != 0) perror(path);
+
+    free(packed);
+    free(spawns);
+    return rc;
+}
+
+/**
+ * @brief Destroy a maze created by maze_create() or maze_clone().
+ * @param maze Maze to destroy (may be NULL).
+ */
+void maze_destroy(MAZE *maze) {
+    if (!maze || maze == &default_maze) return;
+    maze_teardown(maze);
     free(maze);
-    maze = NULL;
-    pthread_mutex_unlock(&maze_mutex);
-    pthread_mutex_destroy(&maze_mutex);
+}
+
+/**
+ * @brief Get the default maze, i.e. the one maze.h functions operate on.
+ */
+MAZE *maze_default(void) {
+    return &default_maze;
 }
 
 int maze_get_rows() {
-    return maze_rows;
+    return default_maze.rows;
 }
 
 int maze_get_cols() {
-    return maze_cols;
+    return default_maze.cols;
 }
 
 /**
- * @brief Attempt to place a player's avatar at a specific location in the maze.
+ * @brief Attempt to place an occupant at a specific location in a maze.
  *
- * This function sets the specified cell of the maze to contain the given avatar,
+ * This function sets the specified cell of the maze to contain the given occupant,
  * only if the cell is currently unoccupied (i.e., contains a space character).
- * The operation is protected by a mutex to ensure thread safety.
+ * The check and the change are made under the mutex of the cell's region.
  *
- * @param avatar The avatar character to place (typically an uppercase letter).
- * @param row    The row index in the maze.
- * @param col    The column index in the maze.
+ * @param maze  The maze.
+ * @param id    The occupant ID to place.
+ * @param glyph The character used to display the occupant in views.
+ * @param row   The row index in the maze.
+ * @param col   The column index in the maze.
  * @return 0 on success, -1 if the cell is out of bounds or not empty.
  */
-int maze_set_player(OBJECT avatar, int row, int col) {
-    pthread_mutex_lock(&maze_mutex);
+int maze_set_occupant(MAZE *maze, OCCUPANT id, OBJECT glyph, int row, int col) {
+    if (id >= MAZE_MAX_OCCUPANTS) return -1;
 
     // Validate bounds
-    if (row < 0 || row >= maze_rows || col < 0 || col >= maze_cols) {
-        debug("maze_set_player: Out of bounds placement [%d, %d] for %c", row, col, avatar);
-        pthread_mutex_unlock(&maze_mutex);
+    if (!IN_BOUNDS(maze, row, col)) {
+        debug("maze_set_occupant: Out of bounds placement [%d, %d] for %c", row, col, glyph);
         return -1;
     }
 
+    maze_lock_cell(maze, row, col);
+    epoch_enter();
+
     // Ensure the cell is empty
-    if (!IS_EMPTY(maze[row][col])) {
-        debug("maze_set_player: Cell [%d, %d] is not empty (contains '%c')",
-              row, col, maze[row][col]);
-        pthread_mutex_unlock(&maze_mutex);
+    uint16_t c = snapshot_cell(maze, maze_snapshot(maze), row, col);
+    if (!IS_EMPTY(c)) {
+        debug("maze_set_occupant: Cell [%d, %d] is not empty (contains '%c')",
+              row, col, cell_glyph(maze, c));
+        epoch_exit();
+        maze_unlock_cell(maze, row, col);
         return -1;
     }
 
-    // Perform the placement
-    maze[row][col] = avatar;
-    debug("maze_set_player: Placed %c at [%d, %d]", avatar, row, col);
+    // Perform the placement; the glyph is visible before the snapshot is
+    atomic_store_explicit(&maze->glyphs[id], glyph, memory_order_relaxed);
+    CELL_UPDATE update = { row, col, OCCUPANT_CELL(id) };
+    int rc = maze_publish(maze, &update, 1);
+    if (rc == 0) debug("maze_set_occupant: Placed %c (id %u) at [%d, %d]", glyph, id, row, col);
 
-    pthread_mutex_unlock(&maze_mutex);
-    return 0;
+    epoch_exit();
+    maze_unlock_cell(maze, row, col);
+    return rc;
 }
 
+/**
+ * @brief Place a player's avatar at a specific location, using the avatar as its ID.
+ */
+int maze_set_player(OBJECT avatar, int row, int col) {
+    return maze_set_occupant(&default_maze, avatar, avatar, row, col);
+}
 
-void maze_remove_player(OBJECT avatar, int row, int col) {
-    pthread_mutex_lock(&maze_mutex);
-    if (maze[row][col] == avatar) {
-        maze[row][col] = EMPTY;
+void maze_remove_occupant(MAZE *maze, OCCUPANT id, int row, int col) {
+    if (!IN_BOUNDS(maze, row, col)) return;
+
+    maze_lock_cell(maze, row, col);
+    epoch_enter();
+    if (snapshot_cell(maze, maze_snapshot(maze), row, col) == OCCUPANT_CELL(id)) {
+        CELL_UPDATE update = { row, col, EMPTY };
+        maze_publish(maze, &update, 1);
     }
-    pthread_mutex_unlock(&maze_mutex);
+    epoch_exit();
+    maze_unlock_cell(maze, row, col);
+}
+
+void maze_remove_player(OBJECT avatar, int row, int col) {
+    maze_remove_occupant(&default_maze, avatar, row, col);
 }
 
 /**
- * @brief Place a player's avatar at a random unoccupied location in the maze.
+ * @brief Place an occupant at a random unoccupied location in a maze.
  *
  * Attempts up to 1000 times to randomly find a valid position (i.e., empty cell)
- * and place the avatar there. On success, updates the output row and column pointers.
+ * and place the occupant there. On success, updates the output row and column pointers.
+ * Mazes loaded from an image draw candidates from the image's spawn index,
+ * so that placement succeeds quickly even in mostly-solid mazes.
  *
- * This function must be called with unplaced avatar — it does not remove previous positions.
+ * This function must be called with an unplaced occupant — it does not remove previous positions.
  *
- * @param avatar The avatar character to place (e.g., 'A', 'B', etc.).
- * @param rowp Pointer to store the selected row (optional).
- * @param colp Pointer to store the selected col (optional).
+ * @param maze  The maze.
+ * @param id    The occupant ID to place.
+ * @param glyph The character used to display the occupant in views.
+ * @param rowp  Pointer to store the selected row (optional).
+ * @param colp  Pointer to store the selected col (optional).
  * @return 0 on success, -1 on failure after max_attempts.
  */
-int maze_set_player_random(OBJECT avatar, int *rowp, int *colp) {
+int maze_set_occupant_random(MAZE *maze, OCCUPANT id, OBJECT glyph, int *rowp, int *colp) {
     const int max_attempts = 1000;
 
+    if (maze->rows <= 0 || maze->cols <= 0) return -1;
+
     for (int i = 0; i < max_attempts; i++) {
-        int r = rand() % maze_get_rows();
-        int c = rand() % maze_get_cols();
+        int r, c;
+        if (maze->nspawns > 0) {
+            size_t cell = maze->spawns[maze_random(maze) % maze->nspawns];
+            r = cell / maze->cols;
+            c = cell % maze->cols;
+        } else {
+            uint64_t rc = maze_random(maze);
+            r = (uint32_t)rc % maze->rows;
+            c = (uint32_t)(rc >> 32) % maze->cols;
+        }
 
-        debug("maze_set_player_random: Trying to place %c at [%d,%d] (attempt %d)", avatar, r, c, i + 1);
+        debug("maze_set_occupant_random: Trying to place %c at [%d,%d] (attempt %d)", glyph, r, c, i + 1);
 
-        if (maze_set_player(avatar, r, c) == 0) {
+        if (maze_set_occupant(maze, id, glyph, r, c) == 0) {
             if (rowp) *rowp = r;
             if (colp) *colp = c;
 
-            debug("maze_set_player_random: SUCCESS placing %c at [%d,%d]", avatar, r, c);
+            debug("maze_set_occupant_random: SUCCESS placing %c at [%d,%d]", glyph, r, c);
             return 0;
         }
     }
 
-    debug("maze_set_player_random: FAILED to place %c after %d attempts", avatar, max_attempts);
+    debug("maze_set_occupant_random: FAILED to place %c after %d attempts", glyph, max_attempts);
     return -1;
 }
 
+int maze_set_player_random(OBJECT avatar, int *rowp, int *colp) {
+    return maze_set_occupant_random(&default_maze, avatar, avatar, rowp, colp);
+}
+
 
-int maze_move(int row, int col, int dir) {
+/**
+ * @brief Move the occupant at (row, col) one cell in direction dir.
+ *
+ * Locks the regions of both the source and destination cells, so that a
+ * move across a region boundary hands the occupant from one region to the
+ * next atomically, and publishes both halves of the move in one snapshot.
+ */
+int maze_move_in(MAZE *maze, int row, int col, int dir) {
     int drow[] = { -1, 0, 1, 0 };
     int dcol[] = { 0, -1, 0, 1 };
 
-    pthread_mutex_lock(&maze_mutex);
-
-    if (row < 0 || row >= maze_rows || col < 0 || col >= maze_cols || !IS_AVATAR(maze[row][col])) {
-        pthread_mutex_unlock(&maze_mutex);
-        return -1;
-    }
-
     int new_row = row + drow[dir];
     int new_col = col + dcol[dir];
 
-    if (new_row < 0 || new_row >= maze_rows || new_col < 0 || new_col >= maze_cols ||
-        !IS_EMPTY(maze[new_row][new_col])) {
-        pthread_mutex_unlock(&maze_mutex);
-        return -1;
+    if (!IN_BOUNDS(maze, row, col) || !IN_BOUNDS(maze, new_row, new_col)) return -1;
+
+    int r0 = (row < new_row) ? row : new_row, r1 = (row < new_row) ? new_row : row;
+    int c0 = (col < new_col) ? col : new_col, c1 = (col < new_col) ? new_col : col;
+    maze_lock_span(maze, r0, c0, r1, c1);
+    epoch_enter();
+
+    MAZE_SNAPSHOT *snap = maze_snapshot(maze);
+    uint16_t c = snapshot_cell(maze, snap, row, col);
+    int rc = -1;
+    if (CELL_IS_OCCUPANT(c) && IS_EMPTY(snapshot_cell(maze, snap, new_row, new_col))) {
+        CELL_UPDATE updates[2] = { { new_row, new_col, c }, { row, col, EMPTY } };
+        rc = maze_publish(maze, updates, 2);
     }
 
-    maze[new_row][new_col] = maze[row][col];
-    maze[row][col] = EMPTY;
+    epoch_exit();
+    maze_unlock_span(maze, r0, c0, r1, c1);
+    return rc;
+}
 
-    pthread_mutex_unlock(&maze_mutex);
-    return 0;
+int maze_move(int row, int col, int dir) {
+    return maze_move_in(&default_maze, row, col, dir);
 }
 
-OBJECT maze_find_target(int row, int col, DIRECTION dir) {
+/**
+ * @brief Find the first non-empty cell along a ray.
+ *
+ * The ray is traced through the current snapshot, without any locks, so
+ * it never waits for a move and a move never waits for it.  If glyphp is
+ * non-NULL it receives the glyph of the cell found.
+ *
+ * @return The cell value found, or EMPTY if the ray left the maze.
+ */
+static uint16_t maze_trace_ray(MAZE *maze, int row, int col, DIRECTION dir, OBJECT *glyphp) {
     int drow[] = { -1, 0, 1, 0 };
     int dcol[] = { 0, -1, 0, 1 };
 
-    pthread_mutex_lock(&maze_mutex);
+    row += drow[dir];
+    col += dcol[dir];
 
-    while (row >= 0 && row < maze_rows && col >= 0 && col < maze_cols) {
+    epoch_enter();
+    SNAPSHOT_READER rd = { maze, maze_snapshot(maze), -1, -1, NULL, 0 };
+    uint16_t c = EMPTY;
+    while (IN_BOUNDS(maze, row, col)) {
+        c = READER_CELL(&rd, row, col);
+        if (!IS_EMPTY(c)) break;
         row += drow[dir];
         col += dcol[dir];
-
-        if (row < 0 || row >= maze_rows || col < 0 || col >= maze_cols) break;
-
-        if (!IS_EMPTY(maze[row][col])) {
-            OBJECT result = maze[row][col];
-            pthread_mutex_unlock(&maze_mutex);
-            return IS_AVATAR(result) ? result : EMPTY;
-        }
     }
-
-    pthread_mutex_unlock(&maze_mutex);
-    return EMPTY;
+    if (glyphp) *glyphp = cell_glyph(maze, c);
+    epoch_exit();
+    return c;
 }
 
-int maze_get_view(VIEW *view, int row, int col, DIRECTION gaze, int depth) {
-    int drow[] = { -1, 0, 1, 0 };
-    int dcol[] = { 0, -1, 0, 1 };
+OCCUPANT maze_find_occupant(MAZE *maze, int row, int col, DIRECTION dir) {
+    uint16_t c = maze_trace_ray(maze, row, col, dir, NULL);
+    return CELL_IS_OCCUPANT(c) ? CELL_OCCUPANT(c) : NO_OCCUPANT;
+}
 
-    int lrow[] = { 0, -1, 0, 1 };
-    int lcol[] = { -1, 0, 1, 0 };
+OBJECT maze_find_target(int row, int col, DIRECTION dir) {
+    OBJECT result;
+    maze_trace_ray(&default_maze, row, col, dir, &result);
+    return IS_AVATAR(result) ? result : EMPTY;
+}
 
-    pthread_mutex_lock(&maze_mutex);
+/// Offsets of a step in each direction, and of the cell to the left of it.
+static const int view_drow[] = { -1, 0, 1, 0 };
+static const int view_dcol[] = { 0, -1, 0, 1 };
+static const int view_lrow[] = { 0, -1, 0, 1 };
+static const int view_lcol[] = { -1, 0, 1, 0 };
 
+/**
+ * @brief Fill in a view from a snapshot.
+ * @return The depth of the view.
+ */
+static int maze_fill_view(MAZE *maze, MAZE_SNAPSHOT *snap, char (*view)[VIEW_WIDTH],
+                          int row, int col, DIRECTION gaze, int depth) {
+    SNAPSHOT_READER rd = { maze, snap, -1, -1, NULL, 0 };
     int actual_depth = 0;
     for (int d = 0; d < depth; d++) {
-        int r = row + d * drow[gaze];
-        int c = col + d * dcol[gaze];
+        int r = row + d * view_drow[gaze];
+        int c = col + d * view_dcol[gaze];
 
-        if (r < 0 || r >= maze_rows || c < 0 || c >= maze_cols) break;
+        if (!IN_BOUNDS(maze, r, c)) break;
 
-        (*view)[d][CORRIDOR] = maze[r][c];
+        view[d][CORRIDOR] = cell_glyph(maze, READER_CELL(&rd, r, c));
 
-        int rl = r + lrow[gaze];
-        int cl = c + lcol[gaze];
-        (*view)[d][LEFT_WALL] = (rl < 0 || rl >= maze_rows || cl < 0 || cl >= maze_cols)
-                                ? '*' : maze[rl][cl];
+        int rl = r + view_lrow[gaze];
+        int cl = c + view_lcol[gaze];
+        view[d][LEFT_WALL] = !IN_BOUNDS(maze, rl, cl) ? '*' : cell_glyph(maze, READER_CELL(&rd, rl, cl));
 
-        int rr = r - lrow[gaze];
-        int cr = c - lcol[gaze];
-        (*view)[d][RIGHT_WALL] = (rr < 0 || rr >= maze_rows || cr < 0 || cr >= maze_cols)
-                                 ? '*' : maze[rr][cr];
+        int rr = r - view_lrow[gaze];
+        int cr = c - view_lcol[gaze];
+        view[d][RIGHT_WALL] = !IN_BOUNDS(maze, rr, cr) ? '*' : cell_glyph(maze, READER_CELL(&rd, rr, cr));
 
         actual_depth++;
     }
+    return actual_depth;
+}
 
-    pthread_mutex_unlock(&maze_mutex);
+int maze_get_view_in(MAZE *maze, VIEW *view, int row, int col, DIRECTION gaze, int depth) {
+    epoch_enter();
+    int actual_depth = maze_fill_view(maze, maze_snapshot(maze), *view, row, col, gaze, depth);
+    epoch_exit();
     return actual_depth;
 }
 
+/**
+ * @brief Compute several views from one snapshot, so that no move can be
+ * seen by one view and missed by another.
+ */
+void maze_get_views_in(MAZE *maze, MAZE_VIEW *views, int count) {
+    epoch_enter();
+    MAZE_SNAPSHOT *snap = maze_snapshot(maze);
+    for (int i = 0; i < count; i++)
+        views[i].depth = maze_fill_view(maze, snap, views[i].view, views[i].row, views[i].col,
+                                        views[i].gaze, VIEW_DEPTH);
+    epoch_exit();
+}
+
+int maze_get_view(VIEW *view, int row, int col, DIRECTION gaze, int depth) {
+    return maze_get_view_in(&default_maze, view, row, col, gaze, depth);
+}
+
 void show_view(VIEW *view, int depth) {
     fprintf(stderr, "View:\n");
     for (int i = 0; i < depth; i++) {
@@ -265,10 +1304,16 @@ void show_view(VIEW *view, int depth) {
 }
 
 void show_maze() {
-    pthread_mutex_lock(&maze_mutex);
+    MAZE *maze = &default_maze;
+
+    epoch_enter();
+    MAZE_SNAPSHOT *snap = maze_snapshot(maze);
     fprintf(stderr, "Current Maze State:\n");
-    for (int i = 0; i < maze_rows; i++) {
-        fprintf(stderr, "%s\n", maze[i]);
+    for (int i = 0; i < maze->rows; i++) {
+        for (int j = 0; j < maze->cols; j++) {
+            fputc(cell_glyph(maze, snapshot_cell(maze, snap, i, j)), stderr);
+        }
+        fputc('\n', stderr);
     }
-    pthread_mutex_unlock(&maze_mutex);
+    epoch_exit();
 }
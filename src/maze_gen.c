@@ -0,0 +1,219 @@
+/**
+ * @file maze_gen.c
+ * @brief Seeded procedural maze generator.
+ *
+ * Templates are built in a single contiguous buffer of rows * (cols + 1)
+ * bytes, with a NUL after each row, and an array of row pointers into it,
+ * so a generated maze costs two allocations regardless of its size.
+ * Randomness comes from a private splitmix64 generator rather than rand(),
+ * so that results depend only on the seed, not on the C library or on
+ * other users of rand().
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "maze.h"
+#include "maze_gen.h"
+#include "debug.h"
+
+/// Characters used for generated walls.
+#define GEN_WALL '*'
+#define GEN_PILLAR '#'
+
+/// Rounds of smoothing applied to caverns.
+#define CAVERN_ROUNDS 4
+
+/**
+ * @brief Advance a splitmix64 generator and return its next output.
+ */
+static uint64_t gen_next(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/**
+ * @brief Return a pseudo-random number in [0, bound).
+ */
+static uint64_t gen_below(uint64_t *state, uint64_t bound) {
+    return gen_next(state) % bound;
+}
+
+/**
+ * @brief Carve a perfect maze into a grid that is entirely walls.
+ *
+ * Cells at odd (row, col) are rooms; the algorithm is an iterative
+ * randomized depth-first search that knocks down the wall between a room
+ * and a random unvisited neighbour, backtracking when there is none.
+ * Room indexes are kept on an explicit stack so that huge mazes do not
+ * overflow the thread stack.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int gen_perfect(char *grid, int rows, int cols, uint64_t *state) {
+    static const int dr[] = { -2, 0, 2, 0 };
+    static const int dc[] = { 0, -2, 0, 2 };
+    size_t stride = (size_t)cols + 1;
+    int room_rows = (rows - 1) / 2, room_cols = (cols - 1) / 2;
+
+    uint32_t *stack = malloc((size_t)room_rows * room_cols * sizeof(uint32_t));
+    if (!stack) return -1;
+
+    size_t top = 0;
+    int r = 1 + 2 * (int)gen_below(state, room_rows);
+    int c = 1 + 2 * (int)gen_below(state, room_cols);
+    grid[r * stride + c] = EMPTY;
+    stack[top++] = (uint32_t)((r / 2) * room_cols + c / 2);
+
+    while (top > 0) {
+        uint32_t room = stack[top - 1];
+        r = 1 + 2 * (room / room_cols);
+        c = 1 + 2 * (room % room_cols);
+
+        // Collect the unvisited neighbouring rooms
+        int choices[4], n = 0;
+        for (int d = 0; d < 4; d++) {
+            int nr = r + dr[d], nc = c + dc[d];
+            if (nr > 0 && nr < rows - 1 && nc > 0 && nc < cols - 1 &&
+                grid[nr * stride + nc] != EMPTY)
+                choices[n++] = d;
+        }
+        if (n == 0) {
+            top--;
+            continue;
+        }
+
+        int d = choices[gen_below(state, n)];
+        int nr = r + dr[d], nc = c + dc[d];
+        grid[(r + dr[d] / 2) * stride + (c + dc[d] / 2)] = EMPTY;
+        grid[nr * stride + nc] = EMPTY;
+        stack[top++] = (uint32_t)((nr / 2) * room_cols + nc / 2);
+    }
+
+    free(stack);
+    return 0;
+}
+
+/**
+ * @brief Grow caverns: random fill followed by cellular-automaton smoothing.
+ *
+ * Each round, an interior cell becomes a wall if at least five of the nine
+ * cells of its 3x3 neighbourhood are walls, and open otherwise.  The rule
+ * is applied from a snapshot of the previous round, so the result does not
+ * depend on scan order.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int gen_cavern(char *grid, int rows, int cols, int density, uint64_t *state) {
+    size_t stride = (size_t)cols + 1;
+
+    for (int r = 1; r < rows - 1; r++)
+        for (int c = 1; c < cols - 1; c++)
+            grid[r * stride + c] = ((int)gen_below(state, 100) < density) ? GEN_WALL : EMPTY;
+
+    char *prev = malloc((size_t)rows * stride);
+    if (!prev) return -1;
+
+    for (int round = 0; round < CAVERN_ROUNDS; round++) {
+        memcpy(prev, grid, (size_t)rows * stride);
+        for (int r = 1; r < rows - 1; r++) {
+            for (int c = 1; c < cols - 1; c++) {
+                int walls = 0;
+                for (int i = -1; i <= 1; i++)
+                    for (int j = -1; j <= 1; j++)
+                        walls += (prev[(r + i) * stride + (c + j)] != EMPTY);
+                grid[r * stride + c] = (walls >= 5) ? GEN_WALL : EMPTY;
+            }
+        }
+    }
+
+    free(prev);
+    return 0;
+}
+
+/**
+ * @brief Scatter single-cell pillars over an open floor.
+ */
+static void gen_arena(char *grid, int rows, int cols, int density, uint64_t *state) {
+    size_t stride = (size_t)cols + 1;
+
+    for (int r = 1; r < rows - 1; r++)
+        for (int c = 1; c < cols - 1; c++)
+            grid[r * stride + c] = ((int)gen_below(state, 100) < density) ? GEN_PILLAR : EMPTY;
+}
+
+int maze_gen_parse_kind(const char *name, MAZE_GEN_KIND *kindp) {
+    if (strcmp(name, "perfect") == 0) *kindp = MAZE_GEN_PERFECT;
+    else if (strcmp(name, "cavern") == 0) *kindp = MAZE_GEN_CAVERN;
+    else if (strcmp(name, "arena") == 0) *kindp = MAZE_GEN_ARENA;
+    else return -1;
+    return 0;
+}
+
+/**
+ * @brief Generate a maze template of the given kind.
+ *
+ * The grid starts out as all walls; each kind then opens up the interior,
+ * leaving the border intact.
+ *
+ * @param kind    Kind of maze.
+ * @param rows    Number of rows (>= 3).
+ * @param cols    Number of columns (>= 3).
+ * @param density Wall percentage for caverns and arenas.
+ * @param seed    Generator seed.
+ * @return NULL-terminated row array, or NULL on invalid arguments or allocation failure.
+ */
+char **maze_generate(MAZE_GEN_KIND kind, int rows, int cols, int density, unsigned long seed) {
+    if (rows < 3 || cols < 3 || density < 0 || density > 100 ||
+        (uint64_t)rows * cols > UINT32_MAX) {
+        error("maze_generate: Invalid maze %d x %d, density %d", rows, cols, density);
+        return NULL;
+    }
+
+    size_t stride = (size_t)cols + 1;
+    char **template = malloc(((size_t)rows + 1) * sizeof(char *));
+    char *grid = malloc((size_t)rows * stride);
+    if (!template || !grid) {
+        error("maze_generate: Memory allocation failed for %d x %d maze", rows, cols);
+        free(template);
+        free(grid);
+        return NULL;
+    }
+
+    memset(grid, GEN_WALL, (size_t)rows * stride);
+    for (int r = 0; r < rows; r++) {
+        grid[r * stride + cols] = '\0';
+        template[r] = grid + r * stride;
+    }
+    template[rows] = NULL;
+
+    uint64_t state = seed;
+    int rc = 0;
+    switch (kind) {
+    case MAZE_GEN_PERFECT: rc = gen_perfect(grid, rows, cols, &state); break;
+    case MAZE_GEN_CAVERN:  rc = gen_cavern(grid, rows, cols, density, &state); break;
+    case MAZE_GEN_ARENA:   gen_arena(grid, rows, cols, density, &state); break;
+    default:               rc = -1; break;
+    }
+    if (rc != 0) {
+        error("maze_generate: Failed to generate %d x %d maze", rows, cols);
+        maze_gen_free(template);
+        return NULL;
+    }
+
+    debug("maze_generate: Generated %d x %d maze (kind %d, density %d, seed %lu)",
+          rows, cols, kind, density, seed);
+    return template;
+}
+
+/**
+ * @brief Release a template returned by maze_generate().
+ */
+void maze_gen_free(char **template) {
+    if (!template) return;
+    free(template[0]);
+    free(template);
+}
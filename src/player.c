@@ -4,57 +4,198 @@
  *
  * This module manages player login/logout, state, communication,
  * view updates, scoring, and game events like laser hits.
- * Thread safety is ensured via recursive mutexes.
+ * Players live in a PLAYER_TABLE (one per game room), which maps player IDs
+ * to players and owns the room's scoreboard.  The functions in player.h use
+ * the default table, which plays in the default maze.
+ * Each player's state is changed only by tasks of the player's strand
+ * (see task_sched.h), and other players send it messages rather than
+ * taking a lock on it.
  * All PLAYER operations are reference-counted for memory safety.
  */
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
 #include <pthread.h>
 #include <signal.h>
 #include <unistd.h>
+#include <stdatomic.h>
 
 #include "player.h"
+#include "player_ext.h"
 #include "protocol.h"
+#include "protocol_ext.h"
 #include "maze.h"
+#include "maze_ext.h"
+#include "scoreboard.h"
+#include "lockprof.h"
+#include "trace.h"
+#include "slab.h"
+#include "task_sched.h"
 #include "debug.h"
 
 #define MAX_PLAYERS 256
 
+/// Longest name, including its terminator, kept inside the player object.
+#define PLAYER_NAME_INLINE 32
+
 /**
  * @struct player
  * @brief Internal representation of a MazeWar player.
  *
  * This structure holds all server-side state for a logged-in MazeWar player.
- * All mutable fields must be accessed under the player's recursive mutex.
- * The `laser_hit` field is marked volatile and updated asynchronously by the SIGUSR1 signal handler.
+ * The player is an actor: its mutable state (position, score, cached view,
+ * scoreboard version) is touched only by tasks of its strand, so it needs
+ * no lock.  Other players never change it directly; they post messages to
+ * the strand instead (a new view is to be shown, the scores have changed, a
+ * packet is to be sent), and read only the atomically published pose.
+ * The `laser_hit` flag is set by shooters and by the SIGUSR1 signal handler.
  */
 struct player {
-    pthread_mutex_t mutex;        /**< Recursive mutex for player state. */
-    int ref_count;                /**< Reference count for lifetime management. */
+    atomic_int ref_count;         /**< Reference count for lifetime management. */
     int client_fd;                /**< Socket descriptor for this player. */
-    OBJECT avatar;                /**< Character representing the player in the maze. */
-    char *name;                   /**< Player name (malloc-allocated). */
+    PLAYER_TABLE *table;          /**< Table (game room) the player is logged in to. */
+    OCCUPANT id;                  /**< Player ID: key in the table and occupant ID in the maze. */
+    OBJECT avatar;                /**< Character displaying the player in views. */
+    char *name;                   /**< Player name: name_inline, or malloc-allocated if too long. */
+    char name_inline[PLAYER_NAME_INLINE]; /**< Storage for short names. */
     int row, col;                 /**< Current maze coordinates. */
     DIRECTION dir;                /**< Current gaze direction (NORTH, EAST, etc). */
     int score;                    /**< Player's score. */
+    int caps;                     /**< MZW_CAP_* flags advertised by the client at login. */
+    unsigned long score_version;  /**< Scoreboard version last sent to this client. */
 
-    volatile sig_atomic_t laser_hit;  /**< Set to 1 when hit by a laser (signal-safe). */
+    atomic_int laser_hit;         /**< Set to 1 when hit by a laser (lock-free, so signal-safe). */
 
     pthread_t thread_id;          /**< Thread ID servicing this player (for SIGUSR1). */
     char last_view[VIEW_DEPTH][VIEW_WIDTH]; /**< Cached view sent to client. */
     int view_valid_depth;         /**< Valid depth of cached view; -1 = no valid view. */
+
+    STRAND strand;                /**< Runs everything that touches the state above (see player_strand()). */
+    _Atomic uint64_t pose;        /**< Position, direction and view validity, published for other players. */
+    atomic_int view_queued;       /**< A view update task is waiting in the strand. */
+    atomic_int view_dirty;        /**< The view is stale and awaits the table's next view batch. */
+    atomic_uint view_seq;         /**< Count of views the player has read from the maze itself. */
+    atomic_int scores_queued;     /**< A scoreboard update task is waiting in the strand. */
+    int logged_out;               /**< Set by player_logout(); messages still queued are dropped. */
+};
+
+
+
+/**
+ * @struct player_table
+ * @brief The players of one game room.
+ */
+struct player_table {
+    PLAYER *map[MAX_PLAYERS];     /**< Players indexed by player ID. */
+    pthread_mutex_t mutex;        /**< Protects map. */
+    SCOREBOARD *scores;           /**< Versioned scoreboard of this table's players. */
+    MAZE *maze;                   /**< Maze the players of this table play in. */
+    STRAND view_strand;           /**< Runs the table's view batches one at a time. */
+    atomic_int view_queued;       /**< A view batch is waiting in view_strand. */
+    PLAYER *batch_players[MAX_PLAYERS];  /**< Players of the running batch (view_strand only). */
+    MAZE_VIEW batch_views[MAX_PLAYERS];  /**< Their views (view_strand only). */
+    unsigned batch_seqs[MAX_PLAYERS];    /**< Their view_seq when the batch began (view_strand only). */
 };
 
+/**
+ * @struct player_view_msg
+ * @brief A view computed by a view batch, for a player's strand to show.
+ */
+typedef struct player_view_msg {
+    PLAYER *player;
+    unsigned seq;                 /**< The player's view_seq when the batch began. */
+    int depth;
+    char view[VIEW_DEPTH][VIEW_WIDTH];
+} PLAYER_VIEW_MSG;
 
+/// Messages carrying views from view batches to players' strands.
+static SLAB view_msg_slab = SLAB_INIT("view", sizeof(PLAYER_VIEW_MSG), 64);
 
-/// Global player map and its mutex.
-static PLAYER *player_map[MAX_PLAYERS];
-static pthread_mutex_t map_mutex = PTHREAD_MUTEX_INITIALIZER;
+/// View batch statistics (see player_view_report()).
+static atomic_ulong view_batches, views_batched, views_stale, views_unbatched;
+static atomic_int view_batch_max;
+
+/// Player objects, recycled so that a login/logout cycle does not use malloc().
+static SLAB player_slab = SLAB_INIT("player", sizeof(PLAYER), 64);
+
+/// Table used by the functions in player.h.
+static PLAYER_TABLE default_table = { .mutex = PTHREAD_MUTEX_INITIALIZER };
 // Thread-local pointer to the PLAYER object for the current thread
 __thread PLAYER *this_player = NULL;
 
+static void player_signal_hit(PLAYER *victim);
+
+/// Function that tells a victim's service thread it has been hit.
+static PLAYER_HIT_NOTIFIER *hit_notifier = player_signal_hit;
+
+static void player_send_score(PLAYER *player, OCCUPANT id, OBJECT glyph, int score);
+static void player_sync_all_scores(PLAYER_TABLE *table, PLAYER *self);
+static void player_update_views_near(PLAYER_TABLE *table, PLAYER *self,
+                                     int row1, int col1, int row2, int col2);
+static int player_do_update_view(PLAYER *player, int unused);
+static void player_hold(void *arg);
+static void player_release(void *arg);
+
+/**
+ * @struct player_op
+ * @brief An operation on a player's state, carried out by player_run().
+ */
+typedef struct player_op {
+    PLAYER *player;
+    int (*fn)(PLAYER *player, int arg);
+    int arg;
+    int rc;                       /**< Value returned by fn. */
+} PLAYER_OP;
+
+/**
+ * @brief Task that carries out a PLAYER_OP.
+ */
+static void player_op_task(void *arg) {
+    PLAYER_OP *op = arg;
+    op->rc = op->fn(op->player, op->arg);
+}
+
+/**
+ * @brief Carry out an operation on a player's state in the player's
+ * strand, and wait for it.
+ *
+ * If the strand is idle (or the caller is running it already), the
+ * operation runs at once on the calling thread; otherwise it runs after
+ * the messages already queued for the player.
+ *
+ * @param player Player whose state is operated on.
+ * @param fn     Operation.
+ * @param arg    Argument passed to fn.
+ * @return The value returned by fn.
+ */
+static int player_run(PLAYER *player, int (*fn)(PLAYER *, int), int arg) {
+    PLAYER_OP op = { .player = player, .fn = fn, .arg = arg };
+    strand_call(&player->strand, player_op_task, &op);
+    return op.rc;
+}
+
+/// Layout of a published pose: row and column, direction, view validity.
+#define POSE_ROW_SHIFT 40
+#define POSE_COL_SHIFT 16
+#define POSE_DIR_SHIFT 8
+#define POSE_COORD_MASK 0xFFFFFFULL
+#define POSE_VIEW_VALID 0x1ULL
+
+/**
+ * @brief Publish a player's position, direction and view validity for other
+ * players' threads (player's strand only).
+ * @param player Player whose state has changed.
+ */
+static void player_publish(PLAYER *player) {
+    uint64_t pose = ((uint64_t)player->row & POSE_COORD_MASK) << POSE_ROW_SHIFT |
+                    ((uint64_t)player->col & POSE_COORD_MASK) << POSE_COL_SHIFT |
+                    (uint64_t)(player->dir & 0xFF) << POSE_DIR_SHIFT |
+                    (player->view_valid_depth >= 0 ? POSE_VIEW_VALID : 0);
+    atomic_store(&player->pose, pose);
+}
+
 
 /**
  * @brief Signal handler for SIGUSR1 (laser hit).
@@ -66,7 +207,7 @@ __thread PLAYER *this_player = NULL;
 static void handle_sigusr1(int sig __attribute__((unused))) {
     debug("SIGUSR1 handler: thread %lu, this_player = %p", pthread_self(), (void *)this_player);
     if (this_player != NULL) {
-        this_player->laser_hit = 1;
+        atomic_store(&this_player->laser_hit, 1);
         debug("SIGUSR1 handler: laser_hit set for %s[%c]", this_player->name, this_player->avatar);
     } else {
         debug("SIGUSR1 handler: this_player was NULL");
@@ -75,6 +216,22 @@ static void handle_sigusr1(int sig __attribute__((unused))) {
 
 
 
+/**
+ * @brief Default hit notifier: interrupt the victim's service thread with SIGUSR1.
+ * @param victim Player that has been hit.
+ */
+static void player_signal_hit(PLAYER *victim) {
+    pthread_kill(victim->thread_id, SIGUSR1);
+}
+
+/**
+ * @brief Replace the way victims of laser hits are notified.
+ * @param notify Notifier to use, or NULL for the default (SIGUSR1).
+ */
+void player_set_hit_notifier(PLAYER_HIT_NOTIFIER *notify) {
+    hit_notifier = notify ? notify : player_signal_hit;
+}
+
 /**
  * @brief Initialize the player module and install signal handler.
  */
@@ -83,86 +240,205 @@ void player_init(void) {
     sa.sa_handler = handle_sigusr1;
     sigemptyset(&sa.sa_mask);
     sigaction(SIGUSR1, &sa, NULL);
-    memset(player_map, 0, sizeof(player_map));
+    memset(default_table.map, 0, sizeof(default_table.map));
+    default_table.scores = scoreboard_create();
+    default_table.maze = maze_default();
+    strand_init(&default_table.view_strand);
     debug("player_init: player module initialized.");
 }
 
 /**
- * @brief Finalize the player module, releasing all player resources.
+ * @brief Release every player still registered in a table.
+ * @param table Table to clear.
  */
-void player_fini(void) {
-    pthread_mutex_lock(&map_mutex);
+static void player_table_clear(PLAYER_TABLE *table) {
+    strand_drain(&table->view_strand);
+    prof_lock(&table->mutex, &lock_table);
     for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (player_map[i]) {
-            debug("player_fini: unref player %p for avatar %d", player_map[i], i);
-            player_unref(player_map[i], "player_fini");
+        if (table->map[i]) {
+            debug("player_table_clear: unref player %p for id %d", table->map[i], i);
+            player_unref(table->map[i], "player_fini");
+            table->map[i] = NULL;
         }
     }
-    pthread_mutex_unlock(&map_mutex);
+    prof_unlock(&table->mutex);
+    scoreboard_destroy(table->scores);
+    table->scores = NULL;
+}
+
+/**
+ * @brief Finalize the player module, releasing all player resources.
+ */
+void player_fini(void) {
+    player_table_clear(&default_table);
     debug("player_fini: player module finalized.");
 }
 
+/**
+ * @brief Create a player table for an additional game room.
+ * @param maze Maze in which the table's players play.
+ * @return New table, or NULL on allocation failure.
+ */
+PLAYER_TABLE *player_table_create(MAZE *maze) {
+    PLAYER_TABLE *table = calloc(1, sizeof(PLAYER_TABLE));
+    if (!table) {
+        error("player_table_create: Memory allocation failed");
+        return NULL;
+    }
+    if (!(table->scores = scoreboard_create())) {
+        free(table);
+        return NULL;
+    }
+    pthread_mutex_init(&table->mutex, NULL);
+    table->maze = maze;
+    strand_init(&table->view_strand);
+    return table;
+}
+
+/**
+ * @brief Destroy a table created by player_table_create(), releasing its players.
+ * @param table Table to destroy (may be NULL).
+ */
+void player_table_destroy(PLAYER_TABLE *table) {
+    if (!table || table == &default_table) return;
+    player_table_clear(table);
+    pthread_mutex_destroy(&table->mutex);
+    free(table);
+}
+
+/**
+ * @brief Get the table used by the functions in player.h.
+ */
+PLAYER_TABLE *player_default_table(void) {
+    return &default_table;
+}
+
+/**
+ * @brief Pick a free player ID for an extended-ID login.
+ *
+ * IDs equal to uppercase avatar characters are handed out last, so that
+ * base-protocol clients (whose ID is their avatar) are not locked out by
+ * extended-ID players while other IDs remain.  Must be called with the table mutex held.
+ *
+ * @param table Table in which to allocate.
+ * @return A free ID, or -1 if the table is full.
+ */
+static int player_alloc_id(PLAYER_TABLE *table) {
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < MAX_PLAYERS; i++) {
+            if (table->map[i]) continue;
+            if (pass == 0 && IS_AVATAR(i)) continue;
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Copy a name into a player, inline if it is short enough.
+ * @param player Player being initialized.
+ * @param name   Name to copy.
+ */
+static void player_set_name(PLAYER *player, const char *name) {
+    size_t len = strlen(name);
+    if (len < sizeof(player->name_inline)) {
+        memcpy(player->name_inline, name, len + 1);
+        player->name = player->name_inline;
+    } else {
+        player->name = strdup(name);
+    }
+}
+
+/**
+ * @brief Free a player's name if it did not fit inline.
+ * @param player Player being destroyed.
+ */
+static void player_free_name(PLAYER *player) {
+    if (player->name != player->name_inline)
+        free(player->name);
+    player->name = NULL;
+}
+
 /**
  * @brief Attempt to log in a player with a specified avatar.
  *
- * This function creates and initializes a PLAYER object, assigns it an avatar,
- * places it randomly into the maze, and registers it into the global player map.
+ * Equivalent to player_login_ext() with no capabilities: the avatar is used
+ * as the player ID and must not already be in use.
+ */
+PLAYER *player_login(int clientfd, OBJECT avatar, char *name) {
+    return player_login_ext(&default_table, clientfd, avatar, name, 0);
+}
+
+/**
+ * @brief Attempt to log in a player with a specified avatar and client capabilities.
+ *
+ * This function creates and initializes a PLAYER object, assigns it an ID and avatar,
+ * places it randomly into the table's maze, and registers it into the table.
  * Also sets up per-thread tracking (`this_player`) for SIGUSR1 hit detection.
  *
+ * @param table    Table (game room) to log in to.
  * @param clientfd File descriptor of the client's socket connection.
  * @param avatar   Desired avatar character for the player.
  * @param name     User's name (copied internally).
+ * @param caps     MZW_CAP_* flags from the client's LOGIN packet.
  * @return Pointer to PLAYER object on success, or NULL on failure.
  */
-PLAYER *player_login(int clientfd, OBJECT avatar, char *name) {
-    pthread_mutex_lock(&map_mutex);
-
-    if (player_map[avatar]) {
-        pthread_mutex_unlock(&map_mutex);
+PLAYER *player_login_ext(PLAYER_TABLE *table, int clientfd, OBJECT avatar, char *name, int caps) {
+    prof_lock(&table->mutex, &lock_table);
+
+    int id = avatar;
+    if (caps & MZW_CAP_EXTENDED_ID) {
+        if ((id = player_alloc_id(table)) < 0) {
+            prof_unlock(&table->mutex);
+            debug("player_login: No free player IDs for %c", avatar);
+            return NULL;
+        }
+    } else if (table->map[id]) {
+        prof_unlock(&table->mutex);
         debug("player_login: Avatar %c already in use", avatar);
         return NULL;
     }
 
-    PLAYER *player = calloc(1, sizeof(PLAYER));
+    PLAYER *player = slab_alloc(&player_slab);
     if (!player) {
-        pthread_mutex_unlock(&map_mutex);
+        prof_unlock(&table->mutex);
         error("player_login: Memory allocation failed");
         return NULL;
     }
 
-    // Initialize recursive mutex for safe reentrant locking
-    pthread_mutexattr_t attr;
-    pthread_mutexattr_init(&attr);
-    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
-    pthread_mutex_init(&player->mutex, &attr);
+    // While the strand has messages to run, it keeps the player alive
+    strand_init_owned(&player->strand, player_hold, player_release, player);
 
-    player->ref_count = 1;
+    atomic_init(&player->ref_count, 1);
     player->client_fd = clientfd;
+    player->table = table;
+    player->id = id;
     player->avatar = avatar;
-    player->name = strdup(name ? name : "Anonymous");
+    player->caps = caps;
+    player_set_name(player, name ? name : "Anonymous");
     player->dir = NORTH;
     player->view_valid_depth = -1;
 
     // Attempt to place the avatar randomly into the maze
-    if (maze_set_player_random(avatar, &player->row, &player->col) != 0) {
+    if (maze_set_occupant_random(table->maze, id, avatar, &player->row, &player->col) != 0) {
         debug("player_login: Failed to place avatar %c in maze", avatar);
-        free(player->name);
-        pthread_mutex_destroy(&player->mutex);
-        free(player);
-        pthread_mutex_unlock(&map_mutex);
+        player_free_name(player);
+        slab_free(&player_slab, player);
+        prof_unlock(&table->mutex);
         return NULL;
     }
+    player_publish(player);
 
     // Record the thread ID and set thread-local SIGUSR1 player context
     player->thread_id = pthread_self();
     this_player = player;
     debug("player_login: this_player set to %p for thread %lu", (void *)player, player->thread_id);
 
-    // Register player in global map
-    player_map[avatar] = player;
+    // Register player in the table
+    table->map[id] = player;
 
-    pthread_mutex_unlock(&map_mutex);
-    success("player_login: %s[%c] logged in", player->name, avatar);
+    prof_unlock(&table->mutex);
+    success("player_login: %s[%c] logged in with id %d", player->name, avatar, id);
     return player;
 }
 
@@ -170,38 +446,87 @@ PLAYER *player_login(int clientfd, OBJECT avatar, char *name) {
 
 
 /**
- * @brief Log out a player and remove from the map and maze.
- * @param player Player to log out.
+ * @brief Remove a player from its table, maze and scoreboard (player's strand).
+ *
+ * Messages queued for the player after this are dropped, so nothing more
+ * is written to its connection, which may be closed as soon as the
+ * logout returns.
+ *
+ * @param player Player logging out.
+ * @return 0.
  */
-void player_logout(PLAYER *player) {
-    pthread_mutex_lock(&map_mutex);
-    if (player_map[player->avatar] == player)
-        player_map[player->avatar] = NULL;
-    pthread_mutex_unlock(&map_mutex);
+static int player_do_logout(PLAYER *player, int unused) {
+    PLAYER_TABLE *table = player->table;
+    (void)unused;
 
-    maze_remove_player(player->avatar, player->row, player->col);
+    prof_lock(&table->mutex, &lock_table);
+    if (table->map[player->id] == player)
+        table->map[player->id] = NULL;
+    prof_unlock(&table->mutex);
+
+    maze_remove_occupant(table->maze, player->id, player->row, player->col);
+    scoreboard_remove(table->scores, player->id);
 
     // Notify client to remove score from scoreboard
-    MZW_PACKET pkt = { .type = MZW_SCORE_PKT, .param1 = player->avatar, .param2 = -1 };
-    player_send_packet(player, &pkt, NULL);
+    player_send_score(player, player->id, player->avatar, -1);
+    player->logged_out = 1;
+
+    // Remaining players pick up the removal as a one-entry delta
+    player_sync_all_scores(table, NULL);
+    return 0;
+}
 
+/**
+ * @brief Log out a player and remove from the map and maze.
+ *
+ * The player's queued commands are carried out first.
+ *
+ * @param player Player to log out.
+ */
+void player_logout(PLAYER *player) {
+    player_run(player, player_do_logout, 0);
     debug("player_logout: Player %s[%c] logged out", player->name, player->avatar);
     player_unref(player, "logout");
 }
 
 /**
  * @brief Get a reference to the player object for a given avatar.
+ *
+ * The avatar is interpreted as a player ID, which finds any player logged
+ * in without MZW_CAP_EXTENDED_ID.
+ *
  * @param avatar Avatar character.
  * @return PLAYER* with incremented ref count, or NULL if not found.
  */
 PLAYER *player_get(unsigned char avatar) {
-    pthread_mutex_lock(&map_mutex);
-    PLAYER *p = player_map[avatar];
+    return player_get_by_id(&default_table, avatar);
+}
+
+/**
+ * @brief Get a reference to the player object with a given ID.
+ * @param table Table to look in.
+ * @param id    Player ID.
+ * @return PLAYER* with incremented ref count, or NULL if not found.
+ */
+PLAYER *player_get_by_id(PLAYER_TABLE *table, OCCUPANT id) {
+    if (id >= MAX_PLAYERS) return NULL;
+
+    prof_lock(&table->mutex, &lock_table);
+    PLAYER *p = table->map[id];
     if (p) player_ref(p, "get");
-    pthread_mutex_unlock(&map_mutex);
+    prof_unlock(&table->mutex);
     return p;
 }
 
+/**
+ * @brief Get the ID of a player.
+ * @param player Player to query.
+ * @return The player's ID.
+ */
+OCCUPANT player_get_id(PLAYER *player) {
+    return player->id;
+}
+
 /**
  * @brief Increment reference count on player.
  * @param player Player to reference.
@@ -209,10 +534,9 @@ PLAYER *player_get(unsigned char avatar) {
  * @return PLAYER* (same as input).
  */
 PLAYER *player_ref(PLAYER *player, char *why) {
-    pthread_mutex_lock(&player->mutex);
-    player->ref_count++;
-    debug("player_ref: %p -> %d (%s)", player, player->ref_count, why);
-    pthread_mutex_unlock(&player->mutex);
+    int refs = atomic_fetch_add(&player->ref_count, 1) + 1;
+    debug("player_ref: %p -> %d (%s)", player, refs, why);
+    (void)refs;
     return player;
 }
 
@@ -222,37 +546,265 @@ PLAYER *player_ref(PLAYER *player, char *why) {
  * @param why    Reason for unref (for debug).
  */
 void player_unref(PLAYER *player, char *why) {
-    pthread_mutex_lock(&player->mutex);
-    player->ref_count--;
-    debug("player_unref: %p -> %d (%s)", player, player->ref_count, why);
+    int refs = atomic_fetch_sub(&player->ref_count, 1) - 1;
+    debug("player_unref: %p -> %d (%s)", player, refs, why);
 
-    if (player->ref_count == 0) {
-        free(player->name);
-        pthread_mutex_unlock(&player->mutex);
-        pthread_mutex_destroy(&player->mutex);
-        free(player);
+    if (refs == 0) {
+        player_free_name(player);
+        slab_free(&player_slab, player);
         debug("player_unref: Freed player object");
-        return;
     }
-    pthread_mutex_unlock(&player->mutex);
+}
+
+/**
+ * @brief Reference taken by a player's strand while it has messages to run.
+ */
+static void player_hold(void *arg) {
+    player_ref(arg, "strand");
+}
+
+/**
+ * @brief Release the reference taken by player_hold().
+ */
+static void player_release(void *arg) {
+    player_unref(arg, "strand");
+}
+
+/**
+ * @brief Take a reference to every player currently in a table.
+ *
+ * Players may log out (and be freed) at any time, so code that visits the
+ * players of a table works on such a snapshot rather than on the map.
+ *
+ * @param table   Table to snapshot.
+ * @param players [out] Receives the players, each with a reference held.
+ * @return Number of players stored.
+ */
+static int player_table_snapshot(PLAYER_TABLE *table, PLAYER *players[MAX_PLAYERS]) {
+    int n = 0;
+    prof_lock(&table->mutex, &lock_table);
+    for (int i = 0; i < MAX_PLAYERS; i++)
+        if (table->map[i]) players[n++] = player_ref(table->map[i], "snapshot");
+    prof_unlock(&table->mutex);
+    return n;
+}
+
+/**
+ * @brief Release the references taken by player_table_snapshot().
+ */
+static void player_snapshot_release(PLAYER *players[], int n) {
+    for (int i = 0; i < n; i++)
+        player_unref(players[i], "snapshot");
+}
+
+/// Payloads up to this size are copied into a queued packet itself.
+#define PLAYER_PACKET_INLINE 128
+
+/**
+ * @struct player_packet
+ * @brief A packet to be sent by a player's strand.
+ */
+typedef struct player_packet {
+    PLAYER *player;
+    MZW_PACKET pkt;
+    void *data;                   /**< Payload: NULL, inline_data, or (if queued) malloc-allocated. */
+    int rc;                       /**< Result of the send. */
+    char inline_data[PLAYER_PACKET_INLINE];
+} PLAYER_PACKET;
+
+/// Packets queued by player_post_packet().
+static SLAB player_packet_slab = SLAB_INIT("player_packet", sizeof(PLAYER_PACKET), 64);
+
+/**
+ * @brief Task that sends a packet to a player's client, unless the player
+ * has logged out.
+ */
+static void player_packet_task(void *arg) {
+    PLAYER_PACKET *msg = arg;
+    msg->rc = msg->player->logged_out ? -1 :
+        proto_send_packet(msg->player->client_fd, &msg->pkt, msg->data);
+}
+
+/**
+ * @brief Task that sends a packet queued by player_post_packet(), and frees it.
+ */
+static void player_posted_packet_task(void *arg) {
+    PLAYER_PACKET *msg = arg;
+    player_packet_task(msg);
+    if (msg->data != msg->inline_data) free(msg->data);
+    slab_free(&player_packet_slab, msg);
+}
+
+/**
+ * @brief Queue a copy of a packet in a player's strand, without waiting.
+ * @return 0 on success, -1 if memory is exhausted.
+ */
+static int player_post_packet(PLAYER *player, MZW_PACKET *pkt, void *data) {
+    PLAYER_PACKET *msg = slab_alloc(&player_packet_slab);
+    if (msg && data) {
+        msg->data = pkt->size <= PLAYER_PACKET_INLINE ? msg->inline_data : malloc(pkt->size);
+        if (!msg->data) {
+            slab_free(&player_packet_slab, msg);
+            msg = NULL;
+        } else {
+            memcpy(msg->data, data, pkt->size);
+        }
+    }
+    if (!msg) {
+        error("player_post_packet: Memory allocation failed");
+        return -1;
+    }
+    msg->player = player;
+    msg->pkt = *pkt;
+    strand_post(&player->strand, player_posted_packet_task, msg);
+    return 0;
 }
 
 /**
  * @brief Thread-safe send of a packet to the player's client.
+ *
+ * Packets are written by the player's strand, so that they never
+ * interleave.  A task of another player's strand queues a copy and goes
+ * on, rather than wait for this player; any other thread waits for the
+ * send.
+ *
  * @param player Player to send to.
  * @param pkt    Packet to send.
  * @param data   Optional payload.
- * @return 0 on success, nonzero on error.
+ * @return 0 on success (or once queued), nonzero on error.
  */
 int player_send_packet(PLAYER *player, MZW_PACKET *pkt, void *data) {
-    pthread_mutex_lock(&player->mutex);
-    int rc = proto_send_packet(player->client_fd, pkt, data);
-    pthread_mutex_unlock(&player->mutex);
-    return rc;
+    STRAND *current = strand_current();
+    if (current == &player->strand)
+        return proto_send_packet(player->client_fd, pkt, data);
+    if (current)
+        return player_post_packet(player, pkt, data);
+
+    PLAYER_PACKET msg = { .player = player, .pkt = *pkt, .data = data };
+    strand_call(&player->strand, player_packet_task, &msg);
+    return msg.rc;
+}
+
+/**
+ * @brief Send a single scoreboard entry to a player's client.
+ *
+ * Extended-ID clients cannot receive an ID in param1, so they always get
+ * the batched form, here with a single record.
+ *
+ * @param player Player whose client is to receive the entry.
+ * @param id     ID of the player the entry describes.
+ * @param glyph  Avatar of the player the entry describes.
+ * @param score  Score, or -1 to remove the entry.
+ */
+static void player_send_score(PLAYER *player, OCCUPANT id, OBJECT glyph, int score) {
+    if (player->caps & MZW_CAP_EXTENDED_ID) {
+        MZW_SCORE_RECORD record = { .id = htons(id), .score = htons(score), .glyph = glyph };
+        MZW_PACKET pkt = {
+            .type = MZW_SCORE_PKT,
+            .param1 = MZW_SCORE_BATCH,
+            .size = sizeof(record)
+        };
+        player_send_packet(player, &pkt, &record);
+    } else {
+        MZW_PACKET pkt = { .type = MZW_SCORE_PKT, .param1 = glyph, .param2 = score };
+        player_send_packet(player, &pkt, NULL);
+    }
+}
+
+/**
+ * @brief Bring a player's scoreboard up to date with the shared scoreboard.
+ *
+ * Only entries that changed since the version last sent to this client are
+ * transmitted.  Clients advertising MZW_CAP_SCORE_BATCH receive a delta of
+ * several entries as one batched SCORE packet; others get one SCORE packet
+ * per entry.  Clients without MZW_CAP_EXTENDED_ID see only the players
+ * whose ID is their avatar.
+ *
+ * @param player Player whose client is to be updated (player's strand).
+ */
+static void player_sync_scores(PLAYER *player) {
+    SCORE_ENTRY delta[SCOREBOARD_SIZE];
+    unsigned long version;
+
+    int n = scoreboard_delta(player->table->scores, player->score_version, delta, SCOREBOARD_SIZE, &version);
+
+    // A client without extended IDs knows players by avatar, so entries of
+    // extended-ID players, whose avatar may be that of another player, would
+    // overwrite or remove the wrong entry: leave them out
+    if (!(player->caps & MZW_CAP_EXTENDED_ID)) {
+        int kept = 0;
+        for (int i = 0; i < n; i++)
+            if (delta[i].id == (OCCUPANT)delta[i].glyph) delta[kept++] = delta[i];
+        n = kept;
+    }
+
+    if (n > 1 && (player->caps & (MZW_CAP_SCORE_BATCH | MZW_CAP_EXTENDED_ID))) {
+        MZW_SCORE_RECORD records[SCOREBOARD_SIZE];
+        for (int i = 0; i < n; i++) {
+            records[i].id = htons(delta[i].id);
+            records[i].score = htons(delta[i].score);
+            records[i].glyph = delta[i].glyph;
+            records[i].reserved = 0;
+        }
+        MZW_PACKET pkt = {
+            .type = MZW_SCORE_PKT,
+            .param1 = MZW_SCORE_BATCH,
+            .size = n * sizeof(MZW_SCORE_RECORD)
+        };
+        player_send_packet(player, &pkt, records);
+    } else {
+        for (int i = 0; i < n; i++) {
+            player_send_score(player, delta[i].id, delta[i].glyph, delta[i].score);
+        }
+    }
+
+    player->score_version = version;
+    debug("player_sync_scores: %c sent %d entries (now at version %lu)",
+          player->avatar, n, version);
+}
+
+/**
+ * @brief Task that brings a player's scoreboard up to date.
+ * @param arg The player.
+ */
+static void player_scores_task(void *arg) {
+    PLAYER *player = arg;
+    atomic_store(&player->scores_queued, 0);
+    if (!player->logged_out)
+        player_sync_scores(player);
+}
+
+/**
+ * @brief Send every player of a table the scoreboard changes it has not yet seen.
+ *
+ * The calling player (if any) is updated at once; the others are sent a
+ * message to update themselves, unless one is already waiting.
+ *
+ * @param table Table whose players are to be updated.
+ * @param self  Player whose strand is calling (may be NULL).
+ */
+static void player_sync_all_scores(PLAYER_TABLE *table, PLAYER *self) {
+    PLAYER *players[MAX_PLAYERS];
+    int n = player_table_snapshot(table, players);
+
+    proto_batch_begin();
+    for (int i = 0; i < n; i++) {
+        PLAYER *p = players[i];
+        if (p == self)
+            player_sync_scores(p);
+        else if (!atomic_exchange(&p->scores_queued, 1))
+            strand_post(&p->strand, player_scores_task, p);
+    }
+    proto_batch_end();
+    player_snapshot_release(players, n);
 }
 
 /**
  * @brief Get current location and direction for a player.
+ *
+ * This reads the pose the player last published, so it does not wait for
+ * the player's strand.
+ *
  * @param player Player to query.
  * @param rowp   [out] Row index.
  * @param colp   [out] Column index.
@@ -260,172 +812,425 @@ int player_send_packet(PLAYER *player, MZW_PACKET *pkt, void *data) {
  * @return 0 if valid, nonzero otherwise.
  */
 int player_get_location(PLAYER *player, int *rowp, int *colp, int *dirp) {
-    pthread_mutex_lock(&player->mutex);
-    *rowp = player->row;
-    *colp = player->col;
-    *dirp = player->dir;
-    pthread_mutex_unlock(&player->mutex);
+    uint64_t pose = atomic_load(&player->pose);
+    *rowp = (int)((pose >> POSE_ROW_SHIFT) & POSE_COORD_MASK);
+    *colp = (int)((pose >> POSE_COL_SHIFT) & POSE_COORD_MASK);
+    *dirp = (int)((pose >> POSE_DIR_SHIFT) & 0xFF);
     return 0;
 }
 
 /**
- * @brief Move the player's avatar forward or backward.
+ * @brief Move the player's avatar (player's strand).
  * @param player Player to move.
  * @param sign   1 for forward, -1 for backward.
  * @return 0 on success, nonzero on error.
  */
-int player_move(PLAYER *player, int sign) {
-    pthread_mutex_lock(&player->mutex);
+static int player_do_move(PLAYER *player, int sign) {
     DIRECTION move_dir = (sign == -1) ? REVERSE(player->dir) : player->dir;
-    int rc = maze_move(player->row, player->col, move_dir);
+    int old_row = player->row;
+    int old_col = player->col;
+    int rc = maze_move_in(player->table->maze, player->row, player->col, move_dir);
     if (rc == 0) {
         // Update coordinates on successful move
         if (move_dir == NORTH) player->row--;
         else if (move_dir == SOUTH) player->row++;
         else if (move_dir == WEST)  player->col--;
         else if (move_dir == EAST)  player->col++;
+        player_publish(player);
     }
-    pthread_mutex_unlock(&player->mutex);
 
-    // Update all player views after move
-    for (int i = 0; i < MAX_PLAYERS; i++)
-        if (player_map[i]) player_update_view(player_map[i]);
+    // Update the views of the players that can see either affected cell
+    proto_batch_begin();
+    if (rc == 0)
+        player_update_views_near(player->table, player, old_row, old_col, player->row, player->col);
+    else
+        player_do_update_view(player, 0);
+    proto_batch_end();
+    return rc;
+}
 
+/**
+ * @brief Move the player's avatar forward or backward.
+ * @param player Player to move.
+ * @param sign   1 for forward, -1 for backward.
+ * @return 0 on success, nonzero on error.
+ */
+int player_move(PLAYER *player, int sign) {
+    int rc = player_run(player, player_do_move, sign);
     debug("player_move: Player %p moved %s", player, (sign == 1) ? "forward" : "backward");
     return rc;
 }
 
 /**
- * @brief Rotate the player's gaze.
+ * @brief Rotate the player's gaze (player's strand).
  * @param player Player to rotate.
  * @param dir    1 for CCW, -1 for CW.
+ * @return 0.
  */
-void player_rotate(PLAYER *player, int dir) {
-    pthread_mutex_lock(&player->mutex);
+static int player_do_rotate(PLAYER *player, int dir) {
     player->dir = (dir == 1) ? TURN_LEFT(player->dir) : TURN_RIGHT(player->dir);
-    player_invalidate_view(player);
-    pthread_mutex_unlock(&player->mutex);
+    player->view_valid_depth = -1;
+    player_publish(player);
+    return player_do_update_view(player, 0);
+}
 
-    player_update_view(player);
+/**
+ * @brief Rotate the player's gaze.
+ * @param player Player to rotate.
+ * @param dir    1 for CCW, -1 for CW.
+ */
+void player_rotate(PLAYER *player, int dir) {
+    player_run(player, player_do_rotate, dir);
     debug("player_rotate: Player %p rotated %s", player, (dir == 1) ? "CCW" : "CW");
 }
 
+/**
+ * @brief Invalidate the player's cached view (player's strand).
+ * @return 0.
+ */
+static int player_do_invalidate_view(PLAYER *player, int unused) {
+    (void)unused;
+    player->view_valid_depth = -1;
+    player_publish(player);
+    return 0;
+}
+
 /**
  * @brief Invalidate the player's cached view.
  * @param player Player whose view is invalidated.
  */
 void player_invalidate_view(PLAYER *player) {
-    player->view_valid_depth = -1;
+    player_run(player, player_do_invalidate_view, 0);
     debug("player_invalidate_view: Player %p view invalidated", player);
 }
 
 /**
- * @brief Update the player's view based on current maze state.
- * @param player Player to update.
+ * @brief Bring the player's client up to date with a view (player's strand).
+ *
+ * The cells that differ from the cached view are encoded into one buffer
+ * and sent with a single write; the cache then holds the new view.
+ *
+ * @param player Player whose client is updated.
+ * @param view   View to show.
+ * @param depth  Depth of the view.
  */
-void player_update_view(PLAYER *player) {
-    char view[VIEW_DEPTH][VIEW_WIDTH];
-    pthread_mutex_lock(&player->mutex);
-    int depth = maze_get_view((VIEW *)view, player->row, player->col, player->dir, VIEW_DEPTH);
+static void player_show_view(PLAYER *player, char (*view)[VIEW_WIDTH], int depth) {
+    MZW_PACKET pkts[1 + VIEW_DEPTH * VIEW_WIDTH];
+    int n = 0;
+    uint32_t sent = 0;
 
     if (player->view_valid_depth < 0) {
-        // Full update: send CLEAR then SHOW for all cells
-        MZW_PACKET clear = { .type = MZW_CLEAR_PKT };
-        player_send_packet(player, &clear, NULL);
-
-        for (int d = 0; d < depth; d++) {
-            for (int x = 0; x < VIEW_WIDTH; x++) {
-                MZW_PACKET show = {
+        // Full update: CLEAR then SHOW for all cells
+        pkts[n++] = (MZW_PACKET){ .type = MZW_CLEAR_PKT };
+        sent = TRACE_VIEW_FULL;
+    }
+    // An incremental update sends only changed cells, and every cell beyond
+    // the depth of the cached view, which holds nothing valid
+    for (int d = 0; d < depth; d++) {
+        for (int x = 0; x < VIEW_WIDTH; x++) {
+            if (player->view_valid_depth < 0 || d >= player->view_valid_depth ||
+                view[d][x] != player->last_view[d][x]) {
+                pkts[n++] = (MZW_PACKET){
                     .type = MZW_SHOW_PKT,
                     .param1 = view[d][x],
                     .param2 = x,
                     .param3 = d
                 };
-                player_send_packet(player, &show, NULL);
-            }
-        }
-    } else {
-        // Incremental update: only send changed cells
-        for (int d = 0; d < depth; d++) {
-            for (int x = 0; x < VIEW_WIDTH; x++) {
-                if (view[d][x] != player->last_view[d][x]) {
-                    MZW_PACKET show = {
-                        .type = MZW_SHOW_PKT,
-                        .param1 = view[d][x],
-                        .param2 = x,
-                        .param3 = d
-                    };
-                    player_send_packet(player, &show, NULL);
-                }
+                sent++;
             }
         }
     }
-    memcpy(player->last_view, view, sizeof(view));
+    proto_send_packets(player->client_fd, pkts, n);
+
+    memcpy(player->last_view, view, sizeof(player->last_view));
+    int was_valid = (player->view_valid_depth >= 0);
     player->view_valid_depth = depth;
-    pthread_mutex_unlock(&player->mutex);
+    if (!was_valid) player_publish(player);
+    TRACE(TRACE_VIEW_SENT, player->id, sent);
+}
+
+/**
+ * @brief Update the player's view based on current maze state (player's strand).
+ * @param player Player to update.
+ * @return 0.
+ */
+static int player_do_update_view(PLAYER *player, int unused) {
+    char view[VIEW_DEPTH][VIEW_WIDTH];
+    (void)unused;
+    // Any view batch that began before this is older than what is read here
+    atomic_fetch_add(&player->view_seq, 1);
+    int depth = maze_get_view_in(player->table->maze, (VIEW *)view, player->row, player->col, player->dir, VIEW_DEPTH);
+    player_show_view(player, view, depth);
+    return 0;
+}
+
+/**
+ * @brief Update the player's view based on current maze state.
+ * @param player Player to update.
+ */
+void player_update_view(PLAYER *player) {
+    player_run(player, player_do_update_view, 0);
     debug("player_update_view: Player %p view updated", player);
 }
 
 /**
- * @brief Fire the player's laser in the direction of gaze.
+ * @brief Task that brings a player's view up to date.
+ * @param arg The player.
+ */
+static void player_view_task(void *arg) {
+    PLAYER *player = arg;
+    atomic_store(&player->view_queued, 0);
+    if (!player->logged_out)
+        player_do_update_view(player, 0);
+}
+
+/**
+ * @brief Tell a player that its view may be stale.
  *
- * This function searches in the current direction of gaze to find the first
- * avatar (if any) in the laser's path. If a player is hit, the victim's thread
- * is notified via SIGUSR1, the shooter's score is incremented, and a SCORE
- * packet is broadcast to all clients. The victim will detect the signal,
- * process the hit, and eventually respawn.
+ * Messages sent while one is already waiting are merged into it.
+ *
+ * @param player Player whose view is to be updated.
+ */
+static void player_post_view(PLAYER *player) {
+    if (atomic_exchange(&player->view_queued, 1)) return;
+    strand_post(&player->strand, player_view_task, player);
+}
+
+/**
+ * @brief Check whether a cell lies within a field of view.
+ *
+ * The view is the VIEW_DEPTH x VIEW_WIDTH strip starting at the player's
+ * own cell and extending in the direction of gaze.
  *
+ * @param row    Row of the player.
+ * @param col    Column of the player.
+ * @param dir    Direction of gaze.
+ * @param crow   Row of the cell.
+ * @param ccol   Column of the cell.
+ * @return nonzero if the view covers the cell.
+ */
+static int player_sees(int row, int col, int dir, int crow, int ccol) {
+    int dr = crow - row;
+    int dc = ccol - col;
+    switch (dir) {
+    case NORTH: return (dr <= 0 && dr > -VIEW_DEPTH && dc >= -1 && dc <= 1);
+    case SOUTH: return (dr >= 0 && dr < VIEW_DEPTH && dc >= -1 && dc <= 1);
+    case WEST:  return (dc <= 0 && dc > -VIEW_DEPTH && dr >= -1 && dr <= 1);
+    case EAST:  return (dc >= 0 && dc < VIEW_DEPTH && dr >= -1 && dr <= 1);
+    }
+    return 0;
+}
+
+/**
+ * @brief Check whether a change to the maze requires a player's view to be
+ * updated: its view is invalid, or covers one of the changed cells.
+ *
+ * This reads the pose the player last published; if the player is moving,
+ * it updates its own view after publishing its new pose.
+ *
+ * @param player Player whose view is checked.
+ * @param row1   Row of the first changed cell.
+ * @param col1   Column of the first changed cell.
+ * @param row2   Row of the second changed cell.
+ * @param col2   Column of the second changed cell.
+ * @return nonzero if the view needs updating.
+ */
+static int player_view_affected(PLAYER *player, int row1, int col1, int row2, int col2) {
+    uint64_t pose = atomic_load(&player->pose);
+    if (!(pose & POSE_VIEW_VALID)) return 1;
+    int row = (int)((pose >> POSE_ROW_SHIFT) & POSE_COORD_MASK);
+    int col = (int)((pose >> POSE_COL_SHIFT) & POSE_COORD_MASK);
+    int dir = (int)((pose >> POSE_DIR_SHIFT) & 0xFF);
+    return player_sees(row, col, dir, row1, col1) || player_sees(row, col, dir, row2, col2);
+}
+
+/**
+ * @brief Task that shows a view computed by a view batch, unless the player
+ * has logged out or has read a newer view from the maze since.
+ *
+ * A view read by the player itself after the batch began is at least as
+ * recent as the batch's, and any change made after that read marks the
+ * player for a later batch, so the batch's view can be dropped.
+ *
+ * @param arg The PLAYER_VIEW_MSG, which is freed.
+ */
+static void player_view_msg_task(void *arg) {
+    PLAYER_VIEW_MSG *msg = arg;
+    PLAYER *player = msg->player;
+    if (!player->logged_out) {
+        if (atomic_load(&player->view_seq) == msg->seq)
+            player_show_view(player, msg->view, msg->depth);
+        else
+            atomic_fetch_add_explicit(&views_stale, 1, memory_order_relaxed);
+    }
+    slab_free(&view_msg_slab, msg);
+}
+
+/**
+ * @brief Task that updates the views of every player of a table marked as
+ * stale (table's view strand).
+ *
+ * All the views are read from one consistent state of the maze, under a
+ * single acquisition of its locks, and handed to the players' strands,
+ * which diff, encode and send them in parallel.  Changes made while a
+ * batch is waiting or running are picked up by the next one.
+ *
+ * @param arg The table.
+ */
+static void player_view_batch_task(void *arg) {
+    PLAYER_TABLE *table = arg;
+    PLAYER **players = table->batch_players;
+    MAZE_VIEW *views = table->batch_views;
+    unsigned *seqs = table->batch_seqs;
+
+    // Players marked from now on need another batch
+    atomic_store(&table->view_queued, 0);
+
+    int n = player_table_snapshot(table, players), count = 0;
+    for (int i = 0; i < n; i++) {
+        PLAYER *p = players[i];
+        if (!atomic_exchange(&p->view_dirty, 0)) {
+            player_unref(p, "snapshot");
+            continue;
+        }
+        // Read the sequence before the maze, as player_do_update_view() bumps
+        // it before reading the maze
+        seqs[count] = atomic_load(&p->view_seq);
+        uint64_t pose = atomic_load(&p->pose);
+        players[count] = p;
+        views[count].row = (int)((pose >> POSE_ROW_SHIFT) & POSE_COORD_MASK);
+        views[count].col = (int)((pose >> POSE_COL_SHIFT) & POSE_COORD_MASK);
+        views[count].gaze = (DIRECTION)((pose >> POSE_DIR_SHIFT) & 0xFF);
+        count++;
+    }
+    if (count == 0) return;
+
+    maze_get_views_in(table->maze, views, count);
+
+    for (int i = 0; i < count; i++) {
+        PLAYER_VIEW_MSG *msg = slab_alloc(&view_msg_slab);
+        if (msg) {
+            msg->player = players[i];
+            msg->seq = seqs[i];
+            msg->depth = views[i].depth;
+            memcpy(msg->view, views[i].view, sizeof(msg->view));
+            strand_post(&players[i]->strand, player_view_msg_task, msg);
+        } else {
+            // Out of memory: let the player read its view itself
+            atomic_fetch_add_explicit(&views_unbatched, 1, memory_order_relaxed);
+            player_post_view(players[i]);
+        }
+    }
+    player_snapshot_release(players, count);
+
+    atomic_fetch_add_explicit(&view_batches, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&views_batched, count, memory_order_relaxed);
+    int max = atomic_load_explicit(&view_batch_max, memory_order_relaxed);
+    while (count > max && !atomic_compare_exchange_weak(&view_batch_max, &max, count))
+        ;
+}
+
+/**
+ * @brief Mark a player's view as stale, to be updated by the next view batch
+ * of its table.
+ * @param player Player whose view is stale.
+ */
+static void player_mark_view(PLAYER *player) {
+    atomic_store(&player->view_dirty, 1);
+    PLAYER_TABLE *table = player->table;
+    if (!atomic_exchange(&table->view_queued, 1))
+        strand_post(&table->view_strand, player_view_batch_task, table);
+}
+
+/**
+ * @brief Update the views of the players affected by a change to the maze.
+ *
+ * Only players whose field of view covers one of the (at most two) changed
+ * cells are updated, so the cost of a move or respawn is bounded by the
+ * number of nearby players rather than by the number of players in the
+ * room.  A player with an invalidated view is always updated.  The calling
+ * player's view is updated at once; the others are marked for the table's
+ * next view batch.
+ *
+ * @param table Table whose players are considered.
+ * @param self  Player that caused the change, whose strand is calling.
+ * @param row1  Row of the first changed cell.
+ * @param col1  Column of the first changed cell.
+ * @param row2  Row of the second changed cell (may repeat the first).
+ * @param col2  Column of the second changed cell.
+ */
+static void player_update_views_near(PLAYER_TABLE *table, PLAYER *self,
+                                     int row1, int col1, int row2, int col2) {
+    PLAYER *players[MAX_PLAYERS];
+    int n = player_table_snapshot(table, players);
+
+    for (int i = 0; i < n; i++) {
+        PLAYER *p = players[i];
+        if (p == self)
+            player_do_update_view(p, 0);
+        else if (player_view_affected(p, row1, col1, row2, col2))
+            player_mark_view(p);
+    }
+    player_snapshot_release(players, n);
+}
+
+/**
+ * @brief Fire the player's laser (player's strand).
  * @param player The player firing the laser.
+ * @return 0.
  */
-void player_fire_laser(PLAYER *player) {
-    // Lock to safely access firing player's direction and position
-    pthread_mutex_lock(&player->mutex);
-    OBJECT target = maze_find_target(player->row, player->col, player->dir);
-    pthread_mutex_unlock(&player->mutex);
+static int player_do_fire_laser(PLAYER *player, int unused) {
+    (void)unused;
+    OCCUPANT target = maze_find_occupant(player->table->maze, player->row, player->col, player->dir);
 
-    if (!IS_AVATAR(target)) {
+    if (target == NO_OCCUPANT) {
         debug("player_fire_laser: No avatar hit");
-        return;
+        return 0;
     }
 
     // Lookup victim's player object
-    PLAYER *victim = player_get(target);
+    PLAYER *victim = player_get_by_id(player->table, target);
     if (!victim) {
-        debug("player_fire_laser: Target avatar not found in player_map");
-        return;
+        debug("player_fire_laser: Target avatar not found in player table");
+        return 0;
     }
 
     // Tag the victim and signal their thread to interrupt blocking recv
-    pthread_mutex_lock(&victim->mutex);
-    victim->laser_hit = 1;
-    pthread_mutex_unlock(&victim->mutex);
+    atomic_store(&victim->laser_hit, 1);
 
-    // Send SIGUSR1 to victim's actual thread
-    pthread_kill(victim->thread_id, SIGUSR1);
+    TRACE(TRACE_LASER_HIT, victim->id, player->id);
+
+    // Interrupt the victim's thread (SIGUSR1, unless a simulation hooks it)
+    hit_notifier(victim);
 
     // Increment shooter's score
-    pthread_mutex_lock(&player->mutex);
-    player->score++;
-    int score = player->score;
-    pthread_mutex_unlock(&player->mutex);
-
-    // Broadcast updated score
-    MZW_PACKET pkt = {
-        .type = MZW_SCORE_PKT,
-        .param1 = player->avatar,
-        .param2 = score
-    };
+    int score = ++player->score;
 
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (player_map[i]) {
-            player_send_packet(player_map[i], &pkt, NULL);
-        }
-    }
+    // Publish the new score; every client receives it as a one-entry delta
+    scoreboard_set(player->table->scores, player->id, player->avatar, score);
+    player_sync_all_scores(player->table, player);
+
+    debug("player_fire_laser: %c hit %c; new score=%d",
+          player->avatar, victim->avatar, score);
 
     // Release victim player reference
     player_unref(victim, "fire_laser");
-    debug("player_fire_laser: %c hit %c; new score=%d",
-          player->avatar, target, score);
+    return 0;
+}
+
+/**
+ * @brief Fire the player's laser in the direction of gaze.
+ *
+ * This function searches in the current direction of gaze to find the first
+ * avatar (if any) in the laser's path. If a player is hit, the victim's thread
+ * is notified via SIGUSR1, the shooter's score is incremented, and a SCORE
+ * packet is broadcast to all clients. The victim will detect the signal,
+ * process the hit, and eventually respawn.
+ *
+ * @param player The player firing the laser.
+ */
+void player_fire_laser(PLAYER *player) {
+    player_run(player, player_do_fire_laser, 0);
 }
 
 
@@ -435,68 +1240,122 @@ void player_fire_laser(PLAYER *player) {
  *
  * This function should be called at the top of the client service loop.
  * If the player has been marked as hit (via SIGUSR1), this function will:
- *  - Clear the hit flag
- *  - Remove the player from the maze
- *  - Broadcast updated views to all clients
- *  - Send an ALERT packet to the hit client
- *  - Sleep for 3 seconds (purgatory)
+ *  - Take the hit (see player_take_hit())
+ *  - Sleep for PLAYER_PURGATORY_SECONDS (purgatory)
  *  - Respawn the player at a new location and update scoreboards
  *
  * @param player Pointer to the PLAYER object being serviced.
  */
 void player_check_for_laser_hit(PLAYER *player) {
-    debug("player_check_for_laser_hit: Checking hit status for player %s[%c]",
+    if (!atomic_load(&player->laser_hit)) return;
+    if (!player_take_hit(player)) return;
+
+    // Sleep for purgatory duration
+    sleep(PLAYER_PURGATORY_SECONDS);
+
+    // Reset player (new location, zero score, scoreboard/view updates)
+    player_reset(player);
+    debug("player_check_for_laser_hit: Respawned %s[%c] successfully",
           player->name, player->avatar);
+}
 
-    // Step 1: Check and clear the laser hit flag safely
-    pthread_mutex_lock(&player->mutex);
-    int hit = player->laser_hit;
-    if (hit) {
-        player->laser_hit = 0;
-        debug("player_check_for_laser_hit: Laser hit detected for %s[%c]",
-              player->name, player->avatar);
-    }
-    pthread_mutex_unlock(&player->mutex);
+/**
+ * @brief Take a pending laser hit (player's strand).
+ * @return 1 if a hit was taken, 0 if there was none.
+ */
+static int player_do_take_hit(PLAYER *player, int unused) {
+    (void)unused;
+    debug("player_take_hit: Checking hit status for player %s[%c]",
+          player->name, player->avatar);
 
-    if (!hit) {
-        debug("player_check_for_laser_hit: No hit to process for %s[%c]",
+    // Step 1: Check and clear the laser hit flag
+    if (!atomic_exchange(&player->laser_hit, 0)) {
+        debug("player_take_hit: No hit to process for %s[%c]",
               player->name, player->avatar);
-        return;
+        return 0;
     }
+    debug("player_take_hit: Laser hit detected for %s[%c]",
+          player->name, player->avatar);
 
     // Step 2: Remove the player from their current location in the maze
-    pthread_mutex_lock(&player->mutex);
     int row = player->row;
     int col = player->col;
-    pthread_mutex_unlock(&player->mutex);
-
-    maze_remove_player(player->avatar, row, col);
-    debug("player_check_for_laser_hit: Removed %s[%c] from maze location [%d,%d]",
+    maze_remove_occupant(player->table->maze, player->id, row, col);
+    debug("player_take_hit: Removed %s[%c] from maze location [%d,%d]",
           player->name, player->avatar, row, col);
 
-    // Step 3: Update all player views to reflect removal
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (player_map[i]) {
-            player_update_view(player_map[i]);
-        }
-    }
+    // Step 3: Update the views of players that could see this player
+    proto_batch_begin();
+    player_update_views_near(player->table, player, row, col, row, col);
+    proto_batch_end();
 
     // Step 4: Send ALERT packet to this player
     MZW_PACKET alert = { .type = MZW_ALERT_PKT };
     player_send_packet(player, &alert, NULL);
-    debug("player_check_for_laser_hit: Sent ALERT to %s[%c]",
+    debug("player_take_hit: Sent ALERT to %s[%c]",
           player->name, player->avatar);
+    return 1;
+}
 
-    // Step 5: Sleep for purgatory duration
-    sleep(3);
-
-    // Step 6: Reset player (new location, zero score, scoreboard/view updates)
-    player_reset(player);
-    debug("player_check_for_laser_hit: Respawned %s[%c] successfully",
-          player->name, player->avatar);
+/**
+ * @brief Take a pending laser hit, leaving the player out of the maze.
+ *
+ * If the player has been marked as hit, this function will:
+ *  - Clear the hit flag
+ *  - Remove the player from the maze
+ *  - Broadcast updated views to all clients
+ *  - Send an ALERT packet to the hit client
+ *
+ * Commands of the player queued before the hit is taken are carried out
+ * first.
+ *
+ * @param player Pointer to the PLAYER object being serviced.
+ * @return 1 if a hit was taken (the player must later be respawned with
+ *         player_reset()), 0 if there was none.
+ */
+int player_take_hit(PLAYER *player) {
+    return player_run(player, player_do_take_hit, 0);
 }
 
+/**
+ * @brief Reset a player (player's strand).
+ * @return 0.
+ */
+static int player_do_reset(PLAYER *player, int unused) {
+    (void)unused;
 
+    // Step 1: Save old position and remove player from maze
+    int old_row = player->row;
+    int old_col = player->col;
+    maze_remove_occupant(player->table->maze, player->id, old_row, old_col);
+    debug("player_reset: Removed %c from [%d,%d]", player->avatar, old_row, old_col);
+
+    // Step 2: Place player in a new random unoccupied location
+    if (maze_set_occupant_random(player->table->maze, player->id, player->avatar,
+                                 &player->row, &player->col) != 0) {
+        error("player_reset: Failed to place %c in maze — maze may be full", player->avatar);
+        return 0;
+    }
+    player_publish(player);
+    debug("player_reset: Re-placed %c at [%d,%d]", player->avatar, player->row, player->col);
+
+    // Step 3: Reset score
+    player->score = 0;
+
+    // Steps 4-6 are one logical update, so stamp them as a single batch
+    proto_batch_begin();
+
+    // Steps 4-5: Publish the score reset and sync every scoreboard.  A player
+    // that has just logged in is at version 0 and receives the whole board;
+    // everybody else receives only this player's new entry.
+    scoreboard_set(player->table->scores, player->id, player->avatar, 0);
+    player_sync_all_scores(player->table, player);
+
+    // Step 6: Update the views of players that can see the old or new position
+    player_update_views_near(player->table, player, old_row, old_col, player->row, player->col);
+    proto_batch_end();
+    return 0;
+}
 
 /**
  * @brief Reset a player after being hit by a laser or logging in.
@@ -506,9 +1365,9 @@ void player_check_for_laser_hit(PLAYER *player) {
  *   1. Removes the player from their current position in the maze.
  *   2. Resets the player's score to 0.
  *   3. Places the player at a random unoccupied location in the maze.
- *   4. Sends all other players' scores to this player (to populate scoreboard).
- *   5. Broadcasts this player's score to all players (score reset).
- *   6. Triggers a full view update for all players.
+ *   4. Publishes this player's score reset on the shared scoreboard.
+ *   5. Sends every client the scoreboard entries it has not yet seen.
+ *   6. Updates the views of the players that can see the old or new position.
  *
  * If maze placement fails (e.g. full maze), the function logs the error and returns
  * without closing the socket — it's the service thread's job to handle termination.
@@ -524,61 +1383,27 @@ void player_check_for_laser_hit(PLAYER *player) {
  * @param player Pointer to the PLAYER object being reset.
  */
 void player_reset(PLAYER *player) {
-    pthread_mutex_lock(&player->mutex);
-
-    // Step 1: Save old position and remove player from maze
-    int old_row = player->row;
-    int old_col = player->col;
-    maze_remove_player(player->avatar, old_row, old_col);
-    debug("player_reset: Removed %c from [%d,%d]", player->avatar, old_row, old_col);
-
-    // Step 2: Place player in a new random unoccupied location
-    if (maze_set_player_random(player->avatar, &player->row, &player->col) != 0) {
-        error("player_reset: Failed to place %c in maze — maze may be full", player->avatar);
-        pthread_mutex_unlock(&player->mutex);
-        return;
-    }
-    debug("player_reset: Re-placed %c at [%d,%d]", player->avatar, player->row, player->col);
-
-    // Step 3: Reset score
-    player->score = 0;
+    player_run(player, player_do_reset, 0);
+}
 
-    pthread_mutex_unlock(&player->mutex);
 
-    // Step 4: Send all other scores to this player
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (player_map[i] && player_map[i] != player) {
-            MZW_PACKET pkt = {
-                .type = MZW_SCORE_PKT,
-                .param1 = player_map[i]->avatar,
-                .param2 = player_map[i]->score
-            };
-            player_send_packet(player, &pkt, NULL);
-        }
-    }
 
-    // Step 5: Broadcast this player's score reset to all players
-    MZW_PACKET pkt = {
-        .type = MZW_SCORE_PKT,
-        .param1 = player->avatar,
-        .param2 = 0
-    };
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (player_map[i]) {
-            player_send_packet(player_map[i], &pkt, NULL);
-        }
-    }
 
-    // Step 6: Update all player views
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (player_map[i]) {
-            player_update_view(player_map[i]);
-        }
-    }
+/**
+ * @brief Get the strand of a player.
+ * @param player Player.
+ * @return The player's strand.
+ */
+STRAND *player_strand(PLAYER *player) {
+    return &player->strand;
 }
 
-
-
+int player_view_report(char *buf, size_t len) {
+    return snprintf(buf, len, "views batches %lu batched %lu stale %lu unbatched %lu max_batch %d\n",
+                    atomic_load(&view_batches), atomic_load(&views_batched),
+                    atomic_load(&views_stale), atomic_load(&views_unbatched),
+                    atomic_load(&view_batch_max));
+}
 
 /**
  * @brief Broadcast a chat message from a player to all players.
@@ -589,10 +1414,19 @@ void player_reset(PLAYER *player) {
 void player_send_chat(PLAYER *player, char *msg, size_t len) {
     char buf[1024];
     int n = snprintf(buf, sizeof(buf), "%s[%c] %.*s", player->name, player->avatar, (int)len, msg);
+    // The name and message come from the client: send what fit in buf
+    if (n < 0) n = 0;
+    if ((size_t)n >= sizeof(buf)) n = sizeof(buf) - 1;
     MZW_PACKET pkt = { .type = MZW_CHAT_PKT, .size = n };
 
-    for (int i = 0; i < MAX_PLAYERS; i++)
-        if (player_map[i]) player_send_packet(player_map[i], &pkt, buf);
+    PLAYER *players[MAX_PLAYERS];
+    int count = player_table_snapshot(player->table, players);
+
+    proto_batch_begin();
+    for (int i = 0; i < count; i++)
+        player_send_packet(players[i], &pkt, buf);
+    proto_batch_end();
+    player_snapshot_release(players, count);
 
     debug("player_send_chat: Player %p broadcast chat", player);
 }
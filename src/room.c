@@ -0,0 +1,124 @@
+/**
+ * @file room.c
+ * @brief Independent game rooms, each with its own maze and player table.
+ *
+ * Room 0 wraps the default maze and player table, so a server started with
+ * a single room behaves exactly as before.  Additional rooms get their own
+ * MAZE (a copy of the default maze's template) and PLAYER_TABLE, and therefore their
+ * own lock domains.
+ */
+
+#define _GNU_SOURCE  // pthread_setaffinity_np, CPU_SET
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "room.h"
+#include "debug.h"
+
+/**
+ * @struct room
+ * @brief State of one game room.
+ */
+struct room {
+    int index;                /**< Index of the room (LOGIN param3). */
+    MAZE *maze;               /**< Maze the room plays in. */
+    PLAYER_TABLE *players;    /**< Players logged in to the room. */
+    int cpu;                  /**< CPU serving threads are pinned to; -1 = no pinning. */
+};
+
+static ROOM *rooms = NULL;
+static int num_rooms = 0;
+
+/**
+ * @brief Create the rooms; room 0 reuses the default maze and player table.
+ *
+ * @param count    Number of rooms (1..MAX_ROOMS).
+ * @param pin      Nonzero to pin each room's serving threads to a CPU.
+ * @return 0 on success, -1 on failure.
+ */
+int room_init(int count, int pin) {
+    if (count < 1 || count > MAX_ROOMS) {
+        error("room_init: Invalid room count %d", count);
+        return -1;
+    }
+
+    rooms = calloc(count, sizeof(ROOM));
+    if (!rooms) {
+        error("room_init: Memory allocation failed");
+        return -1;
+    }
+
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpus < 1) ncpus = 1;
+
+    for (int i = 0; i < count; i++) {
+        ROOM *room = &rooms[i];
+        room->index = i;
+        room->cpu = pin ? (int)(i % ncpus) : -1;
+
+        if (i == 0) {
+            room->maze = maze_default();
+            room->players = player_default_table();
+        } else {
+            room->maze = maze_clone(maze_default());
+            room->players = room->maze ? player_table_create(room->maze) : NULL;
+            if (!room->players) {
+                error("room_init: Failed to create room %d", i);
+                maze_destroy(room->maze);
+                num_rooms = i;
+                room_fini();
+                return -1;
+            }
+        }
+        num_rooms = i + 1;
+    }
+
+    debug("room_init: %d rooms created (pinning %s)", num_rooms, pin ? "on" : "off");
+    return 0;
+}
+
+/**
+ * @brief Destroy all rooms except the default maze and player table.
+ */
+void room_fini(void) {
+    for (int i = 1; i < num_rooms; i++) {
+        player_table_destroy(rooms[i].players);
+        maze_destroy(rooms[i].maze);
+    }
+    free(rooms);
+    rooms = NULL;
+    num_rooms = 0;
+}
+
+int room_count(void) {
+    return num_rooms;
+}
+
+ROOM *room_get(int index) {
+    if (index < 0 || index >= num_rooms) return NULL;
+    return &rooms[index];
+}
+
+PLAYER_TABLE *room_players(ROOM *room) {
+    return room->players;
+}
+
+/**
+ * @brief Pin the calling thread to the room's CPU, if pinning is enabled.
+ * @param room Room the calling thread is about to serve.
+ */
+void room_enter(ROOM *room) {
+    if (room->cpu < 0) return;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(room->cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        debug("room_enter: Could not pin thread to CPU %d", room->cpu);
+        return;
+    }
+    debug("room_enter: Thread %lu pinned to CPU %d for room %d", pthread_self(), room->cpu, room->index);
+}
@@ -0,0 +1,126 @@
+/**
+ * @file scoreboard.c
+ * @brief Versioned scoreboard used to send score deltas instead of full boards.
+ *
+ * Entries are indexed directly by occupant ID.  Each entry remembers the version
+ * at which it last changed; removed players are kept as tombstones so that
+ * clients which have seen them can be told to drop them.
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "scoreboard.h"
+#include "lockprof.h"
+#include "debug.h"
+
+/**
+ * @brief State of a single scoreboard slot.
+ */
+typedef struct score_slot {
+    OBJECT glyph;              /**< Display glyph of the player. */
+    int score;                 /**< Current score. */
+    int present;               /**< 1 if the player is on the board, 0 if removed. */
+    unsigned long version;     /**< Version at which this slot last changed; 0 = never used. */
+} SCORE_SLOT;
+
+struct scoreboard {
+    pthread_mutex_t mutex;              /**< Protects slots and version. */
+    unsigned long version;              /**< Version of the most recent change. */
+    SCORE_SLOT slots[SCOREBOARD_SIZE];  /**< Slots indexed by occupant ID. */
+};
+
+/**
+ * @brief Create an empty scoreboard at version 0.
+ * @return New scoreboard, or NULL on allocation failure.
+ */
+SCOREBOARD *scoreboard_create(void) {
+    SCOREBOARD *sb = calloc(1, sizeof(SCOREBOARD));
+    if (!sb) {
+        error("scoreboard_create: Memory allocation failed");
+        return NULL;
+    }
+    pthread_mutex_init(&sb->mutex, NULL);
+    return sb;
+}
+
+/**
+ * @brief Destroy a scoreboard.
+ * @param sb Scoreboard to destroy (may be NULL).
+ */
+void scoreboard_destroy(SCOREBOARD *sb) {
+    if (!sb) return;
+    pthread_mutex_destroy(&sb->mutex);
+    free(sb);
+}
+
+/**
+ * @brief Record a new score for a player and bump the board version.
+ * @param sb     Scoreboard.
+ * @param id     Player's occupant ID.
+ * @param glyph  Player's display glyph.
+ * @param score  New score.
+ */
+void scoreboard_set(SCOREBOARD *sb, OCCUPANT id, OBJECT glyph, int score) {
+    if (id >= SCOREBOARD_SIZE) return;
+
+    prof_lock(&sb->mutex, &lock_scoreboard);
+    SCORE_SLOT *slot = &sb->slots[id];
+    slot->glyph = glyph;
+    slot->score = score;
+    slot->present = 1;
+    slot->version = ++sb->version;
+    debug("scoreboard_set: %c (id %u) -> %d (version %lu)", glyph, id, score, slot->version);
+    prof_unlock(&sb->mutex);
+}
+
+/**
+ * @brief Turn a player's slot into a tombstone and bump the board version.
+ * @param sb     Scoreboard.
+ * @param id     Player's occupant ID.
+ */
+void scoreboard_remove(SCOREBOARD *sb, OCCUPANT id) {
+    if (id >= SCOREBOARD_SIZE) return;
+
+    prof_lock(&sb->mutex, &lock_scoreboard);
+    SCORE_SLOT *slot = &sb->slots[id];
+    if (slot->present) {
+        slot->present = 0;
+        slot->version = ++sb->version;
+        debug("scoreboard_remove: id %u removed (version %lu)", id, slot->version);
+    }
+    prof_unlock(&sb->mutex);
+}
+
+/**
+ * @brief Copy out every slot that changed after version @p since.
+ *
+ * @param sb       Scoreboard.
+ * @param since    Version the client already has.
+ * @param out      [out] Changed entries.
+ * @param max      Capacity of @p out.
+ * @param versionp [out] Version the client will be at after applying the delta.
+ * @return Number of entries written.
+ */
+int scoreboard_delta(SCOREBOARD *sb, unsigned long since, SCORE_ENTRY *out, int max,
+                     unsigned long *versionp) {
+    int n = 0, i;
+
+    prof_lock(&sb->mutex, &lock_scoreboard);
+    for (i = 0; i < SCOREBOARD_SIZE && n < max; i++) {
+        SCORE_SLOT *slot = &sb->slots[i];
+        if (slot->version <= since) continue;
+        if (!slot->present && since == 0) continue;  // Client never saw this player
+
+        out[n].id = i;
+        out[n].glyph = slot->glyph;
+        out[n].score = slot->present ? slot->score : -1;
+        n++;
+    }
+    // If out filled up before the scan finished, keep the client at its old
+    // version so that the remaining entries are picked up by the next delta.
+    if (versionp) *versionp = (i < SCOREBOARD_SIZE) ? since : sb->version;
+    prof_unlock(&sb->mutex);
+
+    return n;
+}
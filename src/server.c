@@ -16,44 +16,235 @@
 #include <arpa/inet.h>
 
 #include "server.h"
+#include "server_ext.h"
 #include "protocol.h"
 #include "player.h"
+#include "player_ext.h"
+#include "protocol_ext.h"
+#include "room.h"
+#include "admission.h"
+#include "stats.h"
+#include "slab.h"
+#include "trace.h"
+#include "journal.h"
+#include "task_sched.h"
 #include "client_registry.h"
+#include "client_registry_ext.h"
 #include "debug.h"
 
 int debug_show_maze = 1;
 extern __thread PLAYER *this_player;
 
+/// Payloads up to this size are copied into the command itself.
+#define COMMAND_DATA_INLINE 128
+
 /**
- * @brief Thread function to handle a connected MazeWar client.
+ * @struct command
+ * @brief A packet from a logged-in client, queued in its player's strand.
+ */
+typedef struct command {
+    MZW_SESSION session;          /**< Copy of the session (fd and player). */
+    MZW_PACKET pkt;               /**< The packet. */
+    void *data;                   /**< Its payload: NULL, inline_data or malloc-allocated. */
+    uint64_t start;               /**< When it was received, for handling latency. */
+    char inline_data[COMMAND_DATA_INLINE];
+} COMMAND;
+
+static SLAB command_slab = SLAB_INIT("command", sizeof(COMMAND), 64);
+
+/**
+ * @brief Carry out one packet received from a client.
  *
- * Responsibilities:
- * 1. Detach the thread to allow automatic cleanup.
- * 2. Extract and register the client socket with the global registry.
- * 3. Wait for incoming packets in a loop, handle each by type.
- * 4. On disconnect or error, log out the player, unregister the client, and close the socket.
+ * Until the session has logged in, only LOGIN packets are honored; a
+ * successful LOGIN places the player in the requested room and records it
+ * in the session.  After that, LOGIN packets are ignored.
  *
- * @param arg Pointer to malloc'd int (client fd). Caller must free it.
+ * @param session Client session; its player is set by a successful LOGIN.
+ * @param pkt     Packet received (fields in host byte order).
+ * @param data    Payload, or NULL.
+ */
+void mzw_handle_packet(MZW_SESSION *session, MZW_PACKET *pkt, void *data) {
+    PLAYER *player = session->player;
+
+    switch (pkt->type) {
+        case MZW_LOGIN_PKT:
+            if (player) {
+                debug("mzw_handle_packet: Ignoring duplicate LOGIN from fd=%d", session->fd);
+                break;
+            }
+
+            // Extract login info; param3 selects the game room
+            OBJECT avatar = pkt->param1;
+            char *username = data;
+            ROOM *room = room_get(pkt->param3);
+
+            debug("mzw_handle_packet: Attempting login for fd=%d as '%s' (avatar=%d, room=%d)",
+                  session->fd, username, avatar, pkt->param3);
+
+            // Try logging in; param2 carries the client's MZW_CAP_* flags
+            if (room) {
+                room_enter(room);
+                player = player_login_ext(room_players(room), session->fd, avatar, username, pkt->param2);
+            } else {
+                player = NULL;
+            }
+            this_player = player; // Explicitly set thread-local player pointer
+            debug("mzw_handle_packet: this_player set to %p for thread %lu", (void *)player, pthread_self());
+
+            if (!player) {
+                debug("mzw_handle_packet: Login failed for avatar=%d", avatar);
+                MZW_PACKET response = { .type = MZW_INUSE_PKT, .size = 0 };
+                proto_send_packet(session->fd, &response, NULL);
+                break;
+            }
+
+            // Successful login.  Other players may already be sending to
+            // the client, so READY goes through the player as well.
+            session->player = player;
+            if (pkt->param2 & MZW_CAP_EXTENDED_ID) {
+                // Extended-ID clients learn their assigned ID from the READY payload
+                uint16_t id = htons(player_get_id(player));
+                MZW_PACKET response = { .type = MZW_READY_PKT, .size = sizeof(id) };
+                player_send_packet(player, &response, &id);
+            } else {
+                MZW_PACKET response = { .type = MZW_READY_PKT, .size = 0 };
+                player_send_packet(player, &response, NULL);
+            }
+            player_reset(player);
+            debug("mzw_handle_packet: Login succeeded for '%s' (fd=%d)", username, session->fd);
+            break;
+
+        case MZW_MOVE_PKT:
+            if (player) {
+                debug("mzw_handle_packet: MOVE command from fd=%d", session->fd);
+                player_move(player, pkt->param1);
+            }
+            break;
+
+        case MZW_TURN_PKT:
+            if (player) {
+                debug("mzw_handle_packet: TURN command from fd=%d", session->fd);
+                player_rotate(player, pkt->param1);
+            }
+            break;
+
+        case MZW_FIRE_PKT:
+            if (player) {
+                debug("mzw_handle_packet: FIRE command from fd=%d", session->fd);
+                player_fire_laser(player);
+            }
+            break;
+
+        case MZW_REFRESH_PKT:
+            if (player) {
+                debug("mzw_handle_packet: REFRESH command from fd=%d", session->fd);
+                player_invalidate_view(player);
+                player_update_view(player);
+            }
+            break;
+
+        case MZW_SEND_PKT:
+            if (player && data != NULL) {
+                debug("mzw_handle_packet: SEND chat from fd=%d", session->fd);
+                player_send_chat(player, data, pkt->size);
+            }
+            break;
+
+        default:
+            debug("mzw_handle_packet: Unknown or unhandled packet type=%d from fd=%d",
+                  pkt->type, session->fd);
+            break;
+    }
+}
+
+/**
+ * @brief Task that carries out a command queued by post_command().
+ * @param arg The command, which is freed.
+ */
+static void command_task(void *arg) {
+    COMMAND *cmd = arg;
+    mzw_handle_packet(&cmd->session, &cmd->pkt, cmd->data);
+    stats_record(cmd->pkt.type, stats_now() - cmd->start);
+    TRACE(TRACE_PACKET_DONE, cmd->pkt.type, 0);
+    if (cmd->data != cmd->inline_data) free(cmd->data);
+    slab_free(&command_slab, cmd);
+}
+
+/**
+ * @brief Queue a packet from a logged-in client in its player's strand.
+ *
+ * The player's commands then run in order on the task scheduler, while the
+ * service thread goes back to receiving.  The session's player stays valid
+ * until player_logout(), which waits for the strand.
+ *
+ * @param session Session, which has a player.
+ * @param pkt     Packet received.
+ * @param data    Its payload (copied), or NULL.
+ * @param start   When it was received.
+ * @return 0 on success, -1 if memory is exhausted.
+ */
+static int post_command(MZW_SESSION *session, MZW_PACKET *pkt, void *data, uint64_t start) {
+    COMMAND *cmd = slab_alloc(&command_slab);
+    if (!cmd) return -1;
+    cmd->session = *session;
+    cmd->pkt = *pkt;
+    cmd->start = start;
+    if (data) {
+        cmd->data = pkt->size <= COMMAND_DATA_INLINE ? cmd->inline_data : malloc(pkt->size);
+        if (!cmd->data) {
+            slab_free(&command_slab, cmd);
+            return -1;
+        }
+        memcpy(cmd->data, data, pkt->size);
+    }
+    strand_post(player_strand(session->player), command_task, cmd);
+    return 0;
+}
+
+/**
+ * @brief Thread function to handle a connected MazeWar client.
+ *
+ * @param arg Pointer to malloc'd int (client fd), freed here.
  * @return Always NULL.
  */
 void *mzw_client_service(void *arg) {
-    debug("Running My Version");
-
-    // Step 1: Extract client socket file descriptor
     int client_fd = *((int *) arg);
     free(arg);
+    mzw_serve_connection(client_fd);
+    return NULL;
+}
 
-    // Step 2: Detach thread for automatic cleanup
-    pthread_detach(pthread_self());
-    debug("mzw_client_service: Client service thread started for fd=%d", client_fd);
+/**
+ * @brief Serve a connected MazeWar client until it disconnects.
+ *
+ * Responsibilities:
+ * 1. Register the client socket with the global registry
+ *    (closing it straight away if the registry is full).
+ * 2. Wait for incoming packets in a loop, handle each by type.
+ * 3. On disconnect or error, log out the player, unregister the client, and close the socket.
+ *
+ * @param client_fd The client's socket, which is closed on return.
+ */
+void mzw_serve_connection(int client_fd) {
+    debug("mzw_serve_connection: Serving fd=%d", client_fd);
 
-    // Step 3: Register the client file descriptor in the global registry
-    creg_register(client_registry, client_fd);
+    // Step 1: Register the client file descriptor in the global registry,
+    // turning the client away if the registry is full
+    if (creg_try_register(client_registry, client_fd) != 0) {
+        error("mzw_serve_connection: Registry full, closing fd=%d", client_fd);
+        close(client_fd);
+        admission_release();
+        return;
+    }
 
-    PLAYER *player = NULL;
-    int logged_in = 0;
+    MZW_SESSION session = { .fd = client_fd, .player = NULL };
+    uint32_t conn = journal_open(client_fd);
 
-    // Step 4: Main service loop
+    // Packet payloads live in this session's arena until the packet is handled
+    ARENA arena;
+    arena_init(&arena);
+
+    // Step 2: Main service loop
     while (1) {
         //  Process laser hit from *previous* signal before recv
         if (this_player) {
@@ -64,109 +255,54 @@ void *mzw_client_service(void *arg) {
         void *data = NULL;
 
         // Attempt to receive the next packet (may be interrupted by SIGUSR1)
-        if (proto_recv_packet(client_fd, &pkt, &data) < 0) {
-            debug("mzw_client_service: Disconnection or error from fd=%d", client_fd);
+        if (proto_recv_packet_arena(client_fd, &pkt, &arena, &data) < 0) {
+            debug("mzw_serve_connection: Disconnection or error from fd=%d", client_fd);
             break;
         }
 
+        // Handling time is measured from here to the last send it causes
+        uint64_t start = stats_now();
+        TRACE(TRACE_PACKET_RECV, pkt.type, pkt.size);
+        journal_packet(conn, &pkt, data);
+
         // Process laser hit that may have occurred during the blocking recv
         if (this_player) {
             player_check_for_laser_hit(this_player);
         }
 
-        debug("mzw_client_service: Received packet type=%d from fd=%d", pkt.type, client_fd);
-
-        // Step 5: Handle packet types
-        switch (pkt.type) {
-            case MZW_LOGIN_PKT:
-                if (logged_in) {
-                    debug("mzw_client_service: Ignoring duplicate LOGIN from fd=%d", client_fd);
-                    break;
-                }
-
-                // Extract login info
-                OBJECT avatar = pkt.param1;
-                char *username = data;
-
-                debug("mzw_client_service: Attempting login for fd=%d as '%s' (avatar=%d)",
-                      client_fd, username, avatar);
-
-                // Try logging in
-                player = player_login(client_fd, avatar, username);
-                this_player = player; // Explicitly set thread-local player pointer
-                debug("mzw_client_service: this_player set to %p for thread %lu", (void *)player, pthread_self());
-
-                if (!player) {
-                    debug("mzw_client_service: Login failed for avatar=%d", avatar);
-                    MZW_PACKET response = { .type = MZW_INUSE_PKT, .size = 0 };
-                    proto_send_packet(client_fd, &response, NULL);
-                    break;
-                }
-
-                // Successful login
-                logged_in = 1;
-                MZW_PACKET response = { .type = MZW_READY_PKT, .size = 0 };
-                proto_send_packet(client_fd, &response, NULL);
-                player_reset(player);
-                debug("mzw_client_service: Login succeeded for '%s' (fd=%d)", username, client_fd);
-                break;
-
-            case MZW_MOVE_PKT:
-                if (logged_in) {
-                    debug("mzw_client_service: MOVE command from fd=%d", client_fd);
-                    player_move(player, pkt.param1);
-                }
-                break;
-
-            case MZW_TURN_PKT:
-                if (logged_in) {
-                    debug("mzw_client_service: TURN command from fd=%d", client_fd);
-                    player_rotate(player, pkt.param1);
-                }
-                break;
-
-            case MZW_FIRE_PKT:
-                if (logged_in) {
-                    debug("mzw_client_service: FIRE command from fd=%d", client_fd);
-                    player_fire_laser(player);
-                }
-                break;
-
-            case MZW_REFRESH_PKT:
-                if (logged_in) {
-                    debug("mzw_client_service: REFRESH command from fd=%d", client_fd);
-                    player_invalidate_view(player);
-                    player_update_view(player);
-                }
-                break;
-
-            case MZW_SEND_PKT:
-                if (logged_in && data != NULL) {
-                    debug("mzw_client_service: SEND chat from fd=%d", client_fd);
-                    player_send_chat(player, data, pkt.size);
-                }
-                break;
+        debug("mzw_serve_connection: Received packet type=%d from fd=%d", pkt.type, client_fd);
 
-            default:
-                debug("mzw_client_service: Unknown or unhandled packet type=%d from fd=%d",
-                      pkt.type, client_fd);
-                break;
+        // Step 3: Handle the packet by type: queued in the player's strand
+        // once logged in and if the task scheduler is running, else right
+        // here (the player's state is still only changed in its strand,
+        // which this thread runs if it is idle, or else waits for)
+        if (session.player && task_sched_running()) {
+            if (post_command(&session, &pkt, data, start) == 0) {
+                arena_reset(&arena);
+                continue;
+            }
+            strand_drain(player_strand(session.player));  // Keep the order
         }
+        mzw_handle_packet(&session, &pkt, data);
 
-        // Always free packet payload if allocated
-        if (data != NULL) {
-            free(data);
-        }
+        stats_record(pkt.type, stats_now() - start);
+        TRACE(TRACE_PACKET_DONE, pkt.type, 0);
+
+        // Release the packet payload, if any
+        arena_reset(&arena);
     }
 
-    // Step 6: Client has disconnected or errored out — clean up
-    if (player != NULL) {
-        debug("mzw_client_service: Logging out player on fd=%d", client_fd);
-        player_logout(player);
+    // Step 4: Client has disconnected or errored out — clean up
+    if (session.player != NULL) {
+        debug("mzw_serve_connection: Logging out player on fd=%d", client_fd);
+        player_logout(session.player);
     }
+    this_player = NULL;  // The thread may go on to serve another session
 
+    arena_fini(&arena);
+    journal_close(conn, client_fd);
     creg_unregister(client_registry, client_fd);
     close(client_fd);
-    debug("mzw_client_service: Thread exiting for fd=%d", client_fd);
-    return NULL;
+    admission_release();
+    debug("mzw_serve_connection: Done with fd=%d", client_fd);
 }
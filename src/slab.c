@@ -0,0 +1,171 @@
+/**
+ * @file slab.c
+ * @brief Slab allocator for fixed-size objects, and per-connection arenas.
+ *
+ * Objects are carved from chunks obtained from malloc() and recycled
+ * through a free list threaded through the free objects themselves, so
+ * each object is rounded up to hold at least a pointer and to keep the
+ * alignment malloc() guarantees.  A slab is listed for reports the first
+ * time it grows.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "slab.h"
+#include "debug.h"
+
+/// Alignment of slab objects and arena allocations.
+#define SLAB_ALIGN (sizeof(max_align_t))
+
+#define ROUND_UP(n, a) (((n) + (a) - 1) / (a) * (a))
+
+/**
+ * @struct arena_spill
+ * @brief An arena allocation too large for the rest of the arena's block.
+ */
+struct arena_spill {
+    struct arena_spill *next;
+    max_align_t data[];
+};
+
+/// Blocks of arenas.
+static SLAB arena_blocks = SLAB_INIT("arena_block", ARENA_BLOCK_SIZE, 16);
+
+/// Arena allocations served by malloc() because they did not fit.
+static atomic_ulong arena_spills = 0;
+
+/// Slabs that have grown at least once, for reports.
+static SLAB *slabs = NULL;
+static pthread_mutex_t slabs_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Size a slab's objects occupy, including rounding.
+ */
+static size_t slab_stride(SLAB *slab) {
+    size_t size = slab->size < sizeof(void *) ? sizeof(void *) : slab->size;
+    return ROUND_UP(size, SLAB_ALIGN);
+}
+
+/**
+ * @brief Add a chunk of objects to a slab's free list.
+ *
+ * Must be called with the slab's mutex held.
+ *
+ * @return 0 on success, -1 if malloc() failed.
+ */
+static int slab_grow(SLAB *slab) {
+    size_t stride = slab_stride(slab);
+    size_t count = slab->per_chunk > 0 ? slab->per_chunk : 1;
+    char *chunk = malloc(stride * count);
+    if (!chunk) {
+        error("slab_grow: Failed to allocate %zu %s objects", count, slab->name);
+        return -1;
+    }
+    for (size_t i = count; i-- > 0; ) {
+        void *obj = chunk + i * stride;
+        *(void **)obj = slab->free_list;
+        slab->free_list = obj;
+    }
+    slab->chunks++;
+
+    if (!slab->registered) {
+        pthread_mutex_lock(&slabs_mutex);
+        slab->next = slabs;
+        slabs = slab;
+        slab->registered = 1;
+        pthread_mutex_unlock(&slabs_mutex);
+    }
+    debug("slab_grow: %s now has %lu chunks of %zu", slab->name, slab->chunks, count);
+    return 0;
+}
+
+void *slab_alloc(SLAB *slab) {
+    pthread_mutex_lock(&slab->mutex);
+    if (!slab->free_list && slab_grow(slab) != 0) {
+        pthread_mutex_unlock(&slab->mutex);
+        return NULL;
+    }
+    void *obj = slab->free_list;
+    slab->free_list = *(void **)obj;
+    slab->allocs++;
+    if (++slab->in_use > slab->peak) slab->peak = slab->in_use;
+    pthread_mutex_unlock(&slab->mutex);
+
+    memset(obj, 0, slab->size);
+    return obj;
+}
+
+void slab_free(SLAB *slab, void *obj) {
+    if (!obj) return;
+    pthread_mutex_lock(&slab->mutex);
+    *(void **)obj = slab->free_list;
+    slab->free_list = obj;
+    slab->frees++;
+    slab->in_use--;
+    pthread_mutex_unlock(&slab->mutex);
+}
+
+void arena_init(ARENA *arena) {
+    arena->block = slab_alloc(&arena_blocks);
+    arena->used = 0;
+    arena->spill = NULL;
+}
+
+void *arena_alloc(ARENA *arena, size_t size) {
+    size_t rounded = ROUND_UP(size, SLAB_ALIGN);
+    if (arena->block && rounded <= ARENA_BLOCK_SIZE - arena->used) {
+        void *p = arena->block + arena->used;
+        arena->used += rounded;
+        return p;
+    }
+
+    struct arena_spill *spill = malloc(sizeof(struct arena_spill) + size);
+    if (!spill) return NULL;
+    spill->next = arena->spill;
+    arena->spill = spill;
+    atomic_fetch_add_explicit(&arena_spills, 1, memory_order_relaxed);
+    return spill->data;
+}
+
+void arena_reset(ARENA *arena) {
+    while (arena->spill) {
+        struct arena_spill *next = arena->spill->next;
+        free(arena->spill);
+        arena->spill = next;
+    }
+    arena->used = 0;
+}
+
+void arena_fini(ARENA *arena) {
+    arena_reset(arena);
+    slab_free(&arena_blocks, arena->block);
+    arena->block = NULL;
+}
+
+int slab_report(char *buf, size_t len) {
+    size_t n = 0;
+#define EMIT(...) do { \
+        int w = snprintf(n < len ? buf + n : NULL, n < len ? len - n : 0, __VA_ARGS__); \
+        if (w > 0) n += w; \
+    } while (0)
+
+    EMIT("%-16s %10s %10s %10s %10s %12s %12s %12s\n", "slab", "obj_bytes", "chunks",
+         "in_use", "peak", "reserved_kb", "allocs", "frees");
+    pthread_mutex_lock(&slabs_mutex);
+    for (SLAB *slab = slabs; slab; slab = slab->next) {
+        pthread_mutex_lock(&slab->mutex);
+        size_t reserved = slab->chunks * slab->per_chunk * slab_stride(slab);
+        EMIT("%-16s %10zu %10lu %10lu %10lu %12.1f %12lu %12lu\n", slab->name, slab->size,
+             slab->chunks, slab->in_use, slab->peak, reserved / 1024.0, slab->allocs, slab->frees);
+        pthread_mutex_unlock(&slab->mutex);
+    }
+    pthread_mutex_unlock(&slabs_mutex);
+    EMIT("arena_spills %lu\n", atomic_load(&arena_spills));
+#undef EMIT
+    return (int)n;
+}
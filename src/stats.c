@@ -0,0 +1,323 @@
+/**
+ * @file stats.c
+ * @brief Lock-free latency histograms, traffic counters and the stats port.
+ *
+ * Histograms are arrays of atomic bucket counters updated with relaxed
+ * atomic increments, so recording never blocks and never takes a lock.
+ * Traffic counters are bumped for every packet sent, which is by far the
+ * hottest path, so they are striped: each thread adds into one of several
+ * cache-line-sized stripes, and a report sums the stripes.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "stats.h"
+#include "lockprof.h"
+#include "protocol.h"
+#include "debug.h"
+
+/// Linear sub-buckets per power of two: 2^SUB_BITS.
+#define SUB_BITS 5
+#define SUB_COUNT (1 << SUB_BITS)
+
+/// Enough buckets for any 64-bit value.
+#define HIST_BUCKETS ((64 - SUB_BITS + 1) * SUB_COUNT)
+
+/// Number of traffic counter stripes.
+#define STRIPES 16
+
+/**
+ * @struct histogram
+ * @brief Log-linear histogram of latencies in nanoseconds.
+ */
+struct histogram {
+    atomic_ulong counts[HIST_BUCKETS];  /**< Number of values in each bucket. */
+    atomic_ulong max;                   /**< Largest value recorded. */
+};
+
+/**
+ * @struct stripe
+ * @brief One stripe of the traffic counters, alone on its cache line.
+ */
+typedef struct stripe {
+    atomic_ulong packets_in, bytes_in;
+    atomic_ulong packets_out, bytes_out;
+} __attribute__((aligned(64))) STRIPE;
+
+static HISTOGRAM histograms[STATS_MAX_TYPES];
+static STRIPE stripes[STRIPES];
+static atomic_uint next_stripe = 0;
+static __thread int my_stripe = -1;
+static uint64_t start_time;
+
+// State of the previous report, for computing rates (serialized by report_mutex)
+static pthread_mutex_t report_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t prev_time;
+static unsigned long prev_packets_in, prev_bytes_in, prev_packets_out, prev_bytes_out;
+
+// Sections added by other modules (added under report_mutex)
+static STATS_REPORT_FN *sections[STATS_MAX_REPORTS];
+static int nsections = 0;
+
+/// Names of the packet types with histograms.
+static const char *type_names[STATS_MAX_TYPES] = {
+    [MZW_LOGIN_PKT] = "LOGIN", [MZW_MOVE_PKT] = "MOVE", [MZW_TURN_PKT] = "TURN",
+    [MZW_FIRE_PKT] = "FIRE", [MZW_REFRESH_PKT] = "REFRESH", [MZW_SEND_PKT] = "SEND",
+};
+
+void stats_init(void) {
+    start_time = prev_time = stats_now();
+}
+
+int stats_add_report(STATS_REPORT_FN *fn) {
+    pthread_mutex_lock(&report_mutex);
+    int rc = -1;
+    if (nsections < STATS_MAX_REPORTS) {
+        sections[nsections++] = fn;
+        rc = 0;
+    }
+    pthread_mutex_unlock(&report_mutex);
+    return rc;
+}
+
+uint64_t stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief Bucket index of a value.
+ *
+ * Values below SUB_COUNT have a bucket each.  Above that, each power of two
+ * [2^e, 2^(e+1)) is split into SUB_COUNT equal buckets.
+ */
+static int bucket_of(uint64_t v) {
+    if (v < SUB_COUNT) return (int)v;
+    int e = 63 - __builtin_clzll(v);
+    int shift = e - SUB_BITS;
+    return (shift + 1) * SUB_COUNT + (int)((v >> shift) - SUB_COUNT);
+}
+
+/**
+ * @brief Largest value that falls in a bucket.
+ */
+static uint64_t bucket_high(int index) {
+    int group = index / SUB_COUNT, sub = index % SUB_COUNT;
+    if (group == 0) return sub;
+    int shift = group - 1;
+    return (((uint64_t)(SUB_COUNT + sub)) << shift) + ((1ULL << shift) - 1);
+}
+
+HISTOGRAM *histogram_create(void) {
+    HISTOGRAM *h = calloc(1, sizeof(HISTOGRAM));
+    if (!h) error("histogram_create: Memory allocation failed");
+    return h;
+}
+
+void histogram_record(HISTOGRAM *h, uint64_t nanos) {
+    atomic_fetch_add_explicit(&h->counts[bucket_of(nanos)], 1, memory_order_relaxed);
+
+    unsigned long max = atomic_load_explicit(&h->max, memory_order_relaxed);
+    while (nanos > max &&
+           !atomic_compare_exchange_weak_explicit(&h->max, &max, nanos,
+                                                  memory_order_relaxed, memory_order_relaxed))
+        ;
+}
+
+/**
+ * @brief Compute the count and p50/p99/p999/max of a histogram.
+ *
+ * The buckets are read twice (once for the total, once for the quantiles)
+ * while other threads may still be recording, so a summary taken under
+ * load is approximate; quantiles are capped at the recorded maximum, since
+ * a bucket's upper bound can exceed every value actually in it.
+ */
+unsigned long histogram_summary(HISTOGRAM *h, uint64_t *p50p, uint64_t *p99p,
+                                uint64_t *p999p, uint64_t *maxp) {
+    unsigned long total = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        total += atomic_load_explicit(&h->counts[i], memory_order_relaxed);
+
+    uint64_t max = atomic_load(&h->max);
+    const double q[3] = { 0.50, 0.99, 0.999 };
+    uint64_t *out[3] = { p50p, p99p, p999p };
+    unsigned long seen = 0;
+    int k = 0;
+
+    for (int j = 0; j < 3; j++) *out[j] = 0;
+    for (int i = 0; i < HIST_BUCKETS && k < 3 && total > 0; i++) {
+        seen += atomic_load_explicit(&h->counts[i], memory_order_relaxed);
+        while (k < 3 && seen >= (unsigned long)(q[k] * total + 0.999999)) {
+            uint64_t v = bucket_high(i);
+            *out[k++] = (v < max) ? v : max;
+        }
+    }
+    while (k < 3) *out[k++] = max;  // Buckets grew while being read
+    *maxp = max;
+    return total;
+}
+
+void stats_record(int type, uint64_t nanos) {
+    if (type < 0 || type >= STATS_MAX_TYPES) return;
+    histogram_record(&histograms[type], nanos);
+}
+
+/**
+ * @brief The calling thread's traffic counter stripe.
+ */
+static STRIPE *stripe(void) {
+    if (my_stripe < 0) my_stripe = atomic_fetch_add(&next_stripe, 1) % STRIPES;
+    return &stripes[my_stripe];
+}
+
+void stats_count_in(size_t bytes) {
+    STRIPE *s = stripe();
+    atomic_fetch_add_explicit(&s->packets_in, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->bytes_in, bytes, memory_order_relaxed);
+}
+
+void stats_count_out(size_t bytes) {
+    STRIPE *s = stripe();
+    atomic_fetch_add_explicit(&s->packets_out, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->bytes_out, bytes, memory_order_relaxed);
+}
+
+int stats_report(char *buf, size_t len) {
+    size_t n = 0;
+#define EMIT(...) do { \
+        int w = snprintf(n < len ? buf + n : NULL, n < len ? len - n : 0, __VA_ARGS__); \
+        if (w > 0) n += w; \
+    } while (0)
+
+    pthread_mutex_lock(&report_mutex);
+
+    unsigned long packets_in = 0, bytes_in = 0, packets_out = 0, bytes_out = 0;
+    for (int i = 0; i < STRIPES; i++) {
+        packets_in += atomic_load(&stripes[i].packets_in);
+        bytes_in += atomic_load(&stripes[i].bytes_in);
+        packets_out += atomic_load(&stripes[i].packets_out);
+        bytes_out += atomic_load(&stripes[i].bytes_out);
+    }
+
+    uint64_t now = stats_now();
+    double interval = (now - prev_time) / 1e9;
+    if (interval <= 0) interval = 1e-9;
+
+    EMIT("uptime_s %.3f\n", (now - start_time) / 1e9);
+    EMIT("interval_s %.3f\n", interval);
+    EMIT("packets_in %lu %.1f/s\n", packets_in, (packets_in - prev_packets_in) / interval);
+    EMIT("bytes_in %lu %.1f/s\n", bytes_in, (bytes_in - prev_bytes_in) / interval);
+    EMIT("packets_out %lu %.1f/s\n", packets_out, (packets_out - prev_packets_out) / interval);
+    EMIT("bytes_out %lu %.1f/s\n", bytes_out, (bytes_out - prev_bytes_out) / interval);
+    EMIT("%-8s %10s %10s %10s %10s %10s\n", "type", "count", "p50_us", "p99_us", "p999_us", "max_us");
+
+    for (int t = 0; t < STATS_MAX_TYPES; t++) {
+        uint64_t p50, p99, p999, max;
+        unsigned long total = histogram_summary(&histograms[t], &p50, &p99, &p999, &max);
+        if (total == 0) continue;
+
+        char name[16];
+        if (type_names[t]) snprintf(name, sizeof(name), "%s", type_names[t]);
+        else snprintf(name, sizeof(name), "type%d", t);
+        EMIT("%-8s %10lu %10.1f %10.1f %10.1f %10.1f\n", name, total,
+             p50 / 1e3, p99 / 1e3, p999 / 1e3, max / 1e3);
+    }
+
+    // Lock contention, if profiling is on
+    n += lockprof_report(n < len ? buf + n : NULL, n < len ? len - n : 0);
+
+    // Other modules' counters
+    for (int i = 0; i < nsections; i++)
+        n += sections[i](n < len ? buf + n : NULL, n < len ? len - n : 0);
+
+    prev_time = now;
+    prev_packets_in = packets_in;
+    prev_bytes_in = bytes_in;
+    prev_packets_out = packets_out;
+    prev_bytes_out = bytes_out;
+
+    pthread_mutex_unlock(&report_mutex);
+#undef EMIT
+    return (n < len) ? (int)n : (int)(len ? len - 1 : 0);
+}
+
+// Listening socket and thread started by stats_serve(), if any
+static int serve_fd = -1;
+static pthread_t serve_tid;
+
+/**
+ * @brief Serve one report per connection on the stats port, until
+ * stats_fini() shuts the listening socket down.
+ * @param arg Unused.
+ */
+static void *stats_thread(void *arg) {
+    (void)arg;
+    char report[8192];
+    while (1) {
+        int fd = accept(serve_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+
+        int len = stats_report(report, sizeof(report));
+        for (int off = 0; off < len; ) {
+            ssize_t w = write(fd, report + off, len - off);
+            if (w <= 0) break;
+            off += w;
+        }
+        close(fd);
+    }
+    return NULL;
+}
+
+int stats_serve(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("stats socket");
+        return -1;
+    }
+
+    int optval = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK)
+    };
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+        perror("stats bind/listen");
+        close(fd);
+        return -1;
+    }
+
+    serve_fd = fd;
+    if (pthread_create(&serve_tid, NULL, stats_thread, NULL) != 0) {
+        perror("pthread_create");
+        serve_fd = -1;
+        close(fd);
+        return -1;
+    }
+    debug("stats_serve: Serving statistics on 127.0.0.1:%d", port);
+    return 0;
+}
+
+void stats_fini(void) {
+    if (serve_fd < 0) return;
+    shutdown(serve_fd, SHUT_RDWR);  // Makes the blocked accept() fail
+    pthread_join(serve_tid, NULL);
+    close(serve_fd);
+    serve_fd = -1;
+}
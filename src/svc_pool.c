@@ -0,0 +1,318 @@
+/**
+ * @file svc_pool.c
+ * @brief Pool of pre-spawned client service threads.
+ *
+ * Connections are passed to workers through a bounded multi-producer,
+ * multi-consumer ring (after D. Vyukov): each cell carries a sequence
+ * number that tells producers and consumers whether it is free or full for
+ * their lap of the ring, so both sides claim cells with a single
+ * compare-and-swap on their index and never take a lock.  A semaphore
+ * counts the connections in the ring, so that idle workers can sleep.
+ *
+ * Growth is driven by a count of idle workers.  Each submitted connection
+ * claims one idle worker by decrementing the count; if there is none, it
+ * creates a worker that is claimed from birth, or, at the maximum, is left
+ * for the next worker that finishes a session to claim instead of going
+ * idle.  The counts only steer growth: a queued connection is served by
+ * whichever worker takes it from the ring.
+ *
+ * At shutdown, connections still in the ring are closed, and each worker
+ * exits instead of waiting for another connection once its session ends.
+ */
+
+#define _GNU_SOURCE  // pthread_getaffinity_np
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+
+#include "svc_pool.h"
+#include "svc_thread.h"
+#include "server_ext.h"
+#include "admission.h"
+#include "debug.h"
+
+#define QUEUE_MASK (SVC_POOL_QUEUE_SIZE - 1)
+_Static_assert((SVC_POOL_QUEUE_SIZE & QUEUE_MASK) == 0, "queue size must be a power of two");
+
+/**
+ * @struct cell
+ * @brief One slot of the connection ring.
+ */
+typedef struct cell {
+    atomic_size_t seq;        /**< Position the cell is next free (== pos) or full (== pos + 1) for. */
+    int fd;                   /**< Connection, when full. */
+} CELL;
+
+static CELL cells[SVC_POOL_QUEUE_SIZE];
+static atomic_size_t enqueue_pos, dequeue_pos;
+static sem_t pending;                       // Connections in the ring
+
+static int min_workers, max_workers;
+static atomic_int workers = 0;              // Workers in existence
+static atomic_int idle = 0;                 // Idle workers not yet claimed by a connection
+static atomic_int unclaimed = 0;            // Connections that found no worker to claim
+static atomic_int queued = 0, queued_peak = 0;
+static atomic_ulong spawned = 0, exited = 0;
+static atomic_int stopping = 0;             // Set by svc_pool_shutdown()
+
+// Signaled as each worker exits
+static pthread_mutex_t exit_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t exit_cond = PTHREAD_COND_INITIALIZER;
+
+/// Argument of a worker created for a connection that is already waiting.
+#define WORKER_CLAIMED ((void *)1)
+
+/**
+ * @brief Append a connection to the ring.
+ * @return 0 on success, -1 if the ring is full.
+ */
+static int queue_push(int fd) {
+    size_t pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+    while (1) {
+        CELL *cell = &cells[pos & QUEUE_MASK];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                cell->fd = fd;
+                atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+                return 0;
+            }
+        } else if (dif < 0) {
+            return -1;
+        } else {
+            pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+/**
+ * @brief Remove the oldest connection from the ring.
+ * @return The connection, or -1 if the ring is empty (or the oldest cell
+ * has been claimed but not yet filled by its producer).
+ */
+static int queue_pop(void) {
+    size_t pos = atomic_load_explicit(&dequeue_pos, memory_order_relaxed);
+    while (1) {
+        CELL *cell = &cells[pos & QUEUE_MASK];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&dequeue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                int fd = cell->fd;
+                atomic_store_explicit(&cell->seq, pos + SVC_POOL_QUEUE_SIZE, memory_order_release);
+                return fd;
+            }
+        } else if (dif < 0) {
+            return -1;
+        } else {
+            pos = atomic_load_explicit(&dequeue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+/**
+ * @brief Decrement a counter if it is positive.
+ * @return 1 if it was decremented, 0 if it was zero.
+ */
+static int take_one(atomic_int *count) {
+    int n = atomic_load(count);
+    while (n > 0) {
+        if (atomic_compare_exchange_weak(count, &n, n - 1)) return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Make the calling worker available: claim a connection that found
+ * no worker, or else count the worker as idle.
+ */
+static void worker_offer(void) {
+    if (!take_one(&unclaimed)) atomic_fetch_add(&idle, 1);
+}
+
+/**
+ * @brief Take the calling worker out of the count of workers, so that it
+ * can exit because the pool is shutting down.
+ * @return -1, for worker_wait() to return.
+ */
+static int worker_stop(void) {
+    atomic_fetch_sub(&workers, 1);
+    return -1;
+}
+
+/**
+ * @brief Wait for a connection to be queued.
+ * @return 0 when one is available, -1 if the worker should exit because
+ * the pool is shutting down, or because it has been idle too long and
+ * there are more than the minimum.  The worker has then been taken out of
+ * the count of workers.
+ */
+static int worker_wait(void) {
+    while (1) {
+        if (atomic_load(&stopping)) return worker_stop();
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += SVC_POOL_IDLE_SECONDS;
+        if (sem_timedwait(&pending, &deadline) == 0)
+            return atomic_load(&stopping) ? worker_stop() : 0;
+        if (errno != ETIMEDOUT) continue;  // EINTR, e.g. a stale SIGUSR1
+
+        // Withdraw an idle worker, unless a connection has claimed them all
+        if (atomic_load(&workers) <= min_workers || !take_one(&idle)) continue;
+        if (atomic_fetch_sub(&workers, 1) > min_workers) return -1;
+        atomic_fetch_add(&workers, 1);
+        atomic_fetch_add(&idle, 1);
+    }
+}
+
+/**
+ * @brief Worker thread: serve queued connections one after another.
+ * @param arg WORKER_CLAIMED if created for a waiting connection, else NULL.
+ * @return NULL.
+ */
+static void *pool_worker(void *arg) {
+    int claimed = (arg == WORKER_CLAIMED);
+
+    // Serving a pinned room moves the thread; move it back after each session
+    cpu_set_t cpus;
+    int have_cpus = (pthread_getaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0);
+
+    while (1) {
+        if (!claimed) worker_offer();
+        claimed = 0;
+        if (worker_wait() != 0) break;
+
+        // Its producer may be between claiming and filling the cell, or the
+        // connection may have been closed by svc_pool_shutdown()
+        int fd;
+        while ((fd = queue_pop()) < 0 && !atomic_load(&stopping))
+            sched_yield();
+        if (fd < 0) {
+            worker_stop();
+            break;
+        }
+        atomic_fetch_sub(&queued, 1);
+
+        debug("pool_worker: Serving fd=%d", fd);
+        mzw_serve_connection(fd);
+        if (have_cpus) pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+    atomic_fetch_add(&exited, 1);
+    pthread_mutex_lock(&exit_mutex);
+    pthread_cond_broadcast(&exit_cond);
+    pthread_mutex_unlock(&exit_mutex);
+    debug("pool_worker: Idle worker exiting");
+    return NULL;
+}
+
+/**
+ * @brief Create a worker.
+ * @param arg Argument passed to pool_worker().
+ * @return 0 on success, -1 if the thread could not be created.
+ */
+static int spawn_worker(void *arg) {
+    if (svc_thread_create(pool_worker, arg) != 0) return -1;
+    atomic_fetch_add(&spawned, 1);
+    return 0;
+}
+
+/**
+ * @brief Initialize the ring and create the minimum number of workers.
+ * @param min Minimum (and initial) number of workers.
+ * @param max Maximum number of workers (0 = no limit).
+ * @return 0 on success, -1 on failure.
+ */
+int svc_pool_init(int min, int max) {
+    min_workers = min > 0 ? min : 0;
+    max_workers = (max > 0 && max < min_workers) ? min_workers : (max > 0 ? max : 0);
+    for (size_t i = 0; i < SVC_POOL_QUEUE_SIZE; i++)
+        atomic_init(&cells[i].seq, i);
+    if (sem_init(&pending, 0, 0) != 0) return -1;
+
+    for (int i = 0; i < min_workers; i++) {
+        atomic_fetch_add(&workers, 1);
+        if (spawn_worker(NULL) != 0) {
+            atomic_fetch_sub(&workers, 1);
+            error("svc_pool_init: Created only %d of %d workers", i, min_workers);
+            return -1;
+        }
+    }
+    debug("svc_pool_init: %d workers, at most %d", min_workers, max_workers);
+    return 0;
+}
+
+/**
+ * @brief Queue a connection and make sure a worker will serve it.
+ * @param fd Admitted connection.
+ * @return 0 if queued, -1 if the ring is full.
+ */
+int svc_pool_submit(int fd) {
+    if (queue_push(fd) != 0) {
+        error("svc_pool_submit: Queue full, cannot serve fd=%d", fd);
+        return -1;
+    }
+    int n = atomic_fetch_add(&queued, 1) + 1;
+    int peak = atomic_load(&queued_peak);
+    while (n > peak && !atomic_compare_exchange_weak(&queued_peak, &peak, n))
+        ;
+    sem_post(&pending);
+
+    if (take_one(&idle)) return 0;
+
+    // No idle worker: create one for this connection, if the limit allows
+    int w = atomic_load(&workers);
+    while (max_workers == 0 || w < max_workers) {
+        if (atomic_compare_exchange_weak(&workers, &w, w + 1)) {
+            if (spawn_worker(WORKER_CLAIMED) == 0) return 0;
+            atomic_fetch_sub(&workers, 1);
+            error("svc_pool_submit: Failed to create a worker");
+            break;
+        }
+    }
+    atomic_fetch_add(&unclaimed, 1);
+    return 0;
+}
+
+/**
+ * @brief Close the connections no worker has taken, and wait for every
+ * worker to finish its session and exit.
+ */
+void svc_pool_shutdown(void) {
+    atomic_store(&stopping, 1);
+
+    int fd;
+    while ((fd = queue_pop()) >= 0) {
+        atomic_fetch_sub(&queued, 1);
+        debug("svc_pool_shutdown: Closing queued fd=%d", fd);
+        close(fd);
+        admission_release();
+    }
+
+    // Wake the idle workers; busy ones see the flag when their session ends
+    for (int i = atomic_load(&workers); i > 0; i--)
+        sem_post(&pending);
+    pthread_mutex_lock(&exit_mutex);
+    while (atomic_load(&workers) > 0)
+        pthread_cond_wait(&exit_cond, &exit_mutex);
+    pthread_mutex_unlock(&exit_mutex);
+    debug("svc_pool_shutdown: All workers exited");
+}
+
+int svc_pool_report(char *buf, size_t len) {
+    int w = atomic_load(&workers), i = atomic_load(&idle);
+    return snprintf(buf, len, "pool workers %d idle %d busy %d spawned %lu exited %lu "
+                    "queued %d queued_peak %d\n", w, i, w > i ? w - i : 0,
+                    atomic_load(&spawned), atomic_load(&exited),
+                    atomic_load(&queued), atomic_load(&queued_peak));
+}
@@ -0,0 +1,179 @@
+/**
+ * @file svc_thread.c
+ * @brief Creation of client service threads with a bounded stack.
+ *
+ * The attributes are set up once by svc_thread_init() and then only read,
+ * so threads may be created concurrently from several accept threads.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+#include "svc_thread.h"
+#include "slab.h"
+#include "debug.h"
+
+static pthread_attr_t svc_attr;
+static size_t svc_stack_size, svc_guard_size;
+static pthread_once_t svc_default_once = PTHREAD_ONCE_INIT;
+static int svc_configured = 0;
+
+#define ROUND_UP(n, a) (((n) + (a) - 1) / (a) * (a))
+
+/**
+ * @brief Configure the stack and guard sizes of service threads.
+ * @param stack_size Stack size in bytes (0 = SVC_THREAD_STACK_DEFAULT).
+ * @param guard_size Guard size in bytes (0 = one page).
+ * @return 0 on success, -1 if the stack size is too small.
+ */
+int svc_thread_init(size_t stack_size, size_t guard_size) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    long min = sysconf(_SC_THREAD_STACK_MIN);
+    if (min <= 0) min = PTHREAD_STACK_MIN;
+    if (min < SVC_THREAD_STACK_MIN) min = SVC_THREAD_STACK_MIN;
+
+    stack_size = ROUND_UP(stack_size ? stack_size : SVC_THREAD_STACK_DEFAULT, page);
+    guard_size = ROUND_UP(guard_size ? guard_size : page, page);
+    if (stack_size < (size_t)min) {
+        fprintf(stderr, "Error: Thread stack size must be at least %ld KiB\n", (min + 1023) / 1024);
+        return -1;
+    }
+
+    pthread_attr_init(&svc_attr);
+    pthread_attr_setdetachstate(&svc_attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_attr_setstacksize(&svc_attr, stack_size) != 0 ||
+        pthread_attr_setguardsize(&svc_attr, guard_size) != 0) {
+        fprintf(stderr, "Error: Invalid thread stack size %zu or guard size %zu\n",
+                stack_size, guard_size);
+        pthread_attr_destroy(&svc_attr);
+        return -1;
+    }
+    svc_stack_size = stack_size;
+    svc_guard_size = guard_size;
+    svc_configured = 1;
+    debug("svc_thread_init: stack %zu, guard %zu", stack_size, guard_size);
+    return 0;
+}
+
+/**
+ * @brief Apply the default attributes if svc_thread_init() was not called.
+ */
+static void svc_thread_default(void) {
+    if (!svc_configured) svc_thread_init(0, 0);
+}
+
+/**
+ * @brief Create a detached thread with the service thread attributes.
+ * @param fn  Thread function.
+ * @param arg Argument to fn.
+ * @return 0 on success, else an error number from pthread_create().
+ */
+int svc_thread_create(void *(*fn)(void *), void *arg) {
+    pthread_once(&svc_default_once, svc_thread_default);
+    pthread_t tid;
+    return pthread_create(&tid, &svc_attr, fn, arg);
+}
+
+/**
+ * @brief Read the process's resident set size.
+ * @return Resident bytes, or 0 if unknown.
+ */
+static size_t resident_bytes(void) {
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    unsigned long size, resident;
+    int n = fscanf(f, "%lu %lu", &size, &resident);
+    fclose(f);
+    return n == 2 ? resident * sysconf(_SC_PAGESIZE) : 0;
+}
+
+/**
+ * @struct probe
+ * @brief Rendezvous between the budget measurement and its probe threads.
+ */
+struct probe {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int arrived;              /**< Probe threads started so far. */
+    int released;             /**< Set when the measurement is done. */
+};
+
+/**
+ * @brief Body of a probe thread: stay idle until the measurement is done.
+ */
+static void *probe_thread(void *arg) {
+    struct probe *probe = arg;
+    pthread_mutex_lock(&probe->mutex);
+    probe->arrived++;
+    pthread_cond_broadcast(&probe->cond);
+    while (!probe->released)
+        pthread_cond_wait(&probe->cond, &probe->mutex);
+    pthread_mutex_unlock(&probe->mutex);
+    return NULL;
+}
+
+/**
+ * @brief Measure the per-connection memory cost of service threads.
+ * @param budget Receives the budget.
+ * @param probes Number of idle threads to measure.
+ * @return 0 on success, -1 on failure.
+ */
+int svc_thread_budget(SVC_THREAD_BUDGET *budget, int probes) {
+    pthread_once(&svc_default_once, svc_thread_default);
+    if (probes <= 0) return -1;
+    pthread_t *tids = calloc(probes, sizeof(pthread_t));
+    if (!tids) return -1;
+
+    // Probes are joinable, but otherwise created like service threads
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, svc_stack_size);
+    pthread_attr_setguardsize(&attr, svc_guard_size);
+    struct probe probe = {
+        PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0
+    };
+
+    size_t before = resident_bytes();
+    int created = 0;
+    while (created < probes && pthread_create(&tids[created], &attr, probe_thread, &probe) == 0)
+        created++;
+    pthread_mutex_lock(&probe.mutex);
+    while (probe.arrived < created)
+        pthread_cond_wait(&probe.cond, &probe.mutex);
+    size_t after = resident_bytes();
+    probe.released = 1;
+    pthread_cond_broadcast(&probe.cond);
+    pthread_mutex_unlock(&probe.mutex);
+
+    for (int i = 0; i < created; i++) pthread_join(tids[i], NULL);
+    pthread_attr_destroy(&attr);
+    free(tids);
+    if (created < probes) {
+        error("svc_thread_budget: Created only %d of %d probe threads", created, probes);
+        return -1;
+    }
+
+    budget->stack_size = svc_stack_size;
+    budget->guard_size = svc_guard_size;
+    budget->resident = after > before ? (after - before) / probes : 0;
+    budget->heap = ARENA_BLOCK_SIZE;
+
+    // Each stack is one mapping, split in two by its guard area
+    budget->max_by_maps = -1;
+    FILE *f = fopen("/proc/sys/vm/max_map_count", "r");
+    if (f) {
+        long maps;
+        if (fscanf(f, "%ld", &maps) == 1) budget->max_by_maps = maps / (svc_guard_size ? 2 : 1);
+        fclose(f);
+    }
+
+    struct rlimit rl;
+    budget->max_by_as = -1;
+    if (getrlimit(RLIMIT_AS, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+        budget->max_by_as = rl.rlim_cur / (svc_stack_size + svc_guard_size);
+    return 0;
+}
@@ -0,0 +1,596 @@
+/**
+ * @file task_sched.c
+ * @brief Work-stealing task scheduler and strands.
+ *
+ * Each worker's deque is a fixed-size Chase-Lev deque (in the C11 form of
+ * Lê, Pop, Cohen and Zappa Nardelli): the owner pushes and takes at the
+ * bottom without atomic read-modify-write operations except when taking
+ * the last task, and thieves claim the top task with a compare-and-swap.
+ * A task that finds its worker's deque full is run at once instead.
+ *
+ * Inboxes are lock-free stacks.  Any worker may empty any inbox with one
+ * atomic exchange, so a task dropped into the inbox of a busy worker can
+ * be picked up by whichever worker is woken for it.
+ *
+ * A strand is an intrusive multi-producer, single-consumer queue (after
+ * D. Vyukov) plus a count of pending tasks.  The post that raises the
+ * count from zero schedules the strand; the strand's task runs a batch of
+ * its tasks and reschedules itself if more remain, so that a busy strand
+ * does not monopolize its worker.  Without workers, the post or call that
+ * finds a strand idle claims it in the same way and runs its tasks on the
+ * calling thread until it is empty.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "task_sched.h"
+#include "svc_thread.h"
+#include "slab.h"
+#include "debug.h"
+
+/// Capacity of each worker's deque.
+#define DEQUE_SIZE 4096
+#define DEQUE_MASK (DEQUE_SIZE - 1)
+
+/// Tasks a strand runs before yielding its worker to other tasks.
+#define STRAND_BATCH 16
+
+/// Rounds of looking for work before a worker sleeps.
+#define IDLE_ROUNDS 4
+
+/**
+ * @struct deque
+ * @brief Chase-Lev work-stealing deque.
+ */
+typedef struct deque {
+    atomic_long top;                   /**< Next task to steal. */
+    char pad[64 - sizeof(atomic_long)]; /**< Keep thieves off the owner's cache line. */
+    atomic_long bottom;                /**< Next free slot. */
+    _Atomic(TASK *) buf[DEQUE_SIZE];
+} DEQUE;
+
+/**
+ * @struct worker
+ * @brief State of one worker thread.
+ */
+typedef struct worker {
+    DEQUE deque;
+    _Atomic(TASK *) inbox;             /**< Tasks spawned from other threads. */
+    uint64_t rng;                      /**< Victim selection. */
+    atomic_ulong runs, steals, overflows, sleeps;
+} WORKER;
+
+static WORKER *workers;
+static int num_workers = 0;
+static atomic_int running = 0;
+static atomic_uint next_inbox = 0;
+static __thread WORKER *self = NULL;   // Worker the calling thread is, if any
+static __thread STRAND *current_strand = NULL;  // Strand whose task is running, if any
+
+// Idle workers sleep here until a task is spawned
+static pthread_mutex_t sleep_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sleep_cond = PTHREAD_COND_INITIALIZER;
+static atomic_int sleepers = 0;
+
+// Workers exit once they run out of work after task_sched_shutdown()
+static atomic_int stopping = 0;
+static int live_workers = 0;           // Guarded by sleep_mutex
+static pthread_cond_t exit_cond = PTHREAD_COND_INITIALIZER;
+
+/// Tasks posted to strands and spawned with task_spawn().
+static SLAB task_slab = SLAB_INIT("task", sizeof(TASK), 256);
+
+static void strand_run(void *arg);
+
+/**
+ * @brief Push a task on the bottom of the owner's deque.
+ * @return 0 on success, -1 if the deque is full.
+ */
+static int deque_push(DEQUE *d, TASK *t) {
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    long top = atomic_load_explicit(&d->top, memory_order_acquire);
+    if (b - top >= DEQUE_SIZE) return -1;
+    atomic_store_explicit(&d->buf[b & DEQUE_MASK], t, memory_order_relaxed);
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_release);
+    return 0;
+}
+
+/**
+ * @brief Take the task on the bottom of the owner's deque.
+ * @return The task, or NULL if the deque is empty.
+ */
+static TASK *deque_take(DEQUE *d) {
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long t = atomic_load_explicit(&d->top, memory_order_relaxed);
+    if (t > b) {
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+        return NULL;
+    }
+    TASK *task = atomic_load_explicit(&d->buf[b & DEQUE_MASK], memory_order_relaxed);
+    if (t == b) {
+        // Last task: race thieves for it
+        if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+                                                     memory_order_seq_cst, memory_order_relaxed))
+            task = NULL;
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    }
+    return task;
+}
+
+/**
+ * @brief Steal the task on the top of another worker's deque.
+ * @return The task, or NULL if the deque is empty or another thief won.
+ */
+static TASK *deque_steal(DEQUE *d) {
+    long t = atomic_load_explicit(&d->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+    if (t >= b) return NULL;
+    TASK *task = atomic_load_explicit(&d->buf[t & DEQUE_MASK], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+                                                 memory_order_seq_cst, memory_order_relaxed))
+        return NULL;
+    return task;
+}
+
+/**
+ * @brief Run a task, and free it if the scheduler allocated it.
+ */
+static void run_task(TASK *t) {
+    int pooled = t->pooled;  // A strand's own task may be rescheduled while it runs
+    t->fn(t->arg);
+    if (pooled) slab_free(&task_slab, t);
+}
+
+/**
+ * @brief Wake a sleeping worker, if any.
+ */
+static void wake_worker(void) {
+    // Pairs with the fence in worker_sleep(): either the sleeper sees the
+    // new task, or this sees the sleeper
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&sleepers, memory_order_relaxed) > 0) {
+        pthread_mutex_lock(&sleep_mutex);
+        pthread_cond_signal(&sleep_cond);
+        pthread_mutex_unlock(&sleep_mutex);
+    }
+}
+
+/**
+ * @brief Hand a task to the running scheduler.
+ */
+static void submit(TASK *t) {
+    if (self) {
+        if (deque_push(&self->deque, t) == 0) {
+            wake_worker();
+        } else {
+            atomic_fetch_add_explicit(&self->overflows, 1, memory_order_relaxed);
+            run_task(t);
+        }
+        return;
+    }
+    WORKER *w = &workers[atomic_fetch_add_explicit(&next_inbox, 1, memory_order_relaxed) % num_workers];
+    TASK *head = atomic_load_explicit(&w->inbox, memory_order_relaxed);
+    do {
+        atomic_store_explicit(&t->next, head, memory_order_relaxed);
+    } while (!atomic_compare_exchange_weak_explicit(&w->inbox, &head, t,
+                                                    memory_order_release, memory_order_relaxed));
+    wake_worker();
+}
+
+/**
+ * @brief Empty an inbox into the calling worker's deque.
+ * @return The oldest task of the inbox, to be run next, or NULL if it was empty.
+ */
+static TASK *drain_inbox(WORKER *me, WORKER *w) {
+    TASK *list = atomic_exchange_explicit(&w->inbox, NULL, memory_order_acquire);
+    if (!list) return NULL;
+
+    // The inbox is a stack, newest first.  Queue all but the oldest, so
+    // that the owner, which takes from the bottom of its deque, runs them
+    // oldest first, and run the oldest now.
+    while (1) {
+        TASK *next = atomic_load_explicit(&list->next, memory_order_relaxed);
+        if (!next) return list;
+        if (deque_push(&me->deque, list) != 0) {
+            atomic_fetch_add_explicit(&me->overflows, 1, memory_order_relaxed);
+            run_task(list);
+        }
+        list = next;
+    }
+}
+
+/**
+ * @brief Find a task for a worker: its own deque, its inbox, then other
+ * workers' deques and inboxes, starting from a random victim.
+ * @return A task, or NULL if none was found.
+ */
+static TASK *find_work(WORKER *me) {
+    TASK *t = deque_take(&me->deque);
+    if (t || (t = drain_inbox(me, me))) return t;
+
+    me->rng = me->rng * 6364136223846793005ULL + 1442695040888963407ULL;
+    int start = (int)((me->rng >> 33) % num_workers);
+    for (int i = 0; i < num_workers; i++) {
+        WORKER *victim = &workers[(start + i) % num_workers];
+        if (victim == me) continue;
+        if ((t = deque_steal(&victim->deque)) || (t = drain_inbox(me, victim))) {
+            atomic_fetch_add_explicit(&me->steals, 1, memory_order_relaxed);
+            return t;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Determine whether any worker has a task waiting.
+ */
+static int work_available(void) {
+    for (int i = 0; i < num_workers; i++) {
+        WORKER *w = &workers[i];
+        if (atomic_load(&w->deque.bottom) > atomic_load(&w->deque.top) || atomic_load(&w->inbox))
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Sleep until a task is spawned or the scheduler is shut down.
+ */
+static void worker_sleep(WORKER *me) {
+    pthread_mutex_lock(&sleep_mutex);
+    atomic_fetch_add_explicit(&sleepers, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!work_available() && !atomic_load(&stopping)) {
+        atomic_fetch_add_explicit(&me->sleeps, 1, memory_order_relaxed);
+        pthread_cond_wait(&sleep_cond, &sleep_mutex);
+    }
+    atomic_fetch_sub_explicit(&sleepers, 1, memory_order_relaxed);
+    pthread_mutex_unlock(&sleep_mutex);
+}
+
+/**
+ * @brief Worker thread: run tasks until the scheduler is shut down and
+ * no work is left.
+ * @param arg The worker's WORKER.
+ * @return NULL.
+ */
+static void *worker_main(void *arg) {
+    WORKER *me = arg;
+    self = me;
+    while (1) {
+        TASK *t = NULL;
+        for (int round = 0; round < IDLE_ROUNDS && !(t = find_work(me)); round++)
+            sched_yield();
+        if (!t) {
+            if (atomic_load(&stopping)) break;
+            worker_sleep(me);
+            continue;
+        }
+        atomic_fetch_add_explicit(&me->runs, 1, memory_order_relaxed);
+        run_task(t);
+    }
+    pthread_mutex_lock(&sleep_mutex);
+    if (--live_workers == 0) pthread_cond_signal(&exit_cond);
+    pthread_mutex_unlock(&sleep_mutex);
+    return NULL;
+}
+
+/**
+ * @brief Start the worker threads.
+ * @param count Number of workers (0 = leave the scheduler stopped).
+ * @return 0 on success, -1 on failure.
+ */
+int task_sched_init(int count) {
+    if (count <= 0) return 0;
+    workers = calloc(count, sizeof(WORKER));
+    if (!workers) return -1;
+    num_workers = count;
+    for (int i = 0; i < count; i++)
+        workers[i].rng = 0x9E3779B97F4A7C15ULL * (i + 1);
+
+    // Tasks may be spawned as soon as the first worker exists
+    atomic_store(&running, 1);
+    for (int i = 0; i < count; i++) {
+        pthread_mutex_lock(&sleep_mutex);
+        live_workers++;
+        pthread_mutex_unlock(&sleep_mutex);
+        if (svc_thread_create(worker_main, &workers[i]) != 0) {
+            error("task_sched_init: Failed to start worker %d", i);
+            pthread_mutex_lock(&sleep_mutex);
+            live_workers--;
+            pthread_mutex_unlock(&sleep_mutex);
+            return -1;
+        }
+    }
+    debug("task_sched_init: %d workers", count);
+    return 0;
+}
+
+/**
+ * @brief Let the workers finish the tasks they have, wait for them to
+ * exit, and free their state.
+ */
+void task_sched_shutdown(void) {
+    if (!workers) return;
+
+    // From here on, tasks spawned from outside the workers run inline
+    atomic_store(&running, 0);
+    atomic_store(&stopping, 1);
+    pthread_mutex_lock(&sleep_mutex);
+    pthread_cond_broadcast(&sleep_cond);
+    while (live_workers > 0)
+        pthread_cond_wait(&exit_cond, &sleep_mutex);
+    pthread_mutex_unlock(&sleep_mutex);
+
+    free(workers);
+    workers = NULL;
+    num_workers = 0;
+    debug("task_sched_shutdown: All workers exited");
+}
+
+int task_sched_running(void) {
+    return atomic_load_explicit(&running, memory_order_relaxed);
+}
+
+/**
+ * @brief Allocate a task to be freed after it runs.
+ * @return The task, or NULL if memory is exhausted.
+ */
+static TASK *task_alloc(TASK_FN *fn, void *arg) {
+    TASK *t = slab_alloc(&task_slab);
+    if (t) {
+        t->fn = fn;
+        t->arg = arg;
+        t->pooled = 1;
+    }
+    return t;
+}
+
+void task_spawn(TASK_FN *fn, void *arg) {
+    TASK *t = task_sched_running() ? task_alloc(fn, arg) : NULL;
+    if (!t) {
+        fn(arg);
+        return;
+    }
+    submit(t);
+}
+
+void strand_init(STRAND *strand) {
+    strand_init_owned(strand, NULL, NULL, NULL);
+}
+
+void strand_init_owned(STRAND *strand, TASK_FN *hold, TASK_FN *release, void *owner) {
+    atomic_init(&strand->stub.next, NULL);
+    atomic_init(&strand->head, &strand->stub);
+    strand->tail = &strand->stub;
+    atomic_init(&strand->pending, 0);
+    strand->run.fn = strand_run;
+    strand->run.arg = strand;
+    strand->run.pooled = 0;
+    atomic_init(&strand->run.next, NULL);
+    strand->hold = hold;
+    strand->release = release;
+    strand->owner = owner;
+}
+
+STRAND *strand_current(void) {
+    return current_strand;
+}
+
+/**
+ * @brief Append a task to a strand's queue (any thread).
+ */
+static void strand_push(STRAND *strand, TASK *t) {
+    atomic_store_explicit(&t->next, NULL, memory_order_relaxed);
+    TASK *prev = atomic_exchange_explicit(&strand->head, t, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, t, memory_order_release);
+}
+
+/**
+ * @brief Remove the next task from a strand's queue (the strand's runner only).
+ * @return The task, or NULL if none is fully posted yet.
+ */
+static TASK *strand_pop(STRAND *strand) {
+    TASK *tail = strand->tail;
+    TASK *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (tail == &strand->stub) {
+        if (!next) return NULL;
+        strand->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    }
+    if (next) {
+        strand->tail = next;
+        return tail;
+    }
+    if (tail != atomic_load_explicit(&strand->head, memory_order_acquire))
+        return NULL;  // A post is between its exchange and its link
+    strand_push(strand, &strand->stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (next) {
+        strand->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Call a task function as the runner of a strand.
+ */
+static void strand_invoke(STRAND *strand, TASK_FN *fn, void *arg) {
+    STRAND *outer = current_strand;  // Posting to an idle strand may run it inside another
+    current_strand = strand;
+    fn(arg);
+    current_strand = outer;
+}
+
+/**
+ * @brief Count one of a strand's tasks as finished.
+ * @return 1 if it was the last pending task, in which case the strand is
+ * idle and must not be touched again by its runner; 0 if more remain.
+ */
+static int strand_finish(STRAND *strand) {
+    // Releasing the owner may free the strand, so read it first
+    TASK_FN *release = strand->release;
+    void *owner = strand->owner;
+    if (atomic_fetch_sub_explicit(&strand->pending, 1, memory_order_acq_rel) != 1)
+        return 0;
+    if (release) release(owner);
+    return 1;
+}
+
+/**
+ * @brief Run a strand's next task.
+ * @return As for strand_finish().
+ */
+static int strand_run_one(STRAND *strand) {
+    TASK *t;
+    // Every pending task has been pushed, though perhaps not yet linked
+    while (!(t = strand_pop(strand)))
+        sched_yield();
+    int pooled = t->pooled;  // A waiting caller may reclaim its task once it has run
+    strand_invoke(strand, t->fn, t->arg);
+    if (pooled) slab_free(&task_slab, t);
+    return strand_finish(strand);
+}
+
+/**
+ * @brief Task that runs a batch of a strand's tasks.
+ * @param arg The strand.
+ */
+static void strand_run(void *arg) {
+    STRAND *strand = arg;
+    for (int i = 0; i < STRAND_BATCH; i++) {
+        if (strand_run_one(strand))
+            return;  // Strand is empty; the next post reschedules it
+    }
+    submit(&strand->run);
+}
+
+/**
+ * @brief Carry on running a strand whose remaining tasks the caller has
+ * become responsible for: hand it to the scheduler if it is running, or
+ * else run the tasks here until the strand is empty.
+ */
+static void strand_continue(STRAND *strand) {
+    if (task_sched_running()) {
+        submit(&strand->run);
+        return;
+    }
+    while (!strand_run_one(strand))
+        ;
+}
+
+/**
+ * @brief Start running a strand that the caller has made non-idle.
+ */
+static void strand_start(STRAND *strand) {
+    if (strand->hold) strand->hold(strand->owner);
+    strand_continue(strand);
+}
+
+/**
+ * @brief Try to run a task function at once, as the runner of an idle strand.
+ * @return 1 if it was run, 0 if the strand is busy.
+ */
+static int strand_try_run(STRAND *strand, TASK_FN *fn, void *arg) {
+    int idle = 0;
+    if (!atomic_compare_exchange_strong_explicit(&strand->pending, &idle, 1,
+                                                 memory_order_acq_rel, memory_order_relaxed))
+        return 0;
+    if (strand->hold) strand->hold(strand->owner);
+    strand_invoke(strand, fn, arg);
+    // Tasks posted meanwhile are now the caller's to run
+    if (!strand_finish(strand)) strand_continue(strand);
+    return 1;
+}
+
+/**
+ * @brief Queue a task on a strand, starting the strand if it was idle.
+ */
+static void strand_enqueue(STRAND *strand, TASK *t) {
+    strand_push(strand, t);
+    if (atomic_fetch_add_explicit(&strand->pending, 1, memory_order_acq_rel) == 0)
+        strand_start(strand);
+}
+
+void strand_post(STRAND *strand, TASK_FN *fn, void *arg) {
+    // Without workers, whoever finds the strand idle runs it
+    if (!task_sched_running() && strand_try_run(strand, fn, arg))
+        return;
+    TASK *t = task_alloc(fn, arg);
+    if (!t) {
+        strand_call(strand, fn, arg);  // Out of memory: wait for it instead
+        return;
+    }
+    strand_enqueue(strand, t);
+}
+
+/**
+ * @struct strand_call
+ * @brief A task function that strand_call() waits for.
+ */
+struct strand_call {
+    TASK_FN *fn;
+    void *arg;
+    sem_t done;
+};
+
+/**
+ * @brief Task that runs a strand_call() and wakes its caller.
+ */
+static void strand_call_task(void *arg) {
+    struct strand_call *call = arg;
+    call->fn(call->arg);
+    sem_post(&call->done);
+}
+
+void strand_call(STRAND *strand, TASK_FN *fn, void *arg) {
+    if (current_strand == strand) {
+        fn(arg);
+        return;
+    }
+    if (strand_try_run(strand, fn, arg))
+        return;
+
+    // The strand is busy: queue the call behind its tasks and wait
+    struct strand_call call = { .fn = fn, .arg = arg };
+    sem_init(&call.done, 0, 0);
+    TASK t = { .fn = strand_call_task, .arg = &call, .pooled = 0 };
+    strand_enqueue(strand, &t);
+    while (sem_wait(&call.done) != 0 && errno == EINTR)
+        ;
+    sem_destroy(&call.done);
+}
+
+/**
+ * @brief Task that does nothing, for strand_drain().
+ */
+static void strand_nop(void *arg) {
+    (void)arg;
+}
+
+void strand_drain(STRAND *strand) {
+    strand_call(strand, strand_nop, NULL);
+}
+
+int task_sched_report(char *buf, size_t len) {
+    unsigned long runs = 0, steals = 0, overflows = 0, sleeps = 0;
+    for (int i = 0; i < num_workers; i++) {
+        runs += atomic_load(&workers[i].runs);
+        steals += atomic_load(&workers[i].steals);
+        overflows += atomic_load(&workers[i].overflows);
+        sleeps += atomic_load(&workers[i].sleeps);
+    }
+    return snprintf(buf, len, "sched workers %d runs %lu steals %lu overflows %lu sleeps %lu\n",
+                    num_workers, runs, steals, overflows, sleeps);
+}
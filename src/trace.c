@@ -0,0 +1,233 @@
+/**
+ * @file trace.c
+ * @brief Per-thread binary trace rings and their background writer.
+ *
+ * Each thread that records an event gets a single-producer/single-consumer
+ * ring on its first event.  The owning thread is the only producer: it
+ * writes a record and then publishes it by advancing the ring's head.  The
+ * writer thread is the only consumer: it copies out the records between
+ * the tail and the head, writes them to the file, and advances the tail.
+ * Neither side ever waits for the other.
+ *
+ * Rings are kept on a list whose head is only ever changed by a
+ * compare-and-swap when a thread registers a new ring, so registration is
+ * lock-free too.  When a thread exits, its ring is marked dead; the writer
+ * drains it one last time and unlinks it (unless it is still at the head
+ * of the list, in which case it is unlinked on a later pass).
+ */
+
+#define _GNU_SOURCE  // gettid
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "trace.h"
+#include "lockprof.h"
+#include "stats.h"
+#include "debug.h"
+
+/// Records per thread ring (a power of two).
+#define RING_SIZE 4096
+
+/// Interval between drains of the rings, in milliseconds.
+#define FLUSH_INTERVAL_MS 10
+
+/**
+ * @struct trace_ring
+ * @brief The trace ring of one thread.
+ */
+typedef struct trace_ring {
+    _Atomic uint32_t head;         // Next slot to write (producer)
+    _Atomic uint32_t tail;         // Next slot to drain (consumer)
+    _Atomic uint32_t dropped;      // Events lost to a full ring (producer)
+    uint32_t dropped_written;      // Part of dropped already reported (consumer)
+    atomic_int dead;               // Set when the owning thread exits
+    uint32_t tid;                  // Kernel thread ID of the owner
+    struct trace_ring *next;       // Next ring on the list
+    TRACE_RECORD records[RING_SIZE];
+} TRACE_RING;
+
+atomic_int trace_enabled = 0;
+
+static int trace_fd = -1;
+static _Atomic(TRACE_RING *) rings = NULL;
+static pthread_key_t ring_key;
+static pthread_t writer_tid;
+static atomic_int writer_stop = 0;
+static __thread TRACE_RING *my_ring = NULL;
+
+static const char *const event_names[TRACE_NEVENTS] = {
+    [TRACE_PACKET_RECV] = "packet",
+    [TRACE_PACKET_DONE] = "packet_done",
+    [TRACE_VIEW_SENT] = "view_sent",
+    [TRACE_LOCK_ACQUIRED] = "lock_acquired",
+    [TRACE_LASER_HIT] = "laser_hit"
+};
+
+const char *trace_event_name(int event) {
+    return (event > 0 && event < TRACE_NEVENTS) ? event_names[event] : NULL;
+}
+
+/**
+ * @brief Thread-exit destructor: hand the ring over to the writer.
+ */
+static void ring_release(void *arg) {
+    TRACE_RING *ring = arg;
+    my_ring = NULL;  // Any later event gets a fresh ring
+    atomic_store_explicit(&ring->dead, 1, memory_order_release);
+}
+
+/**
+ * @brief Create the calling thread's ring and register it.
+ * @return The ring, or NULL if it could not be allocated.
+ */
+static TRACE_RING *ring_create(void) {
+    TRACE_RING *ring = calloc(1, sizeof(TRACE_RING));
+    if (!ring) return NULL;
+    ring->tid = (uint32_t)gettid();
+    pthread_setspecific(ring_key, ring);
+
+    TRACE_RING *first = atomic_load(&rings);
+    do {
+        ring->next = first;
+    } while (!atomic_compare_exchange_weak(&rings, &first, ring));
+    return ring;
+}
+
+void trace_emit(TRACE_EVENT event, uint16_t arg0, uint32_t arg1) {
+    TRACE_RING *ring = my_ring;
+    if (!ring && !(ring = my_ring = ring_create())) return;
+
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail >= RING_SIZE) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    TRACE_RECORD *rec = &ring->records[head & (RING_SIZE - 1)];
+    rec->ts = stats_now();
+    rec->event = event;
+    rec->arg0 = arg0;
+    rec->arg1 = arg1;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/**
+ * @brief Write a buffer in full, retrying short writes.
+ */
+static void write_all(const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(trace_fd, p, len);
+        if (n <= 0) {
+            error("trace: Write to trace file failed");
+            return;
+        }
+        p += n;
+        len -= n;
+    }
+}
+
+/**
+ * @brief Write out the records currently in a ring, as one chunk.
+ */
+static void ring_drain(TRACE_RING *ring) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint32_t dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    if (head == tail && dropped == ring->dropped_written) return;
+
+    TRACE_CHUNK chunk = {
+        .tid = ring->tid,
+        .count = head - tail,
+        .dropped = dropped - ring->dropped_written
+    };
+    write_all(&chunk, sizeof(chunk));
+
+    // The records may wrap around the end of the ring
+    uint32_t start = tail & (RING_SIZE - 1);
+    uint32_t first = RING_SIZE - start < chunk.count ? RING_SIZE - start : chunk.count;
+    write_all(&ring->records[start], first * sizeof(TRACE_RECORD));
+    write_all(&ring->records[0], (chunk.count - first) * sizeof(TRACE_RECORD));
+
+    ring->dropped_written = dropped;
+    atomic_store_explicit(&ring->tail, head, memory_order_release);
+}
+
+/**
+ * @brief Drain every ring, and free the rings of threads that have exited.
+ */
+static void drain_all(void) {
+    TRACE_RING *first = atomic_load(&rings);
+    TRACE_RING *prev = NULL;
+    for (TRACE_RING *ring = first; ring; ) {
+        int dead = atomic_load_explicit(&ring->dead, memory_order_acquire);
+        ring_drain(ring);
+        TRACE_RING *next = ring->next;
+        if (dead && prev) {
+            // Only the head of the list is changed by other threads
+            prev->next = next;
+            free(ring);
+        } else {
+            prev = ring;
+        }
+        ring = next;
+    }
+}
+
+/**
+ * @brief Writer thread: drain the rings periodically until stopped.
+ */
+static void *writer_thread(void *arg __attribute__((unused))) {
+    struct timespec interval = { 0, FLUSH_INTERVAL_MS * 1000000L };
+    while (!atomic_load(&writer_stop)) {
+        nanosleep(&interval, NULL);
+        drain_all();
+    }
+    return NULL;
+}
+
+int trace_init(const char *path) {
+    trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (trace_fd < 0) {
+        error("trace_init: Cannot create trace file %s", path);
+        return -1;
+    }
+
+    TRACE_HEADER header = { .version = TRACE_VERSION, .record_size = sizeof(TRACE_RECORD) };
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    write_all(&header, sizeof(header));
+
+    if (pthread_key_create(&ring_key, ring_release) != 0 ||
+        pthread_create(&writer_tid, NULL, writer_thread, NULL) != 0) {
+        error("trace_init: Failed to start trace writer");
+        close(trace_fd);
+        trace_fd = -1;
+        return -1;
+    }
+
+    atomic_store(&trace_enabled, 1);
+    lockprof_trace(1);
+    debug("trace_init: Tracing to %s", path);
+    return 0;
+}
+
+void trace_fini(void) {
+    if (trace_fd < 0) return;
+
+    lockprof_trace(0);
+    atomic_store(&trace_enabled, 0);
+    atomic_store(&writer_stop, 1);
+    pthread_join(writer_tid, NULL);
+
+    drain_all();
+    close(trace_fd);
+    trace_fd = -1;
+    debug("trace_fini: Trace file closed");
+}
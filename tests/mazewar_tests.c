@@ -1,6 +1,7 @@
 #include <criterion/criterion.h>
 #include <pthread.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <signal.h>
@@ -143,3 +144,789 @@ Test(student_suite, 05_client_registry_concurrency, .timeout = 5) {
 
     creg_fini(cr);
 }
+
+#include "maze_gen.h"
+
+Test(student_suite, 06_maze_generator_is_deterministic, .timeout = 5) {
+    fprintf(stderr, "server_suite/06_maze_generator_is_deterministic\n");
+
+    MAZE_GEN_KIND kinds[] = { MAZE_GEN_PERFECT, MAZE_GEN_CAVERN, MAZE_GEN_ARENA };
+    for (int k = 0; k < 3; k++) {
+        char **a = maze_generate(kinds[k], 41, 73, 40, 12345);
+        char **b = maze_generate(kinds[k], 41, 73, 40, 12345);
+        char **c = maze_generate(kinds[k], 41, 73, 40, 54321);
+        cr_assert(a && b && c, "maze_generate failed for kind %d", kinds[k]);
+
+        int same = 1, differs = 0;
+        for (int r = 0; r < 41; r++) {
+            cr_assert_eq(strlen(a[r]), 73, "Row %d has the wrong width", r);
+            same &= (strcmp(a[r], b[r]) == 0);
+            differs |= (strcmp(a[r], c[r]) != 0);
+        }
+        cr_assert(same, "Same seed produced different mazes for kind %d", kinds[k]);
+        cr_assert(differs, "Different seeds produced the same maze for kind %d", kinds[k]);
+        cr_assert_null(a[41], "Template is not NULL-terminated");
+
+        maze_gen_free(a);
+        maze_gen_free(b);
+        maze_gen_free(c);
+    }
+}
+
+#include "client_registry_ext.h"
+
+static void sum_fds(int fd, void *arg) {
+    *(long *)arg += fd;
+}
+
+Test(student_suite, 07_client_registry_count_and_foreach, .timeout = 5) {
+    fprintf(stderr, "server_suite/07_client_registry_count_and_foreach\n");
+
+    CLIENT_REGISTRY *cr = creg_init();
+    const int num_fds = 1000;  // Well beyond the initial capacity
+    long expected = 0;
+
+    for (int fd = 10; fd < 10 + num_fds; fd++) {
+        cr_assert_eq(creg_try_register(cr, fd), 0, "Failed to register fd=%d", fd);
+        expected += fd;
+    }
+    cr_assert_eq(creg_try_register(cr, 10), 0, "Re-registering fd=10 should succeed");
+    cr_assert_eq(creg_count(cr), num_fds, "Duplicate registration changed the count");
+
+    // Unregister every other fd, plus one that was never registered
+    for (int fd = 10; fd < 10 + num_fds; fd += 2) {
+        creg_unregister(cr, fd);
+        expected -= fd;
+    }
+    creg_unregister(cr, 5);
+    cr_assert_eq(creg_count(cr), num_fds / 2, "Wrong count after unregistering");
+
+    long sum = 0;
+    creg_foreach(cr, sum_fds, &sum);
+    cr_assert_eq(sum, expected, "creg_foreach did not visit exactly the registered fds");
+
+    for (int fd = 11; fd < 10 + num_fds; fd += 2) {
+        creg_unregister(cr, fd);
+    }
+    creg_wait_for_empty(cr);
+    creg_fini(cr);
+}
+
+#include "maze_ext.h"
+
+Test(student_suite, 08_seeded_placement_is_repeatable, .timeout = 5) {
+    fprintf(stderr, "server_suite/08_seeded_placement_is_repeatable\n");
+
+    char **lines = maze_generate(MAZE_GEN_ARENA, 32, 32, 10, 1);
+    cr_assert_not_null(lines, "maze_generate failed");
+
+    int rows[2][20], cols[2][20];
+    for (int run = 0; run < 2; run++) {
+        maze_set_seed(99);
+        MAZE *maze = maze_create(lines);
+        cr_assert_not_null(maze, "maze_create failed");
+        for (int i = 0; i < 20; i++)
+            cr_assert_eq(maze_set_occupant_random(maze, i, 'A', &rows[run][i], &cols[run][i]), 0,
+                         "Placement %d failed", i);
+        maze_destroy(maze);
+    }
+    for (int i = 0; i < 20; i++) {
+        cr_assert(rows[0][i] == rows[1][i] && cols[0][i] == cols[1][i],
+                  "Placement %d differs between runs with the same seed", i);
+    }
+    maze_gen_free(lines);
+}
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/*
+ * Read a "Name: value kB" field of /proc/<pid>/status, or -1 if absent.
+ */
+static long proc_status_field(int pid, const char *name) {
+    char path[64], line[256];
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    long value = -1;
+    size_t len = strlen(name);
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, name, len) == 0 && line[len] == ':') {
+            value = atol(line + len + 1);
+            break;
+        }
+    }
+    fclose(f);
+    return value;
+}
+
+#define IDLE_CONNECTIONS 500
+#define IDLE_RSS_LIMIT_KB (32 * 1024)
+
+Test(student_suite, 09_idle_connections_fit_rss_budget, .timeout = 20) {
+    fprintf(stderr, "server_suite/09_idle_connections_fit_rss_budget\n");
+    int server_pid = fork();
+    if (server_pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, 2);
+        execl("bin/mazewar", "bin/mazewar", "-p", "9996", "-k", "64", NULL);
+        perror("exec failed");
+        exit(1);
+    }
+    sleep(2);
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(9996),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK)
+    };
+    int fds[IDLE_CONNECTIONS], opened = 0;
+    for (; opened < IDLE_CONNECTIONS; opened++) {
+        fds[opened] = socket(AF_INET, SOCK_STREAM, 0);
+        if (fds[opened] < 0 ||
+            connect(fds[opened], (struct sockaddr *)&addr, sizeof(addr)) < 0) break;
+    }
+    sleep(1);
+    long threads = proc_status_field(server_pid, "Threads");
+    long rss = proc_status_field(server_pid, "VmRSS");
+
+    for (int i = 0; i < opened; i++) close(fds[i]);
+    kill(server_pid, SIGHUP);
+    waitpid(server_pid, NULL, 0);
+
+    cr_assert_eq(opened, IDLE_CONNECTIONS, "Only %d connections could be opened", opened);
+    cr_assert_geq(threads, IDLE_CONNECTIONS, "Server has %ld threads for %d connections",
+                  threads, IDLE_CONNECTIONS);
+    cr_assert(rss > 0 && rss < IDLE_RSS_LIMIT_KB,
+              "Server RSS is %ld kB with %d idle connections (limit %d kB)",
+              rss, IDLE_CONNECTIONS, IDLE_RSS_LIMIT_KB);
+}
+
+#include "task_sched.h"
+
+#define ORDER_STRANDS 16
+#define ORDER_POSTS 20000
+
+/*
+ * A strand whose tasks check that they run in the order posted.
+ */
+static struct order_strand {
+    STRAND strand;
+    int next;                // Sequence number the next task must have
+    int errors;
+} order_strands[ORDER_STRANDS];
+
+static void order_task(void *arg) {
+    intptr_t v = (intptr_t)arg;
+    struct order_strand *s = &order_strands[v % ORDER_STRANDS];
+    if (v / ORDER_STRANDS != s->next) s->errors++;
+    s->next++;
+}
+
+/*
+ * Thread posting ORDER_POSTS tasks to each of a quarter of the strands.
+ */
+static void *order_poster(void *arg) {
+    intptr_t first = (intptr_t)arg;
+    for (intptr_t n = 0; n < ORDER_POSTS; n++)
+        for (intptr_t i = first; i < ORDER_STRANDS; i += 4)
+            strand_post(&order_strands[i].strand, order_task, (void *)(n * ORDER_STRANDS + i));
+    return NULL;
+}
+
+Test(student_suite, 10_strands_keep_order, .timeout = 20) {
+    fprintf(stderr, "server_suite/10_strands_keep_order\n");
+    cr_assert_eq(task_sched_init(4), 0, "Scheduler failed to start");
+    for (int i = 0; i < ORDER_STRANDS; i++)
+        strand_init(&order_strands[i].strand);
+
+    pthread_t tids[4];
+    for (intptr_t i = 0; i < 4; i++)
+        pthread_create(&tids[i], NULL, order_poster, (void *)i);
+    for (int i = 0; i < 4; i++)
+        pthread_join(tids[i], NULL);
+
+    for (int i = 0; i < ORDER_STRANDS; i++) {
+        strand_drain(&order_strands[i].strand);
+        cr_assert_eq(order_strands[i].next, ORDER_POSTS, "Strand %d ran %d of %d tasks",
+                     i, order_strands[i].next, ORDER_POSTS);
+        cr_assert_eq(order_strands[i].errors, 0, "Strand %d ran %d tasks out of order",
+                     i, order_strands[i].errors);
+    }
+}
+
+#define EXCL_THREADS 4
+#define EXCL_CALLS 20000
+
+/*
+ * A strand whose tasks check that no other task of it runs at the same time.
+ */
+static struct {
+    STRAND strand;
+    atomic_int running;
+    int count;               // Changed only by the strand's tasks
+    int overlaps;
+} excl;
+
+static void excl_task(void *arg) {
+    (void)arg;
+    if (atomic_fetch_add(&excl.running, 1) != 0) excl.overlaps++;
+    excl.count++;
+    atomic_fetch_sub(&excl.running, 1);
+}
+
+/*
+ * Thread alternately posting to the strand and calling it.
+ */
+static void *excl_client(void *arg) {
+    (void)arg;
+    for (int n = 0; n < EXCL_CALLS; n++) {
+        if (n % 2)
+            strand_call(&excl.strand, excl_task, NULL);
+        else
+            strand_post(&excl.strand, excl_task, NULL);
+    }
+    return NULL;
+}
+
+Test(student_suite, 11_strands_serialize_without_workers, .timeout = 20) {
+    fprintf(stderr, "server_suite/11_strands_serialize_without_workers\n");
+    cr_assert_eq(task_sched_init(0), 0, "Scheduler failed to initialize");
+    strand_init(&excl.strand);
+
+    pthread_t tids[EXCL_THREADS];
+    for (int i = 0; i < EXCL_THREADS; i++)
+        pthread_create(&tids[i], NULL, excl_client, NULL);
+    for (int i = 0; i < EXCL_THREADS; i++)
+        pthread_join(tids[i], NULL);
+
+    strand_drain(&excl.strand);
+    cr_assert_eq(excl.overlaps, 0, "Tasks of one strand ran concurrently %d times", excl.overlaps);
+    cr_assert_eq(excl.count, EXCL_THREADS * EXCL_CALLS, "Strand ran %d of %d tasks",
+                 excl.count, EXCL_THREADS * EXCL_CALLS);
+}
+
+Test(student_suite, 12_batched_views_match_single_views, .timeout = 5) {
+    fprintf(stderr, "server_suite/12_batched_views_match_single_views\n");
+
+    char **lines = maze_generate(MAZE_GEN_CAVERN, 40, 40, 30, 7);
+    cr_assert_not_null(lines, "maze_generate failed");
+    maze_set_seed(7);
+    MAZE *maze = maze_create(lines);
+    cr_assert_not_null(maze, "maze_create failed");
+
+    // Viewers everywhere, gazing every way, including off the edges
+    MAZE_VIEW views[64];
+    for (int i = 0; i < 64; i++) {
+        cr_assert_eq(maze_set_occupant_random(maze, i, 'A' + i % 26, &views[i].row, &views[i].col), 0,
+                     "Placement %d failed", i);
+        views[i].gaze = (DIRECTION)(i % 4);
+    }
+    maze_get_views_in(maze, views, 64);
+
+    for (int i = 0; i < 64; i++) {
+        char view[VIEW_DEPTH][VIEW_WIDTH];
+        int depth = maze_get_view_in(maze, (VIEW *)view, views[i].row, views[i].col, views[i].gaze, VIEW_DEPTH);
+        cr_assert_eq(views[i].depth, depth, "View %d has depth %d, expected %d", i, views[i].depth, depth);
+        cr_assert(memcmp(views[i].view, view, depth * VIEW_WIDTH) == 0, "View %d differs", i);
+    }
+    maze_destroy(maze);
+    maze_gen_free(lines);
+}
+
+#define WHOLE_MOVES 20000
+
+static atomic_int whole_done;
+
+/*
+ * Thread moving one occupant back and forth across a tile boundary, which
+ * is also a region boundary.
+ */
+static void *whole_mover(void *arg) {
+    MAZE *maze = arg;
+    int col = 15;
+    for (int n = 0; n < WHOLE_MOVES; n++) {
+        DIRECTION dir = col == 15 ? EAST : WEST;
+        if (maze_move_in(maze, 1, col, dir)) break;
+        col += dir == EAST ? 1 : -1;
+    }
+    atomic_store(&whole_done, 1);
+    return NULL;
+}
+
+Test(student_suite, 13_moves_are_seen_whole, .timeout = 20) {
+    fprintf(stderr, "server_suite/13_moves_are_seen_whole\n");
+
+    char wall[41], hall[41];
+    memset(wall, '*', 40);
+    memset(hall, ' ', 40);
+    wall[40] = hall[40] = '\0';
+    hall[0] = hall[39] = '*';
+    char *lines[] = { wall, hall, wall, NULL };
+    maze_set_region_size(8);
+    MAZE *maze = maze_create(lines);
+    maze_set_region_size(0);
+    cr_assert_not_null(maze, "maze_create failed");
+    cr_assert_eq(maze_set_occupant(maze, 0, 'A', 1, 15), 0, "Placement failed");
+
+    pthread_t tid;
+    atomic_store(&whole_done, 0);
+    pthread_create(&tid, NULL, whole_mover, maze);
+
+    // A viewer down the hall must see the occupant in exactly one place
+    int views = 0, torn = 0;
+    while (!atomic_load(&whole_done)) {
+        char view[VIEW_DEPTH][VIEW_WIDTH];
+        int depth = maze_get_view_in(maze, (VIEW *)view, 1, 1, EAST, VIEW_DEPTH);
+        int seen = 0;
+        for (int d = 0; d < depth; d++)
+            if (view[d][CORRIDOR] == 'A') seen++;
+        if (seen != 1) torn++;
+        views++;
+    }
+    pthread_join(tid, NULL);
+    cr_assert_eq(torn, 0, "%d of %d views saw a move half done", torn, views);
+    maze_destroy(maze);
+}
+
+#include "scoreboard.h"
+#include "protocol_ext.h"
+
+Test(student_suite, 14_scoreboard_deltas, .timeout = 5) {
+    fprintf(stderr, "server_suite/14_scoreboard_deltas\n");
+
+    // The batched SCORE record is a fixed wire format
+    cr_assert_eq(sizeof(MZW_SCORE_RECORD), 6, "MZW_SCORE_RECORD is %zu bytes", sizeof(MZW_SCORE_RECORD));
+
+    SCOREBOARD *sb = scoreboard_create();
+    cr_assert_not_null(sb, "scoreboard_create failed");
+    SCORE_ENTRY out[SCOREBOARD_SIZE];
+    unsigned long v0, v1, v2, v;
+
+    cr_assert_eq(scoreboard_delta(sb, 0, out, SCOREBOARD_SIZE, &v0), 0, "New board is not empty");
+
+    scoreboard_set(sb, 1, 'A', 5);
+    scoreboard_set(sb, 2, 'B', 0);
+    scoreboard_set(sb, 1, 'A', 7);
+    cr_assert_eq(scoreboard_delta(sb, v0, out, SCOREBOARD_SIZE, &v1), 2, "Expected two entries");
+    cr_assert(out[0].id == 1 && out[0].glyph == 'A' && out[0].score == 7, "Wrong entry for player 1");
+    cr_assert(out[1].id == 2 && out[1].glyph == 'B' && out[1].score == 0, "Wrong entry for player 2");
+    cr_assert_gt(v1, v0, "Version did not advance");
+
+    // Only what changed since v1, with the removal as a score of -1
+    scoreboard_remove(sb, 2);
+    scoreboard_set(sb, 3, 'C', 1);
+    cr_assert_eq(scoreboard_delta(sb, v1, out, SCOREBOARD_SIZE, &v2), 2, "Expected two changes");
+    cr_assert(out[0].id == 2 && out[0].score == -1, "Removal not reported");
+    cr_assert(out[1].id == 3 && out[1].score == 1, "New player not reported");
+    cr_assert_gt(v2, v1, "Version did not advance");
+    cr_assert_eq(scoreboard_delta(sb, v2, out, SCOREBOARD_SIZE, &v), 0, "Up-to-date client got entries");
+    cr_assert_eq(v, v2, "Empty delta changed the version");
+
+    // A client that never saw the board is not told about removed players
+    cr_assert_eq(scoreboard_delta(sb, 0, out, SCOREBOARD_SIZE, &v), 2, "Expected the two present players");
+    cr_assert(out[0].id == 1 && out[1].id == 3, "Removed player reported to new client");
+
+    // A delta that does not fit leaves the client where it was
+    for (int i = 100; i < 110; i++)
+        scoreboard_set(sb, i, 'a' + i - 100, i);
+    cr_assert_eq(scoreboard_delta(sb, v2, out, 4, &v), 4, "Small delta not filled");
+    cr_assert_eq(v, v2, "Client moved past entries it was not sent");
+    cr_assert_eq(scoreboard_delta(sb, v, out, SCOREBOARD_SIZE, &v), 10, "Remaining entries lost");
+    cr_assert(out[9].id == 109 && out[9].score == 109, "Wrong last entry");
+    cr_assert_eq(scoreboard_delta(sb, v, out, SCOREBOARD_SIZE, &v), 0, "Entries sent twice");
+
+    scoreboard_destroy(sb);
+}
+
+#include <stdlib.h>
+
+/*
+ * Load a template from a temporary file with maze_init_file(), capturing
+ * its diagnostics.  On success the default maze is left initialized.
+ */
+static int load_template(const char *text, size_t len, char *diag, size_t size) {
+    char path[] = "/tmp/mazewar_templateXXXXXX", errpath[] = "/tmp/mazewar_diagXXXXXX";
+    int fd = mkstemp(path), errfd = mkstemp(errpath);
+    cr_assert(fd >= 0 && errfd >= 0, "mkstemp failed");
+    cr_assert_eq(write(fd, text, len), (ssize_t)len, "write failed");
+    close(fd);
+
+    fflush(stderr);
+    int saved = dup(2);
+    dup2(errfd, 2);
+    int rc = maze_init_file(path);
+    fflush(stderr);
+    dup2(saved, 2);
+    close(saved);
+
+    ssize_t n = pread(errfd, diag, size - 1, 0);
+    diag[n > 0 ? n : 0] = '\0';
+    close(errfd);
+    unlink(path);
+    unlink(errpath);
+    return rc;
+}
+
+Test(student_suite, 15_template_files_are_validated, .timeout = 5) {
+    fprintf(stderr, "server_suite/15_template_files_are_validated\n");
+    char diag[512];
+
+    static const struct {
+        const char *text;
+        int rows, cols;
+    } good[] = {
+        { "***\n* *\n***\n", 3, 3 },
+        { "***\r\n* *\r\n***\r\n", 3, 3 },     // CRLF line ends
+        { "***\n* *\n***", 3, 3 },              // No final newline
+        { "***\n* *\n***\n\n\r\n\n", 3, 3 },    // Trailing blank lines
+    };
+    for (size_t i = 0; i < sizeof(good) / sizeof(good[0]); i++) {
+        cr_assert_eq(load_template(good[i].text, strlen(good[i].text), diag, sizeof(diag)), 0,
+                     "Template %zu rejected: %s", i, diag);
+        cr_assert(maze_get_rows() == good[i].rows && maze_get_cols() == good[i].cols,
+                  "Template %zu loaded as %d x %d", i, maze_get_rows(), maze_get_cols());
+        maze_fini();
+    }
+
+    // The position of the first error is reported as line:column
+    static const struct {
+        const char *text;
+        const char *where;
+    } bad[] = {
+        { "***\n* *\n****\n", ":3: row has 4 columns" },     // Ragged rows
+        { "***\n*A*\n***\n", ":2:2: invalid maze character" },
+        { "***\n* *\t\n***\n", ":2: row has 4 columns" },
+        { "***\n*\t*\n***\n", ":2:2: invalid maze character" },
+        { "***\n\n***\n", ":2: blank line" },                // Blank line inside
+        { "\n***\n", ":1: blank line" },
+    };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        cr_assert_neq(load_template(bad[i].text, strlen(bad[i].text), diag, sizeof(diag)), 0,
+                      "Template %zu accepted", i);
+        cr_assert_not_null(strstr(diag, bad[i].where), "Template %zu: expected \"%s\", got \"%s\"",
+                           i, bad[i].where, diag);
+    }
+
+    // Rows longer than any line buffer
+    int cols = 300;
+    char *text = malloc(3 * (cols + 1) + 1), *p = text;
+    for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < cols; c++)
+            *p++ = (r == 1 && c > 0 && c < cols - 1) ? ' ' : '*';
+        *p++ = '\n';
+    }
+    cr_assert_eq(load_template(text, p - text, diag, sizeof(diag)), 0, "Long rows rejected: %s", diag);
+    cr_assert(maze_get_rows() == 3 && maze_get_cols() == cols,
+              "Long rows loaded as %d x %d", maze_get_rows(), maze_get_cols());
+    maze_fini();
+
+    // A long row that is one column short is still caught
+    text[2 * (cols + 1) - 2] = '\n';
+    cr_assert_neq(load_template(text, 2 * (cols + 1) - 1, diag, sizeof(diag)), 0, "Short row accepted");
+    cr_assert_not_null(strstr(diag, ":2: row has 299 columns"), "Unexpected diagnostic \"%s\"", diag);
+    free(text);
+}
+
+/* Offsets of fields of the image header written by maze_save_image(). */
+#define IMAGE_CELL_BITS_AT 24
+#define IMAGE_CELLS_OFFSET_AT 104
+
+/*
+ * Save a maze as an image and read the image back into memory.
+ */
+static char *save_image(MAZE *maze, size_t *lenp) {
+    char path[] = "/tmp/mazewar_imageXXXXXX";
+    int fd = mkstemp(path);
+    cr_assert(fd >= 0, "mkstemp failed");
+    cr_assert_eq(maze_save_image(maze, path), 0, "maze_save_image failed");
+    off_t len = lseek(fd, 0, SEEK_END);
+    char *image = malloc(len);
+    cr_assert(image && pread(fd, image, len, 0) == len, "Image could not be read back");
+    close(fd);
+    unlink(path);
+    *lenp = len;
+    return image;
+}
+
+Test(student_suite, 16_maze_images_round_trip, .timeout = 10) {
+    fprintf(stderr, "server_suite/16_maze_images_round_trip\n");
+    static const char walls[] = "!\"#$%&'()*+,-./0123456789:;<=>?@";
+    char diag[512];
+    char *image2 = NULL;
+    size_t len2 = 0;
+
+    // Enough kinds of wall for palettes of 1, 2 and 8 bits per cell
+    static const struct {
+        int kinds;
+        uint32_t bits;
+    } cases[] = { { 1, 1 }, { 2, 2 }, { 20, 8 } };
+    for (size_t k = 0; k < sizeof(cases) / sizeof(cases[0]); k++) {
+        int rows = 37, cols = 53;
+        char **lines = maze_generate(MAZE_GEN_CAVERN, rows, cols, 35, 11 + k);
+        cr_assert_not_null(lines, "maze_generate failed");
+        for (int r = 0; r < rows; r++)
+            for (int c = 0; c < cols; c++)
+                if (lines[r][c] != ' ') lines[r][c] = walls[(r * cols + c) % cases[k].kinds];
+        MAZE *maze = maze_create(lines);
+        cr_assert_not_null(maze, "maze_create failed");
+
+        size_t len;
+        char *image = save_image(maze, &len);
+        uint32_t bits;
+        memcpy(&bits, image + IMAGE_CELL_BITS_AT, sizeof(bits));
+        cr_assert_eq(bits, cases[k].bits, "%d kinds of wall packed at %u bits", cases[k].kinds, bits);
+
+        cr_assert_eq(load_template(image, len, diag, sizeof(diag)), 0, "Image %zu rejected: %s", k, diag);
+        cr_assert(maze_get_rows() == rows && maze_get_cols() == cols,
+                  "Image %zu loaded as %d x %d", k, maze_get_rows(), maze_get_cols());
+        MAZE *loaded = maze_default();
+        for (int r = 0; r < rows; r++) {
+            for (int c = 0; c < cols; c++) {
+                for (int d = 0; d < 4; d++) {
+                    char want[VIEW_DEPTH][VIEW_WIDTH], got[VIEW_DEPTH][VIEW_WIDTH];
+                    int depth = maze_get_view_in(maze, (VIEW *)want, r, c, d, VIEW_DEPTH);
+                    cr_assert_eq(maze_get_view_in(loaded, (VIEW *)got, r, c, d, VIEW_DEPTH), depth,
+                                 "Image %zu: view from %d,%d gazing %d has the wrong depth", k, r, c, d);
+                    cr_assert(memcmp(want, got, depth * VIEW_WIDTH) == 0,
+                              "Image %zu: view from %d,%d gazing %d differs", k, r, c, d);
+                }
+            }
+        }
+        maze_fini();
+        maze_destroy(maze);
+        maze_gen_free(lines);
+
+        if (cases[k].bits == 2) {
+            image2 = image;
+            len2 = len;
+        } else {
+            free(image);
+        }
+    }
+
+    // Truncated images, whether or not the header is whole
+    cr_assert_neq(load_template(image2, 16, diag, sizeof(diag)), 0, "Image without a header accepted");
+    cr_assert_not_null(strstr(diag, "truncated maze image"), "Unexpected diagnostic \"%s\"", diag);
+    cr_assert_neq(load_template(image2, len2 - 1, diag, sizeof(diag)), 0, "Truncated image accepted");
+    cr_assert_not_null(strstr(diag, "corrupt maze image header"), "Unexpected diagnostic \"%s\"", diag);
+
+    // With three palette entries, a cell value of 3 indexes none of them
+    uint64_t cells;
+    memcpy(&cells, image2 + IMAGE_CELLS_OFFSET_AT, sizeof(cells));
+    cr_assert_lt(cells, len2, "Cells offset %lu is past the end", (unsigned long)cells);
+    image2[cells] = (char)0xff;
+    cr_assert_neq(load_template(image2, len2, diag, sizeof(diag)), 0, "Cell outside the palette accepted");
+    cr_assert_not_null(strstr(diag, "corrupt maze image cells"), "Unexpected diagnostic \"%s\"", diag);
+    free(image2);
+}
+
+#include <sys/time.h>
+
+/*
+ * Connect to a server on the loopback interface.
+ * @return the socket, which times out receiving after a second, or -1.
+ */
+static int connect_client(int port) {
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK)
+    };
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    struct timeval timeout = { .tv_sec = 1 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Connect to a server on the loopback interface and send a LOGIN packet.
+ * @return the socket, as for connect_client(), or -1.
+ */
+static int login_client(int port, OBJECT avatar, int caps, char *name) {
+    int fd = connect_client(port);
+    MZW_PACKET pkt = { .type = MZW_LOGIN_PKT, .param1 = avatar, .param2 = caps, .size = strlen(name) };
+    if (fd >= 0 && proto_send_packet(fd, &pkt, name) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Receive packets until the reply to a LOGIN arrives.
+ * @return the ID from the payload of a READY packet, 0 for a READY packet
+ * without one, or -1 if the login was refused or no reply arrived.
+ */
+static int login_reply(int fd) {
+    MZW_PACKET pkt;
+    void *data;
+    while (proto_recv_packet(fd, &pkt, &data) == 0) {
+        int type = pkt.type, id = 0;
+        if (data && pkt.size == sizeof(uint16_t)) {
+            uint16_t n;
+            memcpy(&n, data, sizeof(n));
+            id = ntohs(n);
+        }
+        free(data);
+        if (type == MZW_READY_PKT) return id;
+        if (type == MZW_INUSE_PKT) return -1;
+    }
+    return -1;
+}
+
+#define EXTENDED_PLAYERS 80
+
+Test(student_suite, 17_extended_ids_share_the_table, .timeout = 30) {
+    fprintf(stderr, "server_suite/17_extended_ids_share_the_table\n");
+    int server_pid = fork();
+    if (server_pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, 2);
+        execl("bin/mazewar", "bin/mazewar", "-p", "9995", "-g", "arena:30x60", NULL);
+        perror("exec failed");
+        exit(1);
+    }
+    sleep(2);
+
+    // More players than there are avatars, whose glyphs include those of
+    // the base clients logged in before and after them
+    int base_a = login_client(9995, 'A', 0, "base_a");
+    int base_a_id = login_reply(base_a);
+    int fds[EXTENDED_PLAYERS], ids[EXTENDED_PLAYERS];
+    for (int i = 0; i < EXTENDED_PLAYERS; i++) {
+        fds[i] = login_client(9995, 'A' + i % 26, MZW_CAP_EXTENDED_ID, "extended");
+        ids[i] = login_reply(fds[i]);
+    }
+    int base_b = login_client(9995, 'B', 0, "base_b");
+    int base_b_id = login_reply(base_b);
+    int dup_a = login_client(9995, 'A', 0, "dup_a");
+    int dup_a_id = login_reply(dup_a);
+
+    // Base clients see only base players; extended clients see everyone
+    int base_entries = 0, base_b_seen = 0, extended_only = 0;
+    MZW_PACKET pkt;
+    void *data;
+    while (proto_recv_packet(base_a, &pkt, &data) == 0) {
+        if (pkt.type == MZW_SCORE_PKT) {
+            base_entries++;
+            base_b_seen |= pkt.param1 == 'B';
+            extended_only += pkt.param1 != 'A' && pkt.param1 != 'B';
+        }
+        free(data);
+    }
+    static char listed[1 << 16];
+    int extended_entries = 0;
+    while (proto_recv_packet(fds[EXTENDED_PLAYERS - 1], &pkt, &data) == 0) {
+        if (pkt.type == MZW_SCORE_PKT && pkt.param1 == MZW_SCORE_BATCH && data) {
+            MZW_SCORE_RECORD *rec = data;
+            for (size_t i = 0; i < pkt.size / sizeof(*rec); i++) {
+                int id = ntohs(rec[i].id);
+                if (!listed[id] && (int16_t)ntohs(rec[i].score) >= 0) {
+                    listed[id] = 1;
+                    extended_entries++;
+                }
+            }
+        }
+        free(data);
+    }
+
+    for (int i = 0; i < EXTENDED_PLAYERS; i++) close(fds[i]);
+    close(base_a);
+    close(base_b);
+    close(dup_a);
+    kill(server_pid, SIGHUP);
+    waitpid(server_pid, NULL, 0);
+
+    cr_assert_eq(base_a_id, 0, "Base client A got no READY, or one with a payload");
+    for (int i = 0; i < EXTENDED_PLAYERS; i++) {
+        cr_assert_geq(ids[i], 0, "Extended client %d was refused", i);
+        cr_assert(!IS_AVATAR(ids[i]), "Extended client %d took avatar ID %c while others were free",
+                  i, ids[i]);
+        for (int j = 0; j < i; j++)
+            cr_assert_neq(ids[i], ids[j], "Extended clients %d and %d share ID %d", j, i, ids[i]);
+    }
+    cr_assert_eq(base_b_id, 0, "Base client B was locked out by extended clients");
+    cr_assert_eq(dup_a_id, -1, "Second base client A was let in");
+    cr_assert(base_entries > 0 && base_b_seen, "Base client A was not told about B");
+    cr_assert_eq(extended_only, 0, "Base client A was sent %d entries of extended players", extended_only);
+    cr_assert_eq(extended_entries, EXTENDED_PLAYERS + 2,
+                 "Extended client saw %d players, expected %d", extended_entries, EXTENDED_PLAYERS + 2);
+}
+
+#include <errno.h>
+
+#define ADMITTED_SESSIONS 5
+
+/*
+ * Connect to a server that is expected to be full.
+ * @return 1 if the connection got a busy reply and was then closed, else 0.
+ */
+static int turned_away(int port) {
+    int fd = connect_client(port);
+    if (fd < 0) return 0;
+    MZW_PACKET pkt;
+    void *data;
+    int busy = proto_recv_packet(fd, &pkt, &data) == 0 &&
+               pkt.type == MZW_INUSE_PKT && pkt.param1 == MZW_INUSE_BUSY;
+    if (busy) {
+        // The server closes the connection rather than wait for the client
+        free(data);
+        errno = 0;
+        busy = proto_recv_packet(fd, &pkt, &data) != 0 && errno != EAGAIN;
+    }
+    close(fd);
+    return busy;
+}
+
+Test(student_suite, 18_admission_returns_slots, .timeout = 30) {
+    fprintf(stderr, "server_suite/18_admission_returns_slots\n");
+    signal(SIGPIPE, SIG_IGN);  // A login may be written to a connection turned away
+    char max[16];
+    snprintf(max, sizeof(max), "%d", ADMITTED_SESSIONS);
+    int server_pid = fork();
+    if (server_pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, 2);
+        execl("bin/mazewar", "bin/mazewar", "-p", "9994", "-M", max, NULL);
+        perror("exec failed");
+        exit(1);
+    }
+    sleep(2);
+
+    // Fill every slot, after which connections are turned away
+    int fds[ADMITTED_SESSIONS], admitted = 0;
+    for (int i = 0; i < ADMITTED_SESSIONS; i++) {
+        fds[i] = login_client(9994, 'A' + i, 0, "admitted");
+        admitted += login_reply(fds[i]) == 0;
+    }
+    int busy_when_full = turned_away(9994);
+
+    // Sessions that end give their slots back, once each
+    close(fds[0]);
+    close(fds[1]);
+    usleep(500000);
+    int readmitted = 0;
+    for (int i = 0; i < 2; i++) {
+        fds[i] = login_client(9994, 'A' + i, 0, "readmitted");
+        readmitted += login_reply(fds[i]) == 0;
+    }
+    int busy_when_refilled = turned_away(9994);
+
+    for (int i = 0; i < ADMITTED_SESSIONS; i++) close(fds[i]);
+    kill(server_pid, SIGHUP);
+    waitpid(server_pid, NULL, 0);
+
+    cr_assert_eq(admitted, ADMITTED_SESSIONS, "Only %d of %d sessions were admitted",
+                 admitted, ADMITTED_SESSIONS);
+    cr_assert(busy_when_full, "Connection to a full server did not get a busy reply");
+    cr_assert_eq(readmitted, 2, "Only %d of 2 slots were returned when sessions ended", readmitted);
+    cr_assert(busy_when_refilled, "Server admitted more than %d sessions after slots were returned",
+              ADMITTED_SESSIONS);
+}
@@ -0,0 +1,45 @@
+/**
+ * @file mazeimg.c
+ * @brief Convert a MazeWar text maze template into a maze image.
+ *
+ * Usage: mazeimg <template> <image>
+ *
+ * The template is loaded exactly as the server loads it with -t, and saved
+ * with maze_save_image().  The server accepts the resulting image with -t
+ * in place of the template, and starts without parsing it.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "maze.h"
+#include "maze_ext.h"
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <template> <image>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (maze_init_file(argv[1]) != 0) {
+        fprintf(stderr, "Error: Failed to load maze template %s\n", argv[1]);
+        exit(EXIT_FAILURE);
+    }
+    if (maze_save_image(maze_default(), argv[2]) != 0) {
+        fprintf(stderr, "Error: Failed to write maze image %s\n", argv[2]);
+        maze_fini();
+        exit(EXIT_FAILURE);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    double ms = (stop.tv_sec - start.tv_sec) * 1e3 + (stop.tv_nsec - start.tv_nsec) / 1e6;
+    fprintf(stderr, "Converted %s (%d x %d) to %s in %.3f ms\n",
+            argv[1], maze_get_rows(), maze_get_cols(), argv[2], ms);
+
+    maze_fini();
+    return EXIT_SUCCESS;
+}
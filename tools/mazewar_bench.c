@@ -0,0 +1,611 @@
+/**
+ * @file mazewar_bench.c
+ * @brief Headless load generator for the MazeWar server.
+ *
+ * Usage: mazewar_bench -p <port> [-h <host>] [-c <bots>] [-n <rooms>]
+ *                      [-j <workers>] [-r <requests_per_sec>] [-d <seconds>]
+ *                      [-m move:W,turn:W,fire:W,send:W] [-x] [-S <seed>]
+ *
+ * Opens one connection per bot, logs every bot in, then drives a random
+ * mix of MOVE, TURN, FIRE and SEND requests at a target aggregate rate
+ * (or, with -r 0, as fast as the server answers: each bot sends its next
+ * request as soon as the previous one has been answered).  Bots are spread
+ * round-robin over the server's game rooms (-n, which should match the
+ * server's) and over a number of worker threads, each of which multiplexes
+ * its bots with epoll.
+ *
+ * Bots log in with distinct avatars when there are few enough of them in
+ * each room (AVATARS_PER_ROOM); otherwise, or with -x, they log in with
+ * extended IDs (MZW_CAP_EXTENDED_ID) and avatars are display glyphs only.
+ *
+ * Latency is measured from the moment a request is sent to the arrival of
+ * the first packet that answers it:
+ *
+ *   TURN:  the CLEAR that starts the redraw of the bot's view;
+ *   MOVE:  the first SHOW (a move into a wall is never answered);
+ *   SEND:  the bot's own message, broadcast back to it as a CHAT;
+ *   FIRE:  a SCORE update of the bot's own score (a miss is never answered).
+ *
+ * A MOVE can be credited with a SHOW caused by another bot's move that
+ * happened to arrive first; SHOWs stamped by the server before the MOVE
+ * was sent are ignored, so this only happens under contention.  The
+ * server's timestamp on the answering packet also splits each latency
+ * into the time until the server sent its answer and the delivery time.
+ * Timestamps are CLOCK_MONOTONIC, so the split is only meaningful when the
+ * server runs on the same host (and with its precise clock).
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <arpa/inet.h>
+
+#include "protocol.h"
+#include "protocol_ext.h"
+#include "stats.h"
+
+/// Distinct avatars handed out in each room before extended IDs are needed.
+static const char avatars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+#define AVATARS_PER_ROOM ((int)sizeof(avatars) - 1)
+
+/// Size of each bot's receive buffer (larger than any packet the server sends).
+#define RECV_BUF 4096
+
+/// Time allowed for all bots to log in, in seconds.
+#define LOGIN_TIMEOUT 10
+
+/// With -r 0, a request unanswered for this long is given up on (ns).
+#define CLOSED_LOOP_TIMEOUT 100000000ULL
+
+/// Request kinds, in the order of the -m weights.
+enum { REQ_MOVE, REQ_TURN, REQ_FIRE, REQ_SEND, NREQ };
+static const char *req_names[NREQ] = { "MOVE", "TURN", "FIRE", "SEND" };
+
+/**
+ * @struct bot
+ * @brief One simulated client.
+ */
+typedef struct bot {
+    int fd;
+    int index;                // Bot number, also used in its name
+    int room;
+    unsigned char avatar;
+    uint16_t id;              // Player ID (the avatar, unless extended)
+    int extended;             // Logged in with MZW_CAP_EXTENDED_ID
+    int state;                // BOT_*
+    int pending;              // Request kind awaiting an answer, or -1
+    uint64_t sent_at;         // When the pending request was sent
+    uint64_t connect_at;      // When the bot started connecting
+    char name[16];
+    size_t have;              // Bytes in buf
+    size_t skip;              // Payload bytes still to discard
+    char buf[RECV_BUF];
+} BOT;
+
+enum { BOT_CONNECTING, BOT_READY, BOT_FAILED };
+
+/**
+ * @struct worker
+ * @brief A thread driving a share of the bots.
+ */
+typedef struct worker {
+    pthread_t tid;
+    int epfd;
+    BOT *bots;
+    int nbots;
+    double rate;              // Requests per second for this worker (0 = closed loop)
+    uint64_t rng;
+    unsigned long sent[NREQ], answered[NREQ], unanswered, send_errors;
+    unsigned long packets_in, bytes_in;
+} WORKER;
+
+/// Options.
+static const char *host = "127.0.0.1";
+static int port = -1, nbots = 100, nrooms = 1, nworkers = 4, force_extended = 0;
+static double rate = 1000, duration = 10;
+static int weights[NREQ] = { 40, 40, 15, 5 };
+static unsigned long seed = 1;
+
+/// Shared state.
+static struct sockaddr_storage server_addr;
+static socklen_t server_addrlen;
+static pthread_barrier_t start_barrier;
+static atomic_int logins_done = 0, logins_ok = 0, logins_busy = 0, logins_inuse = 0;
+static uint64_t load_start, load_end;
+static HISTOGRAM *latency[NREQ], *server_latency[NREQ], *latency_all, *login_latency;
+
+/**
+ * @brief Advance a splitmix64 generator and return its next output.
+ */
+static uint64_t rng_next(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/**
+ * @brief Send a request, stamped with the current time.
+ * @return 0 on success, -1 on error.
+ */
+static int bot_send(BOT *bot, int type, int p1, int p2, int p3, const void *data, uint16_t size) {
+    struct {
+        MZW_PACKET hdr;
+        char data[256];
+    } msg;
+    uint64_t now = stats_now();
+    msg.hdr = (MZW_PACKET){
+        .type = type, .param1 = p1, .param2 = p2, .param3 = p3,
+        .size = htons(size),
+        .timestamp_sec = htonl(now / 1000000000ULL),
+        .timestamp_nsec = htonl(now % 1000000000ULL)
+    };
+    if (size > sizeof(msg.data)) return -1;
+    if (size) memcpy(msg.data, data, size);
+
+    size_t len = sizeof(MZW_PACKET) + size;
+    const char *p = (const char *)&msg;
+    while (len > 0) {
+        ssize_t n = send(bot->fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Connect a bot and send its LOGIN.
+ */
+static void bot_connect(BOT *bot) {
+    bot->state = BOT_FAILED;
+    bot->pending = -1;
+    snprintf(bot->name, sizeof(bot->name), "bot%d", bot->index);
+    bot->connect_at = stats_now();
+
+    bot->fd = socket(server_addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (bot->fd < 0) return;
+    if (connect(bot->fd, (struct sockaddr *)&server_addr, server_addrlen) < 0) {
+        close(bot->fd);
+        bot->fd = -1;
+        return;
+    }
+    int one = 1;
+    setsockopt(bot->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct timeval tv = { 1, 0 };  // Never wedge a worker on a stalled server
+    setsockopt(bot->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    int caps = MZW_CAP_SCORE_BATCH | (bot->extended ? MZW_CAP_EXTENDED_ID : 0);
+    if (bot_send(bot, MZW_LOGIN_PKT, bot->avatar, caps, bot->room, bot->name, strlen(bot->name)) != 0) {
+        close(bot->fd);
+        bot->fd = -1;
+        return;
+    }
+    bot->state = BOT_CONNECTING;
+}
+
+/**
+ * @brief Whether a SCORE packet carries an update of the bot's own score.
+ */
+static int score_is_own(BOT *bot, MZW_PACKET *pkt, const char *data) {
+    if (pkt->param1 != MZW_SCORE_BATCH)
+        return !bot->extended && (unsigned char)pkt->param1 == bot->avatar && pkt->param2 >= 0;
+    for (size_t off = 0; off + sizeof(MZW_SCORE_RECORD) <= pkt->size; off += sizeof(MZW_SCORE_RECORD)) {
+        MZW_SCORE_RECORD rec;
+        memcpy(&rec, data + off, sizeof(rec));
+        if (ntohs(rec.id) == bot->id && (int16_t)ntohs(rec.score) >= 0) return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Handle one packet received by a bot.
+ */
+static void bot_handle(WORKER *w, BOT *bot, MZW_PACKET *pkt, const char *data, uint64_t now) {
+    if (bot->state == BOT_CONNECTING) {
+        if (pkt->type == MZW_READY_PKT) {
+            bot->state = BOT_READY;
+            // Time from connect() to the server sending READY, by the
+            // packet's stamp, so that it does not include the time this
+            // worker spends connecting its other bots
+            uint64_t stamp = (uint64_t)pkt->timestamp_sec * 1000000000ULL + pkt->timestamp_nsec;
+            if (stamp >= bot->connect_at) histogram_record(login_latency, stamp - bot->connect_at);
+            if (bot->extended && pkt->size >= sizeof(uint16_t)) {
+                uint16_t id;
+                memcpy(&id, data, sizeof(id));
+                bot->id = ntohs(id);
+            }
+            atomic_fetch_add(&logins_ok, 1);
+            atomic_fetch_add(&logins_done, 1);
+        } else if (pkt->type == MZW_INUSE_PKT) {
+            bot->state = BOT_FAILED;
+            atomic_fetch_add(pkt->param1 == MZW_INUSE_BUSY ? &logins_busy : &logins_inuse, 1);
+            atomic_fetch_add(&logins_done, 1);
+        }
+        return;
+    }
+    if (bot->pending < 0) return;
+
+    // Ignore packets the server sent before the pending request
+    uint64_t stamp = (uint64_t)pkt->timestamp_sec * 1000000000ULL + pkt->timestamp_nsec;
+    if (stamp < bot->sent_at) return;
+
+    int answers;
+    switch (bot->pending) {
+    case REQ_TURN: answers = (pkt->type == MZW_CLEAR_PKT); break;
+    case REQ_MOVE: answers = (pkt->type == MZW_SHOW_PKT || pkt->type == MZW_CLEAR_PKT); break;
+    case REQ_SEND:
+        answers = (pkt->type == MZW_CHAT_PKT && pkt->size > strlen(bot->name) &&
+                   strncmp(data, bot->name, strlen(bot->name)) == 0 &&
+                   data[strlen(bot->name)] == '[');
+        break;
+    case REQ_FIRE: answers = (pkt->type == MZW_SCORE_PKT && score_is_own(bot, pkt, data)); break;
+    default: answers = 0; break;
+    }
+    if (!answers) return;
+
+    histogram_record(latency[bot->pending], now - bot->sent_at);
+    histogram_record(latency_all, now - bot->sent_at);
+    histogram_record(server_latency[bot->pending], stamp - bot->sent_at);
+    w->answered[bot->pending]++;
+    bot->pending = -1;
+}
+
+/**
+ * @brief Read what is available on a bot's connection and handle complete packets.
+ */
+static void bot_read(WORKER *w, BOT *bot) {
+    while (1) {
+        ssize_t n = recv(bot->fd, bot->buf + bot->have, RECV_BUF - bot->have, MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (n <= 0) {
+            // The server closed the connection (e.g. a busy reply, or shutdown)
+            if (bot->state == BOT_CONNECTING) atomic_fetch_add(&logins_done, 1);
+            bot->state = BOT_FAILED;
+            epoll_ctl(w->epfd, EPOLL_CTL_DEL, bot->fd, NULL);
+            return;
+        }
+        w->bytes_in += n;
+        bot->have += n;
+        uint64_t now = stats_now();
+
+        size_t off = 0;
+        while (1) {
+            if (bot->skip) {
+                size_t k = bot->have - off < bot->skip ? bot->have - off : bot->skip;
+                off += k;
+                bot->skip -= k;
+                if (bot->skip) break;
+            }
+            if (bot->have - off < sizeof(MZW_PACKET)) break;
+
+            MZW_PACKET pkt;
+            memcpy(&pkt, bot->buf + off, sizeof(pkt));
+            pkt.size = ntohs(pkt.size);
+            pkt.timestamp_sec = ntohl(pkt.timestamp_sec);
+            pkt.timestamp_nsec = ntohl(pkt.timestamp_nsec);
+
+            if (sizeof(MZW_PACKET) + pkt.size > RECV_BUF) {
+                // Too big to buffer: handle the header alone, discard the payload
+                w->packets_in++;
+                bot_handle(w, bot, &pkt, "", now);
+                off += sizeof(MZW_PACKET);
+                bot->skip = pkt.size;
+                continue;
+            }
+            if (bot->have - off < sizeof(MZW_PACKET) + pkt.size) break;
+
+            w->packets_in++;
+            bot_handle(w, bot, &pkt, bot->buf + off + sizeof(MZW_PACKET), now);
+            off += sizeof(MZW_PACKET) + pkt.size;
+        }
+        memmove(bot->buf, bot->buf + off, bot->have - off);
+        bot->have -= off;
+    }
+}
+
+/**
+ * @brief Send a bot's next request, chosen at random from the mix.
+ */
+static void bot_request(WORKER *w, BOT *bot, uint64_t now) {
+    if (bot->pending >= 0) w->unanswered++;
+
+    int total = 0;
+    for (int k = 0; k < NREQ; k++) total += weights[k];
+    int pick = (int)(rng_next(&w->rng) % total), kind = 0;
+    while (pick >= weights[kind]) pick -= weights[kind++];
+
+    int rc;
+    int dir = (rng_next(&w->rng) & 1) ? 1 : -1;
+    switch (kind) {
+    case REQ_MOVE: rc = bot_send(bot, MZW_MOVE_PKT, dir, 0, 0, NULL, 0); break;
+    case REQ_TURN: rc = bot_send(bot, MZW_TURN_PKT, dir, 0, 0, NULL, 0); break;
+    case REQ_FIRE: rc = bot_send(bot, MZW_FIRE_PKT, 0, 0, 0, NULL, 0); break;
+    default: {
+        char msg[32];
+        int len = snprintf(msg, sizeof(msg), "hello %lu", w->sent[REQ_SEND]);
+        rc = bot_send(bot, MZW_SEND_PKT, 0, 0, 0, msg, len);
+        break;
+    }
+    }
+    if (rc != 0) {
+        w->send_errors++;
+        bot->pending = -1;
+        return;
+    }
+    w->sent[kind]++;
+    bot->pending = kind;
+    bot->sent_at = now;
+}
+
+/**
+ * @brief Wait for events on a worker's bots and handle them.
+ * @param timeout_ms Maximum time to wait.
+ */
+static void worker_poll(WORKER *w, int timeout_ms) {
+    struct epoll_event events[256];
+    int n = epoll_wait(w->epfd, events, 256, timeout_ms);
+    for (int i = 0; i < n; i++)
+        bot_read(w, &w->bots[events[i].data.u32]);
+}
+
+/**
+ * @brief Worker thread: log in the worker's bots, then drive the load.
+ */
+static void *worker_main(void *arg) {
+    WORKER *w = arg;
+
+    for (int i = 0; i < w->nbots; i++) {
+        BOT *bot = &w->bots[i];
+        bot_connect(bot);
+        if (bot->state == BOT_FAILED) {
+            atomic_fetch_add(&logins_done, 1);
+            continue;
+        }
+        struct epoll_event ev = { .events = EPOLLIN, .data.u32 = i };
+        epoll_ctl(w->epfd, EPOLL_CTL_ADD, bot->fd, &ev);
+    }
+
+    // Log in: wait until every bot of every worker has an answer
+    uint64_t deadline = stats_now() + LOGIN_TIMEOUT * 1000000000ULL;
+    while (atomic_load(&logins_done) < nbots && stats_now() < deadline)
+        worker_poll(w, 10);
+    pthread_barrier_wait(&start_barrier);  // Logins done
+    pthread_barrier_wait(&start_barrier);  // Load schedule set
+
+    // Drive the load
+    uint64_t sent = 0;
+    int next = 0;
+    while (1) {
+        uint64_t now = stats_now();
+        if (now >= load_end) break;
+
+        if (w->rate > 0) {
+            // Open loop: keep up with the schedule, round-robin over the bots
+            uint64_t due = (uint64_t)(w->rate * (now - load_start) / 1e9);
+            for (int tries = 0; sent < due && tries < w->nbots; ) {
+                BOT *bot = &w->bots[next];
+                next = (next + 1) % w->nbots;
+                if (bot->state != BOT_READY) {
+                    tries++;
+                    continue;
+                }
+                bot_request(w, bot, now);
+                sent++;
+            }
+            worker_poll(w, 1);
+        } else {
+            // Closed loop: each bot has one request in flight
+            for (int i = 0; i < w->nbots; i++) {
+                BOT *bot = &w->bots[i];
+                if (bot->state == BOT_READY &&
+                    (bot->pending < 0 || now - bot->sent_at > CLOSED_LOOP_TIMEOUT))
+                    bot_request(w, bot, now);
+            }
+            worker_poll(w, 1);
+        }
+    }
+
+    // Collect the last answers before disconnecting
+    uint64_t drain = stats_now() + 200000000ULL;
+    while (stats_now() < drain) worker_poll(w, 10);
+    for (int i = 0; i < w->nbots; i++) {
+        if (w->bots[i].pending >= 0) w->unanswered++;
+        if (w->bots[i].fd >= 0) close(w->bots[i].fd);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Parse a request mix such as "move:40,turn:40,fire:15,send:5".
+ * @return 0 on success, -1 if the mix is invalid.
+ */
+static int parse_mix(char *spec) {
+    int w[NREQ] = { 0 }, total = 0;
+    for (char *item = strtok(spec, ","); item; item = strtok(NULL, ",")) {
+        char name[8];
+        int weight, k;
+        if (sscanf(item, "%7[a-z]:%d", name, &weight) != 2 || weight < 0) return -1;
+        for (k = 0; k < NREQ && strcasecmp(name, req_names[k]) != 0; k++) ;
+        if (k == NREQ) return -1;
+        w[k] = weight;
+        total += weight;
+    }
+    if (total == 0) return -1;
+    memcpy(weights, w, sizeof(weights));
+    return 0;
+}
+
+/**
+ * @brief Resolve the server address.
+ * @return 0 on success, -1 on error.
+ */
+static int resolve(void) {
+    struct addrinfo hints = { .ai_socktype = SOCK_STREAM }, *res;
+    char service[16];
+    snprintf(service, sizeof(service), "%d", port);
+    if (getaddrinfo(host, service, &hints, &res) != 0) return -1;
+    memcpy(&server_addr, res->ai_addr, res->ai_addrlen);
+    server_addrlen = res->ai_addrlen;
+    freeaddrinfo(res);
+    return 0;
+}
+
+/**
+ * @brief Print one row of the latency table.
+ */
+static void report_row(const char *name, unsigned long sent, unsigned long answered,
+                       HISTOGRAM *e2e, HISTOGRAM *srv) {
+    uint64_t p50, p99, p999, max, s50, s99, s999, smax;
+    histogram_summary(e2e, &p50, &p99, &p999, &max);
+    if (srv) histogram_summary(srv, &s50, &s99, &s999, &smax);
+    printf("%-6s %10lu %10lu %10.1f %10.1f %10.1f %10.1f", name, sent, answered,
+           p50 / 1e3, p99 / 1e3, p999 / 1e3, max / 1e3);
+    if (srv) printf(" %10.1f %10.1f", s50 / 1e3, s99 / 1e3);
+    printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:c:n:j:r:d:m:xS:")) != -1) {
+        switch (opt) {
+        case 'h': host = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'c': nbots = atoi(optarg); break;
+        case 'n': nrooms = atoi(optarg); break;
+        case 'j': nworkers = atoi(optarg); break;
+        case 'r': rate = atof(optarg); break;
+        case 'd': duration = atof(optarg); break;
+        case 'x': force_extended = 1; break;
+        case 'S': seed = strtoul(optarg, NULL, 0); break;
+        case 'm':
+            if (parse_mix(optarg) != 0) {
+                fprintf(stderr, "Error: Invalid request mix (expected e.g. move:40,turn:40,fire:15,send:5)\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            fprintf(stderr, "Usage: %s -p <port> [-h <host>] [-c <bots>] [-n <rooms>] "
+                    "[-j <workers>] [-r <requests_per_sec>] [-d <seconds>] "
+                    "[-m move:W,turn:W,fire:W,send:W] [-x] [-S <seed>]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (port <= 0 || nbots < 1 || nrooms < 1 || nworkers < 1 || rate < 0 || duration <= 0) {
+        fprintf(stderr, "Error: Invalid arguments (a valid port must be given with -p)\n");
+        exit(EXIT_FAILURE);
+    }
+    if (nworkers > nbots) nworkers = nbots;
+    if (resolve() != 0) {
+        fprintf(stderr, "Error: Cannot resolve %s\n", host);
+        exit(EXIT_FAILURE);
+    }
+
+    latency_all = histogram_create();
+    login_latency = histogram_create();
+    for (int k = 0; k < NREQ; k++) {
+        latency[k] = histogram_create();
+        server_latency[k] = histogram_create();
+    }
+
+    // Assign bots to rooms and avatars to bots
+    int extended = force_extended || (nbots + nrooms - 1) / nrooms > AVATARS_PER_ROOM;
+    BOT *bots = calloc(nbots, sizeof(BOT));
+    WORKER *workers = calloc(nworkers, sizeof(WORKER));
+    if (!bots || !workers || !latency_all || !login_latency) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < nbots; i++) {
+        bots[i].index = i;
+        bots[i].fd = -1;
+        bots[i].room = i % nrooms;
+        bots[i].avatar = avatars[(i / nrooms) % AVATARS_PER_ROOM];
+        bots[i].id = bots[i].avatar;
+        bots[i].extended = extended;
+    }
+
+    // Give each worker a contiguous share of the bots
+    pthread_barrier_init(&start_barrier, NULL, nworkers + 1);
+    for (int i = 0, first = 0; i < nworkers; i++) {
+        WORKER *w = &workers[i];
+        w->nbots = nbots / nworkers + (i < nbots % nworkers);
+        w->bots = &bots[first];
+        first += w->nbots;
+        w->rate = rate * w->nbots / nbots;
+        w->rng = seed + i;
+        w->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (w->epfd < 0 || pthread_create(&w->tid, NULL, worker_main, w) != 0) {
+            fprintf(stderr, "Error: Failed to start worker %d\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    uint64_t login_start = stats_now();
+    pthread_barrier_wait(&start_barrier);
+    load_start = stats_now();
+    load_end = load_start + (uint64_t)(duration * 1e9);
+    pthread_barrier_wait(&start_barrier);
+    fprintf(stderr, "Logged in %d of %d bots (%s IDs) in %.3f s; running for %.1f s\n",
+            atomic_load(&logins_ok), nbots, extended ? "extended" : "avatar",
+            (load_start - login_start) / 1e9, duration);
+
+    for (int i = 0; i < nworkers; i++) pthread_join(workers[i].tid, NULL);
+
+    // Aggregate and report
+    unsigned long sent[NREQ] = { 0 }, answered[NREQ] = { 0 };
+    unsigned long total_sent = 0, total_answered = 0, unanswered = 0, send_errors = 0;
+    unsigned long packets_in = 0, bytes_in = 0;
+    for (int i = 0; i < nworkers; i++) {
+        for (int k = 0; k < NREQ; k++) {
+            sent[k] += workers[i].sent[k];
+            answered[k] += workers[i].answered[k];
+        }
+        unanswered += workers[i].unanswered;
+        send_errors += workers[i].send_errors;
+        packets_in += workers[i].packets_in;
+        bytes_in += workers[i].bytes_in;
+    }
+    for (int k = 0; k < NREQ; k++) {
+        total_sent += sent[k];
+        total_answered += answered[k];
+    }
+
+    printf("bots %d logged_in %d busy %d inuse %d failed %d\n", nbots, atomic_load(&logins_ok),
+           atomic_load(&logins_busy), atomic_load(&logins_inuse),
+           nbots - atomic_load(&logins_ok) - atomic_load(&logins_busy) - atomic_load(&logins_inuse));
+    printf("duration_s %.3f\n", duration);
+    if (rate > 0)
+        printf("requests %lu %.1f/s (target %.1f/s)\n", total_sent, total_sent / duration, rate);
+    else
+        printf("requests %lu %.1f/s (closed loop)\n", total_sent, total_sent / duration);
+    printf("answered %lu unanswered %lu send_errors %lu\n", total_answered, unanswered, send_errors);
+    printf("packets_in %lu %.1f/s\n", packets_in, packets_in / duration);
+    printf("bytes_in %lu %.1f/s\n", bytes_in, bytes_in / duration);
+    printf("%-6s %10s %10s %10s %10s %10s %10s %10s %10s\n", "type", "sent", "answered",
+           "p50_us", "p99_us", "p999_us", "max_us", "srv_p50_us", "srv_p99_us");
+    for (int k = 0; k < NREQ; k++)
+        if (sent[k]) report_row(req_names[k], sent[k], answered[k], latency[k], server_latency[k]);
+    report_row("ALL", total_sent, total_answered, latency_all, NULL);
+    report_row("LOGIN", nbots, atomic_load(&logins_ok), login_latency, NULL);
+
+    free(bots);
+    free(workers);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,493 @@
+/**
+ * @file mazewar_microbench.c
+ * @brief Microbenchmarks of the maze and player hot paths.
+ *
+ * Usage: mazewar_microbench [-b <bench,...>] [-s <size,...>] [-D <density,...>]
+ *                           [-t <threads,...>] [-T <ms>] [-k <kind>] [-R <region_size>]
+ *                           [-o <results>]
+ *        mazewar_microbench -C <baseline> <results> [-X <percent>]
+ *
+ * Each benchmark is run for every combination of maze size (a square maze
+ * of side -s, generated with maze_generate()), occupant density (-D, the
+ * fraction of cells holding a player) and thread count (-t), for -T
+ * milliseconds each.  All threads operate on the same maze, so the thread
+ * count exposes lock contention.  The benchmarks are:
+ *
+ *   get_view     maze_get_view_in() from random cells, in random directions.
+ *   find_target  maze_find_occupant() (the ray behind maze_find_target())
+ *                from random cells, in random directions.
+ *   move         maze_move_in() of random occupants owned by the thread.
+ *   set_random   maze_set_occupant_random() followed by maze_remove_occupant().
+ *   update_view  player_update_view() of players whose view is cached, i.e.
+ *                the view diff; packets go to /dev/null.  A room holds at
+ *                most a few hundred players, so the density is capped.
+ *
+ * Results are printed as tab-separated values, one line per run, with a
+ * header line.  Compare mode (-C) matches the runs of two result files,
+ * prints the change in time per operation, and exits with status 1 if any
+ * run became slower by more than -X percent (default 10).
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "maze.h"
+#include "maze_ext.h"
+#include "maze_gen.h"
+#include "player.h"
+#include "player_ext.h"
+#include "protocol_ext.h"
+#include "stats.h"
+
+/// Limits of the run matrix.
+#define MAX_VALUES 16
+#define MAX_THREADS 256
+
+/// Players per table in update_view (below the table's capacity).
+#define MAX_BENCH_PLAYERS 250
+
+/// Operations between checks of the clock.
+#define OPS_PER_CHECK 64
+
+/**
+ * @struct occupant
+ * @brief An occupant placed by a benchmark, and where it is.
+ */
+typedef struct occupant {
+    OCCUPANT id;
+    int row, col;
+} OCCUPANT_POS;
+
+/**
+ * @struct run
+ * @brief One benchmark run: a maze, its occupants and the threads' shares.
+ */
+typedef struct run {
+    MAZE *maze;
+    int size;
+    int threads;
+    OCCUPANT_POS *occupants;      // Placed occupants, partitioned among threads
+    int noccupants;
+    PLAYER_TABLE *table;          // update_view only
+    PLAYER **players;
+    int nplayers;
+    int sink;                     // /dev/null, the players' client fd
+    atomic_int stop;
+    pthread_barrier_t barrier;
+} RUN;
+
+/**
+ * @struct thread_arg
+ * @brief State of one benchmark thread.
+ */
+typedef struct thread_arg {
+    RUN *run;
+    int index;
+    uint64_t rng;
+    unsigned long ops;
+    uint64_t elapsed;
+    void (*op)(struct thread_arg *);
+    int first, count;             // Share of occupants or players
+} THREAD_ARG;
+
+/**
+ * @struct bench
+ * @brief A benchmark.
+ */
+typedef struct bench {
+    const char *name;
+    void (*op)(THREAD_ARG *);
+    int needs_players;
+} BENCH;
+
+/// Options.
+static int sizes[MAX_VALUES] = { 64, 512, 2048 }, nsizes = 3;
+static double densities[MAX_VALUES] = { 0.01, 0.1 };
+static int ndensities = 2;
+static int thread_counts[MAX_VALUES] = { 1, 2, 4 }, nthread_counts = 3;
+static int run_ms = 200, region_size = 0;
+static MAZE_GEN_KIND kind = MAZE_GEN_ARENA;
+
+/**
+ * @brief Advance a splitmix64 generator and return its next output.
+ */
+static uint64_t rng_next(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static void op_get_view(THREAD_ARG *t) {
+    char view[VIEW_DEPTH][VIEW_WIDTH];
+    uint64_t r = rng_next(&t->rng);
+    int size = t->run->size;
+    maze_get_view_in(t->run->maze, (VIEW *)view, (int)(r % size), (int)((r >> 20) % size),
+                     (DIRECTION)((r >> 40) & 3), VIEW_DEPTH);
+}
+
+static void op_find_target(THREAD_ARG *t) {
+    uint64_t r = rng_next(&t->rng);
+    int size = t->run->size;
+    maze_find_occupant(t->run->maze, (int)(r % size), (int)((r >> 20) % size),
+                       (DIRECTION)((r >> 40) & 3));
+}
+
+static void op_move(THREAD_ARG *t) {
+    static const int drow[] = { -1, 0, 1, 0 };
+    static const int dcol[] = { 0, -1, 0, 1 };
+    if (t->count == 0) return;
+    uint64_t r = rng_next(&t->rng);
+    OCCUPANT_POS *o = &t->run->occupants[t->first + (int)(r % t->count)];
+    int dir = (int)((r >> 32) & 3);
+    if (maze_move_in(t->run->maze, o->row, o->col, dir) == 0) {
+        o->row += drow[dir];
+        o->col += dcol[dir];
+    }
+}
+
+static void op_set_random(THREAD_ARG *t) {
+    if (t->count == 0) return;
+    OCCUPANT_POS *o = &t->run->occupants[t->first + (int)(rng_next(&t->rng) % t->count)];
+    maze_remove_occupant(t->run->maze, o->id, o->row, o->col);
+    maze_set_occupant_random(t->run->maze, o->id, 'A' + o->id % 26, &o->row, &o->col);
+}
+
+static void op_update_view(THREAD_ARG *t) {
+    if (t->count == 0) return;
+    player_update_view(t->run->players[t->first + (int)(rng_next(&t->rng) % t->count)]);
+}
+
+static const BENCH benches[] = {
+    { "get_view", op_get_view, 0 },
+    { "find_target", op_find_target, 0 },
+    { "move", op_move, 0 },
+    { "set_random", op_set_random, 0 },
+    { "update_view", op_update_view, 1 },
+};
+#define NBENCHES ((int)(sizeof(benches) / sizeof(benches[0])))
+static int selected[NBENCHES] = { 1, 1, 1, 1, 1 };
+
+/**
+ * @brief Benchmark thread: run the operation until told to stop.
+ */
+static void *bench_thread(void *arg) {
+    THREAD_ARG *t = arg;
+    pthread_barrier_wait(&t->run->barrier);
+    uint64_t start = stats_now();
+    while (!atomic_load_explicit(&t->run->stop, memory_order_relaxed)) {
+        for (int i = 0; i < OPS_PER_CHECK; i++) t->op(t);
+        t->ops += OPS_PER_CHECK;
+    }
+    t->elapsed = stats_now() - start;
+    return NULL;
+}
+
+/**
+ * @brief Place the occupants (or log in the players) of a run.
+ * @return 0 on success, -1 on error.
+ */
+static int run_populate(RUN *run, const BENCH *b, double density) {
+    long cells = (long)run->size * run->size;
+    long want = (long)(density * cells);
+    if (want < run->threads) want = run->threads;
+
+    if (b->needs_players) {
+        if (want > MAX_BENCH_PLAYERS) want = MAX_BENCH_PLAYERS;
+        run->table = player_table_create(run->maze);
+        run->players = calloc(want, sizeof(PLAYER *));
+        if (!run->table || !run->players) return -1;
+        for (int i = 0; i < want; i++) {
+            char name[16];
+            snprintf(name, sizeof(name), "p%d", i);
+            PLAYER *p = player_login_ext(run->table, run->sink, 'A' + i % 26, name, MZW_CAP_EXTENDED_ID);
+            if (!p) break;
+            player_update_view(p);  // Cache the view, so that updates are diffs
+            run->players[run->nplayers++] = p;
+        }
+        return run->nplayers > 0 ? 0 : -1;
+    }
+
+    if (want > MAZE_MAX_OCCUPANTS) want = MAZE_MAX_OCCUPANTS;
+    run->occupants = calloc(want, sizeof(OCCUPANT_POS));
+    if (!run->occupants) return -1;
+    for (int i = 0; i < want; i++) {
+        OCCUPANT_POS *o = &run->occupants[run->noccupants];
+        o->id = (OCCUPANT)i;
+        if (maze_set_occupant_random(run->maze, o->id, 'A' + i % 26, &o->row, &o->col) != 0) break;
+        run->noccupants++;
+    }
+    return 0;
+}
+
+/**
+ * @brief Release what run_populate() set up.
+ */
+static void run_depopulate(RUN *run) {
+    for (int i = 0; i < run->nplayers; i++) player_logout(run->players[i]);
+    if (run->table) player_table_destroy(run->table);
+    free(run->players);
+    free(run->occupants);
+}
+
+/**
+ * @brief Run one benchmark for one maze size, density and thread count.
+ * @return 0 on success, -1 on error.
+ */
+static int run_one(FILE *out, const BENCH *b, int size, double density, int threads, int sink) {
+    RUN run = { .size = size, .threads = threads, .sink = sink };
+
+    char **template = maze_generate(kind, size, size, kind == MAZE_GEN_PERFECT ? 0 : 10, 1);
+    if (!template) return -1;
+    run.maze = maze_create(template);
+    maze_gen_free(template);
+    if (!run.maze) return -1;
+    srand(1);
+
+    THREAD_ARG *args = calloc(threads, sizeof(THREAD_ARG));
+    pthread_t *tids = calloc(threads, sizeof(pthread_t));
+    if (!args || !tids || run_populate(&run, b, density) != 0) {
+        fprintf(stderr, "Error: Failed to set up %s on a %d x %d maze\n", b->name, size, size);
+        run_depopulate(&run);
+        maze_destroy(run.maze);
+        free(args);
+        free(tids);
+        return -1;
+    }
+
+    // Each thread owns a contiguous share of the occupants or players
+    int total = b->needs_players ? run.nplayers : run.noccupants;
+    pthread_barrier_init(&run.barrier, NULL, threads + 1);
+    for (int i = 0, first = 0; i < threads; i++) {
+        args[i] = (THREAD_ARG){ .run = &run, .index = i, .rng = 1 + i, .op = b->op, .first = first };
+        args[i].count = total / threads + (i < total % threads);
+        first += args[i].count;
+        pthread_create(&tids[i], NULL, bench_thread, &args[i]);
+    }
+    pthread_barrier_wait(&run.barrier);
+    struct timespec interval = { run_ms / 1000, (run_ms % 1000) * 1000000L };
+    nanosleep(&interval, NULL);
+    atomic_store(&run.stop, 1);
+
+    unsigned long ops = 0;
+    uint64_t busy = 0;
+    for (int i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+        ops += args[i].ops;
+        busy += args[i].elapsed;
+    }
+
+    // Time per operation is per thread; throughput is for all threads together
+    double ns_per_op = ops ? (double)busy / ops : 0;
+    double ops_per_sec = ops ? ops * 1e9 / ((double)busy / threads) : 0;
+    fprintf(out, "%s\t%d\t%g\t%d\t%d\t%lu\t%.1f\t%.0f\n", b->name, size, density, threads,
+            total, ops, ns_per_op, ops_per_sec);
+    fflush(out);
+
+    pthread_barrier_destroy(&run.barrier);
+    run_depopulate(&run);
+    maze_destroy(run.maze);
+    free(args);
+    free(tids);
+    return 0;
+}
+
+/**
+ * @struct result
+ * @brief One line of a result file.
+ */
+typedef struct result {
+    char bench[32];
+    int size, threads;
+    double density, ns_per_op;
+} RESULT;
+
+/**
+ * @brief Read a result file.
+ * @return The results (count in *countp), or NULL on error.
+ */
+static RESULT *read_results(const char *path, int *countp) {
+    FILE *in = fopen(path, "r");
+    if (!in) {
+        perror(path);
+        return NULL;
+    }
+    int count = 0, cap = 64;
+    RESULT *results = malloc(cap * sizeof(RESULT));
+    char line[512];
+    while (results && fgets(line, sizeof(line), in)) {
+        RESULT r;
+        int occupants;
+        unsigned long ops;
+        if (line[0] == '#' || sscanf(line, "%31s %d %lf %d %d %lu %lf", r.bench, &r.size, &r.density,
+                                     &r.threads, &occupants, &ops, &r.ns_per_op) != 7)
+            continue;
+        if (count == cap) results = realloc(results, (cap *= 2) * sizeof(RESULT));
+        if (results) results[count++] = r;
+    }
+    fclose(in);
+    *countp = count;
+    return results;
+}
+
+/**
+ * @brief Compare two result files.
+ * @return EXIT_SUCCESS if no run regressed by more than threshold percent.
+ */
+static int compare(const char *base_path, const char *new_path, double threshold) {
+    int nbase, nnew, regressions = 0, matched = 0;
+    RESULT *base = read_results(base_path, &nbase);
+    RESULT *new = read_results(new_path, &nnew);
+    if (!base || !new) {
+        free(base);
+        free(new);
+        return 2;
+    }
+
+    printf("%-12s %6s %8s %7s %12s %12s %8s\n", "bench", "size", "density", "threads",
+           "base_ns", "new_ns", "change");
+    for (int i = 0; i < nnew; i++) {
+        for (int j = 0; j < nbase; j++) {
+            if (strcmp(new[i].bench, base[j].bench) != 0 || new[i].size != base[j].size ||
+                new[i].density != base[j].density || new[i].threads != base[j].threads)
+                continue;
+            double change = base[j].ns_per_op > 0
+                            ? (new[i].ns_per_op - base[j].ns_per_op) * 100 / base[j].ns_per_op : 0;
+            int regressed = change > threshold;
+            printf("%-12s %6d %8g %7d %12.1f %12.1f %+7.1f%%%s\n", new[i].bench, new[i].size,
+                   new[i].density, new[i].threads, base[j].ns_per_op, new[i].ns_per_op, change,
+                   regressed ? "  REGRESSION" : "");
+            regressions += regressed;
+            matched++;
+            break;
+        }
+    }
+    printf("%d runs compared, %d regressed by more than %g%%\n", matched, regressions, threshold);
+    free(base);
+    free(new);
+    return regressions ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/**
+ * @brief Parse a comma-separated list of integers.
+ * @return The number of values, or -1 if the list is invalid.
+ */
+static int parse_ints(char *list, int *values, int min) {
+    int n = 0;
+    for (char *item = strtok(list, ","); item; item = strtok(NULL, ",")) {
+        if (n == MAX_VALUES || (values[n] = atoi(item)) < min) return -1;
+        n++;
+    }
+    return n;
+}
+
+int main(int argc, char *argv[]) {
+    const char *out_path = NULL, *compare_base = NULL;
+    double threshold = 10;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:s:D:t:T:k:R:o:C:X:")) != -1) {
+        switch (opt) {
+        case 'b':
+            memset(selected, 0, sizeof(selected));
+            for (char *item = strtok(optarg, ","); item; item = strtok(NULL, ",")) {
+                int k;
+                for (k = 0; k < NBENCHES && strcmp(item, benches[k].name) != 0; k++) ;
+                if (k == NBENCHES) {
+                    fprintf(stderr, "Error: Unknown benchmark '%s'\n", item);
+                    exit(EXIT_FAILURE);
+                }
+                selected[k] = 1;
+            }
+            break;
+        case 's':
+            if ((nsizes = parse_ints(optarg, sizes, 3)) <= 0) {
+                fprintf(stderr, "Error: Invalid maze sizes\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'D':
+            ndensities = 0;
+            for (char *item = strtok(optarg, ","); item; item = strtok(NULL, ",")) {
+                double d = atof(item);
+                if (ndensities == MAX_VALUES || d <= 0 || d >= 1) {
+                    fprintf(stderr, "Error: Invalid densities (fractions between 0 and 1)\n");
+                    exit(EXIT_FAILURE);
+                }
+                densities[ndensities++] = d;
+            }
+            break;
+        case 't':
+            if ((nthread_counts = parse_ints(optarg, thread_counts, 1)) <= 0) {
+                fprintf(stderr, "Error: Invalid thread counts\n");
+                exit(EXIT_FAILURE);
+            }
+            for (int i = 0; i < nthread_counts; i++)
+                if (thread_counts[i] > MAX_THREADS) thread_counts[i] = MAX_THREADS;
+            break;
+        case 'T': run_ms = atoi(optarg); break;
+        case 'R': region_size = atoi(optarg); break;
+        case 'k':
+            if (maze_gen_parse_kind(optarg, &kind) != 0) {
+                fprintf(stderr, "Error: Unknown maze kind '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'o': out_path = optarg; break;
+        case 'C': compare_base = optarg; break;
+        case 'X': threshold = atof(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-b <bench,...>] [-s <size,...>] [-D <density,...>] "
+                    "[-t <threads,...>] [-T <ms>] [-k <kind>] [-R <region_size>] [-o <results>]\n"
+                    "       %s -C <baseline> <results> [-X <percent>]\n", argv[0], argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (compare_base) {
+        if (optind != argc - 1) {
+            fprintf(stderr, "Error: -C needs a baseline and a results file\n");
+            exit(EXIT_FAILURE);
+        }
+        return compare(compare_base, argv[optind], threshold);
+    }
+    if (run_ms <= 0) {
+        fprintf(stderr, "Error: Invalid run time\n");
+        exit(EXIT_FAILURE);
+    }
+
+    FILE *out = stdout;
+    if (out_path && !(out = fopen(out_path, "w"))) {
+        perror(out_path);
+        exit(EXIT_FAILURE);
+    }
+    int sink = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (sink < 0) {
+        perror("/dev/null");
+        exit(EXIT_FAILURE);
+    }
+
+    maze_set_region_size(region_size);
+    player_init();
+
+    fprintf(out, "# bench\tsize\tdensity\tthreads\toccupants\tops\tns_per_op\tops_per_sec\n");
+    int failed = 0;
+    for (int k = 0; k < NBENCHES; k++) {
+        if (!selected[k]) continue;
+        for (int s = 0; s < nsizes; s++)
+            for (int d = 0; d < ndensities; d++)
+                for (int t = 0; t < nthread_counts; t++)
+                    failed |= run_one(out, &benches[k], sizes[s], densities[d], thread_counts[t], sink);
+    }
+
+    player_fini();
+    close(sink);
+    if (out != stdout) fclose(out);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
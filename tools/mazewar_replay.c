@@ -0,0 +1,491 @@
+/**
+ * @file mazewar_replay.c
+ * @brief Replay a MazeWar packet journal against a server.
+ *
+ * Usage: mazewar_replay -p <port> [-h <host>] [-x <speed>|max] [-D <percent>] <journal>
+ *
+ * The journal is a file written by the server with -J.  Each connection in
+ * it is reopened, in the order and at the times recorded, and the packets
+ * the server received on it are sent again, with the recorded gaps between
+ * them divided by the speed (-x 1 reproduces the original timing, -x 10 is
+ * ten times faster and -x max sends every packet as soon as the previous
+ * one has been sent).  Where the journal records a connection being closed,
+ * the replay half-closes it and reads until the server closes it too.
+ *
+ * Two things are reported:
+ *
+ *   - for each packet type sent, the latency from sending a packet to the
+ *     arrival of the next packet the server sends on the same connection
+ *     (packets the server stamped before the request was sent are not
+ *     counted, so the latency is only an answer to the request when the
+ *     server runs on the same host; requests that cause no reply, such as
+ *     a move into a wall, are not counted either);
+ *
+ *   - the divergence of the outbound traffic from the recorded run: for
+ *     each packet type, the number of packets the server sent on the
+ *     replayed connections against the number it sent originally, and
+ *     overall the sum over connections and types of the absolute
+ *     differences, as a percentage of the packets sent originally.  Only
+ *     connections whose close was recorded are compared.
+ *
+ * With -D, the exit status is 1 if the divergence exceeds the given
+ * percentage, so that the replay can be used to gate a change.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <arpa/inet.h>
+
+#include "protocol.h"
+#include "journal.h"
+#include "stats.h"
+
+/// Size of each connection's receive buffer (larger than any packet the server sends).
+#define RECV_BUF 4096
+
+/// Time allowed for the server to close the connections after the last record (ns).
+#define DRAIN_TIMEOUT 5000000000ULL
+
+/// Client packet types, which have latency histograms.
+#define NTYPES (MZW_SEND_PKT + 1)
+
+/// Names of packet types.
+static const char *type_names[JOURNAL_OUT_TYPES] = {
+    [MZW_LOGIN_PKT] = "LOGIN", [MZW_MOVE_PKT] = "MOVE", [MZW_TURN_PKT] = "TURN",
+    [MZW_FIRE_PKT] = "FIRE", [MZW_REFRESH_PKT] = "REFRESH", [MZW_SEND_PKT] = "SEND",
+    [MZW_READY_PKT] = "READY", [MZW_INUSE_PKT] = "INUSE", [MZW_CLEAR_PKT] = "CLEAR",
+    [MZW_SHOW_PKT] = "SHOW", [MZW_ALERT_PKT] = "ALERT", [MZW_SCORE_PKT] = "SCORE",
+    [MZW_CHAT_PKT] = "CHAT",
+};
+
+/**
+ * @struct record
+ * @brief A journal record together with its payload.
+ */
+typedef struct record {
+    JOURNAL_RECORD hdr;
+    char *data;
+} RECORD;
+
+/**
+ * @struct conn
+ * @brief One replayed connection.
+ */
+typedef struct conn {
+    int fd;                   // -1 if not (or no longer) connected
+    int state;                // CONN_*
+    int closed;               // The journal records the close
+    int pending;              // Type of the request awaiting a reply, or -1
+    uint64_t sent_at;         // When the pending request was sent
+    uint32_t expected[JOURNAL_OUT_TYPES];
+    uint32_t observed[JOURNAL_OUT_TYPES];
+    size_t have;              // Bytes in buf
+    size_t skip;              // Payload bytes still to discard
+    char buf[RECV_BUF];
+} CONN;
+
+enum { CONN_UNUSED, CONN_OPEN, CONN_CLOSING, CONN_DONE };
+
+/// Options.
+static const char *host = "127.0.0.1";
+static int port = -1;
+static double speed = 1;      // 0 = as fast as possible
+static double max_divergence = -1;
+
+/// Shared state.
+static struct sockaddr_storage server_addr;
+static socklen_t server_addrlen;
+static int epfd;
+static CONN *conns;
+static uint32_t nconns;       // Highest connection ID in the journal, plus one
+static int closing = 0;       // Connections half-closed but not yet closed by the server
+static unsigned long sent[NTYPES], answered[NTYPES], send_errors, connect_errors;
+static HISTOGRAM *latency[NTYPES], *latency_all;
+
+/**
+ * @brief Read a journal into memory.
+ * @param path    The journal.
+ * @param countp  Receives the number of records.
+ * @return The records, or NULL on error (after printing a message).
+ */
+static RECORD *read_journal(const char *path, size_t *countp) {
+    FILE *in = fopen(path, "rb");
+    if (!in) {
+        perror(path);
+        return NULL;
+    }
+
+    JOURNAL_HEADER header;
+    if (fread(&header, sizeof(header), 1, in) != 1 ||
+        memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != JOURNAL_VERSION || header.record_size != sizeof(JOURNAL_RECORD)) {
+        fprintf(stderr, "Error: %s is not a MazeWar journal (version %d)\n", path, JOURNAL_VERSION);
+        fclose(in);
+        return NULL;
+    }
+
+    size_t count = 0, cap = 4096;
+    RECORD *recs = malloc(cap * sizeof(RECORD));
+    JOURNAL_RECORD hdr;
+    while (recs && fread(&hdr, sizeof(hdr), 1, in) == 1) {
+        if (count == cap) {
+            RECORD *grown = realloc(recs, (cap *= 2) * sizeof(RECORD));
+            if (!grown) break;
+            recs = grown;
+        }
+        recs[count].hdr = hdr;
+        recs[count].data = NULL;
+        if (hdr.size) {
+            if (!(recs[count].data = malloc(hdr.size))) break;
+            if (fread(recs[count].data, hdr.size, 1, in) != 1) {
+                // The server was killed mid-write: keep what is complete
+                free(recs[count].data);
+                fprintf(stderr, "Warning: %s is truncated\n", path);
+                break;
+            }
+        }
+        if (hdr.conn >= nconns) nconns = hdr.conn + 1;
+        count++;
+    }
+    fclose(in);
+    if (!recs) fprintf(stderr, "Error: Out of memory\n");
+    *countp = count;
+    return recs;
+}
+
+/**
+ * @brief Handle one packet received on a connection.
+ */
+static void conn_handle(CONN *c, MZW_PACKET *pkt, uint64_t now) {
+    if (pkt->type < JOURNAL_OUT_TYPES) c->observed[pkt->type]++;
+    if (c->pending < 0) return;
+
+    // Ignore packets the server sent before the pending request
+    uint64_t stamp = (uint64_t)pkt->timestamp_sec * 1000000000ULL + pkt->timestamp_nsec;
+    if (stamp < c->sent_at) return;
+
+    histogram_record(latency[c->pending], now - c->sent_at);
+    histogram_record(latency_all, now - c->sent_at);
+    answered[c->pending]++;
+    c->pending = -1;
+}
+
+/**
+ * @brief Stop following a connection the server has closed.
+ */
+static void conn_finish(CONN *c) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    c->fd = -1;
+    if (c->state == CONN_CLOSING) closing--;
+    c->state = CONN_DONE;
+}
+
+/**
+ * @brief Read what is available on a connection and count complete packets.
+ */
+static void conn_read(CONN *c) {
+    while (c->fd >= 0) {
+        ssize_t n = recv(c->fd, c->buf + c->have, RECV_BUF - c->have, MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (n <= 0) {
+            conn_finish(c);
+            return;
+        }
+        c->have += n;
+        uint64_t now = stats_now();
+
+        size_t off = 0;
+        while (1) {
+            if (c->skip) {
+                size_t k = c->have - off < c->skip ? c->have - off : c->skip;
+                off += k;
+                c->skip -= k;
+                if (c->skip) break;
+            }
+            if (c->have - off < sizeof(MZW_PACKET)) break;
+
+            MZW_PACKET pkt;
+            memcpy(&pkt, c->buf + off, sizeof(pkt));
+            pkt.size = ntohs(pkt.size);
+            pkt.timestamp_sec = ntohl(pkt.timestamp_sec);
+            pkt.timestamp_nsec = ntohl(pkt.timestamp_nsec);
+
+            // Only the headers matter here, so payloads are skipped
+            conn_handle(c, &pkt, now);
+            off += sizeof(MZW_PACKET);
+            c->skip = pkt.size;
+        }
+        memmove(c->buf, c->buf + off, c->have - off);
+        c->have -= off;
+    }
+}
+
+/**
+ * @brief Wait for and read what the server sends, for up to a given time.
+ * @param timeout_ms  Longest time to wait, or 0 to read only what has arrived.
+ */
+static void pump(int timeout_ms) {
+    struct epoll_event events[64];
+    int n = epoll_wait(epfd, events, 64, timeout_ms);
+    for (int i = 0; i < n; i++) conn_read(&conns[events[i].data.u32]);
+}
+
+/**
+ * @brief Send a journaled packet on its connection, stamped with the current time.
+ *
+ * While the server is not reading, what it sends is read instead, so that
+ * neither side can block the other.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int conn_send(CONN *c, RECORD *r) {
+    char msg[sizeof(MZW_PACKET) + UINT16_MAX];
+    uint64_t now = stats_now();
+    MZW_PACKET hdr = {
+        .type = r->hdr.type, .param1 = r->hdr.param1, .param2 = r->hdr.param2,
+        .param3 = r->hdr.param3, .size = htons(r->hdr.size),
+        .timestamp_sec = htonl(now / 1000000000ULL),
+        .timestamp_nsec = htonl(now % 1000000000ULL)
+    };
+    memcpy(msg, &hdr, sizeof(hdr));
+    if (r->hdr.size) memcpy(msg + sizeof(hdr), r->data, r->hdr.size);
+
+    size_t len = sizeof(MZW_PACKET) + r->hdr.size;
+    const char *p = msg;
+    while (len > 0 && c->fd >= 0) {
+        ssize_t n = send(c->fd, p, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            pump(1);
+            continue;
+        }
+        if (n <= 0) return -1;
+        p += n;
+        len -= n;
+    }
+    return len == 0 ? 0 : -1;
+}
+
+/**
+ * @brief Open a replayed connection.
+ */
+static void conn_open(uint32_t id) {
+    CONN *c = &conns[id];
+    c->state = CONN_DONE;
+    c->pending = -1;
+    c->fd = socket(server_addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (c->fd < 0 || connect(c->fd, (struct sockaddr *)&server_addr, server_addrlen) < 0) {
+        if (c->fd >= 0) close(c->fd);
+        c->fd = -1;
+        connect_errors++;
+        return;
+    }
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = id };
+    epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev);
+    c->state = CONN_OPEN;
+}
+
+/**
+ * @brief Carry out one journal record.
+ */
+static void replay(RECORD *r) {
+    CONN *c = &conns[r->hdr.conn];
+    switch (r->hdr.kind) {
+    case JOURNAL_OPEN:
+        conn_open(r->hdr.conn);
+        break;
+    case JOURNAL_PACKET:
+        if (c->state != CONN_OPEN) break;
+        if (r->hdr.type < NTYPES) sent[r->hdr.type]++;
+        if (conn_send(c, r) != 0) {
+            send_errors++;
+            break;
+        }
+        if (r->hdr.type < NTYPES) {
+            // A request sent before the last was answered gives up on the last
+            c->pending = r->hdr.type;
+            c->sent_at = stats_now();
+        }
+        break;
+    case JOURNAL_CLOSE:
+        c->closed = 1;
+        if (r->hdr.size >= sizeof(c->expected)) memcpy(c->expected, r->data, sizeof(c->expected));
+        if (c->state == CONN_OPEN) {
+            shutdown(c->fd, SHUT_WR);
+            c->state = CONN_CLOSING;
+            closing++;
+        }
+        break;
+    }
+}
+
+/**
+ * @brief Resolve the server address.
+ * @return 0 on success, -1 on error.
+ */
+static int resolve(void) {
+    struct addrinfo hints = { .ai_socktype = SOCK_STREAM }, *res;
+    char service[16];
+    snprintf(service, sizeof(service), "%d", port);
+    if (getaddrinfo(host, service, &hints, &res) != 0) return -1;
+    memcpy(&server_addr, res->ai_addr, res->ai_addrlen);
+    server_addrlen = res->ai_addrlen;
+    freeaddrinfo(res);
+    return 0;
+}
+
+/**
+ * @brief Print one row of the latency table.
+ */
+static void report_row(const char *name, unsigned long n_sent, unsigned long n_answered,
+                       HISTOGRAM *h) {
+    uint64_t p50, p99, p999, max;
+    histogram_summary(h, &p50, &p99, &p999, &max);
+    printf("%-8s %10lu %10lu %10.1f %10.1f %10.1f %10.1f\n", name, n_sent, n_answered,
+           p50 / 1e3, p99 / 1e3, p999 / 1e3, max / 1e3);
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:x:D:")) != -1) {
+        switch (opt) {
+        case 'h': host = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'x':
+            speed = strcmp(optarg, "max") == 0 ? 0 : atof(optarg);
+            if (speed == 0 && strcmp(optarg, "max") != 0) speed = -1;
+            break;
+        case 'D': max_divergence = atof(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s -p <port> [-h <host>] [-x <speed>|max] [-D <percent>] "
+                    "<journal>\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (port <= 0 || speed < 0 || optind != argc - 1) {
+        fprintf(stderr, "Error: Invalid arguments (a port and a journal must be given)\n");
+        exit(EXIT_FAILURE);
+    }
+    if (resolve() != 0) {
+        fprintf(stderr, "Error: Cannot resolve %s\n", host);
+        exit(EXIT_FAILURE);
+    }
+
+    size_t count;
+    RECORD *recs = read_journal(argv[optind], &count);
+    if (!recs) exit(EXIT_FAILURE);
+
+    latency_all = histogram_create();
+    for (int t = 0; t < NTYPES; t++) latency[t] = histogram_create();
+    conns = calloc(nconns ? nconns : 1, sizeof(CONN));
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (!conns || !latency_all || epfd < 0) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t i = 0; i < nconns; i++) conns[i].fd = -1;
+
+    // Replay the records at their scaled times, reading replies while waiting
+    uint64_t span = count ? recs[count - 1].hdr.ts - recs[0].hdr.ts : 0;
+    uint64_t start = stats_now();
+    for (size_t i = 0; i < count; i++) {
+        if (speed > 0) {
+            uint64_t due = start + (uint64_t)((recs[i].hdr.ts - recs[0].hdr.ts) / speed);
+            uint64_t now;
+            while ((now = stats_now()) < due) pump((int)((due - now + 999999) / 1000000));
+        }
+        replay(&recs[i]);
+        pump(0);
+    }
+    uint64_t replay_end = stats_now();
+
+    // Close what the journal left open, and wait for the server to close everything
+    for (uint32_t i = 0; i < nconns; i++) {
+        if (conns[i].state == CONN_OPEN) {
+            shutdown(conns[i].fd, SHUT_WR);
+            conns[i].state = CONN_CLOSING;
+            closing++;
+        }
+    }
+    uint64_t deadline = stats_now() + DRAIN_TIMEOUT;
+    while (closing > 0 && stats_now() < deadline) pump(100);
+    for (uint32_t i = 0; i < nconns; i++) {
+        // Count what was read from connections the server did not close in time
+        if (conns[i].fd >= 0) conn_finish(&conns[i]);
+    }
+
+    // Compare the outbound traffic with the recorded run
+    unsigned long expected[JOURNAL_OUT_TYPES] = { 0 }, observed[JOURNAL_OUT_TYPES] = { 0 };
+    unsigned long total_expected = 0, total_diff = 0, compared = 0, diverged = 0;
+    for (uint32_t i = 0; i < nconns; i++) {
+        CONN *c = &conns[i];
+        if (!c->closed) continue;
+        compared++;
+        unsigned long diff = 0;
+        for (int t = 0; t < JOURNAL_OUT_TYPES; t++) {
+            expected[t] += c->expected[t];
+            observed[t] += c->observed[t];
+            total_expected += c->expected[t];
+            diff += c->expected[t] > c->observed[t] ? c->expected[t] - c->observed[t]
+                                                    : c->observed[t] - c->expected[t];
+        }
+        total_diff += diff;
+        if (diff) diverged++;
+    }
+    double divergence = total_expected ? 100.0 * total_diff / total_expected : 0;
+
+    unsigned long total_sent = 0, total_answered = 0;
+    for (int t = 0; t < NTYPES; t++) {
+        total_sent += sent[t];
+        total_answered += answered[t];
+    }
+
+    printf("journal %s records %zu connections %u span_s %.3f\n", argv[optind], count,
+           nconns ? nconns - 1 : 0, span / 1e9);
+    if (speed > 0) printf("replay_s %.3f (speed %gx)\n", (replay_end - start) / 1e9, speed);
+    else printf("replay_s %.3f (speed max)\n", (replay_end - start) / 1e9);
+    printf("connect_errors %lu send_errors %lu\n", connect_errors, send_errors);
+    printf("%-8s %10s %10s %10s %10s %10s %10s\n", "type", "sent", "answered",
+           "p50_us", "p99_us", "p999_us", "max_us");
+    for (int t = 0; t < NTYPES; t++)
+        if (sent[t]) report_row(type_names[t], sent[t], answered[t], latency[t]);
+    report_row("ALL", total_sent, total_answered, latency_all);
+
+    printf("%-8s %10s %10s %10s\n", "outbound", "expected", "observed", "diff");
+    for (int t = 0; t < JOURNAL_OUT_TYPES; t++) {
+        if (!expected[t] && !observed[t]) continue;
+        char name[16];
+        if (type_names[t]) snprintf(name, sizeof(name), "%s", type_names[t]);
+        else snprintf(name, sizeof(name), "type%d", t);
+        printf("%-8s %10lu %10lu %+10ld\n", name, expected[t], observed[t],
+               (long)observed[t] - (long)expected[t]);
+    }
+    printf("connections_compared %lu diverged %lu\n", compared, diverged);
+    printf("divergence_pct %.2f\n", divergence);
+
+    for (size_t i = 0; i < count; i++) free(recs[i].data);
+    free(recs);
+    free(conns);
+
+    if (max_divergence >= 0 && divergence > max_divergence) {
+        fprintf(stderr, "Divergence %.2f%% exceeds %.2f%%\n", divergence, max_divergence);
+        return 1;
+    }
+    return EXIT_SUCCESS;
+}
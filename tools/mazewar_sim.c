@@ -0,0 +1,505 @@
+/**
+ * @file mazewar_sim.c
+ * @brief Deterministic single-threaded simulation of a MazeWar server.
+ *
+ * Usage: mazewar_sim [-c <bots>] [-n <rooms>] [-g <kind>:<rows>x<cols>[:<density>] | -t <template>]
+ *                    [-d <seconds>] [-i <think_ms>] [-m move:W,turn:W,fire:W,send:W,refresh:W]
+ *                    [-S <seed>] [-o <transcript>]
+ *
+ * The game (rooms, mazes, players and scoreboards) runs exactly as in the
+ * server, but driven by one event loop instead of a thread per client:
+ *
+ *   - each bot is a client session (MZW_SESSION) fed packets through the
+ *     server's own packet handler, mzw_handle_packet();
+ *   - time is virtual: events are processed in order of virtual time (ties
+ *     in order of scheduling), and packets are stamped with the virtual
+ *     time at which they were sent;
+ *   - sockets are fake: packets sent to a bot are handed to an in-memory
+ *     sink, which counts them and folds them into a digest;
+ *   - a laser hit schedules the victim's hit at the same virtual time, in
+ *     place of SIGUSR1, and the victim respawns PLAYER_PURGATORY_SECONDS
+ *     later; requests a bot makes while out of the maze are held until it
+ *     respawns, as a service thread would hold them in its socket;
+ *   - random placement and the bots' behaviour are drawn from generators
+ *     seeded by -S.
+ *
+ * Bots log in over the first virtual second, then each makes a request
+ * chosen at random from the mix after a think time drawn uniformly from
+ * [0, 2 * think_ms).  The simulation ends when the virtual duration has
+ * elapsed, after which every bot logs out.
+ *
+ * A run with the same arguments always sends the same packets at the same
+ * virtual times, so the printed digest (or the transcript written with -o)
+ * can be compared across builds to check that a change does not alter the
+ * game's behaviour.  The wall-clock cost of each kind of event and the
+ * number of packets it sends show the algorithmic cost of views and
+ * broadcasts without network or scheduling noise.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <getopt.h>
+
+#include "protocol.h"
+#include "protocol_ext.h"
+#include "maze.h"
+#include "maze_ext.h"
+#include "maze_gen.h"
+#include "player.h"
+#include "player_ext.h"
+#include "room.h"
+#include "server_ext.h"
+#include "stats.h"
+
+/// Fake descriptors of bots start here, above any real descriptor.
+#define SIM_FD_BASE (1 << 20)
+
+/// Most bots placed in one room when the number of rooms is chosen automatically.
+#define BOTS_PER_ROOM 200
+
+/// Players per room (the size of a player table).
+#define MAX_PER_ROOM 256
+
+#define NS_PER_SEC 1000000000ULL
+
+/// Request kinds, in the order of the -m weights.
+enum { REQ_MOVE, REQ_TURN, REQ_FIRE, REQ_SEND, REQ_REFRESH, NREQ };
+static const char *req_names[NREQ] = { "MOVE", "TURN", "FIRE", "SEND", "REFRESH" };
+
+/// Event kinds.  Profile rows are the request kinds followed by these.
+enum { EV_ACT, EV_LOGIN = NREQ, EV_HIT, EV_RESPAWN, EV_LOGOUT, NPROF };
+static const char *prof_names[NPROF] = {
+    "MOVE", "TURN", "FIRE", "SEND", "REFRESH", "LOGIN", "HIT", "RESPAWN", "LOGOUT"
+};
+
+/// Names of the packet types the server sends.
+static const char *out_names[] = {
+    [MZW_READY_PKT] = "READY", [MZW_INUSE_PKT] = "INUSE", [MZW_CLEAR_PKT] = "CLEAR",
+    [MZW_SHOW_PKT] = "SHOW", [MZW_ALERT_PKT] = "ALERT", [MZW_SCORE_PKT] = "SCORE",
+    [MZW_CHAT_PKT] = "CHAT",
+};
+#define NOUT ((int)(sizeof(out_names) / sizeof(out_names[0])))
+
+/**
+ * @struct bot
+ * @brief One simulated client.
+ */
+typedef struct bot {
+    int index;
+    int room;
+    MZW_SESSION session;
+    uint64_t rng;
+    int dead;                 // Hit, waiting to respawn
+    int deferred;             // A request is held until respawn
+    char name[16];
+} BOT;
+
+/**
+ * @struct event
+ * @brief A scheduled event; events are ordered by time, then by seq.
+ */
+typedef struct event {
+    uint64_t time;
+    uint64_t seq;
+    int bot;
+    int kind;
+} EVENT;
+
+/// Options.
+static int nbots = 1000, nrooms = 0;
+static double duration = 60, think_ms = 200;
+static int weights[NREQ] = { 40, 40, 10, 5, 5 };
+static unsigned long seed = 1;
+
+/// Simulation state.
+static BOT *bots;
+static BOT *room_bots[MAX_ROOMS][MAX_PER_ROOM];  // Bots by room and player ID
+static EVENT *heap;
+static size_t heap_len, heap_cap;
+static uint64_t next_seq = 0, now = 0;
+static BOT *current = NULL;   // Bot whose event is being processed
+static FILE *transcript = NULL;
+
+/// Results.
+static uint64_t digest = 0xCBF29CE484222325ULL;  // FNV-1a offset basis
+static unsigned long out_count[NOUT], out_packets, out_bytes;
+static unsigned long prof_count[NPROF], prof_packets[NPROF];
+static uint64_t prof_ns[NPROF];
+static unsigned long events, logins, hits;
+
+/**
+ * @brief Advance a splitmix64 generator and return its next output.
+ */
+static uint64_t rng_next(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/**
+ * @brief Whether event a comes before event b.
+ */
+static int event_before(const EVENT *a, const EVENT *b) {
+    return a->time < b->time || (a->time == b->time && a->seq < b->seq);
+}
+
+/**
+ * @brief Schedule an event.
+ */
+static void schedule(uint64_t time, int bot, int kind) {
+    if (heap_len == heap_cap) {
+        heap_cap = heap_cap ? heap_cap * 2 : 1024;
+        EVENT *grown = realloc(heap, heap_cap * sizeof(EVENT));
+        if (!grown) {
+            fprintf(stderr, "Error: Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        heap = grown;
+    }
+    EVENT ev = { .time = time, .seq = next_seq++, .bot = bot, .kind = kind };
+    size_t i = heap_len++;
+    while (i > 0 && event_before(&ev, &heap[(i - 1) / 2])) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = ev;
+}
+
+/**
+ * @brief Remove and return the earliest event.  The heap must not be empty.
+ */
+static EVENT unschedule(void) {
+    EVENT top = heap[0], last = heap[--heap_len];
+    size_t i = 0;
+    while (2 * i + 1 < heap_len) {
+        size_t c = 2 * i + 1;
+        if (c + 1 < heap_len && event_before(&heap[c + 1], &heap[c])) c++;
+        if (!event_before(&heap[c], &last)) break;
+        heap[i] = heap[c];
+        i = c;
+    }
+    heap[i] = last;
+    return top;
+}
+
+/**
+ * @brief Fold bytes into the digest (FNV-1a).
+ */
+static void digest_add(const void *p, size_t len) {
+    const unsigned char *b = p;
+    for (size_t i = 0; i < len; i++) {
+        digest ^= b[i];
+        digest *= 0x100000001B3ULL;
+    }
+}
+
+/**
+ * @brief Packet sink: receives every packet the game sends to a bot.
+ */
+static int sim_sink(int fd, MZW_PACKET *pkt, void *data) {
+    int index = fd - SIM_FD_BASE;
+    if (index < 0 || index >= nbots) return -1;
+    size_t size = data ? pkt->size : 0;
+
+    if (pkt->type < NOUT) out_count[pkt->type]++;
+    out_packets++;
+    out_bytes += sizeof(MZW_PACKET) + size;
+
+    uint32_t fields[] = {
+        index, pkt->type, (uint8_t)pkt->param1, (uint8_t)pkt->param2, (uint8_t)pkt->param3,
+        size, pkt->timestamp_sec, pkt->timestamp_nsec
+    };
+    digest_add(fields, sizeof(fields));
+    if (size) digest_add(data, size);
+
+    if (transcript) {
+        fprintf(transcript, "%u.%09u bot%d type=%d p=%d,%d,%d size=%zu", pkt->timestamp_sec,
+                pkt->timestamp_nsec, index, pkt->type, pkt->param1, pkt->param2, pkt->param3, size);
+        if (size) fputc(' ', transcript);
+        for (size_t i = 0; i < size; i++) fprintf(transcript, "%02x", ((unsigned char *)data)[i]);
+        fputc('\n', transcript);
+    }
+    return 0;
+}
+
+/**
+ * @brief Hit notifier: the victim takes the hit at the current virtual time.
+ */
+static void sim_notify_hit(PLAYER *victim) {
+    BOT *bot = room_bots[current->room][player_get_id(victim)];
+    if (bot) schedule(now, bot->index, EV_HIT);
+}
+
+/**
+ * @brief Feed a bot a packet, as if its service thread had received it.
+ */
+static void bot_packet(BOT *bot, int type, int p1, int p2, int p3, void *data, uint16_t size) {
+    MZW_PACKET pkt = {
+        .type = type, .param1 = p1, .param2 = p2, .param3 = p3, .size = size,
+        .timestamp_sec = now / NS_PER_SEC, .timestamp_nsec = now % NS_PER_SEC
+    };
+    mzw_handle_packet(&bot->session, &pkt, data);
+}
+
+/**
+ * @brief Schedule a bot's next request after a random think time.
+ */
+static void bot_think(BOT *bot) {
+    uint64_t mean = (uint64_t)(think_ms * 1e6);
+    uint64_t delay = mean ? rng_next(&bot->rng) % (2 * mean) : 0;
+    schedule(now + delay + 1, bot->index, EV_ACT);
+}
+
+/**
+ * @brief Make a bot's next request, chosen at random from the mix.
+ * @return The request kind.
+ */
+static int bot_act(BOT *bot) {
+    int total = 0, pick, k;
+    for (k = 0; k < NREQ; k++) total += weights[k];
+    pick = rng_next(&bot->rng) % total;
+    for (k = 0; pick >= weights[k]; k++) pick -= weights[k];
+
+    int sign = (rng_next(&bot->rng) & 3) ? 1 : -1;  // Mostly forward / left
+    switch (k) {
+    case REQ_MOVE: bot_packet(bot, MZW_MOVE_PKT, sign, 0, 0, NULL, 0); break;
+    case REQ_TURN: bot_packet(bot, MZW_TURN_PKT, sign, 0, 0, NULL, 0); break;
+    case REQ_FIRE: bot_packet(bot, MZW_FIRE_PKT, 0, 0, 0, NULL, 0); break;
+    case REQ_REFRESH: bot_packet(bot, MZW_REFRESH_PKT, 0, 0, 0, NULL, 0); break;
+    case REQ_SEND: {
+        char msg[32];
+        int len = snprintf(msg, sizeof(msg), "hello from %s", bot->name);
+        bot_packet(bot, MZW_SEND_PKT, 0, 0, 0, msg, len);
+        break;
+    }
+    }
+    return k;
+}
+
+/**
+ * @brief Process one event.
+ * @return The profile row to charge it to, or -1 if it did nothing.
+ */
+static int process(EVENT *ev) {
+    BOT *bot = &bots[ev->bot];
+    PLAYER *player = bot->session.player;
+    current = bot;
+
+    switch (ev->kind) {
+    case EV_LOGIN: {
+        int caps = MZW_CAP_EXTENDED_ID | MZW_CAP_SCORE_BATCH;
+        bot_packet(bot, MZW_LOGIN_PKT, 'A' + bot->index % 26, caps, bot->room,
+                   bot->name, strlen(bot->name) + 1);
+        if (!(player = bot->session.player)) return EV_LOGIN;
+        room_bots[bot->room][player_get_id(player)] = bot;
+        logins++;
+        bot_think(bot);
+        return EV_LOGIN;
+    }
+    case EV_ACT:
+        if (!player) return -1;
+        if (bot->dead) {
+            bot->deferred = 1;
+            return -1;
+        }
+        int kind = bot_act(bot);
+        if (now < (uint64_t)(duration * NS_PER_SEC)) bot_think(bot);
+        return kind;
+    case EV_HIT:
+        if (!player || bot->dead || !player_take_hit(player)) return -1;
+        bot->dead = 1;
+        hits++;
+        schedule(now + PLAYER_PURGATORY_SECONDS * NS_PER_SEC, bot->index, EV_RESPAWN);
+        return EV_HIT;
+    case EV_RESPAWN:
+        player_reset(player);
+        bot->dead = 0;
+        if (bot->deferred) {
+            bot->deferred = 0;
+            schedule(now, bot->index, EV_ACT);
+        }
+        return EV_RESPAWN;
+    }
+    return -1;
+}
+
+/**
+ * @brief Parse a request mix such as "move:40,turn:40,fire:10,send:5,refresh:5".
+ * @return 0 on success, -1 if the mix is invalid.
+ */
+static int parse_mix(char *spec) {
+    int w[NREQ] = { 0 }, total = 0;
+    for (char *item = strtok(spec, ","); item; item = strtok(NULL, ",")) {
+        char name[8];
+        int weight, k;
+        if (sscanf(item, "%7[a-z]:%d", name, &weight) != 2 || weight < 0) return -1;
+        for (k = 0; k < NREQ && strcasecmp(name, req_names[k]) != 0; k++) ;
+        if (k == NREQ) return -1;
+        w[k] = weight;
+        total += weight;
+    }
+    if (total == 0) return -1;
+    memcpy(weights, w, sizeof(weights));
+    return 0;
+}
+
+/**
+ * @brief Build the default maze from a -g spec.
+ * @return 0 on success, -1 on error (after printing a message).
+ */
+static int build_generated(const char *spec) {
+    char kind_name[16];
+    int rows, cols, density = -1;
+    MAZE_GEN_KIND kind;
+    if (sscanf(spec, "%15[a-z]:%dx%d:%d", kind_name, &rows, &cols, &density) < 3 ||
+        maze_gen_parse_kind(kind_name, &kind) != 0) {
+        fprintf(stderr, "Error: Invalid maze spec '%s' "
+                "(expected perfect|cavern|arena:<rows>x<cols>[:<density>])\n", spec);
+        return -1;
+    }
+    if (density < 0) density = (kind == MAZE_GEN_CAVERN) ? 45 : (kind == MAZE_GEN_ARENA) ? 10 : 0;
+    char **lines = maze_generate(kind, rows, cols, density, seed);
+    if (!lines) {
+        fprintf(stderr, "Error: Failed to generate maze '%s'\n", spec);
+        return -1;
+    }
+    maze_init(lines);
+    maze_gen_free(lines);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *gen_spec = "arena:64x64", *template_file = NULL, *transcript_file = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:n:g:t:d:i:m:S:o:")) != -1) {
+        switch (opt) {
+        case 'c': nbots = atoi(optarg); break;
+        case 'n': nrooms = atoi(optarg); break;
+        case 'g': gen_spec = optarg; break;
+        case 't': template_file = optarg; break;
+        case 'd': duration = atof(optarg); break;
+        case 'i': think_ms = atof(optarg); break;
+        case 'S': seed = strtoul(optarg, NULL, 0); break;
+        case 'o': transcript_file = optarg; break;
+        case 'm':
+            if (parse_mix(optarg) != 0) {
+                fprintf(stderr, "Error: Invalid request mix "
+                        "(expected e.g. move:40,turn:40,fire:10,send:5,refresh:5)\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-c <bots>] [-n <rooms>] "
+                    "[-g <kind>:<rows>x<cols>[:<density>] | -t <template>] [-d <seconds>] "
+                    "[-i <think_ms>] [-m move:W,turn:W,fire:W,send:W,refresh:W] [-S <seed>] "
+                    "[-o <transcript>]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (nrooms == 0) nrooms = (nbots + BOTS_PER_ROOM - 1) / BOTS_PER_ROOM;
+    if (nbots < 1 || nrooms < 1 || nrooms > MAX_ROOMS || duration <= 0 || think_ms < 0) {
+        fprintf(stderr, "Error: Invalid arguments\n");
+        exit(EXIT_FAILURE);
+    }
+    if ((nbots + nrooms - 1) / nrooms > MAX_PER_ROOM) {
+        fprintf(stderr, "Error: At most %d bots fit in each room (use more rooms with -n)\n",
+                MAX_PER_ROOM);
+        exit(EXIT_FAILURE);
+    }
+    if (transcript_file && !(transcript = fopen(transcript_file, "w"))) {
+        perror(transcript_file);
+        exit(EXIT_FAILURE);
+    }
+
+    // Set up the game as the server does, with a virtual clock and fake sockets
+    stats_init();
+    proto_set_clock_mode(MZW_CLOCK_VIRTUAL);
+    proto_set_sink(sim_sink);
+    maze_set_seed(seed);
+    if (template_file) {
+        if (maze_init_file(template_file) != 0) exit(EXIT_FAILURE);
+    } else if (build_generated(gen_spec) != 0) {
+        exit(EXIT_FAILURE);
+    }
+    player_init();
+    player_set_hit_notifier(sim_notify_hit);
+    if (room_init(nrooms, 0) != 0) {
+        fprintf(stderr, "Error: Failed to create %d game rooms\n", nrooms);
+        exit(EXIT_FAILURE);
+    }
+
+    if (!(bots = calloc(nbots, sizeof(BOT)))) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < nbots; i++) {
+        bots[i].index = i;
+        bots[i].room = i % nrooms;
+        bots[i].session.fd = SIM_FD_BASE + i;
+        bots[i].rng = seed * 0x9E3779B97F4A7C15ULL + i;
+        snprintf(bots[i].name, sizeof(bots[i].name), "bot%d", i);
+        schedule((uint64_t)i * NS_PER_SEC / nbots, i, EV_LOGIN);
+    }
+
+    // Run the events in virtual-time order, timing each in wall-clock time
+    uint64_t wall_start = stats_now();
+    while (heap_len > 0) {
+        EVENT ev = unschedule();
+        now = ev.time;
+        proto_set_virtual_time(now);
+        unsigned long before = out_packets;
+
+        uint64_t t0 = stats_now();
+        int row = process(&ev);
+        uint64_t t1 = stats_now();
+
+        events++;
+        if (row < 0) continue;
+        prof_count[row]++;
+        prof_ns[row] += t1 - t0;
+        prof_packets[row] += out_packets - before;
+    }
+
+    // Everybody leaves, in order
+    for (int i = 0; i < nbots; i++) {
+        if (!bots[i].session.player) continue;
+        current = &bots[i];
+        unsigned long before = out_packets;
+        uint64_t t0 = stats_now();
+        player_logout(bots[i].session.player);
+        prof_ns[EV_LOGOUT] += stats_now() - t0;
+        prof_packets[EV_LOGOUT] += out_packets - before;
+        prof_count[EV_LOGOUT]++;
+        bots[i].session.player = NULL;
+    }
+    uint64_t wall = stats_now() - wall_start;
+
+    printf("bots %d rooms %d logged_in %lu seed %lu\n", nbots, nrooms, logins, seed);
+    printf("virtual_s %.3f wall_s %.3f speedup %.1f\n", now / 1e9, wall / 1e9,
+           wall ? (double)now / wall : 0);
+    printf("events %lu %.1f/s hits %lu\n", events, wall ? events * 1e9 / wall : 0, hits);
+    printf("packets_out %lu bytes_out %lu\n", out_packets, out_bytes);
+    printf("%-8s %10s %12s %12s %12s\n", "event", "count", "ns_per_op", "pkts_per_op", "total_ms");
+    for (int k = 0; k < NPROF; k++) {
+        if (!prof_count[k]) continue;
+        printf("%-8s %10lu %12.0f %12.1f %12.3f\n", prof_names[k], prof_count[k],
+               (double)prof_ns[k] / prof_count[k], (double)prof_packets[k] / prof_count[k],
+               prof_ns[k] / 1e6);
+    }
+    printf("%-8s %10s\n", "outbound", "count");
+    for (int t = 0; t < NOUT; t++)
+        if (out_count[t] && out_names[t]) printf("%-8s %10lu\n", out_names[t], out_count[t]);
+    printf("digest %016llx\n", (unsigned long long)digest);
+
+    if (transcript) fclose(transcript);
+    room_fini();
+    player_fini();
+    maze_fini();
+    free(bots);
+    free(heap);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,203 @@
+/**
+ * @file trace2json.c
+ * @brief Convert a MazeWar binary trace into Chrome trace JSON.
+ *
+ * Usage: trace2json <trace> [<json>]
+ *
+ * The trace is a file written by the server with -T.  The JSON (written to
+ * standard output if no file is given) can be loaded in chrome://tracing or
+ * https://ui.perfetto.dev.  Each server thread appears as one track:
+ *
+ *   - packet handling is a slice from receipt to the end of handling,
+ *     named after the packet type;
+ *   - each lock acquisition is a slice covering the time spent waiting
+ *     for the lock, named after the lock class;
+ *   - views sent, laser hits and events lost to full rings are instants.
+ *
+ * Timestamps are shown relative to the first event in the trace.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "protocol.h"
+#include "trace.h"
+#include "lockprof.h"
+
+/**
+ * @struct event
+ * @brief A trace record together with the thread that recorded it.
+ */
+typedef struct event {
+    uint32_t tid;
+    TRACE_RECORD rec;
+} EVENT;
+
+/// Names of client packet types.
+static const char *packet_names[] = {
+    [MZW_LOGIN_PKT] = "LOGIN", [MZW_MOVE_PKT] = "MOVE", [MZW_TURN_PKT] = "TURN",
+    [MZW_FIRE_PKT] = "FIRE", [MZW_REFRESH_PKT] = "REFRESH", [MZW_SEND_PKT] = "SEND",
+};
+
+/**
+ * @brief Name of a client packet type, or NULL if it has none.
+ */
+static const char *packet_name(int type) {
+    if (type < 0 || type >= (int)(sizeof(packet_names) / sizeof(packet_names[0]))) return NULL;
+    return packet_names[type];
+}
+
+/**
+ * @brief Read every event from a trace file.
+ * @param in       The trace file, positioned after the header.
+ * @param countp   Receives the number of events.
+ * @param droppedp Receives the total number of events lost by the server.
+ * @return The events, or NULL on error (after printing a message).
+ */
+static EVENT *read_events(FILE *in, size_t *countp, unsigned long *droppedp) {
+    size_t count = 0, cap = 4096;
+    EVENT *events = malloc(cap * sizeof(EVENT));
+    if (!events) return NULL;
+    *droppedp = 0;
+
+    TRACE_CHUNK chunk;
+    while (fread(&chunk, sizeof(chunk), 1, in) == 1) {
+        *droppedp += chunk.dropped;
+        if (count + chunk.count + 1 > cap) {
+            while (count + chunk.count + 1 > cap) cap *= 2;
+            EVENT *grown = realloc(events, cap * sizeof(EVENT));
+            if (!grown) {
+                free(events);
+                return NULL;
+            }
+            events = grown;
+        }
+        for (uint32_t i = 0; i < chunk.count; i++) {
+            events[count].tid = chunk.tid;
+            if (fread(&events[count].rec, sizeof(TRACE_RECORD), 1, in) != 1) {
+                fprintf(stderr, "Error: Trace is truncated\n");
+                free(events);
+                return NULL;
+            }
+            count++;
+        }
+        if (chunk.dropped) {
+            // Show the loss where it was noticed: just after this chunk
+            events[count].tid = chunk.tid;
+            events[count].rec = (TRACE_RECORD){
+                .ts = count > 0 ? events[count - 1].rec.ts : 0,
+                .event = 0, .arg1 = chunk.dropped
+            };
+            count++;
+        }
+    }
+    *countp = count;
+    return events;
+}
+
+/**
+ * @brief Write one event as a JSON object.
+ */
+static void write_event(FILE *out, const EVENT *ev, uint64_t base) {
+    const TRACE_RECORD *r = &ev->rec;
+    double ts = r->ts > base ? (r->ts - base) / 1e3 : 0;
+    const char *name;
+
+    switch (r->event) {
+    case TRACE_PACKET_RECV:
+        name = packet_name(r->arg0);
+        if (name) fprintf(out, "{\"name\":\"%s\"", name);
+        else fprintf(out, "{\"name\":\"type%u\"", r->arg0);
+        fprintf(out, ",\"cat\":\"packet\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,"
+                "\"args\":{\"size\":%u}}", ts, ev->tid, r->arg1);
+        break;
+    case TRACE_PACKET_DONE:
+        fprintf(out, "{\"cat\":\"packet\",\"ph\":\"E\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}",
+                ts, ev->tid);
+        break;
+    case TRACE_VIEW_SENT:
+        fprintf(out, "{\"name\":\"view_sent\",\"cat\":\"view\",\"ph\":\"i\",\"s\":\"t\","
+                "\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"player\":%u,\"cells\":%u,\"full\":%s}}",
+                ts, ev->tid, r->arg0, r->arg1 & ~TRACE_VIEW_FULL,
+                (r->arg1 & TRACE_VIEW_FULL) ? "true" : "false");
+        break;
+    case TRACE_LOCK_ACQUIRED:
+        // The slice spans the wait, ending when the lock was acquired
+        name = lockprof_class_name(r->arg0);
+        fprintf(out, "{\"name\":\"%s\",\"cat\":\"lock\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                "\"pid\":1,\"tid\":%u}", name ? name : "lock", ts - r->arg1 / 1e3, r->arg1 / 1e3,
+                ev->tid);
+        break;
+    case TRACE_LASER_HIT:
+        fprintf(out, "{\"name\":\"laser_hit\",\"cat\":\"game\",\"ph\":\"i\",\"s\":\"p\","
+                "\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"victim\":%u,\"shooter\":%u}}",
+                ts, ev->tid, r->arg0, r->arg1);
+        break;
+    default:
+        // Events lost by this thread, and any unknown event
+        fprintf(out, "{\"name\":\"%s\",\"cat\":\"trace\",\"ph\":\"i\",\"s\":\"t\","
+                "\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"count\":%u}}",
+                r->event == 0 ? "dropped" : "unknown", ts, ev->tid, r->arg1);
+        break;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr, "Usage: %s <trace> [<json>]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    FILE *in = fopen(argv[1], "rb");
+    if (!in) {
+        perror(argv[1]);
+        exit(EXIT_FAILURE);
+    }
+
+    TRACE_HEADER header;
+    if (fread(&header, sizeof(header), 1, in) != 1 ||
+        memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != TRACE_VERSION || header.record_size != sizeof(TRACE_RECORD)) {
+        fprintf(stderr, "Error: %s is not a MazeWar trace (version %d)\n", argv[1], TRACE_VERSION);
+        fclose(in);
+        exit(EXIT_FAILURE);
+    }
+
+    size_t count;
+    unsigned long dropped;
+    EVENT *events = read_events(in, &count, &dropped);
+    fclose(in);
+    if (!events) {
+        fprintf(stderr, "Error: Failed to read %s\n", argv[1]);
+        exit(EXIT_FAILURE);
+    }
+
+    FILE *out = stdout;
+    if (argc == 3 && !(out = fopen(argv[2], "w"))) {
+        perror(argv[2]);
+        free(events);
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t base = UINT64_MAX;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t start = events[i].rec.ts;
+        if (events[i].rec.event == TRACE_LOCK_ACQUIRED) start -= events[i].rec.arg1;
+        if (events[i].rec.event != 0 && start < base) base = start;
+    }
+    if (base == UINT64_MAX) base = 0;
+
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    for (size_t i = 0; i < count; i++) {
+        write_event(out, &events[i], base);
+        fprintf(out, i + 1 < count ? ",\n" : "\n");
+    }
+    fprintf(out, "]}\n");
+
+    if (out != stdout) fclose(out);
+    fprintf(stderr, "Converted %zu events from %s (%lu dropped)\n", count, argv[1], dropped);
+    free(events);
+    return EXIT_SUCCESS;
+}